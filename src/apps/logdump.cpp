@@ -0,0 +1,22 @@
+#include <cstdio>
+#include <cstring>
+#include "utils.h"
+#include "log.h"
+
+// Prints binary logs written by sigil-tools --log-binary=FILE as text
+int main(int argc, char *argv[]) {
+    if (argc < 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+        fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+        return 1;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; i++) {
+        sigil::status_t status = sigil::log::dump_binary_file(argv[i], stdout);
+        if (status != sigil::VM_OK) {
+            fprintf(stderr, "sigil-logdump: %s: %s\n", argv[i], sigil::status_to_cstr(status));
+            result = 1;
+        }
+    }
+    return result;
+}
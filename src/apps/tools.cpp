@@ -19,7 +19,8 @@
     --flush-vm
         Clear tempdata and cache of SigilVM
     --exec
-        Run a SigilVM script snippet
+        Run a SigilVM script snippet, with - or fd:N runs commands
+        streamed from stdin or given file descriptor
     --fexec
         Run a SigilVM script snippet from a file
 */
@@ -27,6 +28,15 @@
 #include "virtual-machine.h"
 #include "graphics.h"
 #include "vulkan.h"
+#include "iocommon.h"
+#include "station.h"
+#include "script.h"
+#include "frame-arena.h"
+#include "histogram.h"
+#include "line-buffer.h"
+#include "mem-track.h"
+#include "proc-stats.h"
+#include "trace.h"
 #include "imgui.h"
 #include "utils.h"
 #include "visor.h"
@@ -38,6 +48,7 @@
 #include <GLFW/glfw3.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <iostream>
 #include <cstring>
@@ -48,15 +59,23 @@
 #include <regex.h>
 #include <string>
 #include <vector>
+#include <mutex>
 
 // SigilVM and auxiliary variable
 ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 sigil::graphics::window_t *main_window = nullptr;
 const char program_name[] = "SigilVM Tools";
 uint32_t frames_processed = 0;
-sigil::memstat_t mem_usage;
+// Time spent on every frame drawn, in ns
+static sigil::windowed_histogram_t frame_times;
+// Copy of latest sample taken by VM in background
+static sigil::procstat::snapshot_t proc_stats;
 
+// Filled from pool jobs and timer callbacks, guarded by dummy_log_mutex
 std::vector<std::string> dummy_log = {};
+static std::mutex dummy_log_mutex;
+// Upper bound for entries added by one test command
+#define TOOLS_TEST_ENTRIES_MAX 65536
 
 // Visibility of various subwindows
 static struct {
@@ -73,18 +92,31 @@ static struct {
 
 // Subwindows helper data
 std::string command_input;      // command to be executed via terminal
-std::string output_buffer;      // output combined for many source like terminal or debug
+// Output combined for many sources like terminal or debug, collected by GUI every frame
+static sigil::line_buffer_t output_lines;
+static std::string output_archive_path;
 
 static struct text_editor_t {
     char editor_content[1024 * 32] = {0};
 } text_editor;
 
 static bool vm_shutdown_on_dwm_shutdown = false;
+static bool vm_shutdown_on_exec_done = false;
+static std::string exec_script;
+static int exec_stream_fd = -1;
+static std::string trace_path;
+static std::string log_path;
+static std::string log_binary_path;
+// Commands a script may have queued before their results are collected
+#define TOOLS_COMMAND_WINDOW 4096
+static std::string fexec_path;
 
 // Sigil Tools subcommands
 static sigil::status_t subcommand_flush_vm();
 static sigil::status_t subcommand_console();
-static sigil::status_t subcommand_exec();
+static sigil::status_t subcommand_exec(const sigil::argparser_t &parser);
+static sigil::status_t subcommand_fexec();
+static sigil::status_t register_tools_commands();
 static void            subcommand_help();
 static sigil::status_t subcommand_roll();
 static sigil::status_t subcommand_gui();
@@ -110,10 +142,13 @@ static void popup_new_project();
 static void popup_import_file();
 static void popup_export_file();
 
-// Subprograms aka funtions to be threaded
-static void subprogram_console();
-static void subprogram_desktop();
-static void subprogram_gui();
+// Subprograms aka funtions to be threaded, token is cancelled on VM shutdown
+static void subprogram_console(sigil::cancel_token_t token);
+static void subprogram_desktop(sigil::cancel_token_t token);
+static void subprogram_exec(sigil::cancel_token_t token);
+static void subprogram_exec_stream(sigil::cancel_token_t token);
+static void subprogram_fexec(sigil::cancel_token_t token);
+static void subprogram_gui(sigil::cancel_token_t token);
 
 // Wrapper to run sigil tools commands
 sigil::status_t tools_cmd(const char* cmd);
@@ -137,6 +172,28 @@ int main(int argc, const char **argv) {
         sigil::virtual_machine::set_debug_mode(true);
     }
 
+    // Trace is recorded from the very start, and written once VM is down
+    for (auto &argument : parser.arguments) {
+        if (argument.rfind("--trace=", 0) == 0) trace_path = argument.substr(8);
+        if (argument.rfind("--log=", 0) == 0) log_path = argument.substr(6);
+        if (argument.rfind("--log-binary=", 0) == 0) log_binary_path = argument.substr(13);
+        if (argument.rfind("--output-archive=", 0) == 0) output_archive_path = argument.substr(17);
+    }
+    if (!log_path.empty() && sigil::log::open_file(log_path.c_str()) != sigil::VM_OK) {
+        printf("sigil-tools: failed to open log file %s\n", log_path.c_str());
+    }
+    if (!log_binary_path.empty() && sigil::log::open_binary_file(log_binary_path.c_str()) != sigil::VM_OK) {
+        printf("sigil-tools: failed to create log file %s\n", log_binary_path.c_str());
+    }
+    // Set before GUI thread starts collecting output
+    if (!output_archive_path.empty() && output_lines.set_archive(output_archive_path.c_str()) != sigil::VM_OK) {
+        printf("sigil-tools: failed to open output archive %s\n", output_archive_path.c_str());
+    }
+    if (!trace_path.empty()) {
+        sigil::trace::set_thread_name("main");
+        sigil::trace::enable(true);
+    }
+
     if (parser.is_set("--countdown")) {
         sigil::log::tt_end_of_year();
     }
@@ -149,7 +206,21 @@ int main(int argc, const char **argv) {
     if (parser.is_set("--exec") || parser.is_set("-e")) {
         status = sigil::virtual_machine::initialize(argc, argv);
         if (!(status == sigil::VM_OK || status == sigil::VM_ALREADY_EXISTS)) goto tools_wait_for_shutdown;
-        subcommand_exec();
+        vm_shutdown_on_exec_done = !(parser.is_set("--console") || parser.is_set("--dwm") || parser.is_set("--gui"));
+        subcommand_exec(parser);
+    }
+
+    // Both --fexec:/path and --fexec /path are accepted
+    for (size_t i = 0; i < parser.arguments.size(); i++) {
+        if (parser.arguments[i].rfind("--fexec:", 0) == 0) fexec_path = parser.arguments[i].substr(8);
+        else if (parser.arguments[i] == "--fexec" && i + 1 < parser.arguments.size()) fexec_path = parser.arguments[i + 1];
+    }
+
+    if (!fexec_path.empty()) {
+        status = sigil::virtual_machine::initialize(argc, argv);
+        if (!(status == sigil::VM_OK || status == sigil::VM_ALREADY_EXISTS)) goto tools_wait_for_shutdown;
+        vm_shutdown_on_exec_done = !(parser.is_set("--console") || parser.is_set("--dwm") || parser.is_set("--gui"));
+        subcommand_fexec();
     }
 
     if (parser.is_set("--console")) {
@@ -173,22 +244,27 @@ int main(int argc, const char **argv) {
 
     tools_wait_for_shutdown:
     status = sigil::virtual_machine::wait_for_shutdown();
+    if (!trace_path.empty()) {
+        sigil::status_t trace_status = sigil::trace::export_json(trace_path.c_str());
+        if (trace_status != sigil::VM_OK) SIGIL_LOG_ERROR("sigil-tools: failed to write trace %s", trace_path.c_str());
+        else if (sigil::trace::num_dropped()) SIGIL_LOG_WARN("sigil-tools: trace buffers overflowed, %lu zones dropped", sigil::trace::num_dropped());
+    }
+    sigil::log::flush();
     printf("Exitting (%s)\n", sigil::status_to_cstr(status));
     return status;
 }
 
 // Subcommands
 static sigil::status_t subcommand_flush_vm() {
-    printf("sigil-tools: flushing virtual machine\n");
+    SIGIL_LOG_INFO("sigil-tools: flushing virtual machine");
     return sigil::virtual_machine::flush();
 }
 
 static sigil::status_t subcommand_console() {
     sigil::status_t status = sigil::virtual_machine::spawn_thread(subprogram_console);
 
-    status != sigil::VM_OK ?
-        printf("sigil-tools: failed to start console (%s)\n", sigil::status_to_cstr(status)):
-        printf("sigil-tools: console started\n");
+    if (status != sigil::VM_OK) SIGIL_LOG_ERROR("sigil-tools: failed to start console (%s)", sigil::status_to_cstr(status));
+    else SIGIL_LOG_INFO("sigil-tools: console started");
     
     return status;
 }
@@ -196,23 +272,44 @@ static sigil::status_t subcommand_console() {
 static sigil::status_t subcommand_dwm() {
     sigil::status_t status = sigil::virtual_machine::spawn_thread(subprogram_desktop);
 
-    status != sigil::VM_OK ?
-        printf("sigil-tools: failed to start desktop environment (%s)\n", sigil::status_to_cstr(status)):
-        printf("sigil-tools: desktop environment started\n");
+    if (status != sigil::VM_OK) SIGIL_LOG_ERROR("sigil-tools: failed to start desktop environment (%s)", sigil::status_to_cstr(status));
+    else SIGIL_LOG_INFO("sigil-tools: desktop environment started");
 
     return status;
 }
 
+static sigil::status_t add_module(const char *name, std::vector<sigil::name_t> depends_on,
+                                  sigil::status_t (*initialize)(void),
+                                  sigil::status_t (*deinitialize)(void), bool main_thread = false) {
+    sigil::vmmodule_descriptor_t module_info;
+    module_info.name = name;
+    module_info.depends_on = depends_on;
+    module_info.initialize = initialize;
+    module_info.deinitialize = deinitialize;
+    module_info.main_thread = main_thread;
+
+    sigil::status_t status = sigil::virtual_machine::register_module(module_info);
+    return status == sigil::VM_ALREADY_EXISTS ? sigil::VM_OK : status;
+}
+
 static sigil::status_t subcommand_gui() {
-    sigil::status_t status = sigil::vulkan::initialize();
+    // Only visor has to wait for vulkan, rest is initialized in parallel
+    // glfwInit has to run on main thread, extension queries vulkan makes after it are thread safe
+    sigil::status_t status = sigil::graphics::initialize_glfw();
+    if (status == sigil::VM_ALREADY_EXISTS) status = sigil::VM_OK;
+    // Window creation in visor stays on main thread, vulkan instance and device go to the pool
+    if (status == sigil::VM_OK) status = add_module("vulkan", {}, sigil::vulkan::initialize, sigil::vulkan::deinitialize);
+    if (status == sigil::VM_OK) status = add_module("visor", {"vulkan"}, sigil::visor::initialize, sigil::visor::deinitialize, true);
+    if (status == sigil::VM_OK) status = add_module("station", {}, sigil::station::initialize, sigil::station::deinitialize);
+    if (status == sigil::VM_OK) status = add_module("iocommon", {}, sigil::iocommon::initialize, sigil::iocommon::deinitialize);
     if (status != sigil::VM_OK) {
-        printf("sigil-tools: an error occured when initializing vulkan %s\n", sigil::status_to_cstr(status));
+        SIGIL_LOG_ERROR("sigil-tools: failed to register modules %s", sigil::status_to_cstr(status));
         return status;
-    } 
-        
-    status = sigil::visor::initialize();
+    }
+
+    status = sigil::virtual_machine::initialize_modules();
     if (status != sigil::VM_OK) {
-        printf("sigil-tools: an error occured when initializing visor %s\n", sigil::status_to_cstr(status));
+        SIGIL_LOG_ERROR("sigil-tools: an error occured when initializing modules %s", sigil::status_to_cstr(status));
         return status;
     }
 
@@ -220,9 +317,45 @@ static sigil::status_t subcommand_gui() {
     return status;
 }
 
-sigil::status_t subcommand_exec() {
-    printf("virtual-machine: Direct command execution not available yet\n");
-    return sigil::VM_NOT_IMPLEMENTED;
+static sigil::status_t subcommand_exec(const sigil::argparser_t &parser) {
+    // Script is the argument following the flag
+    for (size_t i = 0; i + 1 < parser.arguments.size(); i++) {
+        if (parser.arguments[i] == "--exec" || parser.arguments[i] == "-e") {
+            exec_script = parser.arguments[i + 1];
+            break;
+        }
+    }
+
+    if (exec_script.empty()) {
+        SIGIL_LOG_WARN("sigil-tools: nothing to execute");
+        return sigil::VM_ARG_INVALID;
+    }
+
+    // Commands streamed from stdin, or an inherited descriptor
+    if (exec_script == "-") exec_stream_fd = STDIN_FILENO;
+    else if (exec_script.rfind("fd:", 0) == 0) {
+        char *end = nullptr;
+        long fd = strtol(exec_script.c_str() + 3, &end, 10);
+        if (*end != '\0' || fd < 0 || end == exec_script.c_str() + 3) {
+            SIGIL_LOG_ERROR("sigil-tools: invalid descriptor %s", exec_script.c_str());
+            return sigil::VM_ARG_INVALID;
+        }
+        exec_stream_fd = (int)fd;
+    }
+
+    sigil::status_t status = register_tools_commands();
+    if (status == sigil::VM_OK) {
+        status = sigil::virtual_machine::spawn_thread(exec_stream_fd < 0 ? subprogram_exec : subprogram_exec_stream);
+    }
+    if (status != sigil::VM_OK) SIGIL_LOG_ERROR("sigil-tools: failed to start execution (%s)", sigil::status_to_cstr(status));
+    return status;
+}
+
+static sigil::status_t subcommand_fexec() {
+    sigil::status_t status = register_tools_commands();
+    if (status == sigil::VM_OK) status = sigil::virtual_machine::spawn_thread(subprogram_fexec);
+    if (status != sigil::VM_OK) SIGIL_LOG_ERROR("sigil-tools: failed to start script (%s)", sigil::status_to_cstr(status));
+    return status;
 }
 
 static void subcommand_help() {
@@ -237,7 +370,15 @@ static void subcommand_help() {
     printf("  --test-load          Run a test procedure for threaded load.\n");
     printf("  --test-results       Dump the results of the last test procedure.\n");
     printf("  --countdown          Display the percentage of the year passed and countdown to New Year's Eve.\n");
-    printf("  --exec [COMMAND]     Execute an arbitrary command.\n");
+    printf("  --log=FILE           Append log messages to FILE, with time, level and thread.\n");
+    printf("  --output-archive=FILE\n");
+    printf("                      Append lines leaving the bounded GUI Output window to FILE.\n");
+    printf("  --log-binary=FILE    Write log messages unformatted to FILE, sigil-logdump prints it.\n");
+    printf("  --trace=FILE         Record trace zones, and write them to FILE as Chrome trace JSON on exit.\n");
+    printf("  --exec [COMMANDS]    Execute commands separated by semicolons or newlines.\n");
+    printf("  --exec -             Execute newline separated commands from stdin, \"fd:N\"\n");
+    printf("                      reads them from file descriptor N instead. Every command\n");
+    printf("                      prints its line number and status.\n");
     printf("  --fexec:/path/to/script.svm\n");
     printf("                      Execute a custom script from a file.\n\n");
     printf("Inbuilt Console Commands:\n");
@@ -250,33 +391,39 @@ static void subcommand_help() {
     printf("  test-results         Dump the results of the last test procedure.\n");
     printf("  countdown            Display the percentage of the year passed and countdown to New Year's Eve.\n");
     printf("  exec [COMMAND]       Execute an arbitrary command within the console.\n");
+    printf("  trace on|off         Start or stop recording trace zones.\n");
+    printf("  trace save FILE      Write zones recorded so far to FILE as Chrome trace JSON.\n");
+    printf("  latency              Show p50/p99/p99.9/max latency of VM commands.\n");
+    printf("  frametimes           Show p50/p99/p99.9/max GUI frame times.\n");
     printf("  fexec /path/to/script.svm\n");
     printf("                      Execute a custom script from a file.\n\n");
     printf("For more details, refer to the documentation or use the --help option.\n");
 }
 
 // Subprograms
-static void subprogram_console() {
-    sigil::virtual_machine::wait_for_vm();
+static void subprogram_console(sigil::cancel_token_t token) {
+    if (sigil::virtual_machine::wait_for_vm() != sigil::VM_OK) return;
     std::string payload;
     sigil::status_t status;
 
-    while (sigil::virtual_machine::is_active()) {
+    while (!token.is_cancelled()) {
         // Simple propmt
         // TODO: Add variable for changeable prompt
+        // Messages logged by the last command go out before the prompt
+        sigil::log::flush();
         printf("sigil -> ");
         // Flush to get prompt out
         fflush(stdout);
-        // Get the user input
-        std::cin >> payload;
-        //printf("\n");
+        // Get the user input, whole line, so commands can take arguments
+        if (!std::getline(std::cin, payload)) goto console_exit;
         // Run command
         status = tools_cmd(payload.c_str());
         if (status == sigil::VM_SYSTEM_SHUTDOWN) goto console_exit;
 
-        bool critical_err = !(status == sigil::VM_OK || status == sigil::VM_NOT_IMPLEMENTED);
+        bool critical_err = !(status == sigil::VM_OK || status == sigil::VM_NOT_IMPLEMENTED ||
+                              status == sigil::VM_ARG_INVALID);
         if (critical_err) {
-            printf("sigil-tools: critical error occured within console thread (%s)\n", sigil::status_to_cstr(status));
+            SIGIL_LOG_ERROR("sigil-tools: critical error occured within console thread (%s)", sigil::status_to_cstr(status));
             goto console_exit;
         }
     }
@@ -285,11 +432,113 @@ static void subprogram_console() {
     printf("\nsigil-tools: exiting console\n");
 }
 
-static void subprogram_desktop() {
+// Whole script goes out as one batch, results are collected afterwards
+static void subprogram_exec(sigil::cancel_token_t token) {
+    if (sigil::virtual_machine::wait_for_vm() != sigil::VM_OK) return;
+
+    std::vector<sigil::parser::command_t> commands;
+    sigil::status_t status = sigil::parser::parse_script(exec_script, commands);
+    if (status != sigil::VM_OK) {
+        SIGIL_LOG_ERROR("sigil-tools: failed to parse script (%s)", sigil::status_to_cstr(status));
+        if (vm_shutdown_on_exec_done) sigil::virtual_machine::request_shutdown();
+        return;
+    }
+
+    sigil::exec_timer exec_timer;
+    exec_timer.start();
+    std::vector<std::string> names;
+    for (auto &command : commands) names.push_back(command.body[0]);
+
+    std::vector<std::future<sigil::status_t>> results = sigil::virtual_machine::run_commands(std::move(commands));
+    uint32_t num_failed = 0;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        status = results[i].get();
+        if (status == sigil::VM_OK) continue;
+
+        num_failed++;
+        printf("sigil-tools: command %s failed (%s)\n", names[i].c_str(), sigil::status_to_cstr(status));
+    }
+
+    exec_timer.stop();
+    if (sigil::virtual_machine::get_debug_mode()) {
+        printf("sigil-tools: ran %zu commands in %luus, %u failed\n", results.size(), exec_timer.us(), num_failed);
+    }
+
+    if (vm_shutdown_on_exec_done) sigil::virtual_machine::request_shutdown();
+}
+
+// Runs until end of input, results are streamed to stdout
+static void subprogram_exec_stream(sigil::cancel_token_t token) {
+    if (sigil::virtual_machine::wait_for_vm() != sigil::VM_OK) return;
+
+    // Results are written past stdio, anything printed before has to go out first
+    fflush(stdout);
+
+    sigil::exec_timer exec_timer;
+    exec_timer.start();
+    uint64_t num_commands = 0;
+    sigil::status_t status = sigil::virtual_machine::run_command_stream(exec_stream_fd, STDOUT_FILENO, &num_commands, &token);
+    exec_timer.stop();
+
+    if (status != sigil::VM_OK) fprintf(stderr, "sigil-tools: command stream stopped (%s)\n", sigil::status_to_cstr(status));
+    if (sigil::virtual_machine::get_debug_mode()) {
+        uint64_t per_second = exec_timer.us() ? num_commands * 1000000 / exec_timer.us() : 0;
+        fprintf(stderr, "sigil-tools: streamed %lu commands in %luus (%lu/s)\n", num_commands, exec_timer.us(), per_second);
+    }
+
+    if (vm_shutdown_on_exec_done) sigil::virtual_machine::request_shutdown();
+}
+
+// Keeps futures of commands queued by a script, bounded however long script runs
+struct script_commands_t {
+    std::vector<std::future<sigil::status_t>> results;
+    std::vector<std::string> names;
+
+    void wait() {
+        for (size_t i = 0; i < results.size(); i++) {
+            sigil::status_t result = results[i].get();
+            if (result != sigil::VM_OK) printf("sigil-tools: command %s failed (%s)\n", names[i].c_str(), sigil::status_to_cstr(result));
+        }
+        results.clear();
+        names.clear();
+    }
+};
+
+// Script is mapped and run chunk by chunk, its commands are queued while it runs
+static void subprogram_fexec(sigil::cancel_token_t token) {
+    if (sigil::virtual_machine::wait_for_vm() != sigil::VM_OK) return;
+
+    sigil::script::program_t program;
+    sigil::script::environment_t environment;
+    script_commands_t commands;
+    std::string error;
+
+    environment.on_command = [&](sigil::parser::command_t command) {
+        if (token.is_cancelled()) return sigil::VM_SYSTEM_SHUTDOWN;
+        if (commands.results.size() >= TOOLS_COMMAND_WINDOW) commands.wait();
+
+        commands.names.push_back(command.body[0]);
+        commands.results.push_back(sigil::virtual_machine::run_command(std::move(command)));
+        return sigil::VM_OK;
+    };
+
+    sigil::exec_timer exec_timer;
+    exec_timer.start();
+    sigil::status_t status = sigil::script::execute_file(fexec_path.c_str(), program, environment, &error);
+    commands.wait();
+    exec_timer.stop();
+
+    if (status != sigil::VM_OK) printf("sigil-tools: %s: %s (%s)\n", fexec_path.c_str(), error.c_str(), sigil::status_to_cstr(status));
+    if (sigil::virtual_machine::get_debug_mode()) printf("sigil-tools: ran %s in %luus\n", fexec_path.c_str(), exec_timer.us());
+    if (vm_shutdown_on_exec_done) sigil::virtual_machine::request_shutdown();
+}
+
+static void subprogram_desktop(sigil::cancel_token_t token) {
     // Wait until VM is fully launched
     sigil::exec_timer desktop_timer;
     desktop_timer.start();
-    sigil::virtual_machine::wait_for_vm();
+    if (sigil::virtual_machine::wait_for_vm() != sigil::VM_OK) return;
     desktop_timer.stop();
     printf("\nsigil-tools: starting desktop session after wating %lums\n", desktop_timer.ms());
     
@@ -303,25 +552,31 @@ static void subprogram_desktop() {
 }
 
 // Wrap this into a thread after we ensured that VM is running
-static void subprogram_gui() {
-    sigil::exec_timer gui_subpr_timer;
+static void subprogram_gui(sigil::cancel_token_t token) {
+    sigil::trace::set_thread_name("gui");
+    SIGIL_MEM_TAG(sigil::MEM_TAG_GUI);
+    sigil::tsc_timer_t gui_subpr_timer;
     gui_subpr_timer.start();
     sigil::status_t status = sigil::virtual_machine::wait_for_vm();
+    if (status != sigil::VM_OK) return;
     gui_subpr_timer.stop();
     if (sigil::virtual_machine::get_debug_mode()) {
-        printf("sigil-tools: GUI waited %lums for VM\n", gui_subpr_timer.ms());
+        SIGIL_LOG_DEBUG("sigil-tools: GUI waited %lums for VM", gui_subpr_timer.ms());
     }
 
     gui_subpr_timer.start();
-    status = sigil::graphics::initialize_glfw();
+    {
+        SIGIL_TRACE_ZONE("gui-initialize-glfw");
+        status = sigil::graphics::initialize_glfw();
+    }
     if (!(status == sigil::VM_OK || status == sigil::VM_ALREADY_EXISTS)) {
-        printf("sigil-tools: error failed to init glfw %s\n", sigil::status_to_cstr(status));
+        SIGIL_LOG_ERROR("sigil-tools: failed to init glfw %s", sigil::status_to_cstr(status));
         return;
     }
 
     gui_subpr_timer.stop();
     if (sigil::virtual_machine::get_debug_mode()) {
-        printf("sigil-tools: glfw registered in %luus\n", gui_subpr_timer.us());
+        SIGIL_LOG_DEBUG("sigil-tools: glfw registered in %luus", gui_subpr_timer.us());
     }
     
     gui_subpr_timer.start();
@@ -332,15 +587,21 @@ static void subprogram_gui() {
     // Measure init stop
     gui_subpr_timer.stop();
     if (sigil::virtual_machine::get_debug_mode()) {
-        printf("sigil-tools: GUI components initialized in %luus\n", gui_subpr_timer.us());
+        SIGIL_LOG_DEBUG("sigil-tools: GUI components initialized in %luus", gui_subpr_timer.us());
     }
 
-    while (!glfwWindowShouldClose(main_window->glfw_window)) {
+    while (!glfwWindowShouldClose(main_window->glfw_window) && !token.is_cancelled()) {
         // Start measuring frame thread time
+        SIGIL_TRACE_ZONE("gui-frame");
         gui_subpr_timer.start();
+        // Everything drawn last frame is on screen, its transient data can go
+        sigil::frame_arena().reset();
 
         // Use visor to prepare new frame
-        status = sigil::visor::prepare_for_new_frame(main_window);
+        {
+            SIGIL_TRACE_ZONE("gui-prepare-frame");
+            status = sigil::visor::prepare_for_new_frame(main_window);
+        }
         if (status != sigil::VM_OK) return;
 
         // Prepare new frame, but from ImGui perspective only
@@ -352,34 +613,42 @@ static void subprogram_gui() {
         main_window->imgui_wd.ClearValue.color.float32[3] = clear_color.w;
         
         // Main window composition
-        ImGui::DockSpaceOverViewport();
-        
-        // Always draw menubar
-        subwindow_menubar();
-        
-        // Conditional subwindows
-        if (subwindows.asset_manager) subwindow_asset_manager();
-        if (subwindows.style_editor) subwindow_style_manager();
-        if (subwindows.asset_editor) subwindow_asset_editor();
-        if (subwindows.text_editor) subwindow_text_editor();
-        if (subwindows.overview) subwindow_overview();
-        if (subwindows.options) subwindow_options();
-        if (subwindows.output) subwindow_output();
-        if (subwindows.demo) subwindow_demo();
-        if (subwindows.perf) subwindow_perf();
-
-        status = sigil::visor::finalize_new_frame(main_window);
+        {
+            SIGIL_TRACE_ZONE("gui-compose");
+            ImGui::DockSpaceOverViewport();
+            // Collected even while Output is hidden, so pushed lines never pile up
+            output_lines.collect();
+            
+            // Always draw menubar
+            subwindow_menubar();
+            
+            // Conditional subwindows
+            if (subwindows.asset_manager) subwindow_asset_manager();
+            if (subwindows.style_editor) subwindow_style_manager();
+            if (subwindows.asset_editor) subwindow_asset_editor();
+            if (subwindows.text_editor) subwindow_text_editor();
+            if (subwindows.overview) subwindow_overview();
+            if (subwindows.options) subwindow_options();
+            if (subwindows.output) subwindow_output();
+            if (subwindows.demo) subwindow_demo();
+            if (subwindows.perf) subwindow_perf();
+        }
+
+        {
+            SIGIL_TRACE_ZONE("gui-finalize-frame");
+            status = sigil::visor::finalize_new_frame(main_window);
+        }
         if (status != sigil::VM_OK) return;
 
         frames_processed++;
         gui_subpr_timer.stop();
-
-        // TODO: Add decay based last X frame stats
+        frame_times.record(gui_subpr_timer.ns());
 
         if (!(frames_processed % 515)) {
-            output_buffer += sigil::log::get_current_time();
-            sigil::insert_into_string(output_buffer,":spent %lu microseconds rendering last frame (#%u)\n",
-                gui_subpr_timer.us(), frames_processed);
+            sigil::histogram_t recent;
+            frame_times.snapshot(recent, frame_times.window_max_ns());
+            output_lines.printf("%s: frame times last 10s %s (#%u)", sigil::log::get_current_time().c_str(),
+                recent.summary().c_str(), frames_processed);
         }
     }
 }
@@ -399,7 +668,7 @@ void subwindow_menubar() {
             if (ImGui::MenuItem("Exit", "Alt+F4")) {
                 sigil::status_t st = sigil::virtual_machine::request_shutdown();
                 if (st != sigil::VM_OK) {
-                    printf("sigil-tools: errors occured when requesting shutdown %s\n", sigil::status_to_cstr(st));
+                    SIGIL_LOG_ERROR("sigil-tools: errors occured when requesting shutdown %s", sigil::status_to_cstr(st));
                 }
             }
             ImGui::EndMenu();
@@ -442,24 +711,96 @@ void subwindow_menubar() {
     }
 }
 
+// Percentiles over last second, last 10 seconds and whole run, in microseconds
+static void table_latency(const char *label, const sigil::windowed_histogram_t &latency) {
+    static sigil::histogram_t window;
+    const uint64_t windows_ns[] = {1000000000ull, latency.window_max_ns()};
+    const char *window_names[] = {"1s", "10s", "all"};
+
+    ImGui::Separator();
+    ImGui::TextUnformatted(label);
+    if (!ImGui::BeginTable(label, 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) return;
+    for (const char *column : {"window", "count", "p50 us", "p99 us", "p99.9 us", "max us"}) ImGui::TableSetupColumn(column);
+    ImGui::TableHeadersRow();
+
+    for (uint32_t i = 0; i < 3; i++) {
+        if (i < 2) latency.snapshot(window, windows_ns[i]);
+        const sigil::histogram_t &values = i < 2 ? window : latency.all_time();
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn(); ImGui::TextUnformatted(window_names[i]);
+        ImGui::TableNextColumn(); ImGui::Text("%lu", values.count());
+        ImGui::TableNextColumn(); ImGui::Text("%.1f", values.percentile(50.0) / 1000.0);
+        ImGui::TableNextColumn(); ImGui::Text("%.1f", values.percentile(99.0) / 1000.0);
+        ImGui::TableNextColumn(); ImGui::Text("%.1f", values.percentile(99.9) / 1000.0);
+        ImGui::TableNextColumn(); ImGui::Text("%.1f", values.max() / 1000.0);
+    }
+
+    ImGui::EndTable();
+}
+
 void subwindow_perf() {
     ImGuiIO &io = ImGui::GetIO();
-    sigil::get_memstats(mem_usage);
+    bool has_stats = sigil::procstat::read(proc_stats);
     ImGui::Begin("Performance", &subwindows.perf);
 
     ImGui::Text("Frame time: %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
     ImGui::Text("Frames drawn: %lu", (uint64_t)frames_processed);
-    // ImGui::Text("Program size (Pages/MB): %lu/%luMB", mem_usage.size, mem_usage.size >> 8 );
-    // ImGui::Text("Text size (Pages/MB): %lu/%luMB", mem_usage.text, mem_usage.text >> 8);
-    // ImGui::Text("Shared memory (Pages/MB): %lu/%luMB", mem_usage.share, mem_usage.share >> 8);
-    // ImGui::Text("Data memory usage (Pages/MB): %lu/%luMB", mem_usage.data, mem_usage.data >> 8);
-    // ImGui::Text("Resident memory usage (Pages/MB): %lu/%luMB", mem_usage.resident, mem_usage.resident >> 8);
-
-    /*
-        1 PAGE = 4KB
+    table_latency("Frame time", frame_times);
+    table_latency("Command latency", sigil::virtual_machine::get_command_latency());
+
+    if (has_stats) {
+        ImGui::Separator();
+        ImGui::Text("CPU: %.1f%% (user %lums, system %lums)", proc_stats.cpu_percent,
+            proc_stats.user_ns / 1000000, proc_stats.system_ns / 1000000);
+        ImGui::Text("Resident: %.1fMB (peak %.1fMB), proportional: %.1fMB",
+            proc_stats.rss / 1048576.0, proc_stats.peak_rss / 1048576.0, proc_stats.pss / 1048576.0);
+        ImGui::Text("Anonymous: %.1fMB, private dirty: %.1fMB, shared: %.1fMB, swap: %.1fMB",
+            proc_stats.anonymous / 1048576.0, proc_stats.private_dirty / 1048576.0,
+            proc_stats.shared / 1048576.0, proc_stats.swap / 1048576.0);
+        ImGui::Text("Virtual: %.1fMB", proc_stats.vsize / 1048576.0);
+        ImGui::Text("Page faults: %lu minor, %lu major", proc_stats.minor_faults, proc_stats.major_faults);
+        ImGui::Text("Context switches: %lu voluntary, %lu involuntary",
+            proc_stats.voluntary_switches, proc_stats.involuntary_switches);
+
+        if (ImGui::BeginTable("Threads", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            ImGui::TableSetupColumn("thread");
+            ImGui::TableSetupColumn("cpu %");
+            ImGui::TableSetupColumn("cpu ms");
+            ImGui::TableHeadersRow();
+            for (uint32_t i = 0; i < proc_stats.num_tasks; i++) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::Text("%s (%u)", proc_stats.tasks[i].name, proc_stats.tasks[i].tid);
+                ImGui::TableNextColumn(); ImGui::Text("%.1f", proc_stats.tasks[i].cpu_percent);
+                ImGui::TableNextColumn(); ImGui::Text("%lu", proc_stats.tasks[i].cpu_ns / 1000000);
+            }
+            ImGui::EndTable();
+        }
+    }
 
-        (num pages * 4) / 1024  
-    */
+    // Without allocation hooks only explicitly tagged memory shows up
+    sigil::mem_tag_stats_t heap[sigil::MEM_TAG_COUNT];
+    sigil::memtrack::read(heap);
+    ImGui::Separator();
+    ImGui::Text("Heap by subsystem%s", sigil::memtrack::hooks_enabled() ? "" : " (explicit allocations only)");
+    if (ImGui::BeginTable("Heap", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("tag");
+        ImGui::TableSetupColumn("live KB");
+        ImGui::TableSetupColumn("peak KB");
+        ImGui::TableSetupColumn("allocs");
+        ImGui::TableSetupColumn("frees");
+        ImGui::TableHeadersRow();
+        for (uint32_t i = 0; i < sigil::MEM_TAG_COUNT; i++) {
+            if (!heap[i].allocations) continue;
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn(); ImGui::TextUnformatted(sigil::memtrack::tag_to_cstr((sigil::mem_tag_t)i));
+            ImGui::TableNextColumn(); ImGui::Text("%.1f", heap[i].live_bytes / 1024.0);
+            ImGui::TableNextColumn(); ImGui::Text("%.1f", heap[i].peak_bytes / 1024.0);
+            ImGui::TableNextColumn(); ImGui::Text("%lu", heap[i].allocations);
+            ImGui::TableNextColumn(); ImGui::Text("%lu", heap[i].frees);
+        }
+        ImGui::EndTable();
+    }
 
     ImGui::End();
 }
@@ -469,7 +810,17 @@ void subwindow_output() {
     ImGui::Begin("Output");
     // Make the text field read-only and scrollable
     ImGui::BeginChild("ScrollingRegion", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
-    ImGui::TextUnformatted(output_buffer.c_str());
+
+    // Only visible lines are drawn, however long the session
+    ImGuiListClipper clipper;
+    clipper.Begin((int)output_lines.num_lines());
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+            std::string_view line = output_lines.line((uint32_t)i);
+            ImGui::TextUnformatted(line.data(), line.data() + line.size());
+        }
+    }
+    clipper.End();
 
     if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) ImGui::SetScrollHereY(1.0f);
     
@@ -477,13 +828,54 @@ void subwindow_output() {
     ImGui::End();
 }
 
+// Metric copied to frame arena for one frame of the VM tree panel
+struct frame_metric_t {
+    std::string_view name;
+    sigil::metric_kind_t kind;
+    int64_t value;
+    std::string_view summary;
+};
+
+// Draws subtree of a VM tree snapshot starting at given entry
+static void draw_vmtree_entry(const sigil::vmtree_snapshot_t *snapshot, uint32_t i) {
+    auto &entry = snapshot->entries[i];
+    // Per node per frame, so kept off the heap
+    sigil::arena_t &arena = sigil::frame_arena();
+    sigil::arena_vector_t<frame_metric_t> values(arena);
+    bool has_metrics = sigil::metrics::visit(entry.node, [&](const sigil::metric_value_t &value) {
+        values.push_back({arena.printf("%s", value.name.c_str()), value.kind, value.value,
+                          arena.printf("%s", value.summary.c_str())});
+    }) == sigil::VM_OK;
+    int flags = entry.subtree_size == 1 && values.size() <= 3 ? ImGuiTreeNodeFlags_Leaf : 0;
+    char description[96];
+    sigil::metrics::describe(entry.node, description, sizeof(description));
+
+    // Path is the ID, so label may change every frame
+    if (ImGui::TreeNodeEx(entry.path.c_str(), flags, "%s (RC:%u)%s%s", entry.name.c_str(), entry.refcount,
+                          has_metrics ? "  " : "", description)) {
+        // Builtin ones are in the label
+        for (size_t m = 3; m < values.size(); m++) {
+            const frame_metric_t &metric = values[m];
+            if (metric.kind == sigil::METRIC_HISTOGRAM) {
+                ImGui::BulletText("%.*s: %.*s", (int)metric.name.size(), metric.name.data(),
+                                  (int)metric.summary.size(), metric.summary.data());
+            }
+            else ImGui::BulletText("%.*s: %ld", (int)metric.name.size(), metric.name.data(), metric.value);
+        }
+        for (uint32_t sub = i + 1; sub < i + entry.subtree_size; sub += snapshot->entries[sub].subtree_size) {
+            draw_vmtree_entry(snapshot, sub);
+        }
+        ImGui::TreePop();
+    }
+}
+
 void subwindow_asset_manager() {
     ImGui::Begin("Asset Manager");
 
     if (ImGui::CollapsingHeader("Modules")) {
-        if (ImGui::CollapsingHeader("Asset1")) {
-            //nodetreeinfo(vmsr);
-        }
+        // Snapshot is read without locks, node registration never stalls GUI
+        sigil::vmtree_reader_t reader = sigil::virtual_machine::read_tree();
+        if (reader.snapshot) draw_vmtree_entry(reader.snapshot, 0);
     }
 
     if (ImGui::CollapsingHeader("Events")) {
@@ -563,99 +955,167 @@ void popup_import_file() {
 
 }
 
+// Runs every 15s on VM timer wheel, see tools_cmd
 void dummy_load() {
-    int i = 0;
+    static int i = 0;
 
-    while (sigil::virtual_machine::is_active()) {
-        sigil::sleep_ms(15000);
-        std::string temp = "Test entry: " + std::to_string(i);
-        dummy_log.push_back(temp);
-        i++;
-        //printf("Hello from some thread\n");
-    }
+    std::lock_guard<std::mutex> lock(dummy_log_mutex);
+    std::string temp = "Test entry: " + std::to_string(i);
+    dummy_log.push_back(temp);
+    i++;
 }
 
-sigil::status_t tools_cmd(const char* cmd) {
-    if (!cmd) return sigil::VM_ARG_NULL;
+// Console commands, node is nullptr when run directly by tools_cmd
+static sigil::status_t command_exit(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::virtual_machine::request_shutdown();
+    return sigil::VM_SYSTEM_SHUTDOWN;
+}
 
-    sigil::status_t status;
+static sigil::status_t command_desktop(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    subprogram_desktop(sigil::cancel_token_t());
+    return sigil::VM_OK;
+}
 
-    if (strcmp(cmd, "exit") == 0) {
-        sigil::virtual_machine::request_shutdown();
-        return sigil::VM_SYSTEM_SHUTDOWN;
-    }
+static sigil::status_t command_hwprobe(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::status_t status = sigil::vulkan::initialize();
+    if (status != sigil::VM_OK) return status;
 
-    else if (strcmp(cmd, "desktop") == 0) {
-        subprogram_desktop();
-        return sigil::VM_OK;
-    }
+    //status = sigil::vulkan::probe_devices();
+    return status;
+}
 
-    else if (strcmp(cmd, "hwprobe") == 0) {
-        status = sigil::vulkan::initialize();
-        if (status != sigil::VM_OK) return status;
+static sigil::status_t command_gui(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    subcommand_gui();
+    return sigil::VM_OK;
+}
 
-        //status = sigil::vulkan::probe_devices();
-        return status;
-    }
+static sigil::status_t command_dummy_load(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    return sigil::virtual_machine::schedule_timer(15000000, 15000000, dummy_load);
+}
 
-    else if (strcmp(cmd, "gui") == 0) {
-        subcommand_gui();
-        return sigil::VM_OK;
-    }
+static sigil::status_t command_cookie(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    return sigil::VM_OK;
+}
 
+static sigil::status_t command_help(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    subcommand_help();
+    return sigil::VM_OK;
+}
 
-    else if (strcmp(cmd, "dummy_load") == 0) {
-        sigil::virtual_machine::spawn_thread(dummy_load);
-        return sigil::VM_OK;
+// Adds given number of entries, or a random number without an argument
+static sigil::status_t command_test(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    if (!command.args.empty() &&
+        (command.args[0].number < 0 || command.args[0].number > TOOLS_TEST_ENTRIES_MAX)) {
+        return sigil::VM_ARG_INVALID;
     }
-
-
-    else if (strcmp(cmd, "treeinfo") == 0) {
-        sigil::virtual_machine::vminfo();
-        return sigil::VM_OK;
+    uint32_t num_iters = command.args.empty() ? sigil::random_u32_scoped(255, 1024) : (uint32_t)command.args[0].number;
+    
+    printf("Adding %u entries\n", num_iters);
+    
+    std::lock_guard<std::mutex> lock(dummy_log_mutex);
+    for (uint32_t i = 0; i < num_iters; i++) {
+        std::string temp = "Test entry: " + std::to_string(i);
+        dummy_log.push_back(temp);
     }
 
-    else if (strcmp(cmd, "memstats") == 0) {
-        sigil::get_memstats(mem_usage);
-        sigil::print_memstats(mem_usage);
-        return sigil::VM_OK;
-    }
+    return sigil::VM_OK;
+}
 
-    else if (strcmp(cmd, "cookie") == 0) {
-        return sigil::VM_OK;
-    }
+static sigil::status_t command_test_results(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    std::lock_guard<std::mutex> lock(dummy_log_mutex);
+    uint32_t num_iters = dummy_log.size();
 
-    else if (strcmp(cmd, "cookie") == 0) {
-        subcommand_help();
-        return sigil::VM_OK;
+    for (uint32_t i = 0; i < num_iters; i++) {
+        printf("Log: %s\n", dummy_log.at(i).c_str());
     }
 
-    else if (strcmp(cmd, "test") == 0) {
-        uint32_t num_iters = sigil::random_u32_scoped(255, 1024);
-        
-        printf("Adding %u entries\n", num_iters);
-        
-        for (uint32_t i = 0; i < num_iters; i++) {
-            std::string temp = "Test entry: " + std::to_string(i);
-            dummy_log.push_back(temp);
-        }
+    return sigil::VM_OK;
+}
 
-        return sigil::VM_OK;
+static sigil::status_t command_frametimes(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::histogram_t window;
+    frame_times.snapshot(window, 1000000000ull);
+    printf("sigil-tools: frame times last 1s   %s\n", window.summary().c_str());
+    frame_times.snapshot(window, frame_times.window_max_ns());
+    printf("sigil-tools: frame times last 10s  %s\n", window.summary().c_str());
+    printf("sigil-tools: frame times all time %s\n", frame_times.all_time().summary().c_str());
+    return sigil::VM_OK;
+}
+
+static const struct tools_command_t {
+    const char *pattern;
+    sigil::vmcommand_handler_ft handler;
+    // Blocks for its whole run, so it must not take a worker of VM pool
+    bool console_only;
+} tools_commands[] = {
+    {"exit",            command_exit,           false},
+    {"desktop",         command_desktop,        true},
+    {"hwprobe",         command_hwprobe,        false},
+    {"gui",             command_gui,            true},
+    {"dummy_load",      command_dummy_load,     false},
+    {"cookie",          command_cookie,         false},
+    {"help",            command_help,           false},
+    {"test",            command_test,           false},
+    {"test <int>",      command_test,           false},
+    {"test-results",    command_test_results,   false},
+    {"frametimes",      command_frametimes,     false},
+};
+
+// Makes tools commands usable by --exec and scripts, they run on a tools node
+static sigil::status_t register_tools_commands() {
+    sigil::vmnode_descriptor_t node_info = {};
+    node_info.name = "tools";
+    sigil::vmnode_handle_t tools_node;
+    sigil::status_t status = sigil::virtual_machine::add_runtime_node(node_info, &tools_node);
+    if (status == sigil::VM_ALREADY_EXISTS) return sigil::VM_OK;
+    if (status != sigil::VM_OK) return status;
+
+    for (auto &entry : tools_commands) {
+        if (entry.console_only) continue;
+
+        sigil::vmcommand_descriptor_t command_info;
+        command_info.pattern = entry.pattern;
+        command_info.owner = tools_node;
+        command_info.handler = entry.handler;
+
+        status = sigil::virtual_machine::register_command(command_info);
+        if (status != sigil::VM_OK) return status;
     }
+    return sigil::VM_OK;
+}
 
-    else if (strcmp(cmd, "test-results") == 0) {
-        uint32_t num_iters = dummy_log.size();
+// Tools commands run right on the calling thread, anything else goes to VM registry
+sigil::status_t tools_cmd(const char* cmd) {
+    if (!cmd) return sigil::VM_ARG_NULL;
 
-        for (uint32_t i = 0; i < num_iters; i++) {
-            printf("Log: %s\n", dummy_log.at(i).c_str());
+    static sigil::parser::syntax_node translator;
+    static std::once_flag translator_ready;
+    std::call_once(translator_ready, []() {
+        for (auto &entry : tools_commands) {
+            sigil::parser::command_t pattern;
+            sigil::parser::parse_command(entry.pattern, pattern);
+            sigil::parser::register_command(translator, pattern, (void*)&entry);
         }
+    });
 
-        return sigil::VM_OK;
+    sigil::parser::command_t command;
+    sigil::status_t status = sigil::parser::parse_command(cmd, command);
+    if (status == sigil::VM_SKIPPED) return sigil::VM_OK;
+    if (status != sigil::VM_OK) {
+        printf("sigil-tools: malformed command %s\n", cmd);
+        return sigil::VM_ARG_INVALID;
     }
 
-    else {
+    void *target = nullptr;
+    status = sigil::parser::translate(translator, command, &target);
+    if (status == sigil::VM_OK) return ((const tools_command_t*)target)->handler(nullptr, command);
+    if (status == sigil::VM_NOT_FOUND) status = sigil::virtual_machine::run_command(std::move(command)).get();
+
+    if (status == sigil::VM_NOT_FOUND) {
         printf("sigil-tools: unknown command %s\n", cmd);
         return sigil::VM_NOT_IMPLEMENTED;
     }
+    if (status == sigil::VM_ARG_INVALID) printf("sigil-tools: invalid arguments for %s\n", cmd);
+    return status;
 }
 
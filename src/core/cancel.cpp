@@ -0,0 +1,28 @@
+#include <chrono>
+#include "cancel.h"
+
+sigil::cancel_token_t::cancel_token_t() {
+    this->state = std::make_shared<state_t>();
+}
+
+bool sigil::cancel_token_t::is_cancelled() const {
+    return state->cancelled.load(std::memory_order_acquire);
+}
+
+void sigil::cancel_token_t::cancel() {
+    // Store under mutex, so a waiter cannot miss it between check and sleep
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->cancelled.store(true, std::memory_order_release);
+    state->cv.notify_all();
+}
+
+bool sigil::cancel_token_t::wait_for(uint32_t ms) const {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    return state->cv.wait_for(lock, std::chrono::milliseconds(ms),
+        [this]() { return state->cancelled.load(std::memory_order_acquire); });
+}
+
+void sigil::cancel_token_t::wait() const {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [this]() { return state->cancelled.load(std::memory_order_acquire); });
+}
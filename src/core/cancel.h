@@ -0,0 +1,38 @@
+#pragma once
+/*
+    Cooperative cancellation.
+    Copies of a token share one state, so whoever owns a task keeps a copy
+    and the task checks or waits on its own. Nothing is interrupted forcibly,
+    long running tasks are expected to poll is_cancelled() or sleep through
+    wait_for() instead of sleep_ms().
+*/
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <mutex>
+
+namespace sigil {
+    class cancel_token_t {
+        public:
+        // Every default constructed token starts a new, uncancelled state
+        cancel_token_t();
+
+        bool is_cancelled() const;
+        // Wakes up everyone waiting on this token or its copies
+        void cancel();
+        // Sleeps up to ms, returns true if token got cancelled meanwhile
+        bool wait_for(uint32_t ms) const;
+        // Sleeps until token is cancelled
+        void wait() const;
+
+        private:
+        struct state_t {
+            std::atomic<bool> cancelled = {false};
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+
+        std::shared_ptr<state_t> state;
+    };
+}
@@ -0,0 +1,123 @@
+#include "executor.h"
+#include "utils.h"
+#include "trace.h"
+
+// Lets submit() from a worker go straight to its own deque
+static thread_local sigil::executor_t *current_executor = nullptr;
+static thread_local uint32_t current_worker = 0;
+
+// Rounds over all deques before a worker parks
+#define EXECUTOR_SPIN_ROUNDS 64
+
+sigil::executor_t::executor_t(uint32_t num_workers) {
+    this->count = MAX(num_workers, 1u);
+    this->workers.reset(new worker_t[count]);
+
+    for (uint32_t i = 0; i < count; i++) {
+        workers[i].thread = std::thread([this, i]() { run(i); });
+    }
+}
+
+sigil::executor_t::~executor_t() {
+    shutdown();
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        stopping = true;
+        park_cv.notify_all();
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (workers[i].thread.joinable()) workers[i].thread.join();
+    }
+}
+
+bool sigil::executor_t::submit(std::function<void()> job) {
+    if (is_closed()) return false;
+    uint32_t target = (current_executor == this) ?
+        current_worker : next_worker.fetch_add(1, std::memory_order_relaxed) % count;
+
+    // Counted before push, so a job is never popped before it is counted
+    num_unfinished.fetch_add(1);
+    num_queued.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(workers[target].mutex);
+        workers[target].jobs.push_back(std::move(job));
+    }
+
+    if (num_parked.load() > 0) {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        park_cv.notify_one();
+    }
+    return true;
+}
+
+// Own deque from the back, others from the front
+bool sigil::executor_t::pop_job(uint32_t self, std::function<void()> &job) {
+    for (uint32_t i = 0; i < count; i++) {
+        worker_t &victim = workers[(self + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.jobs.empty()) continue;
+
+        if (i == 0) {
+            job = std::move(victim.jobs.back());
+            victim.jobs.pop_back();
+        } else {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+        }
+
+        num_queued.fetch_sub(1);
+        return true;
+    }
+
+    return false;
+}
+
+void sigil::executor_t::run(uint32_t self) {
+    current_executor = this;
+    current_worker = self;
+    sigil::trace::set_thread_name(("vm-worker-" + std::to_string(self)).c_str());
+
+    std::function<void()> job;
+    uint32_t idle_rounds = 0;
+
+    while (true) {
+        if (pop_job(self, job)) {
+            idle_rounds = 0;
+            job();
+            job = nullptr;
+
+            if (num_unfinished.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(park_mutex);
+                idle_cv.notify_all();
+            }
+            continue;
+        }
+
+        if (++idle_rounds < EXECUTOR_SPIN_ROUNDS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(park_mutex);
+        if (stopping && num_queued.load() == 0) return;
+
+        num_parked.fetch_add(1);
+        park_cv.wait(lock, [this]() { return stopping || num_queued.load() > 0; });
+        num_parked.fetch_sub(1);
+        idle_rounds = 0;
+    }
+}
+
+void sigil::executor_t::wait_idle() {
+    std::unique_lock<std::mutex> lock(park_mutex);
+    idle_cv.wait(lock, [this]() { return num_unfinished.load() == 0; });
+}
+
+uint32_t sigil::executor_t::num_workers() const {
+    return count;
+}
+
+bool sigil::executor_t::is_worker() const {
+    return current_executor == this;
+}
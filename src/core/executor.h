@@ -0,0 +1,84 @@
+#pragma once
+/*
+    Work stealing executor.
+    Every worker owns a deque, it pushes and pops its own jobs from the back
+    and steals from the front of other deques once its own runs dry.
+    Jobs submitted from outside of the pool are spread round robin.
+    Workers that found nothing to run park on a condition variable,
+    so an idle pool costs no CPU time.
+
+    Meant for short jobs, anything that blocks for long (console input,
+    render loops) should get its own thread instead.
+*/
+#include <condition_variable>
+#include <type_traits>
+#include <functional>
+#include <cstdint>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <deque>
+#include <mutex>
+
+namespace sigil {
+    class executor_t {
+        public:
+        explicit executor_t(uint32_t num_workers);
+        // Runs whatever is still queued, then joins workers
+        ~executor_t();
+        executor_t(const executor_t&) = delete;
+        executor_t& operator=(const executor_t&) = delete;
+
+        // Fire and forget, job must not throw
+        // Returns false and drops job once shutdown() was called
+        bool submit(std::function<void()> job);
+
+        // Result or exception of a job is delivered through the future
+        template <typename fn_t>
+        std::future<std::invoke_result_t<fn_t>> async(fn_t &&fn) {
+            using result_t = std::invoke_result_t<fn_t>;
+
+            // std::function needs a copyable callable, packaged_task is move only
+            auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<fn_t>(fn));
+            std::future<result_t> result = task->get_future();
+            if (!submit([task]() { (*task)(); })) return std::future<result_t>();
+            return result;
+        }
+
+        // Refuses new jobs from here on, jobs queued before still run
+        void shutdown() { closed.store(true, std::memory_order_release); }
+        bool is_closed() const { return closed.load(std::memory_order_acquire); }
+
+        // Blocks until nothing is queued or running, do not call from a worker
+        void wait_idle();
+        uint32_t num_workers() const;
+        // True if calling thread is one of workers of this executor
+        bool is_worker() const;
+
+        private:
+        struct alignas(64) worker_t {
+            std::mutex mutex;
+            std::deque<std::function<void()>> jobs;
+            std::thread thread;
+        };
+
+        bool pop_job(uint32_t self, std::function<void()> &job);
+        void run(uint32_t self);
+
+        std::unique_ptr<worker_t[]> workers;
+        uint32_t count = 0;
+        std::atomic<uint32_t> next_worker = {0};
+
+        // Jobs sitting in deques, and jobs not finished yet
+        std::atomic<size_t> num_queued = {0};
+        std::atomic<size_t> num_unfinished = {0};
+        std::atomic<uint32_t> num_parked = {0};
+
+        std::atomic<bool> closed = {false};
+        std::mutex park_mutex;
+        std::condition_variable park_cv;
+        std::condition_variable idle_cv;
+        bool stopping = false;
+    };
+}
@@ -0,0 +1,108 @@
+#include "frame-arena.h"
+#include <cstdarg>
+#include <cstdio>
+#include <new>
+
+sigil::arena_t::arena_t(size_t chunk_size, sigil::mem_tag_t tag)
+    : chunk_size(MAX(chunk_size, (size_t)1024)), tag(tag) {}
+
+sigil::arena_t::~arena_t() {
+    while (chunk) {
+        chunk_t *previous = chunk->previous;
+        memtrack::release(chunk);
+        chunk = previous;
+    }
+}
+
+// Slow path, newest chunk is full or there is none yet
+void* sigil::arena_t::allocate_chunk(size_t size, size_t alignment) {
+    size_t needed = sizeof(chunk_t) + size + alignment;
+    size_t next_size = chunk ? MAX(chunk->size * 2, needed) : MAX(chunk_size, needed);
+
+    chunk_t *added = (chunk_t*)memtrack::allocate(next_size, tag);
+    if (!added) return nullptr;
+    if (chunk) {
+        used_before += current - (uintptr_t)(chunk + 1);
+        overflows++;
+    }
+    added->previous = chunk;
+    added->size = next_size;
+
+    chunk = added;
+    current = (uintptr_t)(added + 1);
+    limit = (uintptr_t)added + next_size;
+    return allocate(size, alignment);
+}
+
+std::string_view sigil::arena_t::printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(nullptr, 0, format, args);
+    va_end(args);
+    if (length < 0) return {};
+
+    char *text = (char*)allocate(length + 1, 1);
+    if (!text) return {};
+    va_start(args, format);
+    vsnprintf(text, length + 1, format, args);
+    va_end(args);
+    return std::string_view(text, length);
+}
+
+size_t sigil::arena_t::used() const {
+    return chunk ? used_before + (current - (uintptr_t)(chunk + 1)) : 0;
+}
+
+void sigil::arena_t::rewind(const marker_t &marker) {
+    peak = MAX(peak, used());
+    if (!chunk) return;
+
+    // Oldest chunk stays even when marker is from before it, so the next scope does not hit heap
+    while (chunk != marker.chunk && chunk->previous) {
+        chunk_t *previous = chunk->previous;
+        memtrack::release(chunk);
+        chunk = previous;
+    }
+    if (chunk == marker.chunk) {
+        current = marker.current;
+        used_before = marker.used_before;
+    } else {
+        current = (uintptr_t)(chunk + 1);
+        used_before = 0;
+    }
+    limit = (uintptr_t)chunk + chunk->size;
+}
+
+void sigil::arena_t::reset() {
+    peak = MAX(peak, used());
+    if (!chunk) return;
+
+    // Several chunks become one holding them all, next frame of same size fits
+    if (chunk->previous) {
+        size_t total = 0;
+        while (chunk) {
+            chunk_t *previous = chunk->previous;
+            total += chunk->size;
+            memtrack::release(chunk);
+            chunk = previous;
+        }
+        chunk = (chunk_t*)memtrack::allocate(total, tag);
+        if (!chunk) {
+            current = limit = 0;
+            used_before = 0;
+            return;
+        }
+        chunk->previous = nullptr;
+        chunk->size = total;
+    }
+
+    current = (uintptr_t)(chunk + 1);
+    limit = (uintptr_t)chunk + chunk->size;
+    used_before = 0;
+}
+
+sigil::arena_t& sigil::frame_arena() {
+    // Chunks count towards tag thread is in when it first asks
+    static thread_local arena_t arena(64 << 10, memtrack::current_tag());
+    return arena;
+}
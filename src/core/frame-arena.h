@@ -0,0 +1,112 @@
+#pragma once
+/*
+    Linear arena for data that lives one frame.
+    Allocation bumps a pointer, nothing is freed on its own, reset() at
+    frame boundary drops everything at once. A frame that outgrows the
+    arena gets extra chunks, reset() merges them into one, so following
+    frames fit again without touching the heap.
+    Every thread has its own frame_arena(), GUI resets it per frame. Code
+    that may run on a thread without frames takes mark() and rewind()s to
+    it when done. Containers on arena_allocator_t must not outlive reset()
+    or rewind() of their arena.
+*/
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "mem-track.h"
+#include "utils.h"
+
+namespace sigil {
+    class arena_t {
+        public:
+        explicit arena_t(size_t chunk_size = 64 << 10, mem_tag_t tag = MEM_TAG_UNTAGGED);
+        ~arena_t();
+        arena_t(const arena_t&) = delete;
+        arena_t& operator=(const arena_t&) = delete;
+
+        // Alignment is a power of two, nullptr only if heap is out of memory
+        void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+            uintptr_t at = (current + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            if (at + size <= limit && at >= current && chunk) {
+                current = at + size;
+                return (void*)at;
+            }
+            return allocate_chunk(size, alignment);
+        }
+
+        template<typename T> T* allocate_array(size_t count) {
+            return (T*)allocate(count * sizeof(T), alignof(T));
+        }
+
+        // Formatted text in arena, terminated, empty on failure
+        std::string_view printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+        struct marker_t {
+            void *chunk;
+            uintptr_t current;
+            size_t used_before;
+        };
+        // Position to rewind() to, taken before a scoped batch of allocations
+        marker_t mark() const { return {chunk, current, used_before}; }
+        // Frees what was allocated since marker, chunks taken meanwhile go back to heap
+        void rewind(const marker_t &marker);
+
+        // Frees everything allocated so far
+        void reset();
+
+        // Bytes handed out since last reset
+        size_t used() const;
+        // Most bytes used within one frame
+        size_t high_water() const { return peak; }
+        // Chunks taken from heap because a frame did not fit
+        uint64_t num_overflows() const { return overflows; }
+
+        private:
+        struct chunk_t {
+            chunk_t *previous;
+            size_t size;
+        };
+
+        void* allocate_chunk(size_t size, size_t alignment);
+
+        // Newest chunk, allocation happens only there
+        chunk_t *chunk = nullptr;
+        uintptr_t current = 0;
+        uintptr_t limit = 0;
+        // Used bytes of chunks before newest one
+        size_t used_before = 0;
+        size_t chunk_size;
+        size_t peak = 0;
+        uint64_t overflows = 0;
+        mem_tag_t tag;
+    };
+
+    // STL allocator on an arena, deallocate does nothing
+    template<typename T>
+    struct arena_allocator_t {
+        using value_type = T;
+        arena_t *arena;
+
+        arena_allocator_t(arena_t &arena) noexcept : arena(&arena) {}
+        template<typename U> arena_allocator_t(const arena_allocator_t<U> &other) noexcept : arena(other.arena) {}
+
+        T* allocate(size_t count) {
+            T *ptr = arena->allocate_array<T>(count);
+            if (!ptr) throw std::bad_alloc();
+            return ptr;
+        }
+        void deallocate(T*, size_t) noexcept {}
+
+        template<typename U> bool operator==(const arena_allocator_t<U> &other) const { return arena == other.arena; }
+        template<typename U> bool operator!=(const arena_allocator_t<U> &other) const { return arena != other.arena; }
+    };
+
+    template<typename T> using arena_vector_t = std::vector<T, arena_allocator_t<T>>;
+    using arena_string_t = std::basic_string<char, std::char_traits<char>, arena_allocator_t<char>>;
+
+    // Arena of calling thread, owner resets it at its frame boundary
+    arena_t& frame_arena();
+}
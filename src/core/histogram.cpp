@@ -0,0 +1,123 @@
+#include "histogram.h"
+#include <cstdio>
+
+uint32_t sigil::histogram_t::bucket_of(uint64_t value) {
+    if (value < sub_buckets) return (uint32_t)value;
+
+    // Top sub_bucket_bits of value pick bucket within its power of two
+    uint32_t msb = 63 - __builtin_clzll(value);
+    if (msb >= max_value_bits) return num_buckets - 1;
+
+    uint32_t shift = msb - (sub_bucket_bits - 1);
+    return sub_buckets + (shift - 1) * half_buckets + (uint32_t)(value >> shift) - half_buckets;
+}
+
+uint64_t sigil::histogram_t::bucket_max(uint32_t bucket) {
+    if (bucket < sub_buckets) return bucket;
+    if (bucket >= num_buckets - 1) return UINT64_MAX;
+
+    uint32_t shift = (bucket - sub_buckets) / half_buckets + 1;
+    uint64_t top = (bucket - sub_buckets) % half_buckets + half_buckets;
+    return ((top + 1) << shift) - 1;
+}
+
+void sigil::histogram_t::reset() {
+    for (auto &count : counts) count.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    highest.store(0, std::memory_order_relaxed);
+    lowest.store(UINT64_MAX, std::memory_order_relaxed);
+}
+
+void sigil::histogram_t::add(const sigil::histogram_t &other) {
+    if (!other.count()) return;
+
+    for (uint32_t i = 0; i < num_buckets; i++) {
+        uint64_t count = other.counts[i].load(std::memory_order_relaxed);
+        if (count) counts[i].fetch_add(count, std::memory_order_relaxed);
+    }
+    total.fetch_add(other.count(), std::memory_order_relaxed);
+    sum.fetch_add(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    uint64_t value = other.max();
+    uint64_t seen = highest.load(std::memory_order_relaxed);
+    while (value > seen && !highest.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+    value = other.lowest.load(std::memory_order_relaxed);
+    seen = lowest.load(std::memory_order_relaxed);
+    while (value < seen && !lowest.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+}
+
+uint64_t sigil::histogram_t::percentile(double percent) const {
+    uint64_t num_values = count();
+    if (!num_values) return 0;
+
+    uint64_t rank = (uint64_t)(percent / 100.0 * num_values + 0.5);
+    rank = MAX(rank, (uint64_t)1);
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < num_buckets; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        // Bucket bound may overshoot what was actually recorded
+        if (seen >= rank) return MIN(bucket_max(i), max());
+    }
+    return max();
+}
+
+static void append_ns(std::string &out, const char *label, uint64_t ns) {
+    char text[64];
+    if (ns < 10000) snprintf(text, sizeof(text), " %s=%luns", label, ns);
+    else if (ns < 10000000) snprintf(text, sizeof(text), " %s=%.1fus", label, ns / 1000.0);
+    else snprintf(text, sizeof(text), " %s=%.1fms", label, ns / 1000000.0);
+    out += text;
+}
+
+std::string sigil::histogram_t::summary() const {
+    std::string out;
+    append_summary(out);
+    return out;
+}
+
+void sigil::histogram_t::append_summary(std::string &out) const {
+    char text[32];
+    snprintf(text, sizeof(text), "n=%lu", count());
+    out += text;
+    append_ns(out, "p50", percentile(50.0));
+    append_ns(out, "p99", percentile(99.0));
+    append_ns(out, "p99.9", percentile(99.9));
+    append_ns(out, "max", max());
+}
+
+sigil::windowed_histogram_t::windowed_histogram_t(uint64_t slot_ns, uint32_t num_slots)
+    : slot_ns(MAX(slot_ns, (uint64_t)1)), num_slots(MAX(num_slots, 1u)) {
+    slots = new slot_t[this->num_slots];
+}
+
+sigil::windowed_histogram_t::~windowed_histogram_t() {
+    delete[] slots;
+}
+
+void sigil::windowed_histogram_t::record(uint64_t value, uint64_t now_ns) {
+    uint64_t epoch = now_ns / slot_ns;
+    slot_t &slot = slots[epoch % num_slots];
+
+    // First one into a stale slot clears it, others may lose a value or two meanwhile
+    uint64_t seen = slot.epoch.load(std::memory_order_acquire);
+    if ((seen == UINT64_MAX || seen < epoch) && slot.epoch.compare_exchange_strong(seen, epoch)) {
+        slot.values.reset();
+    }
+
+    slot.values.record(value);
+    everything.record(value);
+}
+
+void sigil::windowed_histogram_t::snapshot(sigil::histogram_t &out, uint64_t window_ns, uint64_t now_ns) const {
+    out.reset();
+    uint64_t current = now_ns / slot_ns;
+    uint64_t num_covered = MIN((window_ns + slot_ns - 1) / slot_ns, (uint64_t)num_slots);
+
+    for (uint32_t i = 0; i < num_slots; i++) {
+        uint64_t epoch = slots[i].epoch.load(std::memory_order_acquire);
+        if (epoch == UINT64_MAX || epoch > current || current - epoch >= num_covered) continue;
+        out.add(slots[i].values);
+    }
+}
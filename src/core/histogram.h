@@ -0,0 +1,105 @@
+#pragma once
+/*
+    HDR style latency histograms.
+    Values below 128 get a bucket each, above that every power of two is
+    split into 64 buckets, so any recorded value is off by less than 1/64
+    of itself. Values past 2^40 (18 minutes in ns) land in last bucket.
+    Recording is a few relaxed atomic adds, any number of threads may
+    record and query at once, queries see a slightly moving picture.
+*/
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include "tsc-clock.h"
+#include "utils.h"
+
+namespace sigil {
+    class histogram_t {
+        public:
+        static constexpr uint32_t sub_bucket_bits = 7;
+        static constexpr uint32_t max_value_bits = 40;
+        static constexpr uint32_t sub_buckets = 1 << sub_bucket_bits;
+        static constexpr uint32_t half_buckets = sub_buckets / 2;
+        static constexpr uint32_t num_buckets = sub_buckets + (max_value_bits - sub_bucket_bits) * half_buckets;
+
+        histogram_t() { reset(); }
+        histogram_t(const histogram_t&) = delete;
+        histogram_t& operator=(const histogram_t&) = delete;
+
+        void record(uint64_t value) {
+            counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+
+            uint64_t seen = highest.load(std::memory_order_relaxed);
+            while (value > seen && !highest.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+            seen = lowest.load(std::memory_order_relaxed);
+            while (value < seen && !lowest.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+        }
+
+        // Not atomic as a whole, values recorded meanwhile may be partly lost
+        void reset();
+        // Adds counts of other to this one
+        void add(const histogram_t &other);
+
+        uint64_t count() const { return total.load(std::memory_order_relaxed); }
+        uint64_t max() const { return highest.load(std::memory_order_relaxed); }
+        uint64_t min() const { return count() ? lowest.load(std::memory_order_relaxed) : 0; }
+        uint64_t mean() const { return count() ? sum.load(std::memory_order_relaxed) / count() : 0; }
+
+        // Smallest value that percent of values are at or below, 0 when empty
+        uint64_t percentile(double percent) const;
+
+        // One line, e.g. "n=1200 p50=16.2us p99=33.1us p99.9=40.0us max=41.3us", values in ns
+        std::string summary() const;
+        // Same appended to out, no heap use once out has the capacity
+        void append_summary(std::string &out) const;
+
+        static uint32_t bucket_of(uint64_t value);
+        // Highest value that falls into bucket
+        static uint64_t bucket_max(uint32_t bucket);
+
+        private:
+        std::atomic<uint64_t> counts[num_buckets];
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> highest;
+        std::atomic<uint64_t> lowest;
+    };
+
+    /*
+        Histogram of recent values, for stats like "last 10 seconds".
+        Time is cut into slots, each with its own histogram, a slot is
+        cleared when recording comes around to it again. Windows cover
+        whole slots, so last one is partly filled.
+    */
+    class windowed_histogram_t {
+        public:
+        explicit windowed_histogram_t(uint64_t slot_ns = 1000000000ull, uint32_t num_slots = 10);
+        ~windowed_histogram_t();
+        windowed_histogram_t(const windowed_histogram_t&) = delete;
+        windowed_histogram_t& operator=(const windowed_histogram_t&) = delete;
+
+        void record(uint64_t value, uint64_t now_ns);
+        void record(uint64_t value) { record(value, tsc::now_ns()); }
+
+        // Values of last window_ns go to out, which is reset first
+        void snapshot(histogram_t &out, uint64_t window_ns, uint64_t now_ns) const;
+        void snapshot(histogram_t &out, uint64_t window_ns) const { snapshot(out, window_ns, tsc::now_ns()); }
+
+        // Every value recorded so far
+        const histogram_t& all_time() const { return everything; }
+        uint64_t window_max_ns() const { return slot_ns * num_slots; }
+
+        private:
+        struct slot_t {
+            std::atomic<uint64_t> epoch = {UINT64_MAX};
+            histogram_t values;
+        };
+
+        uint64_t slot_ns;
+        uint32_t num_slots;
+        slot_t *slots;
+        histogram_t everything;
+    };
+}
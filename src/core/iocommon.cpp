@@ -5,7 +5,7 @@
 #include "system.h"
 #include "utils.h"
 
-static sigil::vmnode_t *iocommon_node = nullptr;
+static sigil::vmnode_handle_t iocommon_node;
 static bool glfw_initialized = false;
 
 sigil::status_t sigil::iocommon::deinitialize() {
@@ -0,0 +1,106 @@
+#include "line-buffer.h"
+#include <cstdarg>
+#include <cstring>
+
+sigil::line_buffer_t::line_buffer_t(size_t text_capacity, uint32_t max_lines, uint32_t max_pending)
+    : pending(max_pending), text_capacity(MAX(text_capacity, (size_t)LINE_BUFFER_MAX_LINE)) {
+    uint32_t capacity = 2;
+    while (capacity < max_lines) capacity <<= 1;
+
+    this->text.reset(new char[this->text_capacity]);
+    this->lines.reset(new line_t[capacity]);
+    this->lines_mask = capacity - 1;
+}
+
+sigil::line_buffer_t::~line_buffer_t() {
+    if (archive) fclose(archive);
+}
+
+bool sigil::line_buffer_t::push(std::string_view text) {
+    if (text.empty()) return true;
+    if (pending.push(std::string(text))) return true;
+
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool sigil::line_buffer_t::printf(const char *format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0) return false;
+    if ((size_t)length < sizeof(buffer)) return push(std::string_view(buffer, length));
+
+    std::string text(length, '\0');
+    va_start(args, format);
+    vsnprintf(&text[0], length + 1, format, args);
+    va_end(args);
+    return push(text);
+}
+
+size_t sigil::line_buffer_t::collect() {
+    std::string batch[64];
+    size_t num_lines = 0;
+    size_t count;
+
+    while ((count = pending.pop_batch(batch, 64)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            std::string_view rest = batch[i];
+            while (!rest.empty()) {
+                size_t newline = rest.find('\n');
+                append(rest.substr(0, newline));
+                num_lines++;
+                if (newline == std::string_view::npos) break;
+                rest.remove_prefix(newline + 1);
+            }
+        }
+    }
+    return num_lines;
+}
+
+std::string_view sigil::line_buffer_t::line(uint32_t i) const {
+    if (i >= num_lines()) return {};
+    const line_t &entry = lines[(first_line + i) & lines_mask];
+    return std::string_view(text.get() + entry.offset % text_capacity, entry.length);
+}
+
+// Line never wraps around end of text ring, it starts over at 0 instead
+void sigil::line_buffer_t::append(std::string_view line) {
+    size_t length = MIN(line.size(), (size_t)LINE_BUFFER_MAX_LINE);
+    uint64_t position = text_head;
+    if (position % text_capacity + length > text_capacity) position += text_capacity - position % text_capacity;
+
+    // Oldest lines whose text gets overwritten go first
+    while (num_lines() && lines[first_line & lines_mask].offset + text_capacity < position + length) evict_oldest();
+    if (num_lines() == lines_mask + 1) evict_oldest();
+
+    memcpy(text.get() + position % text_capacity, line.data(), length);
+    lines[end_line & lines_mask] = {position, (uint32_t)length};
+    end_line++;
+    text_head = position + length;
+}
+
+void sigil::line_buffer_t::evict_oldest() {
+    if (archive) {
+        std::string_view oldest = line(0);
+        fwrite(oldest.data(), 1, oldest.size(), archive);
+        fputc('\n', archive);
+    }
+    first_line++;
+}
+
+void sigil::line_buffer_t::clear() {
+    while (num_lines()) evict_oldest();
+    if (archive) fflush(archive);
+}
+
+sigil::status_t sigil::line_buffer_t::set_archive(const char *path) {
+    FILE *file = path ? fopen(path, "a") : nullptr;
+    if (path && !file) return VM_FAILED;
+
+    if (archive) fclose(archive);
+    archive = file;
+    return VM_OK;
+}
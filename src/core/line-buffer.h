@@ -0,0 +1,80 @@
+#pragma once
+/*
+    Bounded buffer of text lines, for output shown in GUI.
+    Any thread pushes text through a bounded MPSC mailbox, without locks.
+    Owner thread collects pushed lines, once per frame, into a ring of
+    text with an index of line offsets next to it, so line i is found in
+    O(1) and drawing touches only visible lines. Once either ring is full
+    oldest lines make room, they are appended to an archive file if one
+    is set, or forgotten.
+*/
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "mailbox.h"
+#include "utils.h"
+
+// Longer lines are cut
+#define LINE_BUFFER_MAX_LINE 4096
+
+namespace sigil {
+    class line_buffer_t {
+        public:
+        explicit line_buffer_t(size_t text_capacity = 4 << 20, uint32_t max_lines = 1 << 16, uint32_t max_pending = 4096);
+        ~line_buffer_t();
+        line_buffer_t(const line_buffer_t&) = delete;
+        line_buffer_t& operator=(const line_buffer_t&) = delete;
+
+        // Any thread, text is split at newlines, text after last one is a line too
+        // Returns false if mailbox was full and text got dropped
+        bool push(std::string_view text);
+        bool printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+        // Owner only, moves pushed lines into buffer, returns their count
+        size_t collect();
+        // Owner only, lines kept, 0 is oldest
+        uint32_t num_lines() const { return (uint32_t)(end_line - first_line); }
+        // Owner only, valid until next collect()
+        std::string_view line(uint32_t i) const;
+        // Owner only, lines evicted or cleared so far, number of line(0) since start
+        uint64_t num_evicted() const { return first_line; }
+        // Owner only, evicts every line
+        void clear();
+
+        /**
+        * Owner only, evicted lines are appended to file at path from now on
+        * nullptr closes the archive
+        * Returns VM_OK, or VM_FAILED if file could not be opened
+        */
+        status_t set_archive(const char *path);
+
+        // Lines lost to a full mailbox
+        uint64_t num_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+        private:
+        struct line_t {
+            uint64_t offset;
+            uint32_t length;
+        };
+
+        void append(std::string_view text);
+        void evict_oldest();
+
+        mailbox_t<std::string> pending;
+        std::atomic<uint64_t> dropped = {0};
+
+        std::unique_ptr<char[]> text;
+        size_t text_capacity;
+        // Positions grow forever, taken modulo capacity
+        uint64_t text_head = 0;
+
+        std::unique_ptr<line_t[]> lines;
+        uint32_t lines_mask;
+        uint64_t first_line = 0;
+        uint64_t end_line = 0;
+
+        FILE *archive = nullptr;
+    };
+}
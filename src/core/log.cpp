@@ -1,24 +1,679 @@
 #include <iostream>
-#include <sstream>
 #include <iomanip>
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 #include "log.h"
+#include "tsc-clock.h"
+#include "trace.h"
+#include "mem-track.h"
 
-std::string sigil::log::get_current_time() {
-    // Get current time as a time_point
-    auto now = std::chrono::system_clock::now();
+// Holds formatted text when format is 0, encoded arguments of format otherwise
+struct log_record_t {
+    uint64_t ticks;
+    uint32_t tid;
+    uint32_t format;
+    uint16_t length;
+    uint8_t level;
+    char text[LOG_PAYLOAD_SIZE];
+};
+
+struct log_format_t {
+    const char *format;
+    const char *file;
+    uint32_t line;
+    sigil::log::level_t level;
+};
+
+/*
+    Binary log file is a header followed by chunks, each a log_chunk_t and
+    length bytes. Format chunk carries "file\0format" of format_id, and
+    comes before first message using it. Message chunk carries payload of
+    a record, formatted text when format_id is 0.
+*/
+#define LOG_FILE_MAGIC "SIGILLOG"
+#define LOG_FILE_VERSION 1
+
+struct log_file_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+enum log_chunk_kind_t : uint8_t {
+    LOG_CHUNK_FORMAT = 1,
+    LOG_CHUNK_MESSAGE,
+};
+
+struct log_chunk_t {
+    uint8_t kind;
+    uint8_t level;
+    uint16_t length;
+    uint32_t tid;
+    uint32_t format_id;
+    uint32_t line;
+    int64_t wall_ns;
+};
+
+static_assert(sizeof(log_record_t) == LOG_RECORD_SIZE, "log record must have LOG_RECORD_SIZE");
+static_assert((LOG_RING_RECORDS & (LOG_RING_RECORDS - 1)) == 0, "log ring size must be a power of two");
+
+// Owner thread moves head, flusher moves tail
+struct log_ring_t {
+    alignas(64) std::atomic<uint64_t> head = {0};
+    alignas(64) std::atomic<uint64_t> tail = {0};
+    std::atomic<uint64_t> dropped = {0};
+    // Set by owner thread as it exits, flusher hands ring out again once it is empty
+    std::atomic<bool> retired = {false};
+    uint32_t tid = 0;
+    log_record_t records[LOG_RING_RECORDS];
+};
+
+// Retires ring of a thread as it exits
+struct log_ring_owner_t {
+    log_ring_t *ring = nullptr;
+    ~log_ring_owner_t();
+};
+
+std::atomic<uint8_t> sigil::log::min_level = {sigil::log::LEVEL_INFO};
+
+static std::mutex rings_mutex;
+static std::vector<log_ring_t*> rings;
+static std::vector<log_ring_t*> free_rings;
+static std::atomic<uint32_t> next_tid = {1};
+static thread_local log_ring_t *local_ring = nullptr;
+static thread_local log_ring_owner_t ring_owner;
+static thread_local bool ring_detached = false;
+
+// One drain at a time, either flusher or flush()
+static std::mutex drain_mutex;
+static std::vector<log_record_t> drain_batch;
+static std::string drain_output;
+static uint64_t dropped_reported = 0;
+
+// Index is id - 1, entries are never removed
+static std::mutex formats_mutex;
+static std::vector<log_format_t> formats;
+
+// Held while writing, so sinks can be swapped
+static std::mutex sinks_mutex;
+static int file_fd = -1;
+static bool file_binary = false;
+// Formats already in binary file
+static uint32_t file_formats = 0;
+static std::atomic<bool> console_enabled = {true};
+
+/*
+    Flusher is started by first message and stopped at exit, after
+    everything still in rings got written.
+*/
+static struct log_flusher_t {
+    std::once_flag started;
+    std::thread worker;
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    bool stopping = false;
+
+    void start();
+    void run();
+
+    ~log_flusher_t() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake_cv.notify_one();
+        worker.join();
+    }
+} log_flusher;
+
+// Wall clock time of tsc::now_ns() == 0, set once flusher starts
+static int64_t wall_offset_ns = 0;
+
+log_ring_owner_t::~log_ring_owner_t() {
+    if (!ring) return;
+    ring->retired.store(true, std::memory_order_release);
+    ring = nullptr;
+    local_ring = nullptr;
+    ring_detached = true;
+}
+
+static log_ring_t* get_local_ring() {
+    if (local_ring) return local_ring;
+    if (ring_detached) return nullptr;
+
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    if (!free_rings.empty()) {
+        local_ring = free_rings.back();
+        free_rings.pop_back();
+        local_ring->retired.store(false, std::memory_order_relaxed);
+    } else {
+        // Counted under log even without allocation hooks
+        local_ring = new (sigil::memtrack::allocate(sizeof(log_ring_t), sigil::MEM_TAG_LOG)) log_ring_t;
+        rings.push_back(local_ring);
+    }
+    local_ring->tid = next_tid.fetch_add(1);
+    ring_owner.ring = local_ring;
+    return local_ring;
+}
+
+void sigil::log::set_level(sigil::log::level_t level) {
+    min_level.store(level, std::memory_order_relaxed);
+}
+
+const char* sigil::log::level_to_cstr(sigil::log::level_t level) {
+    if (level == LEVEL_TRACE) return "TRACE";
+    if (level == LEVEL_DEBUG) return "DEBUG";
+    if (level == LEVEL_INFO) return "INFO";
+    if (level == LEVEL_WARN) return "WARN";
+    if (level == LEVEL_ERROR) return "ERROR";
+    return "OFF";
+}
+
+void sigil::log::write(sigil::log::level_t level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    write_va(level, format, args);
+    va_end(args);
+}
+
+// Next free record of calling thread, nullptr if ring is full
+static log_record_t* reserve_record(sigil::log::level_t level, uint32_t format) {
+    log_ring_t *ring = local_ring;
+    if (!ring) {
+        // Flusher is up once any thread has a ring
+        std::call_once(log_flusher.started, []() { log_flusher.start(); });
+        ring = get_local_ring();
+        if (!ring) return nullptr;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_RECORDS) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    log_record_t *record = &ring->records[head & (LOG_RING_RECORDS - 1)];
+    record->ticks = sigil::tsc::ticks();
+    record->tid = ring->tid;
+    record->format = format;
+    record->level = level;
+    return record;
+}
+
+static void publish_record(size_t length) {
+    log_ring_t *ring = local_ring;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->records[head & (LOG_RING_RECORDS - 1)].length = (uint16_t)MIN(length, (size_t)LOG_PAYLOAD_SIZE);
+    uint64_t used = head - ring->tail.load(std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+
+    // Flusher polls anyway, waking it early keeps a burst from filling the ring
+    if (used + 1 == LOG_RING_RECORDS / 2) log_flusher.wake_cv.notify_one();
+}
+
+void sigil::log::write_va(sigil::log::level_t level, const char *format, va_list args) {
+    if (!format || !is_enabled(level)) return;
+    log_record_t *record = reserve_record(level, 0);
+    if (!record) return;
+
+    int length = vsnprintf(record->text, sizeof(record->text), format, args);
+    publish_record(MIN((size_t)MAX(length, 0), sizeof(record->text) - 1));
+}
+
+uint32_t sigil::log::register_format(sigil::log::level_t level, const char *format, const char *file, uint32_t line) {
+    std::lock_guard<std::mutex> lock(formats_mutex);
+    formats.push_back({format, file, line, level});
+    return (uint32_t)formats.size();
+}
+
+char* sigil::log::begin_record(sigil::log::level_t level, uint32_t format) {
+    log_record_t *record = reserve_record(level, format);
+    return record ? record->text : nullptr;
+}
+
+void sigil::log::end_record(size_t length) {
+    publish_record(length);
+}
+
+using sigil::log::arg_kind_t;
+
+struct decoded_arg_t {
+    arg_kind_t kind;
+    uint64_t bits;
+    double number;
+    std::string text;
+};
+
+// Takes next argument off payload, false once it runs out
+static bool next_arg(const char *&at, const char *end, decoded_arg_t &arg) {
+    if (at >= end) return false;
+    arg.kind = (arg_kind_t)*at++;
+
+    if (arg.kind == sigil::log::ARG_STRING) {
+        uint16_t length;
+        if (end - at < (ptrdiff_t)sizeof(length)) return false;
+        memcpy(&length, at, sizeof(length));
+        at += sizeof(length);
+        if (end - at < length) return false;
+        arg.text.assign(at, length);
+        at += length;
+        return true;
+    }
+
+    if (end - at < 8) return false;
+    if (arg.kind == sigil::log::ARG_DOUBLE) memcpy(&arg.number, at, 8);
+    else memcpy(&arg.bits, at, 8);
+    at += 8;
+    return arg.kind >= sigil::log::ARG_INT && arg.kind <= sigil::log::ARG_POINTER;
+}
+
+template<typename V> static void append_formatted(std::string &out, const char *spec, V value) {
+    char text[128];
+    int length = snprintf(text, sizeof(text), spec, value);
+    if (length < 0) return;
+    if ((size_t)length < sizeof(text)) {
+        out.append(text, length);
+        return;
+    }
+
+    size_t at = out.size();
+    out.resize(at + length + 1);
+    snprintf(&out[at], length + 1, spec, value);
+    out.resize(at + length);
+}
+
+/*
+    Walks format like printf, each conversion takes the next argument.
+    Length modifiers of format are dropped, arguments were widened to
+    64 bits when recorded. Argument of a kind that does not fit its
+    conversion, or missing one, prints as <?>.
+*/
+void sigil::log::format_args(const char *format, const char *payload, size_t length, std::string &out) {
+    const char *at = payload;
+    const char *end = payload + length;
+    decoded_arg_t arg;
+
+    for (const char *p = format; *p;) {
+        if (*p != '%') {
+            const char *next = strchr(p, '%');
+            if (!next) next = p + strlen(p);
+            out.append(p, next - p);
+            p = next;
+            continue;
+        }
+        if (p[1] == '%') {
+            out += '%';
+            p += 2;
+            continue;
+        }
+
+        // Flags, width and precision are kept, '*' is replaced by its argument
+        char spec[40] = "%";
+        size_t n = 1;
+        bool valid = true;
+        for (p++; *p && strchr("-+ #0123456789.*", *p) && n < sizeof(spec) - 8; p++) {
+            if (*p != '*') {
+                spec[n++] = *p;
+                continue;
+            }
+            if (!next_arg(at, end, arg) || (arg.kind != ARG_INT && arg.kind != ARG_UINT)) valid = false;
+            n += snprintf(spec + n, sizeof(spec) - n, "%d", valid ? (int)arg.bits : 0);
+        }
+        while (*p && strchr("hljztLq", *p)) p++;
+        char conversion = *p;
+        if (!conversion) break;
+        p++;
+        if (conversion == 'n') continue;
+
+        if (!valid || !next_arg(at, end, arg)) {
+            out += "<?>";
+            continue;
+        }
+
+        bool integer = arg.kind == ARG_INT || arg.kind == ARG_UINT || arg.kind == ARG_POINTER;
+        switch (conversion) {
+            case 'd': case 'i':
+                if (!integer) break;
+                strcpy(spec + n, "lld");
+                append_formatted(out, spec, (long long)arg.bits);
+                continue;
+            case 'u': case 'o': case 'x': case 'X':
+                if (!integer) break;
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conversion;
+                spec[n] = '\0';
+                append_formatted(out, spec, (unsigned long long)arg.bits);
+                continue;
+            case 'c':
+                if (!integer) break;
+                strcpy(spec + n, "c");
+                append_formatted(out, spec, (int)arg.bits);
+                continue;
+            case 'p':
+                if (!integer) break;
+                strcpy(spec + n, "p");
+                append_formatted(out, spec, (void*)(uintptr_t)arg.bits);
+                continue;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (arg.kind != ARG_DOUBLE) break;
+                spec[n++] = conversion;
+                spec[n] = '\0';
+                append_formatted(out, spec, arg.number);
+                continue;
+            case 's':
+                if (arg.kind != ARG_STRING) break;
+                strcpy(spec + n, "s");
+                append_formatted(out, spec, arg.text.c_str());
+                continue;
+        }
+        out += "<?>";
+    }
+}
 
-    // Convert to time_t to get the HH:MM:SS part
-    auto time_t_now = std::chrono::system_clock::to_time_t(now);
-    auto local_time = *std::localtime(&time_t_now);
+// Caches broken down time of last second seen, localtime_r runs once a second
+struct clock_cache_t {
+    int64_t second = -1;
+    char text[32];
+};
 
-    // Get milliseconds part
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
+// text receives "2026-10-18 12:00:01.123", date is skipped without with_date
+static void format_clock(clock_cache_t &cache, int64_t wall_ns, bool with_date, char *text, size_t size) {
+    int64_t second = wall_ns / 1000000000;
+    if (second != cache.second) {
+        time_t seconds = (time_t)second;
+        struct tm local_time;
+        localtime_r(&seconds, &local_time);
+        strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &local_time);
+        cache.second = second;
+    }
 
-    // Format the time into a string
-    std::ostringstream oss;
-    oss << std::put_time(&local_time, "%H:%M:%S") << '.' << std::setw(3) << std::setfill('0') << ms.count();
-    return oss.str();
+    // Date is the first 11 characters
+    snprintf(text, size, "%s.%03ld", with_date ? cache.text : cache.text + 11, (long)(wall_ns / 1000000 % 1000));
+}
+
+static int64_t realtime_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void write_all(int fd, const char *data, size_t size) {
+    size_t written = 0;
+    while (fd >= 0 && written < size) {
+        ssize_t n = ::write(fd, data + written, size - written);
+        if (n <= 0) break;
+        written += (size_t)n;
+    }
+}
+
+static void append_chunk(std::string &out, const log_chunk_t &chunk, const char *payload) {
+    out.append((const char*)&chunk, sizeof(chunk));
+    out.append(payload, chunk.length);
+}
+
+// "[date time] LEVEL tid message" line of a text log
+static void append_line(std::string &out, clock_cache_t &cache, int64_t wall_ns, uint8_t level, uint32_t tid, const std::string &message) {
+    char clock[40];
+    char prefix[96];
+    format_clock(cache, wall_ns, true, clock, sizeof(clock));
+    snprintf(prefix, sizeof(prefix), "[%s] %-5s %3u ", clock, sigil::log::level_to_cstr((sigil::log::level_t)level), tid);
+    out += prefix;
+    out += message;
+    out += '\n';
+}
+
+// Formats registered since last write go first, so every message in file has its format
+static void write_sinks(const std::string &console, const std::string &file) {
+    std::lock_guard<std::mutex> lock(sinks_mutex);
+    if (!console.empty() && console_enabled.load(std::memory_order_relaxed)) {
+        fwrite(console.data(), 1, console.size(), stdout);
+        fflush(stdout);
+    }
+    if (file_fd < 0 || file.empty()) return;
+
+    if (file_binary) {
+        std::string table;
+        std::lock_guard<std::mutex> formats_lock(formats_mutex);
+        for (; file_formats < formats.size(); file_formats++) {
+            const log_format_t &format = formats[file_formats];
+            std::string text = std::string(format.file) + '\0' + format.format;
+            log_chunk_t chunk = {LOG_CHUNK_FORMAT, format.level, (uint16_t)MIN(text.size(), (size_t)UINT16_MAX),
+                                 0, file_formats + 1, format.line, 0};
+            append_chunk(table, chunk, text.c_str());
+        }
+        write_all(file_fd, table.data(), table.size());
+    }
+    write_all(file_fd, file.data(), file.size());
+}
+
+// Writes out whatever rings hold, returns number of messages
+static size_t drain_rings() {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex);
+    std::vector<log_ring_t*> current;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        current = rings;
+    }
+
+    drain_batch.clear();
+    uint64_t dropped = 0;
+    for (auto ring : current) {
+        // Read before draining, ring retired afterwards may still get a message
+        bool retired = ring->retired.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) drain_batch.push_back(ring->records[tail & (LOG_RING_RECORDS - 1)]);
+        ring->tail.store(head, std::memory_order_release);
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+
+        if (retired) {
+            // Checked again, ring may have been handed out meanwhile
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            bool is_free = std::find(free_rings.begin(), free_rings.end(), ring) != free_rings.end();
+            if (!is_free && ring->retired.load(std::memory_order_relaxed)) free_rings.push_back(ring);
+        }
+    }
+
+    std::stable_sort(drain_batch.begin(), drain_batch.end(), [](const log_record_t &a, const log_record_t &b) {
+        return a.ticks < b.ticks;
+    });
+
+    static clock_cache_t cache;
+    std::string console;
+    drain_output.clear();
+    bool to_console = console_enabled.load(std::memory_order_relaxed);
+    bool to_file, binary;
+    {
+        std::lock_guard<std::mutex> lock(sinks_mutex);
+        to_file = file_fd >= 0;
+        binary = file_binary;
+    }
+
+    std::string message;
+    std::unique_lock<std::mutex> formats_lock(formats_mutex);
+    for (auto &record : drain_batch) {
+        int64_t wall_ns = wall_offset_ns + (int64_t)sigil::tsc::to_ns(record.ticks);
+        if (to_file && binary) {
+            log_chunk_t chunk = {LOG_CHUNK_MESSAGE, record.level, record.length, record.tid, record.format, 0, wall_ns};
+            append_chunk(drain_output, chunk, record.text);
+        }
+        if (!to_console && (!to_file || binary)) continue;
+
+        message.clear();
+        if (record.format && record.format <= formats.size()) {
+            sigil::log::format_args(formats[record.format - 1].format, record.text, record.length, message);
+        } else {
+            message.append(record.text, record.length);
+        }
+
+        if (to_console) {
+            console += message;
+            console += '\n';
+        }
+        if (to_file && !binary) append_line(drain_output, cache, wall_ns, record.level, record.tid, message);
+    }
+    formats_lock.unlock();
+
+    if (dropped > dropped_reported) {
+        char text[64];
+        int length = snprintf(text, sizeof(text), "log: dropped %lu messages", dropped - dropped_reported);
+        if (to_console) {
+            console += text;
+            console += '\n';
+        }
+        if (to_file && binary) {
+            log_chunk_t chunk = {LOG_CHUNK_MESSAGE, sigil::log::LEVEL_WARN, (uint16_t)length, 0, 0, 0, realtime_ns()};
+            append_chunk(drain_output, chunk, text);
+        } else if (to_file) {
+            append_line(drain_output, cache, realtime_ns(), sigil::log::LEVEL_WARN, 0, text);
+        }
+        dropped_reported = dropped;
+    }
+
+    if (!console.empty() || !drain_output.empty()) write_sinks(console, drain_output);
+    return drain_batch.size();
+}
+
+void log_flusher_t::start() {
+    wall_offset_ns = realtime_ns() - (int64_t)sigil::tsc::now_ns();
+    worker = std::thread([this]() { run(); });
+}
+
+void log_flusher_t::run() {
+    sigil::trace::set_thread_name("log-flusher");
+    SIGIL_MEM_TAG(sigil::MEM_TAG_LOG);
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    while (!stopping) {
+        wake_cv.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+        lock.unlock();
+        drain_rings();
+        lock.lock();
+    }
+    lock.unlock();
+
+    // Last messages, logged by threads that are done by now
+    drain_rings();
+}
+
+sigil::status_t sigil::log::open_file(const char *path) {
+    int fd = path ? ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : -1;
+    if (path && fd < 0) return VM_FAILED;
+
+    flush();
+    std::lock_guard<std::mutex> lock(sinks_mutex);
+    if (file_fd >= 0) close(file_fd);
+    file_fd = fd;
+    file_binary = false;
+    return VM_OK;
+}
+
+sigil::status_t sigil::log::open_binary_file(const char *path) {
+    if (!path) return open_file(nullptr);
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return VM_FAILED;
+
+    log_file_header_t header = {};
+    memcpy(header.magic, LOG_FILE_MAGIC, sizeof(header.magic));
+    header.version = LOG_FILE_VERSION;
+    write_all(fd, (const char*)&header, sizeof(header));
+
+    flush();
+    std::lock_guard<std::mutex> lock(sinks_mutex);
+    if (file_fd >= 0) close(file_fd);
+    file_fd = fd;
+    file_binary = true;
+    file_formats = 0;
+    return VM_OK;
+}
+
+sigil::status_t sigil::log::dump_binary_file(const char *path, FILE *out) {
+    if (!path || !out) return VM_ARG_NULL;
+    FILE *file = fopen(path, "rb");
+    if (!file) return VM_NOT_FOUND;
+
+    std::string data;
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) data.append(buffer, n);
+    fclose(file);
+
+    log_file_header_t header;
+    if (data.size() < sizeof(header)) return VM_FAILED;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, LOG_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != LOG_FILE_VERSION) {
+        return VM_FAILED;
+    }
+
+    // Formats are copied, payloads point into data
+    std::unordered_map<uint32_t, std::string> file_formats;
+    clock_cache_t cache;
+    std::string lines, message;
+    size_t at = sizeof(header);
+    while (at < data.size()) {
+        log_chunk_t chunk;
+        if (data.size() - at < sizeof(chunk)) return VM_FAILED;
+        memcpy(&chunk, data.data() + at, sizeof(chunk));
+        at += sizeof(chunk);
+        if (data.size() - at < chunk.length) return VM_FAILED;
+        const char *payload = data.data() + at;
+        at += chunk.length;
+
+        if (chunk.kind == LOG_CHUNK_FORMAT) {
+            // "file\0format", file is not printed
+            const char *separator = (const char*)memchr(payload, '\0', chunk.length);
+            if (!separator) return VM_FAILED;
+            file_formats[chunk.format_id].assign(separator + 1, payload + chunk.length);
+            continue;
+        }
+        if (chunk.kind != LOG_CHUNK_MESSAGE) return VM_FAILED;
+
+        message.clear();
+        auto found = chunk.format_id ? file_formats.find(chunk.format_id) : file_formats.end();
+        if (found != file_formats.end()) format_args(found->second.c_str(), payload, chunk.length, message);
+        else if (chunk.format_id) message = "log: message of unknown format " + std::to_string(chunk.format_id);
+        else message.assign(payload, chunk.length);
+        append_line(lines, cache, chunk.wall_ns, chunk.level, chunk.tid, message);
+
+        if (lines.size() >= sizeof(buffer)) {
+            fwrite(lines.data(), 1, lines.size(), out);
+            lines.clear();
+        }
+    }
+    fwrite(lines.data(), 1, lines.size(), out);
+    return VM_OK;
+}
+
+void sigil::log::enable_console(bool enable) {
+    console_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void sigil::log::flush() {
+    drain_rings();
+}
+
+uint64_t sigil::log::num_dropped() {
+    uint64_t dropped = 0;
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (auto ring : rings) dropped += ring->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
+
+std::string sigil::log::get_current_time() {
+    static thread_local clock_cache_t cache;
+    char text[40];
+    format_clock(cache, realtime_ns(), false, text, sizeof(text));
+    return text;
 }
 
 void sigil::log::tt_end_of_year() {
@@ -39,50 +694,8 @@ void sigil::log::tt_end_of_year() {
     double elapsed_seconds = std::difftime(now_time_t, start_time);
     double percentage = (elapsed_seconds / total_seconds) * 100.0;
 
-    std::cout << "Current date: " 
+    std::cout << "Current date: "
               << std::put_time(&now_tm, "%Y-%m-%d %H:%M:%S") << "\n";
-    std::cout << "Elapsed: " 
+    std::cout << "Elapsed: "
               << std::fixed << std::setprecision(2) << percentage << "% of the year\n";
 }
-
-// void sigil::log::write_log_file(const char* format, va_list args) {
-// #   ifdef __linux__
-//     std::ofstream log_file("/sigil/vm/logs/debug.log", std::ios::app);
-
-//     if (log_file.is_open()) {
-//         char buffer[SIGIL_LOG_BUFF_SIZE];
-//         vsnprintf(buffer, sizeof(buffer), format, args);
-
-//         std::time_t t = std::time(nullptr);
-//         char time_buf[SIGIL_LOG_TIMESTAMP_SIZE];
-//         std::strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
-
-//         log_file << "[" << time_buf << "] " << buffer << std::endl;
-//         //log_file << "[" << time_buf << "] " << buffer;
-//         log_file.close();
-//     }
-// #   endif
-// }
-
-// void sigil::log::print(const char* format, ...) {
-//     va_list args;
-//     va_start(args, format);
-
-// #   ifdef SIGIL_DEBUG_MODE
-//     write_log_file(format, args);
-// #   endif
-
-//     if (use_console) printf(format, args);
-
-//     va_end(args);
-// }
-
-// void sigil::log::debug(const char* format, ...) {
-//     va_list args;
-//     va_start(args, format);
-// #   ifdef SIGIL_DEBUG_MODE
-//     write_log_file(format, args);
-//     vprintf(format, args);
-// #   endif
-//     va_end(args);
-// }
@@ -1,18 +1,178 @@
 #pragma once
+/*
+    Asynchronous logger.
+
+        SIGIL_LOG_INFO("visor: initialized in %luns", tmr.ns());
+
+    Call site copies raw arguments, tagged by type, and id of its format
+    string into a ring buffer of the calling thread, which only that
+    thread writes. A background flusher formats rings of all threads in
+    batches, ordered by time, and writes them to console and log file.
+    A binary log file skips formatting altogether, sigil-logdump turns it
+    into text later.
+    Writers never take a lock or wait for output, a message that does not
+    fit a full ring is dropped and counted instead.
+    Levels below SIGIL_LOG_LEVEL compile to nothing, set_level() filters
+    the rest at runtime. Timestamps are tsc ticks, turned into wall clock
+    time by flusher, which formats date and time once per second.
+*/
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <atomic>
 #include <string>
 #include <ctime>
+#include <type_traits>
+#include "utils.h"
+
+// Longer messages are cut, the record holds its header too
+#define LOG_RECORD_SIZE 256
+#define LOG_PAYLOAD_SIZE (LOG_RECORD_SIZE - 19)
+#define LOG_RING_RECORDS 512
+#define LOG_FLUSH_INTERVAL_MS 5
+
+// Lowest level compiled in, 0 keeps trace messages too
+#ifndef SIGIL_LOG_LEVEL
+#define SIGIL_LOG_LEVEL 1
+#endif
+
+// Format has to be a literal, arguments are checked against it like printf
+#define SIGIL_LOG(level, format, ...) do {                                                              \
+        if constexpr ((int)(level) >= SIGIL_LOG_LEVEL) {                                                \
+            static const uint32_t sigil_log_format =                                                    \
+                sigil::log::register_format(level, format, __FILE__, __LINE__);                         \
+            if (sigil::log::is_enabled(level)) {                                                        \
+                sigil::log::write_deferred(level, sigil_log_format, ##__VA_ARGS__);                     \
+            }                                                                                           \
+            if (false) sigil::log::check_format(format, ##__VA_ARGS__);                                 \
+        }                                                                                               \
+    } while (0)
 
-#define SIGIL_LOG_BUFF_SIZE 2048
-#define SIGIL_LOG_TIMESTAMP_SIZE 128
+#define SIGIL_LOG_TRACE(...) SIGIL_LOG(sigil::log::LEVEL_TRACE, __VA_ARGS__)
+#define SIGIL_LOG_DEBUG(...) SIGIL_LOG(sigil::log::LEVEL_DEBUG, __VA_ARGS__)
+#define SIGIL_LOG_INFO(...) SIGIL_LOG(sigil::log::LEVEL_INFO, __VA_ARGS__)
+#define SIGIL_LOG_WARN(...) SIGIL_LOG(sigil::log::LEVEL_WARN, __VA_ARGS__)
+#define SIGIL_LOG_ERROR(...) SIGIL_LOG(sigil::log::LEVEL_ERROR, __VA_ARGS__)
 
 namespace sigil::log {
-    // printf variants
-    void write_log_file(const char* format, va_list args);
-    void debug(const char* format, va_list args);
+    enum level_t : uint8_t {
+        LEVEL_TRACE,
+        LEVEL_DEBUG,
+        LEVEL_INFO,
+        LEVEL_WARN,
+        LEVEL_ERROR,
+        LEVEL_OFF,
+    };
+
+    // Tags of arguments of a deferred record
+    enum arg_kind_t : uint8_t {
+        ARG_INT = 1,
+        ARG_UINT,
+        ARG_DOUBLE,
+        ARG_POINTER,
+        // Followed by 16 bit length and text without terminator
+        ARG_STRING,
+    };
+
+    // Arguments that do not fit are left out, and print as <?>
+    struct arg_buffer_t {
+        char *at;
+        char *end;
+
+        template<typename V> void put(arg_kind_t kind, V value) {
+            if (end - at < (ptrdiff_t)(1 + sizeof(V))) { at = end; return; }
+            *at++ = (char)kind;
+            memcpy(at, &value, sizeof(V));
+            at += sizeof(V);
+        }
+
+        void put_string(const char *text) {
+            if (!text) text = "(null)";
+            if (end - at < 3) { at = end; return; }
+            uint16_t length = (uint16_t)strnlen(text, end - at - 3);
+            *at++ = (char)ARG_STRING;
+            memcpy(at, &length, sizeof(length));
+            memcpy(at + sizeof(length), text, length);
+            at += sizeof(length) + length;
+        }
+    };
+
+    template<typename T> inline void encode_arg(arg_buffer_t &buffer, const T &value) {
+        using arg_t = std::decay_t<T>;
+        if constexpr (std::is_same_v<arg_t, char*> || std::is_same_v<arg_t, const char*>) buffer.put_string(value);
+        else if constexpr (std::is_floating_point_v<arg_t>) buffer.put(ARG_DOUBLE, (double)value);
+        else if constexpr (std::is_enum_v<arg_t>) buffer.put(ARG_INT, (int64_t)value);
+        else if constexpr (std::is_integral_v<arg_t> && std::is_signed_v<arg_t>) buffer.put(ARG_INT, (int64_t)value);
+        else if constexpr (std::is_integral_v<arg_t>) buffer.put(ARG_UINT, (uint64_t)value);
+        else if constexpr (std::is_pointer_v<arg_t> || std::is_null_pointer_v<arg_t>) {
+            buffer.put(ARG_POINTER, (uint64_t)(uintptr_t)value);
+        }
+        else static_assert(!sizeof(arg_t), "log: argument has no printf conversion, pass .c_str() or a number");
+    }
+
+    extern std::atomic<uint8_t> min_level;
+
+    inline bool is_enabled(level_t level) { return level >= min_level.load(std::memory_order_relaxed); }
+    // Messages below level are skipped, default is LEVEL_INFO
+    void set_level(level_t level);
+    const char* level_to_cstr(level_t level);
+
+    // Message without trailing newline, formatted right away, for formats built at runtime
+    void write(level_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void write_va(level_t level, const char *format, va_list args);
+
+    // Gives format of a SIGIL_LOG_* call site its id, format has to outlive logger
+    uint32_t register_format(level_t level, const char *format, const char *file, uint32_t line);
+    /**
+    * Payload of next record in ring of calling thread, LOG_PAYLOAD_SIZE bytes,
+    * nullptr if ring is full. end_record() of the same thread publishes it
+    */
+    char* begin_record(level_t level, uint32_t format);
+    void end_record(size_t length);
+
+    template<typename... Args> inline void write_deferred(level_t level, uint32_t format, const Args&... args) {
+        char *payload = begin_record(level, format);
+        if (!payload) return;
+        arg_buffer_t buffer = {payload, payload + LOG_PAYLOAD_SIZE};
+        (encode_arg(buffer, args), ...);
+        end_record(buffer.at - payload);
+    }
+
+    // Never called, lets compiler check arguments of SIGIL_LOG_* against format
+    inline void check_format(const char *, ...) __attribute__((format(printf, 1, 2)));
+    inline void check_format(const char *, ...) {}
+
+    // Appends format with encoded arguments to out, as printf would
+    void format_args(const char *format, const char *payload, size_t length, std::string &out);
+
+    /**
+    * Append messages to file too, each line with date, time, level and thread
+    * nullptr closes the file again
+    * Returns VM_OK, or VM_FAILED if file could not be opened
+    */
+    status_t open_file(const char *path);
+    /**
+    * Write binary records to a new file at path instead, nothing gets formatted for it
+    * sigil-logdump prints it as text, like open_file() would have written it
+    * Returns VM_OK, or VM_FAILED if file could not be created
+    */
+    status_t open_binary_file(const char *path);
+    /**
+    * Print binary log file at path to out as text lines
+    * Returns VM_OK, VM_ARG_NULL, VM_NOT_FOUND if it could not be read,
+    * or VM_FAILED if it is malformed
+    */
+    status_t dump_binary_file(const char *path, FILE *out);
+    // Console gets message only, on by default
+    void enable_console(bool enable);
+
+    // Blocks until everything logged before is written out
+    void flush();
+    // Messages lost to full rings so far
+    uint64_t num_dropped();
 
-    // other printouts
+    // Wall clock time as HH:MM:SS.mmm
     std::string get_current_time();
     void tt_end_of_year();
-}
\ No newline at end of file
+}
@@ -0,0 +1,100 @@
+#pragma once
+/*
+    Bounded multi producer, single consumer queue.
+    Every cell carries a sequence number telling whether it is free for the
+    producer at a given position, or filled for the consumer, so producers
+    only contend on one CAS and never take a lock. Producer and consumer
+    positions live on separate cache lines.
+
+    Capacity is rounded up to a power of two, push fails once it is full.
+*/
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+
+namespace sigil {
+    template <typename T>
+    class mailbox_t {
+        public:
+        explicit mailbox_t(uint32_t min_capacity) {
+            size_t capacity = 2;
+            while (capacity < min_capacity) capacity <<= 1;
+
+            this->mask = capacity - 1;
+            this->cells.reset(new cell_t[capacity]);
+            for (size_t i = 0; i < capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        mailbox_t(const mailbox_t&) = delete;
+        mailbox_t& operator=(const mailbox_t&) = delete;
+
+        // Any thread, returns false if mailbox is full
+        bool push(const T &value) {
+            size_t position = tail.load(std::memory_order_relaxed);
+            cell_t *cell;
+
+            while (true) {
+                cell = &cells[position & mask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+
+                if (diff == 0) {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->value = value;
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only, moves up to max values into out, returns their count
+        size_t pop_batch(T *out, size_t max) {
+            size_t count = 0;
+
+            while (count < max) {
+                cell_t *cell = &cells[head & mask];
+                if (cell->sequence.load(std::memory_order_acquire) != head + 1) break;
+
+                out[count++] = std::move(cell->value);
+                // Cell becomes free for the producer one lap ahead
+                cell->sequence.store(head + mask + 1, std::memory_order_release);
+                head++;
+            }
+
+            return count;
+        }
+
+        // Consumer only
+        bool empty() const {
+            return cells[head & mask].sequence.load(std::memory_order_acquire) != head + 1;
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+
+        // Bytes taken, cells included
+        size_t footprint() const {
+            return sizeof(*this) + capacity() * sizeof(cell_t);
+        }
+
+        private:
+        struct cell_t {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<cell_t[]> cells;
+        size_t mask = 0;
+        alignas(64) std::atomic<size_t> tail = {0};
+        alignas(64) size_t head = 0;
+        // Keeps whatever follows off the consumer line
+        char padding[64 - sizeof(size_t)];
+    };
+}
@@ -0,0 +1,75 @@
+#include "mapped-file.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+const char* sigil::find_newline(const char *begin, const char *end) {
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - begin >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)begin);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if (mask) return begin + __builtin_ctz(mask);
+        begin += 16;
+    }
+#endif
+    while (begin < end && *begin != '\n') begin++;
+    return begin;
+}
+
+sigil::mapped_file_t::~mapped_file_t() {
+    close();
+}
+
+sigil::status_t sigil::mapped_file_t::open(const char *path) {
+    if (!path) return VM_ARG_NULL;
+    if (is_open) return VM_ALREADY_EXISTS;
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return VM_NOT_FOUND;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        ::close(fd);
+        return VM_NOT_FOUND;
+    }
+
+    // Mapping stays valid after descriptor is closed
+    if (info.st_size > 0) {
+        void *address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            return VM_NOT_FOUND;
+        }
+        madvise(address, info.st_size, MADV_SEQUENTIAL);
+        map = (char*)address;
+        length = info.st_size;
+    }
+
+    ::close(fd);
+    released = 0;
+    is_open = true;
+    return VM_OK;
+}
+
+void sigil::mapped_file_t::close() {
+    if (map) munmap(map, length);
+    map = nullptr;
+    length = 0;
+    released = 0;
+    is_open = false;
+}
+
+void sigil::mapped_file_t::release(size_t offset) {
+    static const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    offset = MIN(offset, length) & ~(page_size - 1);
+    if (!map || offset <= released) return;
+
+    madvise(map + released, offset - released, MADV_DONTNEED);
+    released = offset;
+}
@@ -0,0 +1,42 @@
+#pragma once
+/*
+    Read-only memory mapped files, for sources too large to copy around.
+    Pages are faulted in on first touch, kernel reads ahead since access is
+    declared sequential, and pages already consumed can be released, so
+    resident memory stays bounded however large the file is.
+*/
+#include <cstddef>
+#include "utils.h"
+
+namespace sigil {
+    /**
+    * First newline in [begin, end), or end if there is none
+    * Scans 16 bytes at a time with SSE2, byte by byte without it
+    */
+    const char* find_newline(const char *begin, const char *end);
+
+    class mapped_file_t {
+        public:
+        mapped_file_t() = default;
+        ~mapped_file_t();
+        mapped_file_t(const mapped_file_t&) = delete;
+        mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+        // Returns VM_OK on success, VM_ALREADY_EXISTS if already open, or VM_NOT_FOUND
+        status_t open(const char *path);
+        void close();
+
+        // Empty file has no data, but is still open
+        const char* data() const { return map; }
+        size_t size() const { return length; }
+
+        // Drop resident pages before offset, they are read again if touched later
+        void release(size_t offset);
+
+        private:
+        char *map = nullptr;
+        size_t length = 0;
+        size_t released = 0;
+        bool is_open = false;
+    };
+}
@@ -0,0 +1,177 @@
+#include "mem-track.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Every tracked block starts with this, right before pointer handed out
+struct alignas(16) block_header_t {
+    uint64_t size;
+    // Distance from start of malloc block to pointer handed out
+    uint32_t offset;
+    uint8_t tag;
+};
+
+static_assert(sizeof(block_header_t) == 16, "block header must keep default new alignment");
+
+// Own line per tag, threads allocating under different tags do not share it
+struct alignas(64) tag_counters_t {
+    std::atomic<int64_t> live_bytes;
+    std::atomic<int64_t> peak_bytes;
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> frees;
+};
+
+// Zero initialized before any constructor runs, new may be called from those
+static tag_counters_t counters[sigil::MEM_TAG_COUNT];
+static thread_local uint8_t thread_tag = sigil::MEM_TAG_UNTAGGED;
+static thread_local int64_t thread_bytes = 0;
+
+static void count_allocation(uint8_t tag, uint64_t size) {
+    tag_counters_t &counter = counters[tag];
+    thread_bytes += (int64_t)size;
+    int64_t live = counter.live_bytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+    counter.allocations.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t peak = counter.peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !counter.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+}
+
+static void count_free(uint8_t tag, uint64_t size) {
+    thread_bytes -= (int64_t)size;
+    counters[tag].live_bytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+    counters[tag].frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Alignment is a power of two, at least 16
+static void* tracked_malloc(size_t size, size_t alignment, uint8_t tag) {
+    void *block;
+    if (alignment <= alignof(block_header_t)) {
+        block = malloc(sizeof(block_header_t) + size);
+    } else if (posix_memalign(&block, alignment, alignment + size) != 0) {
+        block = nullptr;
+    }
+    if (!block) return nullptr;
+
+    uint32_t offset = (uint32_t)MAX(alignment, sizeof(block_header_t));
+    char *ptr = (char*)block + offset;
+    block_header_t *header = (block_header_t*)ptr - 1;
+    header->size = size;
+    header->offset = offset;
+    header->tag = tag;
+
+    count_allocation(tag, size);
+    return ptr;
+}
+
+static void tracked_free(void *ptr) {
+    if (!ptr) return;
+
+    block_header_t *header = (block_header_t*)ptr - 1;
+    count_free(header->tag, header->size);
+    free((char*)ptr - header->offset);
+}
+
+bool sigil::memtrack::hooks_enabled() {
+#   ifdef SIGIL_TRACK_ALLOCATIONS
+    return true;
+#   else
+    return false;
+#   endif
+}
+
+const char* sigil::memtrack::tag_to_cstr(sigil::mem_tag_t tag) {
+    switch (tag) {
+        case MEM_TAG_UNTAGGED: return "untagged";
+        case MEM_TAG_VM: return "vm";
+        case MEM_TAG_VMNODE: return "vmnode";
+        case MEM_TAG_SCRIPT: return "script";
+        case MEM_TAG_NTT: return "ntt";
+        case MEM_TAG_VISOR: return "visor";
+        case MEM_TAG_GUI: return "gui";
+        case MEM_TAG_LOG: return "log";
+        default: return "unknown";
+    }
+}
+
+sigil::mem_tag_t sigil::memtrack::set_current_tag(sigil::mem_tag_t tag) {
+    mem_tag_t previous = (mem_tag_t)thread_tag;
+    thread_tag = tag < MEM_TAG_COUNT ? tag : MEM_TAG_UNTAGGED;
+    return previous;
+}
+
+sigil::mem_tag_t sigil::memtrack::current_tag() {
+    return (mem_tag_t)thread_tag;
+}
+
+void* sigil::memtrack::allocate(size_t size, sigil::mem_tag_t tag) {
+    return tracked_malloc(size, alignof(block_header_t), tag < MEM_TAG_COUNT ? tag : MEM_TAG_UNTAGGED);
+}
+
+void sigil::memtrack::release(void *ptr) {
+    tracked_free(ptr);
+}
+
+int64_t sigil::memtrack::thread_balance() {
+    return thread_bytes;
+}
+
+void sigil::memtrack::read(sigil::mem_tag_stats_t *out) {
+    for (uint32_t i = 0; i < MEM_TAG_COUNT; i++) {
+        out[i].live_bytes = counters[i].live_bytes.load(std::memory_order_relaxed);
+        out[i].peak_bytes = counters[i].peak_bytes.load(std::memory_order_relaxed);
+        out[i].allocations = counters[i].allocations.load(std::memory_order_relaxed);
+        out[i].frees = counters[i].frees.load(std::memory_order_relaxed);
+    }
+}
+
+void sigil::memtrack::print() {
+    mem_tag_stats_t stats[MEM_TAG_COUNT];
+    read(stats);
+
+    printf("Heap by subsystem%s:\n", hooks_enabled() ? "" : " (explicit allocations only, build with SIGIL_TRACK_ALLOCATIONS for all)");
+    printf("  %-10s %12s %12s %12s %12s\n", "tag", "live KiB", "peak KiB", "allocs", "frees");
+    for (uint32_t i = 0; i < MEM_TAG_COUNT; i++) {
+        if (!stats[i].allocations) continue;
+        printf("  %-10s %12ld %12ld %12lu %12lu\n", tag_to_cstr((mem_tag_t)i), stats[i].live_bytes / 1024,
+            stats[i].peak_bytes / 1024, stats[i].allocations, stats[i].frees);
+    }
+}
+
+#ifdef SIGIL_TRACK_ALLOCATIONS
+/*
+    Replacements of global new and delete, every variant, so nothing
+    allocated through one is freed through the C++ library default.
+*/
+static void* tracked_new(size_t size, size_t alignment) {
+    void *ptr = tracked_malloc(size ? size : 1, alignment, thread_tag);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+static void* tracked_new_nothrow(size_t size, size_t alignment) noexcept {
+    return tracked_malloc(size ? size : 1, alignment, thread_tag);
+}
+
+void* operator new(size_t size) { return tracked_new(size, alignof(block_header_t)); }
+void* operator new[](size_t size) { return tracked_new(size, alignof(block_header_t)); }
+void* operator new(size_t size, std::align_val_t align) { return tracked_new(size, (size_t)align); }
+void* operator new[](size_t size, std::align_val_t align) { return tracked_new(size, (size_t)align); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return tracked_new_nothrow(size, alignof(block_header_t)); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return tracked_new_nothrow(size, alignof(block_header_t)); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return tracked_new_nothrow(size, (size_t)align); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return tracked_new_nothrow(size, (size_t)align); }
+
+void operator delete(void *ptr) noexcept { tracked_free(ptr); }
+void operator delete[](void *ptr) noexcept { tracked_free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { tracked_free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { tracked_free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t&) noexcept { tracked_free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept { tracked_free(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t&) noexcept { tracked_free(ptr); }
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t&) noexcept { tracked_free(ptr); }
+#endif /* SIGIL_TRACK_ALLOCATIONS */
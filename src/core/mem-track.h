@@ -0,0 +1,80 @@
+#pragma once
+/*
+    Heap usage by subsystem.
+
+        SIGIL_MEM_TAG(sigil::MEM_TAG_VISOR);
+
+    Allocations of a thread count towards the tag it is in, until end of
+    the scope, and are freed from the tag that allocated them, live bytes,
+    peak and number of allocations are kept per tag.
+    Built with SIGIL_TRACK_ALLOCATIONS global new and delete are replaced
+    to do so, without it tags compile to nothing and only memory taken
+    through memtrack::allocate() with an explicit tag is counted.
+*/
+#include <cstddef>
+#include <cstdint>
+#include "utils.h"
+
+namespace sigil {
+    enum mem_tag_t : uint8_t {
+        MEM_TAG_UNTAGGED,
+        MEM_TAG_VM,
+        MEM_TAG_VMNODE,
+        MEM_TAG_SCRIPT,
+        MEM_TAG_NTT,
+        MEM_TAG_VISOR,
+        MEM_TAG_GUI,
+        MEM_TAG_LOG,
+        MEM_TAG_COUNT,
+    };
+
+    struct mem_tag_stats_t {
+        int64_t live_bytes;
+        int64_t peak_bytes;
+        uint64_t allocations;
+        uint64_t frees;
+    };
+}
+
+namespace sigil::memtrack {
+    // True when built with SIGIL_TRACK_ALLOCATIONS
+    bool hooks_enabled();
+    const char* tag_to_cstr(mem_tag_t tag);
+
+    // Tag of calling thread, returns previous one
+    mem_tag_t set_current_tag(mem_tag_t tag);
+    mem_tag_t current_tag();
+
+    // Counted towards tag whether hooks are built or not, release() frees it
+    void* allocate(size_t size, mem_tag_t tag);
+    void release(void *ptr);
+
+    // Bytes calling thread allocated minus bytes it freed, whatever tag
+    // Difference of two reads is net heap growth of code run in between
+    int64_t thread_balance();
+
+    // Copies counters of every tag, out has MEM_TAG_COUNT entries
+    void read(mem_tag_stats_t *out);
+    void print();
+
+    class scope_t {
+        public:
+        explicit scope_t(mem_tag_t tag) : previous(set_current_tag(tag)) {}
+        ~scope_t() { set_current_tag(previous); }
+
+        scope_t(const scope_t&) = delete;
+        scope_t& operator=(const scope_t&) = delete;
+
+        private:
+        mem_tag_t previous;
+    };
+}
+
+#define SIGIL_MEM_CONCAT_(a, b) a##b
+#define SIGIL_MEM_CONCAT(a, b) SIGIL_MEM_CONCAT_(a, b)
+
+#ifdef SIGIL_TRACK_ALLOCATIONS
+#define SIGIL_MEM_TAG(tag) sigil::memtrack::scope_t SIGIL_MEM_CONCAT(sigil_mem_tag_, __LINE__)(tag)
+#else
+#define SIGIL_MEM_TAG(tag) do {} while (0)
+#endif
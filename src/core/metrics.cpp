@@ -0,0 +1,228 @@
+#include "metrics.h"
+#include "system.h"
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Removes shard of a thread once it exits
+struct metrics_shard_owner_t {
+    sigil::metrics_shard_t *shard = nullptr;
+    ~metrics_shard_owner_t();
+};
+
+thread_local sigil::metrics_shard_t *sigil::metrics::local_shard = nullptr;
+
+// Guards everything below, except gauge values, writers of counters never take it
+static std::mutex metrics_mutex;
+static std::unordered_map<const sigil::vmnode_t*, std::unique_ptr<sigil::vmmetrics_t>> node_metrics;
+static std::vector<sigil::metrics_shard_t*> live_shards;
+static std::vector<sigil::metrics_shard_t*> free_shards;
+static std::vector<uint32_t> free_slots;
+static bool slots_initialized = false;
+// Counts of threads that are gone
+static uint64_t retired_values[VM_METRICS_MAX_SLOTS];
+static std::atomic<int64_t> gauge_values[VM_METRICS_MAX_SLOTS];
+
+static thread_local metrics_shard_owner_t shard_owner;
+static thread_local bool shard_detached = false;
+// Updates from thread_local destructors that run after shard is gone land here
+static sigil::metrics_shard_t discarded_shard;
+
+metrics_shard_owner_t::~metrics_shard_owner_t() {
+    if (!shard) return;
+
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    for (uint32_t i = 1; i < VM_METRICS_MAX_SLOTS; i++) {
+        retired_values[i] += shard->values[i].load(std::memory_order_relaxed);
+        shard->values[i].store(0, std::memory_order_relaxed);
+    }
+    live_shards.erase(std::find(live_shards.begin(), live_shards.end(), shard));
+    free_shards.push_back(shard);
+
+    shard = nullptr;
+    shard_detached = true;
+    sigil::metrics::local_shard = &discarded_shard;
+}
+
+sigil::metrics_shard_t* sigil::metrics::attach_shard() {
+    if (shard_detached) return &discarded_shard;
+
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    if (!free_shards.empty()) {
+        shard_owner.shard = free_shards.back();
+        free_shards.pop_back();
+    } else {
+        shard_owner.shard = new metrics_shard_t;
+        for (auto &value : shard_owner.shard->values) value.store(0, std::memory_order_relaxed);
+    }
+    live_shards.push_back(shard_owner.shard);
+    local_shard = shard_owner.shard;
+    return local_shard;
+}
+
+void sigil::metric_t::set(int64_t value) const {
+    if (!slot || kind != METRIC_GAUGE) return;
+    gauge_values[slot].store(value, std::memory_order_relaxed);
+}
+
+void sigil::metric_t::add_shared(int64_t n) const {
+    if (!slot || kind != METRIC_GAUGE) return;
+    gauge_values[slot].fetch_add(n, std::memory_order_relaxed);
+}
+
+// Caller holds metrics_mutex. Slot is cleared in every shard, so it starts at 0
+static sigil::metric_t allocate_metric(sigil::metric_kind_t kind) {
+    sigil::metric_t metric;
+    metric.kind = kind;
+
+    if (!slots_initialized) {
+        for (uint32_t i = VM_METRICS_MAX_SLOTS - 1; i > 0; i--) free_slots.push_back(i);
+        slots_initialized = true;
+    }
+    if (free_slots.empty()) return metric;
+
+    metric.slot = free_slots.back();
+    free_slots.pop_back();
+    retired_values[metric.slot] = 0;
+    gauge_values[metric.slot].store(0, std::memory_order_relaxed);
+    for (auto shard : live_shards) shard->values[metric.slot].store(0, std::memory_order_relaxed);
+    for (auto shard : free_shards) shard->values[metric.slot].store(0, std::memory_order_relaxed);
+
+    if (kind == sigil::METRIC_HISTOGRAM) metric.histogram = new sigil::histogram_t;
+    return metric;
+}
+
+// Caller holds metrics_mutex
+static sigil::vmmetrics_t* create_metrics(sigil::vmnode_t *node) {
+    auto metrics = std::make_unique<sigil::vmmetrics_t>();
+    metrics->cpu_ns = allocate_metric(sigil::METRIC_COUNTER);
+    metrics->tasks = allocate_metric(sigil::METRIC_COUNTER);
+    metrics->memory = allocate_metric(sigil::METRIC_GAUGE);
+    metrics->entries.push_back({"cpu-ns", metrics->cpu_ns});
+    metrics->entries.push_back({"tasks", metrics->tasks});
+    metrics->entries.push_back({"memory", metrics->memory});
+
+    sigil::vmmetrics_t *created = metrics.get();
+    node_metrics[node] = std::move(metrics);
+    node->metrics.store(created, std::memory_order_release);
+    return created;
+}
+
+sigil::vmmetrics_t* sigil::metrics::of(sigil::vmnode_t *node) {
+    if (!node) return nullptr;
+
+    vmmetrics_t *metrics = node->metrics.load(std::memory_order_acquire);
+    if (metrics) return metrics;
+
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    metrics = node->metrics.load(std::memory_order_acquire);
+    return metrics ? metrics : create_metrics(node);
+}
+
+sigil::status_t sigil::metrics::register_metric(sigil::vmnode_t *node, const char *name,
+                                                sigil::metric_kind_t kind, sigil::metric_t *metric) {
+    if (!node || !name || !metric) return VM_ARG_NULL;
+
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    vmmetrics_t *metrics = node->metrics.load(std::memory_order_acquire);
+    if (!metrics) metrics = create_metrics(node);
+
+    for (auto &entry : metrics->entries) {
+        if (entry.name != name) continue;
+        if (entry.metric.kind != kind) return VM_ARG_INVALID;
+        *metric = entry.metric;
+        return VM_ALREADY_EXISTS;
+    }
+
+    sigil::metric_t created = allocate_metric(kind);
+    if (!created.is_valid()) return VM_FAILED_ALLOC;
+
+    metrics->entries.push_back({name, created});
+    *metric = created;
+    return VM_OK;
+}
+
+// Caller holds metrics_mutex
+static int64_t read_value(const sigil::metric_t &metric) {
+    if (!metric.is_valid()) return 0;
+    if (metric.kind == sigil::METRIC_GAUGE) return gauge_values[metric.slot].load(std::memory_order_relaxed);
+    if (metric.kind == sigil::METRIC_HISTOGRAM) return (int64_t)metric.histogram->count();
+
+    uint64_t sum = retired_values[metric.slot];
+    for (auto shard : live_shards) sum += shard->values[metric.slot].load(std::memory_order_relaxed);
+    return (int64_t)sum;
+}
+
+sigil::status_t sigil::metrics::visit(const sigil::vmnode_t *node, const std::function<void(const sigil::metric_value_t&)> &fn) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    auto found = node_metrics.find(node);
+    if (found == node_metrics.end()) return VM_NOT_FOUND;
+
+    // Strings keep their capacity between calls, so a GUI reading every frame does not touch heap
+    static thread_local metric_value_t value;
+    for (auto &entry : found->second->entries) {
+        value.name = entry.name;
+        value.kind = entry.metric.kind;
+        value.value = read_value(entry.metric);
+        value.summary.clear();
+        if (entry.metric.histogram) entry.metric.histogram->append_summary(value.summary);
+        fn(value);
+    }
+    return VM_OK;
+}
+
+size_t sigil::metrics::describe(const sigil::vmnode_t *node, char *text, size_t size) {
+    if (!size) return 0;
+    text[0] = '\0';
+
+    int64_t cpu_ns, tasks, memory;
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex);
+        auto found = node_metrics.find(node);
+        if (found == node_metrics.end()) return 0;
+
+        cpu_ns = read_value(found->second->cpu_ns);
+        tasks = read_value(found->second->tasks);
+        memory = read_value(found->second->memory);
+    }
+
+    int length;
+    if (cpu_ns < 10000000) length = snprintf(text, size, "cpu %.1fus, %ld tasks", cpu_ns / 1000.0, tasks);
+    else length = snprintf(text, size, "cpu %.1fms, %ld tasks", cpu_ns / 1000000.0, tasks);
+    length = MIN(MAX(length, 0), (int)size - 1);
+
+    int more = 0;
+    if (memory >= (1 << 20)) more = snprintf(text + length, size - length, ", %.1fMB", memory / 1048576.0);
+    else if (memory >= 1024) more = snprintf(text + length, size - length, ", %.1fKB", memory / 1024.0);
+    else if (memory) more = snprintf(text + length, size - length, ", %ldB", memory);
+    return MIN((size_t)(length + MAX(more, 0)), size - 1);
+}
+
+std::string sigil::metrics::describe(const sigil::vmnode_t *node) {
+    char text[96];
+    size_t length = describe(node, text, sizeof(text));
+    return std::string(text, length);
+}
+
+void sigil::metrics::release(sigil::vmnode_t *node) {
+    if (!node || !node->metrics.load(std::memory_order_acquire)) return;
+
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    auto found = node_metrics.find(node);
+    if (found == node_metrics.end()) return;
+
+    for (auto &entry : found->second->entries) {
+        if (!entry.metric.is_valid()) continue;
+        delete entry.metric.histogram;
+        free_slots.push_back(entry.metric.slot);
+    }
+    node_metrics.erase(found);
+    node->metrics.store(nullptr, std::memory_order_release);
+}
+
+size_t sigil::metrics::num_free_slots() {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    return slots_initialized ? free_slots.size() : VM_METRICS_MAX_SLOTS - 1;
+}
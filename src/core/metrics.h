@@ -0,0 +1,139 @@
+#pragma once
+/*
+    Metrics registered against VM nodes.
+    Counters live in per-thread shards, adding to one is a plain store to
+    memory of the calling thread, reads sum shards of every thread. Shard
+    of a finished thread is folded into a shared total and reused.
+    Gauges are one shared value each, histograms are histogram_t.
+
+    Every node gets cpu-ns, tasks and memory on first use, see of().
+    Mailbox drains of a node, commands included, add to the first two.
+*/
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "histogram.h"
+#include "utils.h"
+
+// Counters and gauges of all nodes together, slot 0 is never handed out
+#define VM_METRICS_MAX_SLOTS 4096
+
+namespace sigil {
+    struct vmnode_t;
+
+    enum metric_kind_t : uint8_t {
+        METRIC_COUNTER,
+        METRIC_GAUGE,
+        METRIC_HISTOGRAM,
+    };
+
+    struct metrics_shard_t {
+        std::atomic<uint64_t> values[VM_METRICS_MAX_SLOTS];
+    };
+
+    namespace metrics {
+        extern thread_local metrics_shard_t *local_shard;
+        // Gives calling thread its shard, on first update of a thread
+        metrics_shard_t* attach_shard();
+    }
+
+    /*
+        Reference to a registered metric, cheap to copy. Valid as long as
+        its node is, default one is not registered and ignores updates.
+    */
+    struct metric_t {
+        uint32_t slot = 0;
+        metric_kind_t kind = METRIC_COUNTER;
+        histogram_t *histogram = nullptr;
+
+        // Counters only count up, gauges take negative values too
+        void add(int64_t n = 1) const {
+            if (kind != METRIC_COUNTER) return add_shared(n);
+            if (!slot) return;
+
+            metrics_shard_t *shard = metrics::local_shard ? metrics::local_shard : metrics::attach_shard();
+            std::atomic<uint64_t> &value = shard->values[slot];
+            value.store(value.load(std::memory_order_relaxed) + (uint64_t)n, std::memory_order_relaxed);
+        }
+
+        // Gauges only
+        void set(int64_t value) const;
+        // Histograms only
+        void record(uint64_t value) const { if (histogram) histogram->record(value); }
+        bool is_valid() const { return slot != 0; }
+
+        private:
+        void add_shared(int64_t n) const;
+    };
+
+    // Metrics of one node, created by metrics::of() and freed with node
+    struct vmmetrics_t {
+        struct entry_t {
+            std::string name;
+            metric_t metric;
+        };
+
+        // Time mailbox handlers and calls of node ran, in ns
+        metric_t cpu_ns;
+        // Mailbox handler batches and calls run, commands included
+        metric_t tasks;
+        // Bytes of node mailbox, plus net heap growth of its handlers and calls,
+        // the latter only when built with SIGIL_TRACK_ALLOCATIONS
+        metric_t memory;
+        // Builtin ones first, in order of registration
+        std::vector<entry_t> entries;
+    };
+
+    struct metric_value_t {
+        std::string name;
+        metric_kind_t kind;
+        // Count of values for a histogram
+        int64_t value;
+        // Histogram summary, empty otherwise
+        std::string summary;
+    };
+
+    namespace metrics {
+        /**
+        * Metrics of a node, created with builtin ones on first call
+        * Caller keeps node alive, e.g. holds a reference
+        * Returns nullptr only for a null node
+        */
+        vmmetrics_t* of(vmnode_t *node);
+
+        /**
+        * Register a metric under node, name is unique within node
+        * Returns VM_OK, VM_ALREADY_EXISTS with existing metric in *metric
+        * if kind matches, VM_ARG_INVALID if it does not, VM_ARG_NULL,
+        * or VM_FAILED_ALLOC once every slot is taken
+        */
+        status_t register_metric(vmnode_t *node, const char *name, metric_kind_t kind, metric_t *metric);
+
+        /**
+        * Current values of every metric of node, sums up shards
+        * Node is only used for identity, it may be gone already
+        * Returns VM_NOT_FOUND if node has no metrics
+        */
+        template<typename Allocator>
+        status_t read(const vmnode_t *node, std::vector<metric_value_t, Allocator> &values) {
+            values.clear();
+            return visit(node, [&values](const metric_value_t &value) { values.push_back(value); });
+        }
+
+        // Same as read(), one value at a time, fn runs under registry lock so it must not register
+        // Value is reused for the next one, copy what has to outlive fn
+        status_t visit(const vmnode_t *node, const std::function<void(const metric_value_t&)> &fn);
+
+        // Builtin metrics as one line, e.g. "cpu 1.2ms, 40 tasks, 12KB", empty without metrics
+        std::string describe(const vmnode_t *node);
+        // Same into text, returns its length
+        size_t describe(const vmnode_t *node, char *text, size_t size);
+
+        // Called when node is freed, its slots are handed out again
+        void release(vmnode_t *node);
+
+        size_t num_free_slots();
+    }
+}
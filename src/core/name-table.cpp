@@ -0,0 +1,93 @@
+#include "name-table.h"
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#define NAME_TABLE_SHARDS 16
+
+struct name_hash_t {
+    size_t operator()(std::string_view text) const { return sigil::hash_str(text); }
+};
+
+// Keys view text of their entry, so they stay valid as long as entry does
+struct name_shard_t {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string_view, const sigil::name_entry_t*, name_hash_t> names;
+};
+
+struct name_table_t {
+    name_shard_t shards[NAME_TABLE_SHARDS];
+    std::atomic<uint32_t> next_id = {1};
+};
+
+// Constant initialized, hash is hash_str("") written out
+static const sigil::name_entry_t empty_name = {0xcbf29ce484222325ULL, 0, 0, ""};
+
+// Never destroyed, names in static objects outlive any destructor order
+static name_table_t& name_table() {
+    static name_table_t *table = new name_table_t();
+    return *table;
+}
+
+static name_shard_t& shard_of(uint64_t hash) {
+    // Low bits pick a bucket inside the shard, high ones pick the shard
+    return name_table().shards[(hash >> 56) % NAME_TABLE_SHARDS];
+}
+
+static const sigil::name_entry_t* intern(std::string_view text) {
+    if (text.empty()) return &empty_name;
+
+    uint64_t hash = sigil::hash_str(text);
+    name_shard_t &shard = shard_of(hash);
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.names.find(text);
+        if (found != shard.names.end()) return found->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto found = shard.names.find(text);
+    if (found != shard.names.end()) return found->second;
+
+    // Entry and its text in one block
+    char *block = new char[sizeof(sigil::name_entry_t) + text.size() + 1];
+    char *copy = block + sizeof(sigil::name_entry_t);
+    memcpy(copy, text.data(), text.size());
+    copy[text.size()] = '\0';
+
+    sigil::name_entry_t *entry = (sigil::name_entry_t*)block;
+    entry->hash = hash;
+    entry->id = name_table().next_id.fetch_add(1, std::memory_order_relaxed);
+    entry->length = (uint32_t)text.size();
+    entry->text = copy;
+
+    shard.names.emplace(std::string_view(copy, text.size()), entry);
+    return entry;
+}
+
+sigil::name_t::name_t() : entry(&empty_name) {}
+
+sigil::name_t::name_t(const char *text) : entry(text ? intern(text) : &empty_name) {}
+
+sigil::name_t::name_t(std::string_view text) : entry(intern(text)) {}
+
+sigil::name_t::name_t(const std::string &text) : entry(intern(text)) {}
+
+bool sigil::name_t::find(std::string_view text, sigil::name_t &out) {
+    if (text.empty()) {
+        out.entry = &empty_name;
+        return true;
+    }
+
+    name_shard_t &shard = shard_of(sigil::hash_str(text));
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto found = shard.names.find(text);
+    if (found == shard.names.end()) return false;
+    out.entry = found->second;
+    return true;
+}
+
+size_t sigil::name_t::num_interned() {
+    return name_table().next_id.load(std::memory_order_relaxed);
+}
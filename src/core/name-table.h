@@ -0,0 +1,56 @@
+#pragma once
+/*
+    Interned names for nodes, modules, scenes and commands.
+    Every distinct string is kept once in a global table, name_t is a
+    pointer to that copy with its hash and id next to it, so copying and
+    comparing names costs as much as a pointer, whatever their length.
+    Interning locks one shard of the table, find() never adds to it.
+    Interned text is never freed, names are not for arbitrary input.
+*/
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include "utils.h"
+
+namespace sigil {
+    struct name_entry_t {
+        uint64_t hash;      // hash_str() of text
+        uint32_t id;        // 0 for empty name, then dense in order of interning
+        uint32_t length;
+        const char *text;   // Terminated
+    };
+
+    class name_t {
+        public:
+        // Empty name
+        name_t();
+        name_t(const char *text);
+        name_t(std::string_view text);
+        name_t(const std::string &text);
+
+        // Name of text if it was interned already, out is left alone otherwise
+        static bool find(std::string_view text, name_t &out);
+        // Distinct names so far, empty one included
+        static size_t num_interned();
+
+        const char* c_str() const { return entry->text; }
+        std::string_view view() const { return std::string_view(entry->text, entry->length); }
+        std::string str() const { return std::string(entry->text, entry->length); }
+        size_t size() const { return entry->length; }
+        bool empty() const { return entry->length == 0; }
+        uint64_t hash() const { return entry->hash; }
+        uint32_t id() const { return entry->id; }
+
+        bool operator==(const name_t &other) const { return entry == other.entry; }
+        bool operator!=(const name_t &other) const { return entry != other.entry; }
+
+        private:
+        const name_entry_t *entry;
+    };
+}
+
+template<> struct std::hash<sigil::name_t> {
+    size_t operator()(const sigil::name_t &name) const { return name.hash(); }
+};
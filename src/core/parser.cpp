@@ -0,0 +1,334 @@
+#include "parser.h"
+#include "mapped-file.h"
+#include <unistd.h>
+#include <poll.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+sigil::status_t sigil::parser::parse_command(std::string_view line, sigil::parser::command_t &command) {
+    command.body.clear();
+    size_t i = 0;
+
+    while (true) {
+        while (i < line.size() && is_blank(line[i])) i++;
+        if (i >= line.size()) break;
+        if (command.body.empty() && line[i] == '#') break;
+
+        std::string word;
+        bool quoted = false;
+
+        for (; i < line.size(); i++) {
+            char c = line[i];
+            if (!quoted && is_blank(c)) break;
+
+            if (c == '"') quoted = !quoted;
+            else if (quoted && c == '\\' && i + 1 < line.size()) word += line[++i];
+            else word += c;
+        }
+
+        if (quoted) {
+            command.body.clear();
+            return VM_ARG_INVALID;
+        }
+        command.body.push_back(std::move(word));
+    }
+
+    return command.body.empty() ? VM_SKIPPED : VM_OK;
+}
+
+sigil::status_t sigil::parser::parse_script(std::string_view script, std::vector<sigil::parser::command_t> &commands) {
+    size_t start = 0;
+    bool quoted = false;
+    bool blank = true;
+
+    for (size_t i = 0; i <= script.size(); i++) {
+        if (i < script.size()) {
+            char c = script[i];
+            // Comment runs until end of line, quotes and semicolons in it do not count
+            if (blank && c == '#') {
+                while (i + 1 < script.size() && script[i + 1] != '\n') i++;
+                continue;
+            }
+            if (!is_blank(c)) blank = false;
+
+            if (c == '"') quoted = !quoted;
+            else if (quoted && c == '\\') i++;
+            if (quoted || (c != '\n' && c != ';')) continue;
+        }
+
+        command_t command;
+        status_t status = parse_command(script.substr(start, MIN(i, script.size()) - start), command);
+        if (status == VM_OK) commands.push_back(std::move(command));
+        else if (status != VM_SKIPPED) return status;
+        start = i + 1;
+        blank = true;
+    }
+
+    return VM_OK;
+}
+
+// Edge a pattern word takes, ARG_TYPE_COUNT for a literal word, -1 for unknown placeholder
+static int pattern_edge(const std::string &word) {
+    if (word == "...") return sigil::parser::ARG_REST;
+    if (word.size() < 2 || word.front() != '<' || word.back() != '>') return sigil::parser::ARG_TYPE_COUNT;
+
+    static const char *placeholders[] = {"<int>", "<float>", "<bool>", "<string>"};
+    for (int i = 0; i < 4; i++) {
+        if (word == placeholders[i]) return i;
+    }
+    return -1;
+}
+
+// Node at the end of pattern, nullptr if pattern is not in the trie
+static sigil::parser::syntax_node* find_pattern(sigil::parser::syntax_node *node, const sigil::parser::command_t &pattern) {
+    for (auto &word : pattern.body) {
+        int edge = pattern_edge(word);
+        if (edge < 0) return nullptr;
+
+        if (edge == sigil::parser::ARG_TYPE_COUNT) {
+            auto it = node->words.find(word);
+            node = it == node->words.end() ? nullptr : it->second.get();
+        }
+        else node = node->arguments[edge].get();
+
+        if (!node) return nullptr;
+    }
+    return node;
+}
+
+sigil::status_t sigil::parser::register_command(sigil::parser::syntax_node &translator, sigil::parser::command_t pattern, void *target) {
+    if (!target) return VM_ARG_NULL;
+    if (pattern.body.empty()) return VM_ARG_INVALID;
+
+    for (size_t i = 0; i < pattern.body.size(); i++) {
+        int edge = pattern_edge(pattern.body[i]);
+        if (edge < 0) return VM_ARG_INVALID;
+        if (edge == ARG_REST && i + 1 != pattern.body.size()) return VM_ARG_INVALID;
+    }
+
+    syntax_node *existing = find_pattern(&translator, pattern);
+    if (existing && existing->target) return VM_ALREADY_EXISTS;
+
+    syntax_node *node = &translator;
+    for (auto &word : pattern.body) {
+        int edge = pattern_edge(word);
+        std::unique_ptr<syntax_node> &next = edge == ARG_TYPE_COUNT ? node->words[word] : node->arguments[edge];
+        if (!next) next = std::make_unique<syntax_node>();
+        node = next.get();
+    }
+
+    node->target = target;
+    return VM_OK;
+}
+
+static bool is_empty(const sigil::parser::syntax_node &node) {
+    if (node.target || !node.words.empty()) return false;
+    for (auto &argument : node.arguments) {
+        if (argument) return false;
+    }
+    return true;
+}
+
+// Removes pattern ending below node, together with nodes it leaves empty
+static bool remove_pattern(sigil::parser::syntax_node &node, const std::vector<std::string> &body, size_t i) {
+    if (i == body.size()) {
+        if (!node.target) return false;
+        node.target = nullptr;
+        return true;
+    }
+
+    int edge = pattern_edge(body[i]);
+    if (edge < 0) return false;
+
+    if (edge == sigil::parser::ARG_TYPE_COUNT) {
+        auto it = node.words.find(body[i]);
+        if (it == node.words.end() || !remove_pattern(*it->second, body, i + 1)) return false;
+        if (is_empty(*it->second)) node.words.erase(it);
+        return true;
+    }
+
+    std::unique_ptr<sigil::parser::syntax_node> &next = node.arguments[edge];
+    if (!next || !remove_pattern(*next, body, i + 1)) return false;
+    if (is_empty(*next)) next.reset();
+    return true;
+}
+
+sigil::status_t sigil::parser::unregister_command(sigil::parser::syntax_node &translator, sigil::parser::command_t pattern) {
+    return remove_pattern(translator, pattern.body, 0) ? VM_OK : VM_NOT_FOUND;
+}
+
+static bool has_conflict(const sigil::parser::syntax_node &node, const sigil::parser::syntax_node &other) {
+    if (node.target && other.target) return true;
+
+    for (auto &entry : other.words) {
+        auto it = node.words.find(entry.first);
+        if (it != node.words.end() && has_conflict(*it->second, *entry.second)) return true;
+    }
+    for (int i = 0; i < sigil::parser::ARG_TYPE_COUNT; i++) {
+        if (node.arguments[i] && other.arguments[i] && has_conflict(*node.arguments[i], *other.arguments[i])) return true;
+    }
+    return false;
+}
+
+static void merge(sigil::parser::syntax_node &node, sigil::parser::syntax_node &other) {
+    if (other.target) node.target = other.target;
+
+    for (auto &entry : other.words) {
+        std::unique_ptr<sigil::parser::syntax_node> &next = node.words[entry.first];
+        if (!next) next = std::move(entry.second);
+        else merge(*next, *entry.second);
+    }
+    for (int i = 0; i < sigil::parser::ARG_TYPE_COUNT; i++) {
+        if (!other.arguments[i]) continue;
+        if (!node.arguments[i]) node.arguments[i] = std::move(other.arguments[i]);
+        else merge(*node.arguments[i], *other.arguments[i]);
+    }
+}
+
+sigil::status_t sigil::parser::join_translators(sigil::parser::syntax_node &translator, sigil::parser::syntax_node &new_translator) {
+    if (&translator == &new_translator) return VM_ARG_INVALID;
+    if (has_conflict(translator, new_translator)) return VM_ALREADY_EXISTS;
+
+    merge(translator, new_translator);
+    new_translator = syntax_node();
+    return VM_OK;
+}
+
+static bool parse_argument(const std::string &word, sigil::parser::argument_type_t type, sigil::parser::argument_t &arg) {
+    arg.type = type;
+    arg.text = word;
+    if (word.empty()) return type == sigil::parser::ARG_STRING;
+
+    char *end = nullptr;
+    errno = 0;
+    switch (type) {
+        case sigil::parser::ARG_INT:
+            arg.number = strtoll(word.c_str(), &end, 0);
+            return errno == 0 && *end == '\0';
+        case sigil::parser::ARG_FLOAT:
+            arg.real = strtod(word.c_str(), &end);
+            return errno == 0 && *end == '\0';
+        case sigil::parser::ARG_BOOL:
+            if (word == "true" || word == "on" || word == "yes") arg.number = 1;
+            else if (word == "false" || word == "off" || word == "no") arg.number = 0;
+            else return false;
+            return true;
+        default:
+            return true;
+    }
+}
+
+// Words are preferred over arguments, backtracks if a branch does not end in a command
+static const sigil::parser::syntax_node* match(const sigil::parser::syntax_node &node, sigil::parser::command_t &command, size_t i) {
+    const std::vector<std::string> &body = command.body;
+
+    if (i < body.size()) {
+        auto it = node.words.find(body[i]);
+        if (it != node.words.end()) {
+            const sigil::parser::syntax_node *found = match(*it->second, command, i + 1);
+            if (found) return found;
+        }
+
+        for (int type = 0; type < sigil::parser::ARG_REST; type++) {
+            if (!node.arguments[type]) continue;
+
+            sigil::parser::argument_t arg;
+            if (!parse_argument(body[i], (sigil::parser::argument_type_t)type, arg)) continue;
+
+            command.args.push_back(std::move(arg));
+            const sigil::parser::syntax_node *found = match(*node.arguments[type], command, i + 1);
+            if (found) return found;
+            command.args.pop_back();
+        }
+    }
+    else if (node.target) return &node;
+
+    // Rest takes any number of words, also none
+    const sigil::parser::syntax_node *rest = node.arguments[sigil::parser::ARG_REST].get();
+    if (rest && rest->target) {
+        for (; i < body.size(); i++) {
+            sigil::parser::argument_t arg;
+            parse_argument(body[i], sigil::parser::ARG_REST, arg);
+            command.args.push_back(std::move(arg));
+        }
+        return rest;
+    }
+    return nullptr;
+}
+
+sigil::status_t sigil::parser::translate(const sigil::parser::syntax_node &translator, sigil::parser::command_t &command, void **target) {
+    command.args.clear();
+    if (command.body.empty()) return VM_ARG_INVALID;
+
+    const syntax_node *found = match(translator, command, 0);
+    if (found) {
+        if (target) *target = found->target;
+        return VM_OK;
+    }
+
+    // First word alone tells if such command exists at all
+    bool known = translator.words.count(command.body[0]) > 0;
+    for (int type = 0; type < ARG_TYPE_COUNT && !known; type++) known = translator.arguments[type] != nullptr;
+    return known ? VM_ARG_INVALID : VM_NOT_FOUND;
+}
+
+sigil::parser::line_reader_t::line_reader_t(int fd, size_t buffer_size, std::function<bool()> interrupted)
+    : fd(fd), interrupted(std::move(interrupted)), buffer(MAX(buffer_size, (size_t)64)) {}
+
+// VM_OK once read() would not block, regular files always are ready
+sigil::status_t sigil::parser::line_reader_t::wait_for_input(bool wait) {
+    pollfd request = {fd, POLLIN, 0};
+    while (true) {
+        if (interrupted && interrupted()) return VM_SYSTEM_SHUTDOWN;
+
+        int timeout = !wait ? 0 : interrupted ? LINE_READER_POLL_MS : -1;
+        int ready = poll(&request, 1, timeout);
+        if (ready < 0 && errno == EINTR) continue;
+        // Error or hang up is left for read() to report
+        if (ready != 0) return VM_OK;
+        if (!wait) return VM_BUSY;
+    }
+}
+
+sigil::status_t sigil::parser::line_reader_t::next(std::string_view &line, bool wait) {
+    while (true) {
+        const char *newline = sigil::find_newline(buffer.data() + scanned, buffer.data() + end);
+        if (newline != buffer.data() + end) {
+            size_t length = newline - (buffer.data() + begin);
+            line = std::string_view(buffer.data() + begin, length);
+            begin += length + 1;
+            scanned = begin;
+            return VM_OK;
+        }
+        scanned = end;
+
+        if (eof) {
+            if (begin == end) return VM_SKIPPED;
+            line = std::string_view(buffer.data() + begin, end - begin);
+            begin = scanned = end;
+            return VM_OK;
+        }
+        status_t ready = wait_for_input(wait);
+        if (ready != VM_OK) return ready;
+
+        // Keep unfinished line, move it to front, or grow if it fills whole buffer
+        if (begin > 0) {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            scanned -= begin;
+            begin = 0;
+        }
+        if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+
+        ssize_t count = read(fd, buffer.data() + end, buffer.size() - end);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) return VM_FAILED;
+        if (count == 0) eof = true;
+        end += count;
+    }
+}
@@ -1,17 +1,118 @@
 #pragma once
+#include <unordered_map>
+#include <string_view>
+#include <functional>
+#include <memory>
 #include <vector>
 #include "utils.h"
 
+#define LINE_READER_POLL_MS 50
+
 namespace sigil::parser {
+    // Placeholders of command patterns: <int> <float> <bool> <string> and ... for rest of words
+    enum argument_type_t {
+        ARG_INT,
+        ARG_FLOAT,
+        ARG_BOOL,
+        ARG_STRING,
+        ARG_REST,
+        ARG_TYPE_COUNT,
+    };
+
+    struct argument_t {
+        argument_type_t type = ARG_STRING;
+        int64_t number = 0;     // ARG_INT, ARG_BOOL
+        double real = 0.0;      // ARG_FLOAT
+        std::string text;       // Word as written, for every type
+    };
+
     struct command_t {
         std::vector<std::string> body;
+        // Filled by translate(), one per placeholder of matched pattern
+        std::vector<argument_t> args;
     };
 
+    /*
+        Prefix trie over command words. Each node maps words to subnodes,
+        and has one edge per argument type, tried after words in order of
+        argument_type_t. Lookup costs one hash per word, however many
+        commands are registered.
+    */
     struct syntax_node {
-
+        std::unordered_map<std::string, std::unique_ptr<syntax_node>> words;
+        std::unique_ptr<syntax_node> arguments[ARG_TYPE_COUNT];
+        // Set when a registered command ends at this node
+        void *target = nullptr;
     };
 
-    sigil::status_t register_command(syntax_node &translator, command_t command);
-    sigil::status_t unregister_command(syntax_node &translator, command_t command);
+    /**
+    * Split a line into words separated by whitespace, double quotes
+    * keep a word together, backslash escapes next character in quotes
+    * Returns VM_OK on success, VM_ARG_INVALID for unterminated quote
+    * or VM_SKIPPED for a line without words, or a comment starting with #
+    */
+    sigil::status_t parse_command(std::string_view line, command_t &command);
+
+    /**
+    * Parse commands separated by newlines or semicolons, empty ones are skipped
+    * Returns VM_OK on success, or status of first line failing to parse
+    */
+    sigil::status_t parse_script(std::string_view script, std::vector<command_t> &commands);
+
+    /**
+    * Add a command pattern, e.g. {"net", "ping", "<string>", "<int>"}
+    * target is returned by translate() for commands matching the pattern
+    * Returns VM_OK on success, VM_ALREADY_EXISTS for a registered pattern,
+    * or VM_ARG_INVALID for unknown placeholder, or words after ...
+    */
+    sigil::status_t register_command(syntax_node &translator, command_t pattern, void *target);
+    // Returns VM_NOT_FOUND if pattern is not registered
+    sigil::status_t unregister_command(syntax_node &translator, command_t pattern);
+
+    /**
+    * Move every command of new_translator into translator
+    * Returns VM_OK on success, or VM_ALREADY_EXISTS if both have a
+    * same pattern, then neither translator is changed
+    */
     sigil::status_t join_translators(syntax_node &translator, syntax_node &new_translator);
-}
\ No newline at end of file
+
+    /**
+    * Find pattern matching command body, and parse its arguments into command.args
+    * Returns VM_OK on success, VM_NOT_FOUND if no pattern starts with first word,
+    * or VM_ARG_INVALID if arguments do not fit any pattern
+    */
+    sigil::status_t translate(const syntax_node &translator, command_t &command, void **target);
+
+    /*
+        Reads a file descriptor in large chunks and hands out its lines.
+        Lines point into internal buffer, they stay valid until next call.
+        Buffer grows to fit a line longer than itself.
+        If interrupted is set, it is asked before every read and every
+        LINE_READER_POLL_MS while waiting for input.
+    */
+    class line_reader_t {
+        public:
+        line_reader_t(int fd, size_t buffer_size = 1 << 16, std::function<bool()> interrupted = nullptr);
+
+        /**
+        * Get next line without its newline, last line may lack one
+        * With wait false, returns VM_BUSY instead of blocking on input,
+        * input that is ready is still read
+        * Returns VM_OK on success, VM_SKIPPED at end of input,
+        * VM_SYSTEM_SHUTDOWN once interrupted, or VM_FAILED if read fails
+        */
+        sigil::status_t next(std::string_view &line, bool wait = true);
+
+        private:
+        sigil::status_t wait_for_input(bool wait);
+
+        int fd;
+        std::function<bool()> interrupted;
+        std::vector<char> buffer;
+        size_t begin = 0;
+        size_t end = 0;
+        // Where search for newline continues, bytes before it have none
+        size_t scanned = 0;
+        bool eof = false;
+    };
+}
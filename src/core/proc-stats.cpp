@@ -0,0 +1,260 @@
+#include "proc-stats.h"
+#include "tsc-clock.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+
+#define PROCSTAT_BUFFER_SIZE 8192
+
+struct task_source_t {
+    uint32_t tid;
+    int fd;
+    uint64_t cpu_ns;
+    bool sampled;
+    bool seen;
+};
+
+// Only touched by the thread holding mutex
+static struct {
+    std::mutex mutex;
+    bool opened = false;
+    bool supported = false;
+    int stat_fd = -1;
+    int status_fd = -1;
+    int smaps_fd = -1;
+    DIR *task_dir = nullptr;
+    task_source_t tasks[PROCSTAT_MAX_TASKS];
+    uint32_t num_tasks = 0;
+    uint64_t ns_per_tick = 0;
+    uint64_t previous_ns = 0;
+    char buffer[PROCSTAT_BUFFER_SIZE];
+    sigil::procstat::snapshot_t current;
+} sampler;
+
+// Odd while snapshot is being written, readers retry then
+static std::atomic<uint64_t> published_sequence = {0};
+static sigil::procstat::snapshot_t published;
+
+// Reads whole file into sampler buffer, returns its length, or 0 on failure
+static size_t read_proc(int fd) {
+    if (fd < 0) return 0;
+
+    ssize_t length = pread(fd, sampler.buffer, PROCSTAT_BUFFER_SIZE - 1, 0);
+    if (length <= 0) return 0;
+    sampler.buffer[length] = '\0';
+    return (size_t)length;
+}
+
+// Value of a "Key:   123 kB" line, in bytes if it has a unit, 0 if key is missing
+static uint64_t find_value(const char *text, const char *key) {
+    size_t key_length = strlen(key);
+
+    const char *line = text;
+
+    while (line) {
+        if (strncmp(line, key, key_length) == 0 && line[key_length] == ':') {
+            char *end;
+            uint64_t value = strtoull(line + key_length + 1, &end, 10);
+            while (*end == ' ') end++;
+            return end[0] == 'k' && end[1] == 'B' ? value * 1024 : value;
+        }
+
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    return 0;
+}
+
+/*
+    Parses a stat line, "pid (comm) state field4 field5 ...", comm may hold
+    spaces and parentheses, so fields start after the last ')'.
+    fields[i] receives field i + 1, up to max_fields
+*/
+static bool parse_stat(const char *text, char *name, char *state, uint64_t *fields, uint32_t max_fields) {
+    const char *open = strchr(text, '(');
+    const char *close = strrchr(text, ')');
+    if (!open || !close || close < open || close[1] != ' ') return false;
+
+    size_t name_length = MIN((size_t)(close - open - 1), (size_t)PROCSTAT_NAME_SIZE - 1);
+    memcpy(name, open + 1, name_length);
+    name[name_length] = '\0';
+
+    const char *p = close + 2;
+    *state = *p++;
+    for (uint32_t i = 3; i < max_fields; i++) {
+        char *end;
+        fields[i] = (uint64_t)strtoll(p, &end, 10);
+        if (end == p) return false;
+        p = end;
+    }
+    return true;
+}
+
+static bool open_sources() {
+    sampler.opened = true;
+    sampler.stat_fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+    sampler.status_fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+    // Missing on kernels older than 4.14, memory breakdown stays 0 there
+    sampler.smaps_fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+    sampler.task_dir = opendir("/proc/self/task");
+
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    sampler.ns_per_tick = 1000000000ull / (ticks_per_second > 0 ? ticks_per_second : 100);
+    sampler.supported = sampler.stat_fd >= 0 && sampler.status_fd >= 0;
+    return sampler.supported;
+}
+
+// Opens stat of threads that appeared since last sample, closes those that are gone
+static void refresh_tasks() {
+    if (!sampler.task_dir) return;
+
+    for (uint32_t i = 0; i < sampler.num_tasks; i++) sampler.tasks[i].seen = false;
+
+    rewinddir(sampler.task_dir);
+    struct dirent *entry;
+    while ((entry = readdir(sampler.task_dir))) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+        uint32_t tid = (uint32_t)strtoul(entry->d_name, nullptr, 10);
+
+        uint32_t i = 0;
+        while (i < sampler.num_tasks && sampler.tasks[i].tid != tid) i++;
+        if (i < sampler.num_tasks) {
+            sampler.tasks[i].seen = true;
+            continue;
+        }
+        if (sampler.num_tasks == PROCSTAT_MAX_TASKS) continue;
+
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%u/stat", tid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        sampler.tasks[sampler.num_tasks++] = {tid, fd, 0, false, true};
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < sampler.num_tasks; i++) {
+        if (sampler.tasks[i].seen) sampler.tasks[kept++] = sampler.tasks[i];
+        else close(sampler.tasks[i].fd);
+    }
+    sampler.num_tasks = kept;
+}
+
+static float cpu_percent(uint64_t cpu_ns, uint64_t previous_cpu_ns, uint64_t elapsed_ns) {
+    if (!elapsed_ns || cpu_ns < previous_cpu_ns) return 0.0f;
+    return (float)(100.0 * (cpu_ns - previous_cpu_ns) / elapsed_ns);
+}
+
+static void publish(const sigil::procstat::snapshot_t &snapshot) {
+    uint64_t sequence = published_sequence.load(std::memory_order_relaxed);
+    published_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&published, &snapshot, sizeof(snapshot));
+    published_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+sigil::status_t sigil::procstat::sample() {
+#   ifdef __linux__
+    std::unique_lock<std::mutex> lock(sampler.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) return VM_BUSY;
+    if (!sampler.opened && !open_sources()) return VM_NOT_SUPPORTED;
+    if (!sampler.supported) return VM_NOT_SUPPORTED;
+
+    snapshot_t &current = sampler.current;
+    uint64_t now_ns = tsc::now_ns();
+    uint64_t elapsed_ns = sampler.previous_ns ? now_ns - sampler.previous_ns : 0;
+    uint64_t previous_cpu_ns = current.user_ns + current.system_ns;
+    uint64_t fields[25] = {};
+
+    if (!read_proc(sampler.stat_fd) || !parse_stat(sampler.buffer, current.command, &current.state, fields, 25)) {
+        return VM_FAILED;
+    }
+    current.pid = (uint32_t)getpid();
+    current.minor_faults = fields[9];
+    current.major_faults = fields[11];
+    current.user_ns = fields[13] * sampler.ns_per_tick;
+    current.system_ns = fields[14] * sampler.ns_per_tick;
+    current.num_threads = (uint32_t)fields[19];
+    current.vsize = fields[22];
+    current.cpu_percent = cpu_percent(current.user_ns + current.system_ns, previous_cpu_ns, elapsed_ns);
+
+    if (read_proc(sampler.status_fd)) {
+        current.rss = find_value(sampler.buffer, "VmRSS");
+        current.peak_rss = find_value(sampler.buffer, "VmHWM");
+        current.voluntary_switches = find_value(sampler.buffer, "voluntary_ctxt_switches");
+        current.involuntary_switches = find_value(sampler.buffer, "nonvoluntary_ctxt_switches");
+    }
+
+    if (read_proc(sampler.smaps_fd)) {
+        current.pss = find_value(sampler.buffer, "Pss");
+        current.anonymous = find_value(sampler.buffer, "Anonymous");
+        current.private_dirty = find_value(sampler.buffer, "Private_Dirty");
+        current.shared = find_value(sampler.buffer, "Shared_Clean") + find_value(sampler.buffer, "Shared_Dirty");
+        current.swap = find_value(sampler.buffer, "Swap");
+    }
+
+    refresh_tasks();
+    current.num_tasks = 0;
+    for (uint32_t i = 0; i < sampler.num_tasks; i++) {
+        task_source_t &source = sampler.tasks[i];
+        task_t &task = current.tasks[current.num_tasks];
+        char state;
+        if (!read_proc(source.fd) || !parse_stat(sampler.buffer, task.name, &state, fields, 16)) continue;
+
+        task.tid = source.tid;
+        task.cpu_ns = (fields[13] + fields[14]) * sampler.ns_per_tick;
+        // New thread has no previous sample, it shows from the next one
+        task.cpu_percent = source.sampled ? cpu_percent(task.cpu_ns, source.cpu_ns, elapsed_ns) : 0.0f;
+        source.cpu_ns = task.cpu_ns;
+        source.sampled = true;
+        current.num_tasks++;
+    }
+
+    current.sequence++;
+    current.sampled_ns = now_ns;
+    sampler.previous_ns = now_ns;
+    publish(current);
+    return VM_OK;
+#   else
+    return VM_NOT_SUPPORTED;
+#   endif /* __linux__ */
+}
+
+bool sigil::procstat::read(sigil::procstat::snapshot_t &snapshot) {
+    while (true) {
+        uint64_t before = published_sequence.load(std::memory_order_acquire);
+        if (before == 0) return false;
+        if (before & 1) continue;
+
+        memcpy(&snapshot, &published, sizeof(snapshot));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (published_sequence.load(std::memory_order_relaxed) == before) return true;
+    }
+}
+
+void sigil::procstat::print(const sigil::procstat::snapshot_t &snapshot) {
+    printf("Virtual Machine memory report:\n");
+    printf("PID: %u\n", snapshot.pid);
+    printf("Command: %s\n", snapshot.command);
+    printf("State: %c\n", snapshot.state);
+    printf("Virtual Memory Size: %lu KiB\n", snapshot.vsize / 1024);
+    printf("Resident Set Size: %lu KiB (peak %lu KiB)\n", snapshot.rss / 1024, snapshot.peak_rss / 1024);
+    printf("Proportional Set Size: %lu KiB\n", snapshot.pss / 1024);
+    printf("Anonymous: %lu KiB, private dirty: %lu KiB, shared: %lu KiB, swap: %lu KiB\n",
+        snapshot.anonymous / 1024, snapshot.private_dirty / 1024, snapshot.shared / 1024, snapshot.swap / 1024);
+    printf("Page faults: %lu minor, %lu major\n", snapshot.minor_faults, snapshot.major_faults);
+    printf("Context switches: %lu voluntary, %lu involuntary\n",
+        snapshot.voluntary_switches, snapshot.involuntary_switches);
+    printf("CPU: %.1f%%, user %lums, system %lums\n",
+        snapshot.cpu_percent, snapshot.user_ns / 1000000, snapshot.system_ns / 1000000);
+    printf("Threads: %u\n", snapshot.num_threads);
+
+    for (uint32_t i = 0; i < snapshot.num_tasks; i++) {
+        const task_t &task = snapshot.tasks[i];
+        printf("  %-8u %-16s %6.1f%% %lums\n", task.tid, task.name, task.cpu_percent, task.cpu_ns / 1000000);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+/*
+    Process stats sampled in background.
+    sample() reads /proc/self/stat, status, smaps_rollup and stat of every
+    thread through descriptors kept open, into a fixed buffer, parsing
+    never allocates. Result is published as a snapshot readers copy out
+    without locks, a copy that raced with sampler is simply retried.
+    VM samples every PROCSTAT_INTERVAL_US while it runs.
+*/
+#include <cstdint>
+#include "utils.h"
+
+#define PROCSTAT_INTERVAL_US 500000
+#define PROCSTAT_MAX_TASKS 64
+#define PROCSTAT_NAME_SIZE 16
+
+namespace sigil::procstat {
+    struct task_t {
+        uint32_t tid;
+        char name[PROCSTAT_NAME_SIZE];
+        // User and system time since thread started
+        uint64_t cpu_ns;
+        // Of one core, over interval since previous sample
+        float cpu_percent;
+    };
+
+    // Sizes in bytes
+    struct snapshot_t {
+        // Number of samples so far, 0 before first one
+        uint64_t sequence;
+        uint64_t sampled_ns;
+        uint32_t pid;
+        char state;
+        char command[PROCSTAT_NAME_SIZE];
+
+        uint64_t vsize;
+        uint64_t rss;
+        uint64_t peak_rss;
+        uint64_t pss;
+        uint64_t anonymous;
+        uint64_t private_dirty;
+        uint64_t shared;
+        uint64_t swap;
+
+        uint64_t minor_faults;
+        uint64_t major_faults;
+        uint64_t voluntary_switches;
+        uint64_t involuntary_switches;
+
+        uint64_t user_ns;
+        uint64_t system_ns;
+        float cpu_percent;
+
+        uint32_t num_threads;
+        // Threads past PROCSTAT_MAX_TASKS are counted in num_threads only
+        uint32_t num_tasks;
+        task_t tasks[PROCSTAT_MAX_TASKS];
+    };
+
+    /**
+    * Take one sample and publish it, called periodically by VM
+    * Returns VM_OK, VM_BUSY if another sample is being taken,
+    * or VM_NOT_SUPPORTED without /proc
+    */
+    status_t sample();
+
+    // Copies latest snapshot, returns false before first sample
+    bool read(snapshot_t &snapshot);
+
+    void print(const snapshot_t &snapshot);
+}
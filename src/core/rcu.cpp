@@ -0,0 +1,70 @@
+#include <thread>
+#include "rcu.h"
+
+// Spreads threads over reader slots, so they rarely contend for the same one
+static std::atomic<uint32_t> next_slot_hint = {0};
+static thread_local uint32_t slot_hint = next_slot_hint.fetch_add(1) % MAX_THREADS;
+
+sigil::rcu_domain_t::rcu_domain_t() {
+    for (auto &reader : readers) reader.epoch.store(0, std::memory_order_relaxed);
+    epoch.store(1, std::memory_order_relaxed);
+}
+
+sigil::rcu_domain_t::~rcu_domain_t() {
+    for (auto &entry : retired) entry.second();
+}
+
+uint32_t sigil::rcu_domain_t::read_lock() {
+    for (uint32_t i = slot_hint; ; i = (i + 1) % MAX_THREADS) {
+        uint64_t expected = 0;
+        uint64_t current = epoch.load();
+
+        if (readers[i].epoch.compare_exchange_strong(expected, current)) return i;
+
+        // Every slot taken, only possible with more than MAX_THREADS readers
+        if ((i + 1) % MAX_THREADS == slot_hint) std::this_thread::yield();
+    }
+}
+
+void sigil::rcu_domain_t::read_unlock(uint32_t slot) {
+    readers[slot].epoch.store(0, std::memory_order_release);
+}
+
+void sigil::rcu_domain_t::retire(std::function<void()> reclaim_fn) {
+    // Readers that start after this bump can only see the new version
+    uint64_t retired_at = epoch.fetch_add(1) + 1;
+    {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        retired.emplace_back(retired_at, std::move(reclaim_fn));
+    }
+    reclaim();
+}
+
+size_t sigil::rcu_domain_t::reclaim() {
+    uint64_t oldest_reader = UINT64_MAX;
+    for (auto &reader : readers) {
+        uint64_t reader_epoch = reader.epoch.load();
+        if (reader_epoch) oldest_reader = MIN(oldest_reader, reader_epoch);
+    }
+
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        size_t kept = 0;
+
+        for (size_t i = 0; i < retired.size(); i++) {
+            if (retired[i].first <= oldest_reader) ready.push_back(std::move(retired[i].second));
+            else retired[kept++] = std::move(retired[i]);
+        }
+
+        retired.resize(kept);
+    }
+
+    for (auto &reclaim_fn : ready) reclaim_fn();
+    return ready.size();
+}
+
+size_t sigil::rcu_domain_t::num_retired() {
+    std::lock_guard<std::mutex> lock(retire_mutex);
+    return retired.size();
+}
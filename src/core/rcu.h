@@ -0,0 +1,46 @@
+#pragma once
+/*
+    Epoch based read-copy-update.
+    Readers claim a slot marked with current epoch for as long as they hold
+    a published pointer. Writers publish a new version, then retire the old
+    one, which is reclaimed once every occupied slot is past its epoch.
+    Readers never take a lock or wait on writers.
+*/
+#include <functional>
+#include <cstdint>
+#include <utility>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include "utils.h"
+
+namespace sigil {
+    class rcu_domain_t {
+        public:
+        rcu_domain_t();
+        // Runs whatever is still retired, no readers may be left by then
+        ~rcu_domain_t();
+        rcu_domain_t(const rcu_domain_t&) = delete;
+        rcu_domain_t& operator=(const rcu_domain_t&) = delete;
+
+        // Returns reader slot, which has to be passed back to read_unlock
+        uint32_t read_lock();
+        void read_unlock(uint32_t slot);
+
+        // Call after old value is unpublished, reclaim runs when it is safe
+        void retire(std::function<void()> reclaim_fn);
+        // Returns number of reclaimed entries
+        size_t reclaim();
+        size_t num_retired();
+
+        private:
+        struct alignas(64) reader_slot_t {
+            std::atomic<uint64_t> epoch;    // 0 for a free slot
+        };
+
+        reader_slot_t readers[MAX_THREADS];
+        std::atomic<uint64_t> epoch;
+        std::mutex retire_mutex;
+        std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+    };
+}
@@ -0,0 +1,1040 @@
+#include "script.h"
+#include "mapped-file.h"
+#include "mem-track.h"
+#include <unordered_map>
+#include <cstdio>
+
+using sigil::script::instruction_t;
+using sigil::script::template_t;
+using sigil::script::program_t;
+using sigil::script::opcode_t;
+
+// Handler addresses of the interpreter are only reachable from inside of it
+#if defined(__GNUC__)
+#define SVM_THREADED_DISPATCH
+#endif
+
+static const char *opcode_names[sigil::script::OP_COUNT] = {
+    "halt", "loadi", "loadk", "move", "add", "sub", "mul", "div", "mod", "addi",
+    "lt", "le", "eq", "ne", "and", "or", "not", "neg", "jmp", "jz", "jnz",
+    "blt", "ble", "beq", "bne", "fori", "print", "run",
+};
+
+int32_t sigil::script::program_t::find_variable(std::string_view name) const {
+    for (size_t i = 0; i < variables.size(); i++) {
+        if (variables[i] == name) return (int32_t)i;
+    }
+    return -1;
+}
+
+int64_t sigil::script::environment_t::get(const sigil::script::program_t &program, std::string_view name) const {
+    int32_t reg = program.find_variable(name);
+    return reg < 0 ? 0 : registers[reg];
+}
+
+/*
+    Compiler
+    Works line by line, expressions are compiled straight into registers.
+    Variables take registers from 0 up, temporaries of a statement from the
+    top down. Loops are rotated, so their condition runs once per iteration
+    at the bottom, and compare followed by a jump is fused into one branch.
+*/
+enum svm_token_type_t {
+    TOKEN_END,
+    TOKEN_NAME,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_SYMBOL,
+};
+
+struct svm_token_t {
+    svm_token_type_t type;
+    std::string text;
+    int64_t number = 0;
+};
+
+// Constant, or value living in a register
+struct svm_operand_t {
+    bool is_constant;
+    int64_t value;
+    uint8_t reg;
+};
+
+enum svm_block_type_t {
+    BLOCK_IF,
+    BLOCK_WHILE,
+    BLOCK_FOR,
+};
+
+struct svm_block_t {
+    svm_block_type_t type;
+    uint32_t line;
+    // Jumps to be patched to the end of the block (break, end of if branch)
+    std::vector<size_t> exit_jumps;
+    // Jumps to be patched to the loop condition (continue)
+    std::vector<size_t> continue_jumps;
+    // If: branch taken when last condition is false, SIZE_MAX if none
+    size_t false_branch = SIZE_MAX;
+    bool has_else = false;
+    // While: jump from loop entry to condition, loops: first instruction of body
+    size_t entry_jump = SIZE_MAX;
+    size_t body_start = 0;
+    // While: condition, moved behind the body
+    std::vector<instruction_t> condition;
+    std::vector<uint32_t> condition_lines;
+    // For: counter, limit and constant step
+    uint8_t counter = 0;
+    uint8_t limit = 0;
+    int64_t step = 1;
+};
+
+struct svm_compiler_t {
+    program_t &program;
+    std::unordered_map<std::string, uint8_t> variables;
+    std::vector<svm_block_t> blocks;
+    std::vector<svm_token_t> tokens;
+    size_t pos = 0;
+    uint32_t line = 0;
+    uint32_t temp_top = SVM_MAX_REGISTERS;
+    size_t statement_start = 0;
+    std::string error;
+    // Loads of constant registers, run once before first statement
+    std::vector<instruction_t> prologue;
+    std::unordered_map<int64_t, uint8_t> constant_registers;
+    // Position of each value in program.constants
+    std::unordered_map<int64_t, int32_t> constant_index;
+
+    svm_compiler_t(program_t &program) : program(program) {}
+
+    bool fail(const std::string &reason) {
+        if (error.empty()) error = "line " + std::to_string(line) + ": " + reason;
+        return false;
+    }
+
+    size_t emit(opcode_t op, uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, int32_t imm = 0) {
+        program.code.push_back({op, a, b, c, imm});
+        program.lines.push_back(line);
+        return program.code.size() - 1;
+    }
+
+    void patch(size_t at, size_t target) {
+        if (at != SIZE_MAX) program.code[at].imm = (int32_t)target;
+    }
+
+    // Tokens
+
+    bool tokenize(std::string_view text) {
+        tokens.clear();
+        pos = 0;
+        size_t i = 0;
+
+        while (i < text.size()) {
+            char c = text[i];
+            if (c == ' ' || c == '\t' || c == '\r') { i++; continue; }
+            if (c == '#') break;
+
+            svm_token_t token;
+            if (isalpha((unsigned char)c) || c == '_') {
+                size_t start = i;
+                while (i < text.size() && (isalnum((unsigned char)text[i]) || text[i] == '_')) i++;
+                token.type = TOKEN_NAME;
+                token.text = text.substr(start, i - start);
+            }
+            else if (isdigit((unsigned char)c)) {
+                uint64_t value = 0;
+                while (i < text.size() && isdigit((unsigned char)text[i])) {
+                    value = value * 10 + (text[i++] - '0');
+                    if (value > (uint64_t)INT64_MAX) return fail("number out of range");
+                }
+                token.type = TOKEN_NUMBER;
+                token.number = (int64_t)value;
+            }
+            else if (c == '"') {
+                token.type = TOKEN_STRING;
+                for (i++; i < text.size() && text[i] != '"'; i++) {
+                    if (text[i] == '\\' && i + 1 < text.size()) {
+                        char escaped = text[++i];
+                        token.text += escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped;
+                    }
+                    else token.text += text[i];
+                }
+                if (i >= text.size()) return fail("unterminated string");
+                i++;
+            }
+            else {
+                static const char *symbols[] = {"<=", ">=", "==", "!=", "<", ">", "=", "+", "-", "*", "/", "%", "(", ")", ","};
+                token.type = TOKEN_SYMBOL;
+                for (const char *symbol : symbols) {
+                    if (text.substr(i).rfind(symbol, 0) == 0) {
+                        token.text = symbol;
+                        break;
+                    }
+                }
+                if (token.text.empty()) return fail(std::string("unexpected character '") + c + "'");
+                i += token.text.size();
+            }
+            tokens.push_back(std::move(token));
+        }
+
+        tokens.push_back({TOKEN_END, "", 0});
+        return true;
+    }
+
+    const svm_token_t& peek() { return tokens[pos]; }
+    bool at_end() { return tokens[pos].type == TOKEN_END; }
+
+    bool accept(const char *text) {
+        const svm_token_t &token = tokens[pos];
+        if (token.type == TOKEN_END || token.type == TOKEN_STRING || token.type == TOKEN_NUMBER) return false;
+        if (token.text != text) return false;
+        pos++;
+        return true;
+    }
+
+    bool expect(const char *text) {
+        return accept(text) ? true : fail(std::string("expected '") + text + "'");
+    }
+
+    static bool is_keyword(const std::string &name) {
+        static const char *keywords[] = {
+            "let", "if", "elif", "else", "end", "while", "for", "to", "step",
+            "break", "continue", "print", "run", "and", "or", "not",
+        };
+        for (const char *keyword : keywords) {
+            if (name == keyword) return true;
+        }
+        return false;
+    }
+
+    // Registers
+
+    bool alloc_temp(uint8_t &reg) {
+        if (temp_top <= program.variables.size()) return fail("expression is too complex");
+        reg = (uint8_t)--temp_top;
+        return true;
+    }
+
+    bool declare(const std::string &name, uint8_t &reg) {
+        auto it = variables.find(name);
+        if (it != variables.end()) {
+            reg = it->second;
+            return true;
+        }
+
+        if (program.variables.size() + 1 >= temp_top) return fail("too many variables");
+        reg = (uint8_t)program.variables.size();
+        program.variables.push_back(name);
+        if (!name.empty()) variables[name] = reg;
+        return true;
+    }
+
+    instruction_t constant_load(uint8_t reg, int64_t value) {
+        if (value >= INT32_MIN && value <= INT32_MAX) return {sigil::script::OP_LOADI, reg, 0, 0, (int32_t)value};
+
+        auto found = constant_index.emplace(value, (int32_t)program.constants.size());
+        if (found.second) program.constants.push_back(value);
+        return {sigil::script::OP_LOADK, reg, 0, 0, found.first->second};
+    }
+
+    void load_constant(uint8_t reg, int64_t value) {
+        instruction_t load = constant_load(reg, value);
+        emit(load.op, load.a, load.b, load.c, load.imm);
+    }
+
+    bool to_register(svm_operand_t &operand) {
+        if (!operand.is_constant) return true;
+
+        // Constants get registers nobody writes to, loaded once by prologue of the program
+        auto it = constant_registers.find(operand.value);
+        if (it == constant_registers.end() && program.variables.size() + 1 < temp_top) {
+            uint8_t reg = (uint8_t)program.variables.size();
+            program.variables.push_back("");
+            prologue.push_back(constant_load(reg, operand.value));
+            it = constant_registers.emplace(operand.value, reg).first;
+        }
+
+        if (it != constant_registers.end()) {
+            operand = {false, 0, it->second};
+            return true;
+        }
+
+        if (!alloc_temp(operand.reg)) return false;
+        load_constant(operand.reg, operand.value);
+        operand.is_constant = false;
+        return true;
+    }
+
+    // Last instruction computes value of a temporary of current statement
+    bool is_last_result(const svm_operand_t &operand) {
+        if (operand.is_constant || operand.reg < program.variables.size()) return false;
+        if (program.code.size() <= statement_start) return false;
+
+        const instruction_t &last = program.code.back();
+        return last.a == operand.reg && last.op >= sigil::script::OP_LOADI && last.op <= sigil::script::OP_NEG;
+    }
+
+    // Expressions, from lowest precedence
+
+    static int64_t fold(opcode_t op, int64_t l, int64_t r) {
+        uint64_t ul = (uint64_t)l, ur = (uint64_t)r;
+        switch (op) {
+            case sigil::script::OP_ADD: return (int64_t)(ul + ur);
+            case sigil::script::OP_SUB: return (int64_t)(ul - ur);
+            case sigil::script::OP_MUL: return (int64_t)(ul * ur);
+            case sigil::script::OP_DIV: return r == -1 ? (int64_t)(0 - ul) : l / r;
+            case sigil::script::OP_MOD: return r == -1 ? 0 : l % r;
+            case sigil::script::OP_LT: return l < r;
+            case sigil::script::OP_LE: return l <= r;
+            case sigil::script::OP_EQ: return l == r;
+            case sigil::script::OP_NE: return l != r;
+            case sigil::script::OP_AND: return l && r;
+            case sigil::script::OP_OR: return l || r;
+            default: return 0;
+        }
+    }
+
+    bool binary(opcode_t op, svm_operand_t l, svm_operand_t r, uint32_t mark, svm_operand_t &result) {
+        bool divides = op == sigil::script::OP_DIV || op == sigil::script::OP_MOD;
+        if (l.is_constant && r.is_constant && !(divides && r.value == 0)) {
+            result = {true, fold(op, l.value, r.value), 0};
+            return true;
+        }
+
+        // Small constant added or subtracted goes into the instruction
+        if (op == sigil::script::OP_ADD && l.is_constant) std::swap(l, r);
+        bool immediate = r.is_constant && (op == sigil::script::OP_ADD || op == sigil::script::OP_SUB) &&
+                         r.value > INT32_MIN && r.value <= INT32_MAX;
+
+        if (!to_register(l)) return false;
+        if (!immediate && !to_register(r)) return false;
+
+        // Operands are read before result is written, so their temporaries can be reused
+        temp_top = mark;
+        result.is_constant = false;
+        if (!alloc_temp(result.reg)) return false;
+
+        if (immediate) emit(sigil::script::OP_ADDI, result.reg, l.reg, 0, (int32_t)(op == sigil::script::OP_ADD ? r.value : -r.value));
+        else emit(op, result.reg, l.reg, r.reg);
+        return true;
+    }
+
+    bool expression(svm_operand_t &result) { return parse_or(result); }
+
+    bool parse_or(svm_operand_t &result) {
+        uint32_t mark = temp_top;
+        if (!parse_and(result)) return false;
+        while (accept("or")) {
+            svm_operand_t r;
+            if (!parse_and(r) || !binary(sigil::script::OP_OR, result, r, mark, result)) return false;
+        }
+        return true;
+    }
+
+    bool parse_and(svm_operand_t &result) {
+        uint32_t mark = temp_top;
+        if (!parse_not(result)) return false;
+        while (accept("and")) {
+            svm_operand_t r;
+            if (!parse_not(r) || !binary(sigil::script::OP_AND, result, r, mark, result)) return false;
+        }
+        return true;
+    }
+
+    bool parse_not(svm_operand_t &result) {
+        if (!accept("not")) return parse_comparison(result);
+
+        uint32_t mark = temp_top;
+        svm_operand_t operand;
+        if (!parse_not(operand)) return false;
+        if (operand.is_constant) {
+            result = {true, !operand.value, 0};
+            return true;
+        }
+
+        temp_top = mark;
+        result.is_constant = false;
+        if (!alloc_temp(result.reg)) return false;
+        emit(sigil::script::OP_NOT, result.reg, operand.reg);
+        return true;
+    }
+
+    bool parse_comparison(svm_operand_t &result) {
+        uint32_t mark = temp_top;
+        if (!parse_additive(result)) return false;
+
+        // Greater than is less than with operands swapped
+        static const struct { const char *symbol; opcode_t op; bool swap; } comparisons[] = {
+            {"<", sigil::script::OP_LT, false}, {"<=", sigil::script::OP_LE, false},
+            {">", sigil::script::OP_LT, true},  {">=", sigil::script::OP_LE, true},
+            {"==", sigil::script::OP_EQ, false}, {"!=", sigil::script::OP_NE, false},
+        };
+
+        for (auto &comparison : comparisons) {
+            if (!accept(comparison.symbol)) continue;
+
+            svm_operand_t r;
+            if (!parse_additive(r)) return false;
+            return comparison.swap ? binary(comparison.op, r, result, mark, result)
+                                   : binary(comparison.op, result, r, mark, result);
+        }
+        return true;
+    }
+
+    bool parse_additive(svm_operand_t &result) {
+        uint32_t mark = temp_top;
+        if (!parse_multiplicative(result)) return false;
+        while (true) {
+            opcode_t op;
+            if (accept("+")) op = sigil::script::OP_ADD;
+            else if (accept("-")) op = sigil::script::OP_SUB;
+            else return true;
+
+            svm_operand_t r;
+            if (!parse_multiplicative(r) || !binary(op, result, r, mark, result)) return false;
+        }
+    }
+
+    bool parse_multiplicative(svm_operand_t &result) {
+        uint32_t mark = temp_top;
+        if (!parse_unary(result)) return false;
+        while (true) {
+            opcode_t op;
+            if (accept("*")) op = sigil::script::OP_MUL;
+            else if (accept("/")) op = sigil::script::OP_DIV;
+            else if (accept("%")) op = sigil::script::OP_MOD;
+            else return true;
+
+            svm_operand_t r;
+            if (!parse_unary(r) || !binary(op, result, r, mark, result)) return false;
+        }
+    }
+
+    bool parse_unary(svm_operand_t &result) {
+        if (!accept("-")) return parse_primary(result);
+
+        uint32_t mark = temp_top;
+        svm_operand_t operand;
+        if (!parse_unary(operand)) return false;
+        if (operand.is_constant) {
+            result = {true, (int64_t)(0 - (uint64_t)operand.value), 0};
+            return true;
+        }
+
+        temp_top = mark;
+        result.is_constant = false;
+        if (!alloc_temp(result.reg)) return false;
+        emit(sigil::script::OP_NEG, result.reg, operand.reg);
+        return true;
+    }
+
+    bool parse_primary(svm_operand_t &result) {
+        const svm_token_t &token = peek();
+
+        if (token.type == TOKEN_NUMBER) {
+            result = {true, token.number, 0};
+            pos++;
+            return true;
+        }
+
+        if (token.type == TOKEN_NAME && !is_keyword(token.text)) {
+            auto it = variables.find(token.text);
+            if (it == variables.end()) return fail("unknown variable '" + token.text + "'");
+            result = {false, 0, it->second};
+            pos++;
+            return true;
+        }
+
+        if (accept("(")) return expression(result) && expect(")");
+        return fail(token.type == TOKEN_END ? "expected expression" : "unexpected '" + token.text + "'");
+    }
+
+    // Branches
+
+    // Emits jump taken when condition equals when_true, SIZE_MAX if it never is
+    size_t branch(svm_operand_t condition, bool when_true) {
+        if (condition.is_constant) {
+            return (condition.value != 0) == when_true ? emit(sigil::script::OP_JMP) : SIZE_MAX;
+        }
+
+        if (is_last_result(condition)) {
+            instruction_t last = program.code.back();
+            opcode_t fused = sigil::script::OP_COUNT;
+            uint8_t a = last.b, b = last.c;
+
+            // a < b is false exactly when b <= a
+            switch (last.op) {
+                case sigil::script::OP_LT: fused = when_true ? sigil::script::OP_BLT : sigil::script::OP_BLE; break;
+                case sigil::script::OP_LE: fused = when_true ? sigil::script::OP_BLE : sigil::script::OP_BLT; break;
+                case sigil::script::OP_EQ: fused = when_true ? sigil::script::OP_BEQ : sigil::script::OP_BNE; break;
+                case sigil::script::OP_NE: fused = when_true ? sigil::script::OP_BNE : sigil::script::OP_BEQ; break;
+                default: break;
+            }
+
+            if (fused != sigil::script::OP_COUNT) {
+                if (!when_true && (last.op == sigil::script::OP_LT || last.op == sigil::script::OP_LE)) std::swap(a, b);
+                program.code.pop_back();
+                program.lines.pop_back();
+                return emit(fused, a, b);
+            }
+        }
+
+        return emit(when_true ? sigil::script::OP_JNZ : sigil::script::OP_JZ, condition.reg);
+    }
+
+    svm_block_t* innermost_loop() {
+        for (auto it = blocks.rbegin(); it != blocks.rend(); it++) {
+            if (it->type != BLOCK_IF) return &*it;
+        }
+        return nullptr;
+    }
+
+    // Statements
+
+    bool assign(uint8_t reg) {
+        svm_operand_t value;
+        if (!expression(value)) return false;
+
+        if (value.is_constant) load_constant(reg, value.value);
+        else if (is_last_result(value)) program.code.back().a = reg;
+        else if (value.reg != reg) emit(sigil::script::OP_MOVE, reg, value.reg);
+        return true;
+    }
+
+    bool statement_let() {
+        const svm_token_t &name = peek();
+        if (name.type != TOKEN_NAME || is_keyword(name.text)) return fail("expected variable name");
+        std::string variable = name.text;
+        pos++;
+        if (!expect("=")) return false;
+
+        // Declared only after its value, so it cannot refer to itself
+        svm_operand_t value;
+        if (!expression(value)) return false;
+
+        uint8_t reg = 0;
+        if (!declare(variable, reg)) return false;
+        if (value.is_constant) load_constant(reg, value.value);
+        else if (is_last_result(value)) program.code.back().a = reg;
+        else if (value.reg != reg) emit(sigil::script::OP_MOVE, reg, value.reg);
+        return true;
+    }
+
+    bool statement_if() {
+        svm_operand_t condition;
+        if (!expression(condition)) return false;
+
+        svm_block_t block;
+        block.type = BLOCK_IF;
+        block.line = line;
+        block.false_branch = branch(condition, false);
+        blocks.push_back(std::move(block));
+        return true;
+    }
+
+    bool statement_elif_else(bool is_else) {
+        if (blocks.empty() || blocks.back().type != BLOCK_IF) return fail(is_else ? "else without if" : "elif without if");
+        svm_block_t &block = blocks.back();
+        if (block.has_else) return fail("branch after else");
+
+        block.exit_jumps.push_back(emit(sigil::script::OP_JMP));
+        patch(block.false_branch, program.code.size());
+        block.false_branch = SIZE_MAX;
+
+        if (is_else) {
+            block.has_else = true;
+            return true;
+        }
+
+        svm_operand_t condition;
+        if (!expression(condition)) return false;
+        blocks.back().false_branch = branch(condition, false);
+        return true;
+    }
+
+    bool statement_while() {
+        svm_block_t block;
+        block.type = BLOCK_WHILE;
+        block.line = line;
+
+        // Compiled here for error reporting, but placed after the body
+        size_t condition_start = program.code.size();
+        svm_operand_t condition;
+        if (!expression(condition)) return false;
+
+        size_t taken = branch(condition, true);
+        block.condition.assign(program.code.begin() + condition_start, program.code.end());
+        block.condition_lines.assign(program.lines.begin() + condition_start, program.lines.end());
+        program.code.resize(condition_start);
+        program.lines.resize(condition_start);
+
+        block.entry_jump = emit(sigil::script::OP_JMP);
+        block.body_start = program.code.size();
+        if (taken != SIZE_MAX) block.condition[taken - condition_start].imm = (int32_t)block.body_start;
+
+        blocks.push_back(std::move(block));
+        return true;
+    }
+
+    bool statement_for() {
+        const svm_token_t &name = peek();
+        if (name.type != TOKEN_NAME || is_keyword(name.text)) return fail("expected variable name");
+        std::string variable = name.text;
+        pos++;
+
+        svm_block_t block;
+        block.type = BLOCK_FOR;
+        block.line = line;
+
+        if (!expect("=")) return false;
+        svm_operand_t first, last;
+        if (!expression(first) || !expect("to") || !expression(last)) return false;
+
+        if (accept("step")) {
+            svm_operand_t step;
+            if (!expression(step)) return false;
+            if (!step.is_constant || step.value == 0) return fail("step has to be a non zero constant");
+            if (step.value < INT32_MIN || step.value > INT32_MAX) return fail("step out of range");
+            block.step = step.value;
+        }
+
+        // Limit is evaluated once, hidden variable keeps it over the loop
+        if (!declare(variable, block.counter) || !declare("", block.limit)) return false;
+
+        if (last.is_constant) load_constant(block.limit, last.value);
+        else emit(sigil::script::OP_MOVE, block.limit, last.reg);
+        if (first.is_constant) load_constant(block.counter, first.value);
+        else emit(sigil::script::OP_MOVE, block.counter, first.reg);
+
+        // Skip the loop if counter starts past limit
+        if (block.step > 0) block.exit_jumps.push_back(emit(sigil::script::OP_BLT, block.limit, block.counter));
+        else block.exit_jumps.push_back(emit(sigil::script::OP_BLT, block.counter, block.limit));
+        block.body_start = program.code.size();
+
+        blocks.push_back(std::move(block));
+        return true;
+    }
+
+    bool statement_end() {
+        if (blocks.empty()) return fail("end without block");
+        svm_block_t block = std::move(blocks.back());
+        blocks.pop_back();
+
+        if (block.type == BLOCK_WHILE) {
+            patch(block.entry_jump, program.code.size());
+            for (size_t jump : block.continue_jumps) patch(jump, program.code.size());
+            program.code.insert(program.code.end(), block.condition.begin(), block.condition.end());
+            program.lines.insert(program.lines.end(), block.condition_lines.begin(), block.condition_lines.end());
+        }
+
+        if (block.type == BLOCK_FOR) {
+            for (size_t jump : block.continue_jumps) patch(jump, program.code.size());
+
+            if (block.step >= INT8_MIN && block.step <= INT8_MAX) {
+                emit(sigil::script::OP_FORI, block.counter, block.limit, (uint8_t)(int8_t)block.step, (int32_t)block.body_start);
+            } else {
+                emit(sigil::script::OP_ADDI, block.counter, block.counter, 0, (int32_t)block.step);
+                if (block.step > 0) emit(sigil::script::OP_BLE, block.counter, block.limit, 0, (int32_t)block.body_start);
+                else emit(sigil::script::OP_BLE, block.limit, block.counter, 0, (int32_t)block.body_start);
+            }
+        }
+
+        if (block.type == BLOCK_IF) patch(block.false_branch, program.code.size());
+        for (size_t jump : block.exit_jumps) patch(jump, program.code.size());
+        return true;
+    }
+
+    bool statement_print() {
+        template_t output;
+
+        if (!at_end()) do {
+            const svm_token_t &token = peek();
+            if (token.type == TOKEN_STRING) {
+                output.words.push_back({{token.text, -1}});
+                pos++;
+                continue;
+            }
+
+            // Registers of earlier items stay reserved until print runs
+            svm_operand_t value;
+            if (!expression(value)) return false;
+            if (value.is_constant) output.words.push_back({{std::to_string(value.value), -1}});
+            else output.words.push_back({{"", value.reg}});
+        } while (accept(","));
+
+        program.templates.push_back(std::move(output));
+        emit(sigil::script::OP_PRINT, 0, 0, 0, (int32_t)program.templates.size() - 1);
+        return true;
+    }
+
+    // Words are split once here, $name is replaced with value of a variable on each run
+    bool statement_run(std::string_view rest) {
+        sigil::parser::command_t command;
+        sigil::status_t status = sigil::parser::parse_command(rest, command);
+        if (status == sigil::VM_SKIPPED) return fail("run without command");
+        if (status != sigil::VM_OK) return fail("malformed command");
+
+        template_t words;
+        for (auto &word : command.body) {
+            std::vector<template_t::part_t> parts;
+            size_t i = 0;
+
+            while (i < word.size()) {
+                size_t dollar = word.find('$', i);
+                if (dollar != i) {
+                    parts.push_back({word.substr(i, dollar == std::string::npos ? std::string::npos : dollar - i), -1});
+                    if (dollar == std::string::npos) break;
+                }
+
+                size_t end = dollar + 1;
+                while (end < word.size() && (isalnum((unsigned char)word[end]) || word[end] == '_')) end++;
+                std::string name = word.substr(dollar + 1, end - dollar - 1);
+
+                auto it = variables.find(name);
+                if (it == variables.end()) return fail("unknown variable '$" + name + "'");
+                parts.push_back({"", it->second});
+                i = end;
+            }
+            words.words.push_back(std::move(parts));
+        }
+
+        program.templates.push_back(std::move(words));
+        emit(sigil::script::OP_RUN, 0, 0, 0, (int32_t)program.templates.size() - 1);
+        return true;
+    }
+
+    bool statement(std::string_view text) {
+        // Rest of a run line is a command, not an expression
+        size_t first = text.find_first_not_of(" \t\r");
+        if (first != std::string_view::npos && text.substr(first, 3) == "run" &&
+            (first + 3 == text.size() || text[first + 3] == ' ' || text[first + 3] == '\t')) {
+            return statement_run(text.substr(first + 3));
+        }
+
+        if (!tokenize(text)) return false;
+        if (at_end()) return true;
+
+        const svm_token_t &head = peek();
+        if (head.type != TOKEN_NAME) return fail("expected statement");
+        std::string keyword = head.text;
+        pos++;
+
+        bool ok;
+        if (keyword == "let") ok = statement_let();
+        else if (keyword == "if") ok = statement_if();
+        else if (keyword == "elif") ok = statement_elif_else(false);
+        else if (keyword == "else") ok = statement_elif_else(true);
+        else if (keyword == "end") ok = statement_end();
+        else if (keyword == "while") ok = statement_while();
+        else if (keyword == "for") ok = statement_for();
+        else if (keyword == "print") ok = statement_print();
+        else if (keyword == "break" || keyword == "continue") {
+            svm_block_t *loop = innermost_loop();
+            if (!loop) return fail(keyword + " outside of loop");
+            (keyword == "break" ? loop->exit_jumps : loop->continue_jumps).push_back(emit(sigil::script::OP_JMP));
+            ok = true;
+        }
+        else if (!is_keyword(keyword) && accept("=")) {
+            auto it = variables.find(keyword);
+            if (it == variables.end()) return fail("unknown variable '" + keyword + "', declare it with let");
+            ok = assign(it->second);
+        }
+        else return fail("unknown statement '" + keyword + "'");
+
+        if (ok && !at_end()) return fail("unexpected '" + peek().text + "'");
+        return ok;
+    }
+};
+
+static sigil::status_t interpret(const program_t &program, sigil::script::environment_t *environment,
+                                 std::vector<const void*> *threaded_out);
+
+// Compiles one source line, compiler.error tells why it failed
+static bool compile_line(svm_compiler_t &compiler, std::string_view text) {
+    compiler.line++;
+    compiler.temp_top = SVM_MAX_REGISTERS;
+    compiler.statement_start = compiler.program.code.size();
+    return compiler.statement(text);
+}
+
+static bool check_blocks_closed(svm_compiler_t &compiler) {
+    if (compiler.blocks.empty()) return true;
+    compiler.line = compiler.blocks.back().line;
+    return compiler.fail("block is missing its end");
+}
+
+// Code compiled so far becomes a runnable program, prologue loads constants first seen since last one
+static void finish_program(svm_compiler_t &compiler) {
+    program_t &program = compiler.program;
+    compiler.emit(sigil::script::OP_HALT);
+    compiler.patch(0, program.code.size());
+    for (auto &load : compiler.prologue) compiler.emit(load.op, load.a, load.b, load.c, load.imm);
+    compiler.emit(sigil::script::OP_JMP, 0, 0, 0, 1);
+    compiler.prologue.clear();
+
+    interpret(program, nullptr, &program.threaded);
+}
+
+// Jumps to prologue, which is only known at the end
+// Constants are per chunk too, registers loaded from them keep their values
+static void start_program(svm_compiler_t &compiler) {
+    program_t &program = compiler.program;
+    program.code.clear();
+    program.lines.clear();
+    program.templates.clear();
+    program.threaded.clear();
+    program.constants.clear();
+    compiler.constant_index.clear();
+    compiler.emit(sigil::script::OP_JMP);
+}
+
+sigil::status_t sigil::script::compile(std::string_view source, sigil::script::program_t &program, std::string *error) {
+    SIGIL_MEM_TAG(sigil::MEM_TAG_SCRIPT);
+    program = program_t();
+    svm_compiler_t compiler(program);
+    start_program(compiler);
+
+    const char *cursor = source.data();
+    const char *end = source.data() + source.size();
+    while (true) {
+        const char *newline = sigil::find_newline(cursor, end);
+
+        if (!compile_line(compiler, std::string_view(cursor, newline - cursor))) {
+            if (error) *error = compiler.error;
+            program = program_t();
+            return VM_ARG_INVALID;
+        }
+        if (newline == end) break;
+        cursor = newline + 1;
+    }
+
+    if (!check_blocks_closed(compiler)) {
+        if (error) *error = compiler.error;
+        program = program_t();
+        return VM_ARG_INVALID;
+    }
+
+    finish_program(compiler);
+    return VM_OK;
+}
+
+sigil::status_t sigil::script::compile_file(const char *path, sigil::script::program_t &program, std::string *error) {
+    if (!path) return VM_ARG_NULL;
+
+    mapped_file_t file;
+    if (file.open(path) != VM_OK) {
+        if (error) *error = std::string("cannot open ") + path;
+        return VM_NOT_FOUND;
+    }
+
+    return compile(std::string_view(file.data(), file.size()), program, error);
+}
+
+sigil::status_t sigil::script::execute_file(const char *path, sigil::script::program_t &program,
+                                            sigil::script::environment_t &environment,
+                                            std::string *error, size_t chunk_size) {
+    if (!path) return VM_ARG_NULL;
+
+    mapped_file_t file;
+    if (file.open(path) != VM_OK) {
+        if (error) *error = std::string("cannot open ") + path;
+        return VM_NOT_FOUND;
+    }
+
+    program = program_t();
+    svm_compiler_t compiler(program);
+    start_program(compiler);
+
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+    const char *cursor = begin;
+    const char *chunk_start = begin;
+
+    while (true) {
+        const char *newline = sigil::find_newline(cursor, end);
+        bool last = newline == end;
+
+        bool ok = compile_line(compiler, std::string_view(cursor, newline - cursor));
+        if (ok && last) ok = check_blocks_closed(compiler);
+        if (!ok) {
+            if (error) *error = compiler.error;
+            return VM_ARG_INVALID;
+        }
+        if (!last) cursor = newline + 1;
+
+        // Chunk can only end where no block is open
+        if (!last && (!compiler.blocks.empty() || (size_t)(cursor - chunk_start) < chunk_size)) continue;
+
+        finish_program(compiler);
+        status_t status = execute(program, environment);
+        if (status != VM_OK) {
+            if (error) *error = environment.error;
+            return status;
+        }
+        if (last) return VM_OK;
+
+        file.release(cursor - begin);
+        chunk_start = cursor;
+        start_program(compiler);
+    }
+}
+
+/*
+    Interpreter
+    With GCC and clang every instruction jumps straight to handler of the
+    next one through a precomputed address, otherwise a switch is used.
+*/
+static void render_word(const std::vector<template_t::part_t> &parts, const int64_t *registers, std::string &out) {
+    for (auto &part : parts) {
+        if (part.reg < 0) out += part.text;
+        else out += std::to_string(registers[part.reg]);
+    }
+}
+
+static sigil::status_t runtime_error(const program_t &program, const instruction_t *ip,
+                                     sigil::script::environment_t *environment, const char *reason,
+                                     sigil::status_t status) {
+    environment->error = "line " + std::to_string(program.lines[ip - program.code.data()]) + ": " + reason;
+    return status;
+}
+
+static sigil::status_t interpret(const program_t &program, sigil::script::environment_t *environment,
+                                 std::vector<const void*> *threaded_out) {
+#ifdef SVM_THREADED_DISPATCH
+    static const void *handlers[] = {
+        &&op_HALT, &&op_LOADI, &&op_LOADK, &&op_MOVE, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV,
+        &&op_MOD, &&op_ADDI, &&op_LT, &&op_LE, &&op_EQ, &&op_NE, &&op_AND, &&op_OR, &&op_NOT,
+        &&op_NEG, &&op_JMP, &&op_JZ, &&op_JNZ, &&op_BLT, &&op_BLE, &&op_BEQ, &&op_BNE,
+        &&op_FORI, &&op_PRINT, &&op_RUN,
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == sigil::script::OP_COUNT, "handler missing for an opcode");
+
+    if (threaded_out) {
+        threaded_out->resize(program.code.size());
+        for (size_t i = 0; i < program.code.size(); i++) (*threaded_out)[i] = handlers[program.code[i].op];
+        return sigil::VM_OK;
+    }
+
+    // Copies of a program made elsewhere still carry valid addresses, edited ones do not
+    std::vector<const void*> local;
+    const void * const *threaded = program.threaded.data();
+    if (program.threaded.size() != program.code.size()) {
+        interpret(program, nullptr, &local);
+        threaded = local.data();
+    }
+
+    #define OPCODE(name) op_##name:
+    #define DISPATCH() goto *threaded[ip - code]
+#else
+    if (threaded_out) return sigil::VM_OK;
+
+    #define OPCODE(name) case sigil::script::OP_##name:
+    #define DISPATCH() goto dispatch
+#endif
+    #define NEXT() do { ip++; DISPATCH(); } while (0)
+    #define JUMP(target) do { ip = code + (target); DISPATCH(); } while (0)
+    #define WRAP(expr) ((int64_t)(expr))
+
+    if (program.code.empty()) return sigil::VM_OK;
+    const instruction_t *code = program.code.data();
+    const instruction_t *ip = code;
+    int64_t *r = environment->registers;
+
+    DISPATCH();
+#ifndef SVM_THREADED_DISPATCH
+    dispatch:
+    switch (ip->op) {
+#endif
+    OPCODE(LOADI) r[ip->a] = ip->imm; NEXT();
+    OPCODE(LOADK) r[ip->a] = program.constants[ip->imm]; NEXT();
+    OPCODE(MOVE)  r[ip->a] = r[ip->b]; NEXT();
+    OPCODE(ADD)   r[ip->a] = WRAP((uint64_t)r[ip->b] + (uint64_t)r[ip->c]); NEXT();
+    OPCODE(SUB)   r[ip->a] = WRAP((uint64_t)r[ip->b] - (uint64_t)r[ip->c]); NEXT();
+    OPCODE(MUL)   r[ip->a] = WRAP((uint64_t)r[ip->b] * (uint64_t)r[ip->c]); NEXT();
+    OPCODE(DIV)
+        if (r[ip->c] == 0) return runtime_error(program, ip, environment, "division by zero", sigil::VM_ARG_INVALID);
+        r[ip->a] = r[ip->c] == -1 ? WRAP(0 - (uint64_t)r[ip->b]) : r[ip->b] / r[ip->c];
+        NEXT();
+    OPCODE(MOD)
+        if (r[ip->c] == 0) return runtime_error(program, ip, environment, "division by zero", sigil::VM_ARG_INVALID);
+        r[ip->a] = r[ip->c] == -1 ? 0 : r[ip->b] % r[ip->c];
+        NEXT();
+    OPCODE(ADDI)  r[ip->a] = WRAP((uint64_t)r[ip->b] + (uint64_t)(int64_t)ip->imm); NEXT();
+    OPCODE(LT)    r[ip->a] = r[ip->b] < r[ip->c]; NEXT();
+    OPCODE(LE)    r[ip->a] = r[ip->b] <= r[ip->c]; NEXT();
+    OPCODE(EQ)    r[ip->a] = r[ip->b] == r[ip->c]; NEXT();
+    OPCODE(NE)    r[ip->a] = r[ip->b] != r[ip->c]; NEXT();
+    OPCODE(AND)   r[ip->a] = r[ip->b] && r[ip->c]; NEXT();
+    OPCODE(OR)    r[ip->a] = r[ip->b] || r[ip->c]; NEXT();
+    OPCODE(NOT)   r[ip->a] = !r[ip->b]; NEXT();
+    OPCODE(NEG)   r[ip->a] = WRAP(0 - (uint64_t)r[ip->b]); NEXT();
+    OPCODE(JMP)   JUMP(ip->imm);
+    OPCODE(JZ)    if (!r[ip->a]) JUMP(ip->imm); NEXT();
+    OPCODE(JNZ)   if (r[ip->a]) JUMP(ip->imm); NEXT();
+    OPCODE(BLT)   if (r[ip->a] < r[ip->b]) JUMP(ip->imm); NEXT();
+    OPCODE(BLE)   if (r[ip->a] <= r[ip->b]) JUMP(ip->imm); NEXT();
+    OPCODE(BEQ)   if (r[ip->a] == r[ip->b]) JUMP(ip->imm); NEXT();
+    OPCODE(BNE)   if (r[ip->a] != r[ip->b]) JUMP(ip->imm); NEXT();
+    OPCODE(FORI) {
+        int64_t step = (int8_t)ip->c;
+        r[ip->a] = WRAP((uint64_t)r[ip->a] + (uint64_t)step);
+        if (step > 0 ? r[ip->a] <= r[ip->b] : r[ip->a] >= r[ip->b]) JUMP(ip->imm);
+        NEXT();
+    }
+    OPCODE(PRINT) {
+        std::string line;
+        const template_t &output = program.templates[ip->imm];
+        for (size_t i = 0; i < output.words.size(); i++) {
+            if (i) line += ' ';
+            render_word(output.words[i], r, line);
+        }
+        line += '\n';
+
+        if (environment->output) *environment->output += line;
+        else fwrite(line.data(), 1, line.size(), stdout);
+        NEXT();
+    }
+    OPCODE(RUN) {
+        if (!environment->on_command) {
+            return runtime_error(program, ip, environment, "no command handler", sigil::VM_NOT_SUPPORTED);
+        }
+
+        sigil::parser::command_t command;
+        for (auto &word : program.templates[ip->imm].words) {
+            command.body.emplace_back();
+            render_word(word, r, command.body.back());
+        }
+
+        sigil::status_t status = environment->on_command(std::move(command));
+        if (status != sigil::VM_OK) return runtime_error(program, ip, environment, "command failed", status);
+        NEXT();
+    }
+    OPCODE(HALT) return sigil::VM_OK;
+#ifndef SVM_THREADED_DISPATCH
+    default: return sigil::VM_ARG_INVALID;
+    }
+#endif
+
+    #undef OPCODE
+    #undef DISPATCH
+    #undef NEXT
+    #undef JUMP
+    #undef WRAP
+}
+
+sigil::status_t sigil::script::execute(const sigil::script::program_t &program, sigil::script::environment_t &environment) {
+    environment.error.clear();
+    return interpret(program, &environment, nullptr);
+}
+
+std::string sigil::script::disassemble(const sigil::script::program_t &program) {
+    std::string listing;
+    char line[128];
+
+    for (size_t i = 0; i < program.code.size(); i++) {
+        const instruction_t &ins = program.code[i];
+        snprintf(line, sizeof(line), "%4zu  %-6s %3u %3u %3u %8d    ; line %u\n", i, opcode_names[ins.op],
+            ins.a, ins.b, ins.c, ins.imm, program.lines[i]);
+        listing += line;
+    }
+    return listing;
+}
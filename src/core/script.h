@@ -0,0 +1,146 @@
+#pragma once
+/*
+    SigilVM scripts (.svm)
+    Source is compiled once into register bytecode, interpreter never
+    looks at the text again. One statement per line, blocks close with end:
+
+        # comment
+        let n = 1000
+        let total = 0
+        for i = 1 to n
+            if i % 3 == 0 or i % 5 == 0
+                total = total + i
+            end
+        end
+        print "total:", total
+        run treeinfo            # VM command, $name inserts a variable
+
+    Statements: let, assignment, if/elif/else, while, for/to/step,
+    break, continue, print, run. Values are 64 bit integers, arithmetic
+    wraps around, comparisons give 0 or 1, and/or/not work on truth values.
+*/
+#include <string_view>
+#include <functional>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "parser.h"
+#include "utils.h"
+
+#define SVM_MAX_REGISTERS 256
+#define SVM_CHUNK_SIZE (1 << 20)
+
+namespace sigil::script {
+    enum opcode_t : uint8_t {
+        OP_HALT,
+        OP_LOADI,       // a = imm
+        OP_LOADK,       // a = constants[imm]
+        OP_MOVE,        // a = b
+        OP_ADD,         // a = b + c
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_MOD,
+        OP_ADDI,        // a = b + imm
+        OP_LT,          // a = b < c
+        OP_LE,
+        OP_EQ,
+        OP_NE,
+        OP_AND,         // a = b && c
+        OP_OR,
+        OP_NOT,         // a = !b
+        OP_NEG,         // a = -b
+        OP_JMP,         // goto imm
+        OP_JZ,          // if (!a) goto imm
+        OP_JNZ,         // if (a) goto imm
+        OP_BLT,         // if (a < b) goto imm
+        OP_BLE,
+        OP_BEQ,
+        OP_BNE,
+        OP_FORI,        // a += (int8_t)c, if (step > 0 ? a <= b : a >= b) goto imm
+        OP_PRINT,       // print templates[imm]
+        OP_RUN,         // run command from templates[imm]
+        OP_COUNT,
+    };
+
+    // 8 bytes, registers are addressed by a, b and c
+    struct instruction_t {
+        opcode_t op;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+        int32_t imm;
+    };
+
+    // Words of a print or run statement, each made of text and register parts
+    struct template_t {
+        struct part_t {
+            std::string text;
+            int32_t reg;        // -1 for plain text
+        };
+
+        std::vector<std::vector<part_t>> words;
+    };
+
+    struct program_t {
+        std::vector<instruction_t> code;
+        // Source line of every instruction, for error messages
+        std::vector<uint32_t> lines;
+        std::vector<int64_t> constants;
+        std::vector<template_t> templates;
+        // Register of a variable is its index here
+        std::vector<std::string> variables;
+        // Code with opcodes replaced by handler addresses, filled by compile()
+        std::vector<const void*> threaded;
+
+        // Returns -1 for unknown variable
+        int32_t find_variable(std::string_view name) const;
+    };
+
+    struct environment_t {
+        int64_t registers[SVM_MAX_REGISTERS] = {};
+        // Print appends here if set, otherwise goes to stdout
+        std::string *output = nullptr;
+        // Called for every run statement, script stops unless it returns VM_OK
+        std::function<status_t(parser::command_t command)> on_command;
+        // Line and reason of a runtime error
+        std::string error;
+
+        int64_t get(const program_t &program, std::string_view name) const;
+    };
+
+    /**
+    * Compile source into program, error receives line and reason on failure
+    * Returns VM_OK on success, or VM_ARG_INVALID for a syntax error
+    */
+    status_t compile(std::string_view source, program_t &program, std::string *error = nullptr);
+
+    /**
+    * Like compile, but reads source from file first
+    * Returns VM_NOT_FOUND if file could not be read
+    */
+    status_t compile_file(const char *path, program_t &program, std::string *error = nullptr);
+
+    /**
+    * Compile and run a file piece by piece, without loading it whole.
+    * File is mapped, a chunk ends on first line past chunk_size bytes where
+    * no block is open, and runs before next one is compiled, so a long
+    * script starts at once and pages already run are released again.
+    * Syntax errors only stop the chunk they are in, earlier ones have run.
+    * program keeps last chunk and every variable, for environment.get()
+    * Returns VM_OK on success, VM_NOT_FOUND if file could not be read,
+    * VM_ARG_INVALID for a syntax error, or status of execute()
+    */
+    status_t execute_file(const char *path, program_t &program, environment_t &environment,
+                          std::string *error = nullptr, size_t chunk_size = SVM_CHUNK_SIZE);
+
+    /**
+    * Run a compiled program, registers of environment keep variables afterwards
+    * Returns VM_OK on success, VM_ARG_INVALID on division by zero,
+    * or status returned by on_command, error tells the line
+    */
+    status_t execute(const program_t &program, environment_t &environment);
+
+    // Human readable listing of bytecode, for debugging
+    std::string disassemble(const program_t &program);
+}
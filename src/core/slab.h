@@ -0,0 +1,171 @@
+#pragma once
+/*
+    Slab pool with generational handles.
+    Objects live in fixed size slabs, which are never moved or freed while
+    the pool exists. Freed slots go on a free list and are reused first.
+
+    Every slot carries a generation, bumped whenever its object is destroyed.
+    A handle remembers the generation it was issued with, so a handle to a
+    destroyed object resolves to nullptr instead of reused memory.
+*/
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace sigil {
+    /*
+        Lower index_bits address a slot, remaining upper bits hold generation.
+        Generation 0 is never issued, so zero handle is the null handle.
+    */
+    template <typename storage_t, uint32_t index_bits>
+    struct generic_handle_t {
+        static constexpr uint32_t generation_bits = sizeof(storage_t) * 8 - index_bits;
+        static constexpr uint32_t index_max = (uint32_t)(((uint64_t)1 << index_bits) - 1);
+        static constexpr uint32_t generation_max = (uint32_t)(((uint64_t)1 << generation_bits) - 1);
+
+        storage_t value = 0;
+
+        static generic_handle_t make(uint32_t index, uint32_t generation) {
+            generic_handle_t handle;
+            handle.value = ((storage_t)(generation & generation_max) << index_bits) |
+                           ((storage_t)(index & index_max));
+            return handle;
+        }
+
+        uint32_t index() const { return (uint32_t)(value & index_max); }
+        uint32_t generation() const { return (uint32_t)(value >> index_bits) & generation_max; }
+        bool is_null() const { return value == 0; }
+        bool operator==(const generic_handle_t &other) const { return value == other.value; }
+        bool operator!=(const generic_handle_t &other) const { return value != other.value; }
+    };
+
+    // 1M slots with 4096 generations, for compact tables
+    typedef generic_handle_t<uint32_t, 20> handle32_t;
+    // 4G slots with 4G generations
+    typedef generic_handle_t<uint64_t, 32> handle64_t;
+
+    template <typename T, typename handle_t = handle64_t,
+              uint32_t slab_capacity = 256, uint32_t max_slabs = 4096>
+    class slab_pool_t {
+        static_assert((uint64_t)slab_capacity * max_slabs - 1 <= handle_t::index_max,
+                      "slab pool is larger than its handle can address");
+
+        struct slot_t {
+            // Must stay first, object address is the slot address
+            alignas(T) unsigned char storage[sizeof(T)];
+            std::atomic<uint32_t> generation;
+            uint32_t index;
+            slot_t *next_free;
+        };
+
+        std::atomic<slot_t*> slabs[max_slabs] = {};
+        uint32_t num_slabs = 0;
+        slot_t *free_head = nullptr;
+        size_t num_live = 0;
+        std::mutex pool_mutex;
+
+        // Caller holds pool_mutex
+        slot_t* pop_free_slot() {
+            if (!free_head) {
+                if (num_slabs >= max_slabs) return nullptr;
+
+                slot_t *slab = new (std::nothrow) slot_t[slab_capacity];
+                if (!slab) return nullptr;
+
+                for (uint32_t i = 0; i < slab_capacity; i++) {
+                    slab[i].generation.store(1, std::memory_order_relaxed);
+                    slab[i].index = num_slabs * slab_capacity + i;
+                    slab[i].next_free = (i + 1 < slab_capacity) ? &slab[i + 1] : nullptr;
+                }
+
+                slabs[num_slabs].store(slab, std::memory_order_release);
+                num_slabs++;
+                free_head = slab;
+            }
+
+            slot_t *slot = free_head;
+            free_head = slot->next_free;
+            return slot;
+        }
+
+        static slot_t* slot_of(const T *object) {
+            return reinterpret_cast<slot_t*>(const_cast<T*>(object));
+        }
+
+        public:
+        slab_pool_t() = default;
+        slab_pool_t(const slab_pool_t&) = delete;
+        slab_pool_t& operator=(const slab_pool_t&) = delete;
+
+        // Releases slab memory only, objects still alive are not destructed
+        ~slab_pool_t() {
+            for (uint32_t i = 0; i < num_slabs; i++) {
+                delete[] slabs[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        // Returns nullptr if pool is exhausted
+        template <typename... args_t>
+        T* create(handle_t *handle, args_t&&... args) {
+            slot_t *slot;
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                slot = pop_free_slot();
+                if (!slot) return nullptr;
+                num_live++;
+            }
+
+            T *object = new (slot->storage) T(std::forward<args_t>(args)...);
+            if (handle) *handle = handle_t::make(slot->index, slot->generation.load(std::memory_order_relaxed));
+            return object;
+        }
+
+        // Object must come from this pool
+        void destroy(T *object) {
+            if (!object) return;
+            slot_t *slot = slot_of(object);
+            object->~T();
+
+            uint32_t generation = (slot->generation.load(std::memory_order_relaxed) + 1) & handle_t::generation_max;
+            slot->generation.store(generation ? generation : 1, std::memory_order_release);
+
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            slot->next_free = free_head;
+            free_head = slot;
+            num_live--;
+        }
+
+        // Lock free, returns nullptr for null or stale handles
+        T* get(handle_t handle) const {
+            if (handle.is_null()) return nullptr;
+
+            uint32_t index = handle.index();
+            if (index / slab_capacity >= max_slabs) return nullptr;
+
+            slot_t *slab = slabs[index / slab_capacity].load(std::memory_order_acquire);
+            if (!slab) return nullptr;
+
+            slot_t &slot = slab[index % slab_capacity];
+            if (slot.generation.load(std::memory_order_acquire) != handle.generation()) return nullptr;
+            return reinterpret_cast<T*>(slot.storage);
+        }
+
+        handle_t handle_of(const T *object) const {
+            if (!object) return handle_t();
+            slot_t *slot = slot_of(object);
+            return handle_t::make(slot->index, slot->generation.load(std::memory_order_acquire));
+        }
+
+        size_t live() {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            return num_live;
+        }
+
+        size_t capacity() {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            return (size_t)num_slabs * slab_capacity;
+        }
+    };
+}
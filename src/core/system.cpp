@@ -7,55 +7,608 @@
 #include <cstdio>
 #include <vector>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <vector>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <chrono>
 #include <unistd.h>  // For sysconf(_SC_PAGESIZE)
 
 #include "system.h"
 #include "utils.h"
+#include "log.h"
+
+
+static sigil::slab_pool_t<sigil::vmnode_t, sigil::vmnode_handle_t> vmnode_pool;
+// Snapshots of every tree are reclaimed through one domain
+static sigil::rcu_domain_t vmtree_rcu;
+
+/*
+    Background reclaimer for detached nodes.
+    A detached node is queued once its refcount drops to 0, which happens
+    only after all of its subnodes were freed and all references released.
+    Freeing is deferred through vmtree_rcu, so handles resolved under
+    vmnode_read_guard_t stay usable. Freeing a node releases its master,
+    so subtrees are freed bottom up.
+*/
+static struct vmnode_reclaimer_t {
+    std::vector<sigil::vmnode_t*> queue;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable idle_cv;
+    std::thread worker;
+    // Nodes retired to vmtree_rcu, but not freed yet
+    std::atomic<size_t> num_deferred = {0};
+    bool busy = false;
+    bool stopping = false;
+
+    void push(const std::vector<sigil::vmnode_t*> &nodes) {
+        if (nodes.empty()) return;
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (!worker.joinable()) worker = std::thread([this]() { run(); });
+        queue.insert(queue.end(), nodes.begin(), nodes.end());
+        queue_cv.notify_one();
+    }
+
+    void run() {
+        std::vector<sigil::vmnode_t*> batch;
+        std::unique_lock<std::mutex> lock(queue_mutex);
+
+        while (true) {
+            if (queue.empty() && num_deferred.load() == 0) {
+                idle_cv.notify_all();
+                if (stopping) return;
+                queue_cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+                continue;
+            }
+
+            if (queue.empty()) {
+                // Readers still hold retired nodes, look again shortly
+                queue_cv.wait_for(lock, std::chrono::milliseconds(1), [this]() { return !queue.empty(); });
+                lock.unlock();
+                vmtree_rcu.reclaim();
+                lock.lock();
+                continue;
+            }
+
+            batch.swap(queue);
+            busy = true;
+            lock.unlock();
+
+            // Whole batch is retired at once, freeing it releases masters
+            num_deferred += batch.size();
+            vmtree_rcu.retire([this, nodes = batch]() {
+                for (auto node : nodes) {
+                    sigil::vmnode_t *master = node->master_node;
+                    sigil::vmnode_t::destroy(node);
+                    // May queue master, which is picked up by next batch
+                    if (master) master->release();
+                }
+                num_deferred -= nodes.size();
+            });
+            batch.clear();
+
+            lock.lock();
+            busy = false;
+        }
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        idle_cv.wait(lock, [this]() { return queue.empty() && !busy && num_deferred.load() == 0; });
+    }
+
+    ~vmnode_reclaimer_t() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+            queue_cv.notify_one();
+        }
+        if (worker.joinable()) worker.join();
+    }
+} vmnode_reclaimer;
+
+/*
+    Background publisher of tree snapshots.
+    Writes that come too soon after a publish queue their index here, it is
+    published once its due time passes. Lock order is tree_mutex, then
+    queue_mutex, so publisher lets go of queue_mutex before publishing.
+*/
+static struct vmtree_publisher_t {
+    struct pending_t {
+        sigil::vmnode_index_t *index;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    std::vector<pending_t> queue;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable done_cv;
+    std::thread worker;
+    // Index being published right now
+    sigil::vmnode_index_t *current = nullptr;
+    bool stopping = false;
+
+    void push(sigil::vmnode_index_t *index, std::chrono::steady_clock::time_point due) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (!worker.joinable()) worker = std::thread([this]() { run(); });
+        queue.push_back({index, due});
+        queue_cv.notify_one();
+    }
+
+    // Index is going away, caller does not hold its tree_mutex
+    void cancel(sigil::vmnode_index_t *index) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        for (size_t i = 0; i < queue.size(); ) {
+            if (queue[i].index == index) {
+                queue[i] = queue.back();
+                queue.pop_back();
+            } else {
+                i++;
+            }
+        }
+        done_cv.wait(lock, [this, index]() { return current != index; });
+    }
 
+    void run() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+
+        while (!stopping) {
+            if (queue.empty()) {
+                queue_cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+                continue;
+            }
+
+            size_t first = 0;
+            for (size_t i = 1; i < queue.size(); i++) if (queue[i].due < queue[first].due) first = i;
+            if (queue[first].due > std::chrono::steady_clock::now()) {
+                queue_cv.wait_until(lock, queue[first].due);
+                continue;
+            }
+
+            current = queue[first].index;
+            queue[first] = queue.back();
+            queue.pop_back();
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> tree_lock(current->tree_mutex);
+                current->publish_queued = false;
+                const sigil::vmtree_snapshot_t *latest = current->snapshot.load(std::memory_order_relaxed);
+                if (!latest || latest->version != current->version.load(std::memory_order_relaxed)) current->publish();
+            }
+            lock.lock();
+            current = nullptr;
+            done_cv.notify_all();
+        }
+    }
+
+    ~vmtree_publisher_t() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+            queue_cv.notify_one();
+        }
+        if (worker.joinable()) worker.join();
+    }
+} vmtree_publisher;
+
+// Detached bit and claim go in with one CAS, a concurrent last release() then claims instead
+static bool detach_node(sigil::vmnode_t *node) {
+    uint32_t count = node->refcount.load();
+    uint32_t next;
+    do {
+        if (count & VM_NODE_DETACHED) return false;
+        next = count == 0 ? VM_NODE_CLAIMED : count | VM_NODE_DETACHED;
+    } while (!node->refcount.compare_exchange_weak(count, next));
+
+    return next == VM_NODE_CLAIMED;
+}
+
+// Unindexes and marks whole subtree, subnodes first. Caller holds tree_mutex
+static void detach_subtree(sigil::vmnode_index_t *index, sigil::vmnode_t *node,
+                           std::vector<sigil::vmnode_t*> &unused) {
+    for (auto s : node->subnodes) detach_subtree(index, s, unused);
+
+    if (index) index->remove(node);
+    if (detach_node(node)) unused.push_back(node);
+}
 
 sigil::vmnode_t::vmnode_t() {
-    memset((void*)this, 0, sizeof(*this));
     this->type = REF_VMNODE;
 }
 
 sigil::vmnode_t::~vmnode_t() {
-    printf("Removed: %s\n", this->name.value.c_str());
+    delete this->index.load(std::memory_order_acquire);
+    sigil::metrics::release(this);
+
+    vmmailbox_t *mailbox = this->mailbox.load();
+    if (!mailbox) return;
+
+    // Pending calls still own their context
+    vmmessage_t batch[VM_MAILBOX_BATCH];
+    size_t count;
+    while ((count = mailbox->queue.pop_batch(batch, VM_MAILBOX_BATCH)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            vmcall_t call;
+            if (batch[i].kind == VM_MESSAGE_CALL && batch[i].get(call)) call.fn(call.ctx, nullptr);
+        }
+    }
+    delete mailbox;
+}
+
+sigil::vmnode_read_guard_t::vmnode_read_guard_t() {
+    this->rcu_slot = vmtree_rcu.read_lock();
+}
+
+sigil::vmnode_read_guard_t::~vmnode_read_guard_t() {
+    vmtree_rcu.read_unlock(this->rcu_slot);
+}
+
+sigil::status_t sigil::vmnode_t::open_mailbox(uint32_t capacity, sigil::vmmessage_handler_ft handler, bool on_pool) {
+    if (capacity == 0) return VM_ARG_INVALID;
+
+    vmmailbox_t *new_mailbox = new vmmailbox_t(capacity);
+    new_mailbox->handler = handler;
+    new_mailbox->on_pool = on_pool || handler;
+
+    vmmailbox_t *expected = nullptr;
+    if (!this->mailbox.compare_exchange_strong(expected, new_mailbox)) {
+        delete new_mailbox;
+        return VM_ALREADY_EXISTS;
+    }
+    sigil::metrics::of(this)->memory.add((int64_t)(sizeof(vmmailbox_t) - sizeof(new_mailbox->queue) + new_mailbox->queue.footprint()));
+    return VM_OK;
+}
+
+size_t sigil::vmnode_t::receive(sigil::vmmessage_t *messages, size_t max) {
+    vmmailbox_t *mailbox = this->mailbox.load(std::memory_order_acquire);
+    if (!mailbox || !messages) return 0;
+    size_t count = mailbox->queue.pop_batch(messages, max);
+    if (count) mailbox->notify_room();
+    return count;
 }
 
 sigil::vmnode_t::vmnode_t(const char *name) {
-    memset((void*)this, 0, sizeof(*this));
     this->type = REF_VMNODE;
 
     if (!name) {
-        this->name.value = VM_NODE_INV_NAME;
+        this->name = VM_NODE_INV_NAME;
+        return;
+    }
+    this->name = name;
+    this->path = name;
+}
+
+sigil::vmnode_t* sigil::vmnode_t::create(const char *name) {
+    sigil::vmnode_handle_t handle;
+    sigil::vmnode_t *node = name ? vmnode_pool.create(&handle, name) : vmnode_pool.create(&handle);
+    if (!node) return nullptr;
+
+    node->handle = handle;
+    node->id = handle.value;
+    return node;
+}
+
+sigil::vmnode_t* sigil::vmnode_t::from_handle(sigil::vmnode_handle_t handle) {
+    sigil::vmnode_t *node = vmnode_pool.get(handle);
+    if (!node || node->is_detached()) return nullptr;
+    return node;
+}
+
+void sigil::vmnode_t::destroy(sigil::vmnode_t *node) {
+    if (!node) return;
+
+    if (node->handle.is_null()) {
+        delete node;
+        return;
+    }
+
+    vmnode_pool.destroy(node);
+}
+
+size_t sigil::vmnode_t::num_pooled() {
+    return vmnode_pool.live();
+}
+
+void sigil::vmnode_t::wait_for_reclaim() {
+    vmnode_reclaimer.wait_idle();
+}
+
+static std::string_view vmnode_name_key(const sigil::vmnode_t *node) {
+    return node->name.view();
+}
+
+static std::string_view vmnode_path_key(const sigil::vmnode_t *node) {
+    return node->path;
+}
+
+sigil::vmnode_table_t::vmnode_table_t(std::string_view (*key_of)(const vmnode_t *node), bool interned) {
+    this->key_of = key_of;
+    this->interned = interned;
+    this->num_used = 0;
+    this->num_removed = 0;
+    this->slots.resize(64, {0, nullptr});
+}
+
+sigil::vmnode_t* sigil::vmnode_table_t::find(std::string_view key, uint64_t hash) {
+    size_t mask = slots.size() - 1;
+
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        slot_t &slot = slots[i];
+        if (slot.hash == 0) return nullptr;
+        if (slot.hash != hash || !slot.node) continue;
+
+        std::string_view slot_key = key_of(slot.node);
+        if (interned ? slot_key.data() == key.data() : slot_key == key) return slot.node;
+    }
+}
+
+void sigil::vmnode_table_t::insert(sigil::vmnode_t *node) {
+    // Keep load factor under 0.5, removed entries count as used until rehash
+    if ((num_used + num_removed + 1) * 2 > slots.size()) grow();
+
+    uint64_t hash = sigil::hash_str(key_of(node));
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+
+    while (slots[i].node) i = (i + 1) & mask;
+    if (slots[i].hash) num_removed--;
+
+    slots[i] = {hash, node};
+    num_used++;
+}
+
+void sigil::vmnode_table_t::remove(sigil::vmnode_t *node) {
+    uint64_t hash = sigil::hash_str(key_of(node));
+    size_t mask = slots.size() - 1;
+
+    for (size_t i = hash & mask; slots[i].hash; i = (i + 1) & mask) {
+        if (slots[i].node == node) {
+            slots[i].node = nullptr;
+            num_used--;
+            num_removed++;
+            return;
+        }
+    }
+}
+
+void sigil::vmnode_table_t::grow() {
+    std::vector<slot_t> old_slots;
+    old_slots.swap(slots);
+
+    // Only grow if live entries need it, otherwise just drop removed ones
+    size_t capacity = old_slots.size();
+    if ((num_used + 1) * 4 > capacity) capacity *= 2;
+
+    slots.resize(capacity, {0, nullptr});
+    size_t mask = capacity - 1;
+
+    for (auto &slot : old_slots) if (slot.node) {
+        size_t i = slot.hash & mask;
+        while (slots[i].hash) i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+
+    num_removed = 0;
+}
+
+sigil::vmnode_index_t::vmnode_index_t(sigil::vmnode_t *root) : by_name(vmnode_name_key, true), by_path(vmnode_path_key) {
+    this->root = root;
+    this->version.store(1);
+    this->snapshot.store(nullptr);
+    // Not shared with anyone yet, no lock needed
+    insert(root);
+    publish();
+}
+
+sigil::vmnode_index_t::~vmnode_index_t() {
+    vmtree_publisher.cancel(this);
+
+    const sigil::vmtree_snapshot_t *old = snapshot.exchange(nullptr);
+    if (old) vmtree_rcu.retire([old]() { delete old; });
+}
+
+void sigil::vmnode_index_t::insert(sigil::vmnode_t *node) {
+    if (!node || node->name.empty()) return;
+    by_name.insert(node);
+    by_path.insert(node);
+}
+
+void sigil::vmnode_index_t::remove(sigil::vmnode_t *node) {
+    if (!node || node->name.empty()) return;
+    by_name.remove(node);
+    by_path.remove(node);
+}
+
+void sigil::vmnode_index_t::touch() {
+    version.fetch_add(1, std::memory_order_release);
+    if (publish_queued) return;
+
+    auto due = published_at + std::max<std::chrono::steady_clock::duration>(
+        std::chrono::microseconds(VM_TREE_PUBLISH_US), publish_cost * 4);
+    if (std::chrono::steady_clock::now() >= due) {
+        publish();
         return;
     }
-    this->name.value = name;
+    publish_queued = true;
+    vmtree_publisher.push(this, due);
+}
+
+void sigil::vmnode_index_t::sync() {
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    const sigil::vmtree_snapshot_t *latest = snapshot.load(std::memory_order_relaxed);
+    if (!latest || latest->version != version.load(std::memory_order_relaxed)) publish();
+}
+
+sigil::vmnode_t* sigil::vmnode_index_t::find(std::string_view name_or_path) {
+    if (name_or_path.find(VM_NODE_PATH_SEPARATOR) != std::string_view::npos) {
+        uint64_t hash = sigil::hash_str(name_or_path);
+        std::lock_guard<std::mutex> lock(tree_mutex);
+        return by_path.find(name_or_path, hash);
+    }
+
+    // Name never interned belongs to no node
+    sigil::name_t name;
+    if (!sigil::name_t::find(name_or_path, name)) return nullptr;
+    return find(name);
+}
+
+sigil::vmnode_t* sigil::vmnode_index_t::find(sigil::name_t name) {
+    if (name.empty()) return nullptr;
+
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    return by_name.find(name.view(), name.hash());
+}
+
+// Copies live tree into a new snapshot and swaps it in, old one is retired
+const sigil::vmtree_snapshot_t* sigil::vmnode_index_t::publish() {
+    auto started = std::chrono::steady_clock::now();
+    sigil::vmtree_snapshot_t *next = new sigil::vmtree_snapshot_t();
+    next->version = version.load(std::memory_order_acquire);
+    next->entries.reserve(by_name.num_used);
+
+    // Depth first walk, subtree sizes are filled in once a subtree is done
+    std::vector<std::pair<sigil::vmnode_t*, uint32_t>> stack = {{root, UINT32_MAX}};
+    std::vector<uint32_t> open;
+
+    while (!stack.empty()) {
+        auto [node, master] = stack.back();
+        stack.pop_back();
+
+        while (!open.empty() && open.back() != master) {
+            uint32_t done = open.back();
+            next->entries[done].subtree_size = (uint32_t)next->entries.size() - done;
+            open.pop_back();
+        }
+
+        uint32_t entry_index = (uint32_t)next->entries.size();
+        next->entries.push_back({node->name, node->path, node, node->handle, master,
+                                 1, node->num_references(), node->depth_at_tree, node->data});
+        open.push_back(entry_index);
+
+        for (size_t i = node->subnodes.size(); i > 0; i--) {
+            stack.push_back({node->subnodes[i - 1], entry_index});
+        }
+    }
+
+    for (uint32_t done : open) {
+        next->entries[done].subtree_size = (uint32_t)next->entries.size() - done;
+    }
+
+    const sigil::vmtree_snapshot_t *old = snapshot.exchange(next, std::memory_order_acq_rel);
+    if (old) vmtree_rcu.retire([old]() { delete old; });
+    published_at = std::chrono::steady_clock::now();
+    publish_cost = published_at - started;
+    return next;
+}
+
+int64_t sigil::vmtree_snapshot_t::find(const sigil::vmnode_t *node) const {
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].node == node) return (int64_t)i;
+    }
+    return -1;
+}
+
+sigil::vmtree_reader_t::vmtree_reader_t(sigil::vmnode_t *node) {
+    this->snapshot = nullptr;
+    this->rcu_slot = vmtree_rcu.read_lock();
+
+    sigil::vmnode_index_t *index = node ? node->get_index() : nullptr;
+    if (!index) return;
+
+    // Index publishes root when it is created, so there is always one
+    this->snapshot = index->snapshot.load(std::memory_order_acquire);
+}
+
+sigil::vmtree_reader_t::vmtree_reader_t(sigil::vmtree_reader_t &&other) {
+    this->snapshot = other.snapshot;
+    this->rcu_slot = other.rcu_slot;
+    other.snapshot = nullptr;
+    other.rcu_slot = UINT32_MAX;
+}
+
+sigil::vmtree_reader_t::~vmtree_reader_t() {
+    if (rcu_slot != UINT32_MAX) vmtree_rcu.read_unlock(rcu_slot);
+}
+
+sigil::vmnode_ref_t::vmnode_ref_t(sigil::vmnode_handle_t handle) {
+    vmnode_read_guard_t guard;
+    this->node = vmnode_t::from_handle(handle);
+    if (this->node && !this->node->try_acquire()) this->node = nullptr;
+}
+
+sigil::vmnode_ref_t::vmnode_ref_t(sigil::vmnode_ref_t &&other) {
+    this->node = other.node;
+    other.node = nullptr;
+}
+
+sigil::vmnode_ref_t::~vmnode_ref_t() {
+    if (this->node) this->node->release();
 }
 
 sigil::vmnode_t*
 sigil::vmnode_t::get_root_node() {
     if (this->depth_at_tree == 0) return this;
     if (!this->master_node) {
-        // TODO: Change to logger
-       printf("Warning, %s is orphaned node\n", this->name.value.c_str());
+        SIGIL_LOG_WARN("vm-tree: %s is orphaned node", this->name.c_str());
         return nullptr;
     }
     return this->master_node->get_root_node();
 }
 
+// Index is created lazily on first use, root indexes itself
+sigil::vmnode_index_t*
+sigil::vmnode_t::get_index() {
+    sigil::vmnode_t *root = this->get_root_node();
+    if (!root) return nullptr;
+
+    sigil::vmnode_index_t *index = root->index.load(std::memory_order_acquire);
+    if (index) return index;
+
+    // Concurrent first lookups may both build one, only the first one stored is kept
+    sigil::vmnode_index_t *created = new vmnode_index_t(root);
+    if (root->index.compare_exchange_strong(index, created, std::memory_order_acq_rel)) return created;
+    delete created;
+    return index;
+}
+
+// True if ancestor is this node or one of its masters, at most depth_max levels up
+bool sigil::vmnode_t::is_within(const sigil::vmnode_t *ancestor, int depth_max) {
+    if (!ancestor) return false;
+    if (this->depth_at_tree - ancestor->depth_at_tree > depth_max) return false;
+    // Index is per tree, everything found in it descends from the root
+    if (ancestor->depth_at_tree == 0) return true;
+
+    const sigil::vmnode_t *node = this;
+    while (node && node->depth_at_tree > ancestor->depth_at_tree) {
+        node = node->master_node;
+    }
+
+    return node == ancestor;
+}
+
+// Caller holds tree_mutex
+static sigil::vmnode_t* attach_subnode(sigil::vmnode_t *master, const char *name) {
+    sigil::vmnode_t* new_node = sigil::vmnode_t::create(name);
+    if (!new_node) return nullptr;
+
+    new_node->master_node = master;
+    master->refcount++;
+    master->subnodes.push_back(new_node);
+    new_node->depth_at_tree = master->depth_at_tree + 1;
+    return new_node;
+}
+
 sigil::vmnode_t*
 sigil::vmnode_t::spawn_subnode() {
-    sigil::vmnode_t* new_node = new vmnode_t();
-    new_node->refcount = 0;
-    new_node->master_node = this;
-    this->refcount++;
-    this->subnodes.push_back(new_node);
-    new_node->depth_at_tree = this->depth_at_tree + 1;
+    sigil::vmnode_index_t *index = this->get_index();
+    if (!index) return nullptr;
+
+    std::lock_guard<std::mutex> lock(index->tree_mutex);
+    sigil::vmnode_t *new_node = attach_subnode(this, nullptr);
+    index->touch();
     return new_node;
 }
 
@@ -63,90 +616,169 @@ sigil::vmnode_t*
 sigil::vmnode_t::spawn_subnode(const char* name) {
     if (!name) return nullptr;
 
-    sigil::vmnode_t *root = this->get_root_node();
-    if (!root) return nullptr;
+    sigil::vmnode_index_t *index = this->get_index();
+    if (!index) return nullptr;
+
+    sigil::name_t interned = name;
 
-    if (root->search(name, 0, VM_NODE_LOOKUP_MAX_DEPTH)) {
-       printf("%s already exists!\n", name);
+    // Check and insert under one lock, so concurrent spawns cannot duplicate a name
+    std::lock_guard<std::mutex> lock(index->tree_mutex);
+    if (index->by_name.find(interned.view(), interned.hash())) {
+        SIGIL_LOG_WARN("vm-tree: %s already exists", name);
         return nullptr;
     }
 
-    sigil::vmnode_t *new_node = this->spawn_subnode();
-    new_node->name.value = name;
+    sigil::vmnode_t *new_node = attach_subnode(this, name);
+    if (!new_node) return nullptr;
+
+    new_node->path = this->path;
+    new_node->path += VM_NODE_PATH_SEPARATOR;
+    new_node->path += name;
+    index->insert(new_node);
+    index->touch();
     return new_node;
 }
 
 std::string sigil::vmnode_t::get_node_name() {
-    return this->name.value;
+    return this->name.str();
 }
 
-std::string sigil::vmnode_t::get_node_name_tree() {
-    std::string payload = this->get_node_name();
+std::string sigil::vmnode_t::get_node_path() {
+    return this->path;
+}
 
-    size_t num_subnodes = subnodes.size();
+static void append_name_tree(const sigil::vmtree_snapshot_t *snapshot, uint32_t i, std::string &payload) {
+    auto &entry = snapshot->entries[i];
+    payload += entry.name.view();
 
-    for (size_t i = 0; i < num_subnodes; i++) {
+    for (uint32_t sub = i + 1; sub < i + entry.subtree_size; sub += snapshot->entries[sub].subtree_size) {
         payload += ": ";
-        payload += subnodes[i]->get_node_name_tree();
+        append_name_tree(snapshot, sub, payload);
     }
+}
+
+std::string sigil::vmnode_t::get_node_name_tree() {
+    sigil::vmtree_reader_t reader(this);
+    if (!reader.snapshot) return this->get_node_name();
 
+    int64_t i = reader.snapshot->find(this);
+    if (i < 0) return this->get_node_name();
+
+    std::string payload;
+    append_name_tree(reader.snapshot, (uint32_t)i, payload);
     return payload;
 }
 
-// TODO: Implement recursive reference release
+bool sigil::vmnode_t::try_acquire() {
+    uint32_t count = this->refcount.load();
+    do {
+        if (count == VM_NODE_CLAIMED) return false;
+    } while (!this->refcount.compare_exchange_weak(count, count + 1));
+
+    return true;
+}
+
+// Last release of a detached node hands it over to the reclaimer
+// Node may be freed right after the CAS, so nothing of it is read past that
 void sigil::vmnode_t::release() {
-    if (this->refcount > 0) this->refcount--;
+    uint32_t count = this->refcount.load();
+    uint32_t next;
+    do {
+        if (count == VM_NODE_CLAIMED || (count & ~VM_NODE_DETACHED) == 0) return;
+        next = count - 1 == VM_NODE_DETACHED ? VM_NODE_CLAIMED : count - 1;
+    } while (!this->refcount.compare_exchange_weak(count, next));
+
+    if (next == VM_NODE_CLAIMED) vmnode_reclaimer.push({this});
 }
 
+// Accepts a node name or a full path, lookup goes through the tree index
 sigil::vmnode_t *sigil::vmnode_t::search(const char *name, int depth_current, int depth_max) {
-    if (!name || depth_current > VM_NODE_LOOKUP_MAX_DEPTH) return nullptr;
-    size_t num_subnodes = this->subnodes.size();
+    if (!name || depth_current > depth_max) return nullptr;
 
-    if (this->name.value.compare(std::string(name)) == 0) {
-        return this;
-    }
+    sigil::vmnode_index_t *index = this->get_index();
+    if (!index) return nullptr;
 
-    if (num_subnodes > 0) {
-        vmnode_t *found = nullptr;
+    sigil::vmnode_t *found = index->find(std::string_view(name));
+    if (!found || !found->is_within(this, depth_max - depth_current)) return nullptr;
+    return found;
+}
 
-        for (size_t i = 0; i < num_subnodes; i++) if (found == nullptr) {
-            found = this->subnodes[i]->search(name, depth_current + 1, depth_max);
-        }
+sigil::vmnode_t *sigil::vmnode_t::search(sigil::name_t name, int depth_current, int depth_max) {
+    if (depth_current > depth_max) return nullptr;
 
-        return found;
-    }
+    sigil::vmnode_index_t *index = this->get_index();
+    if (!index) return nullptr;
 
-    return nullptr;
+    sigil::vmnode_t *found = index->find(name);
+    if (!found || !found->is_within(this, depth_max - depth_current)) return nullptr;
+    return found;
 }
 
 sigil::vmnode_t *sigil::vmnode_t::peek_subnode(const char *name, int depth_max) {
     return this->search(name, 0, depth_max);
 }
 
+sigil::vmnode_t *sigil::vmnode_t::peek_subnode(sigil::name_t name, int depth_max) {
+    return this->search(name, 0, depth_max);
+}
+
 sigil::vmnode_t *sigil::vmnode_t::get_subnode(const char *name, int depth_max) {
-    vmnode_t *ref = peek_subnode(name, depth_max);
-    if (ref) ref->refcount++;
+    if (!name) return nullptr;
+
+    sigil::vmnode_index_t *index = this->get_index();
+    if (!index) return nullptr;
+
+    // Reference is taken under tree_mutex, so node cannot be detached in between
+    std::string_view key = name;
+    bool is_path = key.find(VM_NODE_PATH_SEPARATOR) != std::string_view::npos;
+    sigil::name_t interned;
+    if (!is_path && !sigil::name_t::find(key, interned)) return nullptr;
+
+    std::lock_guard<std::mutex> lock(index->tree_mutex);
+    vmnode_t *ref = is_path ? index->by_path.find(key, sigil::hash_str(key))
+                            : index->by_name.find(interned.view(), interned.hash());
+    if (!ref || !ref->is_within(this, depth_max)) return nullptr;
+
+    ref->refcount++;
     return ref;
 }
 
 void sigil::vmnode_t::print_nodeinfo() {
-   printf("vm-tree: ");
-
-    for (int i = 0; i < this->depth_at_tree; i++) {
-       printf("    ");
-    }
-
-   printf("%s(%u, RC:%u), ", 
-        this->get_node_name().c_str(), depth_at_tree,
-        this->refcount);    
-   printf("master: %s, data: %p\n",
-        this->master_node ? master_node->name.value.c_str() : "self/root",
-        this->data);
-    
-    size_t num_subnodes = this->subnodes.size();
-    if (num_subnodes > 0) {
-        for (size_t i = 0; i < num_subnodes; i++) {
-            this->subnodes[i]->print_nodeinfo();
+    sigil::vmtree_reader_t reader(this);
+    if (!reader.snapshot) return;
+
+    int64_t first = reader.snapshot->find(this);
+    if (first < 0) return;
+    size_t begin = (size_t)first;
+
+    auto &entries = reader.snapshot->entries;
+    for (size_t i = begin; i < begin + entries[begin].subtree_size; i++) {
+        auto &entry = entries[i];
+        printf("vm-tree: ");
+
+        for (uint32_t d = 0; d < entry.depth; d++) {
+            printf("    ");
+        }
+
+        printf("%s(%u, RC:%u), ",
+            entry.name.c_str(), entry.depth, entry.refcount);
+        printf("master: %s, data: %p",
+            entry.master != UINT32_MAX ? entries[entry.master].name.c_str() : "self/root",
+            entry.data);
+
+        std::vector<sigil::metric_value_t> values;
+        if (sigil::metrics::read(entry.node, values) != sigil::VM_OK) {
+            printf("\n");
+            continue;
+        }
+        printf(", %s\n", sigil::metrics::describe(entry.node).c_str());
+
+        // Builtin ones are in the line above
+        for (size_t m = 3; m < values.size(); m++) {
+            printf("vm-tree: ");
+            for (int d = 0; d <= entry.depth; d++) printf("    ");
+            if (values[m].kind == sigil::METRIC_HISTOGRAM) printf("%s: %s\n", values[m].name.c_str(), values[m].summary.c_str());
+            else printf("%s: %ld\n", values[m].name.c_str(), values[m].value);
         }
     }
 }
@@ -160,17 +792,65 @@ void sigil::vmnode_t::print_nodemem() {
     }
 }
 
+sigil::status_t sigil::vmnode_t::deinit_subnodes() {
+    sigil::vmnode_index_t *index = this->get_index();
+    std::vector<vmnode_t*> unused;
+
+    for (auto s : this->subnodes) {
+        // Cut off before queueing, so reclaimer does not release this node again
+        s->master_node = nullptr;
+        detach_subtree(index, s, unused);
+        this->release();
+    }
+    this->subnodes.clear();
+    vmnode_reclaimer.push(unused);
+
+    return sigil::VM_OK;
+}
+
 sigil::status_t sigil::vmnode_t::deinit() {
-    printf("Querying deinit of %s\n", this->name.value.c_str());
+    sigil::vmnode_index_t *index = this->get_index();
+    if (!index) return sigil::VM_INVALID_ROOT;
+
+    std::lock_guard<std::mutex> lock(index->tree_mutex);
+    this->deinit_subnodes();
+    index->touch();
+    return sigil::VM_OK;
+}
 
-    if (this->subnodes.size() > 0) for (auto s : this->subnodes) {
-        s->deinit();
-        delete(s);
+sigil::status_t sigil::vmnode_t::deinit_self() {
+    // Master is cleared on removal, depth tells root apart from a removed node
+    if (this->depth_at_tree == 0) {
+        // Root owns the index, it goes to reclaimer like any other node so guarded readers finish first
+        this->deinit();
+        if (detach_node(this)) vmnode_reclaimer.push({this});
+        return sigil::VM_OK;
+    }
+
+    if (this->is_detached()) return sigil::VM_NOT_FOUND;
+    sigil::vmnode_index_t *index = this->get_index();
+    if (!index) return sigil::VM_INVALID_ROOT;
+
+    {
+        std::lock_guard<std::mutex> lock(index->tree_mutex);
+        // Lost race with another removal of this node or one of its masters
+        sigil::vmnode_t *master = this->master_node;
+        if (!master || this->is_detached()) return sigil::VM_NOT_FOUND;
+
+        auto &siblings = master->subnodes;
+        for (size_t i = 0; i < siblings.size(); i++) if (siblings[i] == this) {
+            siblings.erase(siblings.begin() + i);
+            break;
+        }
+
+        std::vector<vmnode_t*> unused;
+        this->master_node = nullptr;
+        detach_subtree(index, this, unused);
+        vmnode_reclaimer.push(unused);
+        master->release();
+        index->touch();
     }
 
-    auto master = this->master_node;
-    //if (this->refcount == 0) this->node_data.data_cleanup();
-    if (master) master->release();
     return sigil::VM_OK;
 }
 
@@ -200,55 +880,6 @@ void sigil::memview(const void *mem_start, uint32_t num_bytes, bool align) {
     for (int i = 0; i < num_bytes; i++) if (!(i % 16)) memview_chunk(printout_start + i);
 }
 
-void sigil::get_memstats(sigil::memstat_t &result) {
-#   ifdef __linux__
-    std::ifstream file("/proc/self/stat");
-    if (!file) {
-        throw std::runtime_error("Failed to open /proc/self/stat");
-    }
-
-    std::string data;
-    std::getline(file, data);
-    std::istringstream stream(data);
-
-
-    // Read first three fields manually
-    stream >> result.pid;
-
-    std::string comm;
-    stream >> comm;
-    while (comm.back() != ')') {
-        std::string part;
-        stream >> part;
-        comm += " " + part;
-    }
-    result.command = comm.substr(1, comm.size() - 2);  // Remove parentheses
-
-    stream >> result.state;  // Read process state
-
-    // Skip to the 23rd and 24th fields
-    for (int i = 0; i < 19; ++i) {
-        std::string skip;
-        stream >> skip;
-    }
-
-    stream >> result.vsize >> result.rss;  // Read virtual size and RSS
-
-    // END    
-#   endif /* __linux__ */
-}
-
-void sigil::print_memstats(const memstat_t &result) {
-    long page_size = sysconf(_SC_PAGESIZE);
-    printf("Virtual Machine memory report:\n");
-    printf("PID: %d\n", result.pid);
-    printf("Command: %s\n", result.command.c_str());
-    printf("State: %c\n", result.state);
-    printf("Virtual Memory Size: %lu KiB\n", result.vsize / 1024);
-    printf("Resident Set Size: %lu KiB\n", page_size * result.rss / 1024);
-}
-
-
 // Print next 16 bytes in memory overwiev style 
 void sigil::memview_chunk(const void *mem_start) {
     if (!mem_start) return;
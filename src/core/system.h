@@ -8,17 +8,40 @@
 #include <cstring>
 #include <cstdint>
 #include <cstdio>
+#include <string_view>
+#include <type_traits>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <mutex>
+#include <condition_variable>
 #include <ctime>
 #include "utils.h"
+#include "name-table.h"
+#include "slab.h"
+#include "rcu.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "parser.h"
 
 #define VM_NODE_VMROOT "vmroot"
 #define VM_NODE_RUNTIME "runtime"
 #define VM_NODE_PLATFORM "platform"
 #define VM_NODE_INV_NAME "INVALID_NAME_DO_NOT_USE"
 #define VM_NODE_LOOKUP_MAX_DEPTH 32
+#define VM_NODE_PATH_SEPARATOR '/'
+// Writes within this long after a snapshot was published are published together
+#define VM_TREE_PUBLISH_US 2000
+// Refcount bit of a node cut off from its tree, kept in the same word so last release and claim are one CAS
+#define VM_NODE_DETACHED 0x80000000u
+// Refcount of a detached node handed over to reclaimer, it cannot be acquired again
+#define VM_NODE_CLAIMED UINT32_MAX
+#define VM_MESSAGE_PAYLOAD_SIZE 48
+#define VM_MAILBOX_BATCH 32
+// Message kinds from here up are reserved for the VM itself
+#define VM_MESSAGE_RESERVED 0xFFFF0000u
+// Payload is vmcall_t, run by mailbox drain instead of node handler
+#define VM_MESSAGE_CALL (VM_MESSAGE_RESERVED + 1)
 
 namespace sigil {
     enum reference_type_t {
@@ -37,9 +60,10 @@ namespace sigil {
     inline const char* reference_type_to_cstr(reference_type_t reftype);
 
     struct reference_t {
-        reference_type_t type;
-        uint64_t id;
-        uint32_t refcount;
+        reference_type_t type = REF_UNKNOWN;
+        uint64_t id = 0;
+        // Shared across threads, see vmnode_t::release()
+        std::atomic<uint32_t> refcount = {0};
         void print_reference_info();
         std::string get_reference_info_string();
     };
@@ -62,52 +86,335 @@ namespace sigil {
         }
     };
 
+    struct vmnode_t;
+
+    // Stable reference to a node, resolves to nullptr once the node is destroyed
+    typedef handle64_t vmnode_handle_t;
+
+    // One cache line, payload is any trivially copyable type that fits
+    struct alignas(64) vmmessage_t {
+        // Meaning is defined by receiving node
+        uint32_t kind = 0;
+        uint32_t size = 0;
+        vmnode_handle_t sender;
+        unsigned char payload[VM_MESSAGE_PAYLOAD_SIZE];
+
+        template <typename T>
+        static vmmessage_t make(uint32_t kind, const T &value, vmnode_handle_t sender = vmnode_handle_t()) {
+            static_assert(std::is_trivially_copyable_v<T>, "message payload must be trivially copyable");
+            static_assert(sizeof(T) <= VM_MESSAGE_PAYLOAD_SIZE, "message payload is too large");
+
+            vmmessage_t message;
+            message.kind = kind;
+            message.size = sizeof(T);
+            message.sender = sender;
+            memcpy(message.payload, &value, sizeof(T));
+            return message;
+        }
+
+        // Returns false if payload is of different size
+        template <typename T>
+        bool get(T &value) const {
+            static_assert(std::is_trivially_copyable_v<T>, "message payload must be trivially copyable");
+            if (size != sizeof(T)) return false;
+            memcpy(&value, payload, sizeof(T));
+            return true;
+        }
+    };
+
+    /*
+        Function queued in a node mailbox, runs in order with its messages.
+        Node is nullptr if call is discarded, because its node got destroyed
+        first, fn still runs then, so it can release ctx.
+    */
+    struct vmcall_t {
+        void (*fn)(void *ctx, vmnode_t *node);
+        void *ctx;
+    };
+
+    // Called on worker pool with a batch of messages, never concurrently for one node
+    typedef void (*vmmessage_handler_ft)(vmnode_t *node, const vmmessage_t *messages, size_t count);
+
+    struct vmmailbox_t : reference_t {
+        mailbox_t<vmmessage_t> queue;
+        vmmessage_handler_ft handler = nullptr;
+        // Drained on worker pool instead of polled, handler is optional then
+        bool on_pool = false;
+        // Set while a drain job is queued or running
+        std::atomic<bool> drain_scheduled = {false};
+        // Producers blocked on a full queue, consumer wakes them once it popped some
+        std::atomic<uint32_t> num_waiting = {0};
+        std::mutex room_mutex;
+        std::condition_variable room_cv;
+
+        vmmailbox_t(uint32_t capacity) : queue(capacity) {
+            this->type = REF_WORKQUEUE;
+        }
+
+        // Consumer calls it after popping
+        void notify_room() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (num_waiting.load(std::memory_order_relaxed) == 0) return;
+            std::lock_guard<std::mutex> lock(room_mutex);
+            room_cv.notify_all();
+        }
+    };
+
+    /*
+        Keeps every node that was reachable when guard was taken from being
+        freed, so a handle can be resolved and used without locking the tree.
+        Guard has to stay short, it holds back reclamation of removed nodes.
+    */
+    struct vmnode_read_guard_t {
+        vmnode_read_guard_t();
+        ~vmnode_read_guard_t();
+        vmnode_read_guard_t(const vmnode_read_guard_t&) = delete;
+        vmnode_read_guard_t& operator=(const vmnode_read_guard_t&) = delete;
+
+        private:
+        uint32_t rcu_slot;
+    };
+
+    /*
+        Open addressing hash table of nodes, keyed by name or by path.
+        Slots keep only the hash and a node pointer, key is compared
+        against the node itself, so a node must not be renamed once indexed.
+        Table of interned keys compares their text by address only.
+    */
+    struct vmnode_table_t {
+        struct slot_t {
+            uint64_t hash;      // 0 when slot was never used
+            vmnode_t *node;     // nullptr with hash set marks a removed entry
+        };
+
+        std::vector<slot_t> slots;
+        std::string_view (*key_of)(const vmnode_t *node);
+        size_t num_used;
+        size_t num_removed;
+        bool interned;
+
+        vmnode_table_t(std::string_view (*key_of)(const vmnode_t *node), bool interned = false);
+        vmnode_t* find(std::string_view key, uint64_t hash);
+        void insert(vmnode_t *node);
+        void remove(vmnode_t *node);
+        void grow();
+    };
+
+    /*
+        Immutable copy of a tree, readers traverse it without any locks.
+        Entries are in depth first order, subtree of entry i spans
+        entries [i, i + subtree_size), so first subnode is at i + 1.
+    */
+    struct vmtree_snapshot_t {
+        struct entry_t {
+            sigil::name_t name;
+            std::string path;
+            const vmnode_t *node;   // Identity only, node may be gone already
+            vmnode_handle_t handle;
+            uint32_t master;        // Entry index of master, UINT32_MAX for root
+            uint32_t subtree_size;
+            uint32_t refcount;
+            uint8_t depth;
+            void *data;
+        };
+
+        uint64_t version;
+        std::vector<entry_t> entries;
+
+        // Entry index of a node, or -1 if it is not in the snapshot
+        int64_t find(const vmnode_t *node) const;
+    };
+
+    /*
+        Index and shared state of a whole tree, owned by its root node.
+        Gives O(1) lookup by node name and by full path, and publishes
+        snapshots of the tree for lock free readers. Writers publish,
+        readers only load latest snapshot. A write right after another
+        publish is left to a background publisher, which publishes once
+        VM_TREE_PUBLISH_US passed, or four times as long as last copy took,
+        so a burst of writes copies tree once and copying stays under 20%.
+    */
+    struct vmnode_index_t {
+        vmnode_table_t by_name;
+        vmnode_table_t by_path;
+        vmnode_t *root;
+        // Serializes writers of the tree: spawning, removal and subnode lists
+        std::mutex tree_mutex;
+        // Bumped by writers, snapshot carries version it was copied at
+        std::atomic<uint64_t> version;
+        std::atomic<const vmtree_snapshot_t*> snapshot;
+        // Under tree_mutex
+        std::chrono::steady_clock::time_point published_at;
+        // How long last publish took, large trees are published less often
+        std::chrono::steady_clock::duration publish_cost = {};
+        bool publish_queued = false;
+
+        // Indexes and publishes root
+        vmnode_index_t(vmnode_t *root);
+        ~vmnode_index_t();
+        // Caller holds tree_mutex
+        void insert(vmnode_t *node);
+        void remove(vmnode_t *node);
+        // After every write, publishes it now or queues it to publisher
+        void touch();
+        const vmtree_snapshot_t* publish();
+        // Takes tree_mutex, publishes writes still queued, for callers that must see them
+        void sync();
+        // Takes tree_mutex
+        vmnode_t* find(std::string_view name_or_path);
+        vmnode_t* find(sigil::name_t name);
+    };
+
+    /*
+        Read guard over latest published snapshot of a tree, an atomic load
+        under vmtree_rcu, readers never lock or copy the tree. Writes from
+        the last VM_TREE_PUBLISH_US may not be in it yet, see sync().
+    */
+    struct vmtree_reader_t {
+        const vmtree_snapshot_t *snapshot;
+
+        vmtree_reader_t(vmnode_t *node);
+        vmtree_reader_t(vmtree_reader_t &&other);
+        ~vmtree_reader_t();
+        vmtree_reader_t(const vmtree_reader_t&) = delete;
+        vmtree_reader_t& operator=(const vmtree_reader_t&) = delete;
+
+        private:
+        uint32_t rcu_slot;
+    };
+
+    /*
+        Reference to a node resolved from a handle, node stays allocated
+        while it is held, even if it is removed from its tree meanwhile.
+        Node is nullptr for null or stale handles.
+    */
+    struct vmnode_ref_t {
+        vmnode_t *node;
+
+        vmnode_ref_t(vmnode_handle_t handle);
+        vmnode_ref_t(vmnode_ref_t &&other);
+        ~vmnode_ref_t();
+        vmnode_ref_t(const vmnode_ref_t&) = delete;
+        vmnode_ref_t& operator=(const vmnode_ref_t&) = delete;
+
+        vmnode_t* operator->() const { return node; }
+    };
+
     struct vmnode_t : reference_t {
+        // Name and depth share a cache line with the header, lookups touch only those
         sigil::name_t name;
-        vmnode_t *master_node;
+        uint8_t depth_at_tree = 0;
+        // Full path from the root, e.g. vmroot/runtime/visor
+        std::string path;
+        // Null for nodes not allocated from the node pool
+        vmnode_handle_t handle;
+        vmnode_t *master_node = nullptr;
+        // Only set on root node, see get_index()
+        std::atomic<vmnode_index_t*> index = {nullptr};
+        // Modified under tree_mutex only, readers use vmtree_reader_t
         std::vector<vmnode_t*> subnodes;
-        uint8_t depth_at_tree;
-        std::mutex node_mutex;
         // Raw pointer to whatever a given node deems relevant
-        void *data;
+        void *data = nullptr;
+        // Optional, see open_mailbox()
+        std::atomic<vmmailbox_t*> mailbox = {nullptr};
+        // Optional, see metrics::of()
+        std::atomic<vmmetrics_t*> metrics = {nullptr};
 
         // References to headers
-        status_t (*start)(void);
-        status_t (*stop)(void);
+        status_t (*start)(void) = nullptr;
+        status_t (*stop)(void) = nullptr;
 
         vmnode_t();
         ~vmnode_t();
         vmnode_t(const char *name);
         vmnode_t(const sigil::name_t name);
+
+        // Nodes live in a slab pool, these replace new/delete
+        static vmnode_t* create(const char *name);
+        static vmnode_t* from_handle(vmnode_handle_t handle);
+        static void destroy(vmnode_t *node);
+        static size_t num_pooled();
+        // Blocks until background reclaimer has nothing left to free
+        static void wait_for_reclaim();
+
+        // Removes whole subtree, node itself stays
         sigil::status_t deinit();
+        // Removes whole subtree and node itself, do not use node afterwards
         sigil::status_t deinit_self();
+        // Detaches subtree from the tree, nodes are freed by background reclaimer
+        // once nobody references them. Caller holds tree_mutex
         sigil::status_t deinit_subnodes();
         vmnode_t* search(const char *name, int depth_current, int depth_max);
+        // Interned name skips hashing its text, never a path
+        vmnode_t* search(sigil::name_t name, int depth_current, int depth_max);
         vmnode_t* spawn_subnode();
         vmnode_t* spawn_subnode(const char *name);
         vmnode_t* peek_subnode(const char *name, int depth_max);
+        vmnode_t* peek_subnode(sigil::name_t name, int depth_max);
         vmnode_t* peek_master_node();
+        // Like peek_subnode, but takes a reference, which keeps node alive until release()
         vmnode_t* get_subnode(const char *name, int depth_max);
         vmnode_t* get_master_node();
         vmnode_t* get_root_node();
+        vmnode_index_t* get_index();
+        bool is_within(const vmnode_t *ancestor, int depth_max);
+        // Set once node is cut off from its tree, it is reclaimed when its references drop to 0
+        bool is_detached() const { return this->refcount.load() & VM_NODE_DETACHED; }
+        uint32_t num_references() const {
+            uint32_t count = this->refcount.load();
+            return count == VM_NODE_CLAIMED ? 0 : count & ~VM_NODE_DETACHED;
+        }
+        // Takes a reference, fails only for a node already handed over to reclaimer
+        // Node must be known to be alive, e.g. under vmnode_read_guard_t
+        bool try_acquire();
         void release();
+        // Handler may be nullptr, then messages are only read with receive(),
+        // unless on_pool is set, then only calls are run and messages dropped
+        sigil::status_t open_mailbox(uint32_t capacity, vmmessage_handler_ft handler, bool on_pool = false);
+        // Single consumer, not to be mixed with a mailbox handler
+        size_t receive(vmmessage_t *messages, size_t max);
         std::string get_node_name();
+        std::string get_node_path();
         std::string get_node_name_tree();
         void print_nodeinfo();
         void print_nodemem();
     };
 
+    typedef status_t (*vmcommand_handler_ft)(vmnode_t *node, const parser::command_t &command);
+
+    /*
+        Command run on worker pool by its owner node. Pattern is made of
+        words and typed placeholders, e.g. "net ping <string> <int>", see
+        parser::register_command(), handler finds parsed values in command.args
+    */
+    struct vmcommand_descriptor_t {
+        // Kept normalized, words separated by single spaces
+        sigil::name_t pattern;
+        vmnode_handle_t owner;
+        vmcommand_handler_ft handler = nullptr;
+    };
+
     struct vmnode_descriptor_t {
         sigil::name_t name;
         status_t (*start)(void);
         status_t (*stop)(void);
     };
 
+    // Module is initialized once every module it depends on is ready
+    struct vmmodule_descriptor_t {
+        sigil::name_t name;
+        std::vector<sigil::name_t> depends_on;
+        status_t (*initialize)(void) = nullptr;
+        status_t (*deinitialize)(void) = nullptr;
+        // Initialized on thread calling initialize_modules(), for APIs bound to main thread (GLFW)
+        bool main_thread = false;
+    };
+
 
 
     inline void reference_t::print_reference_info() {
         printf("sigil: Reference ID: %lu, reference count: %u, type: %s, location: %p\n",
-                        this->id, this->refcount, sigil::reference_type_to_cstr(this->type), this);
+                        this->id, this->refcount.load(), sigil::reference_type_to_cstr(this->type), this);
     }
 
     inline const char* reference_type_to_cstr(sigil::reference_type_t type) {
@@ -0,0 +1,192 @@
+#include "timer-wheel.h"
+
+// Timers further than this are parked at the top level and re-placed on cascade
+#define TIMER_WHEEL_RANGE ((uint64_t)1 << (sigil::timer_wheel_t::num_levels * sigil::timer_wheel_t::level_bits))
+
+sigil::timer_wheel_t::timer_wheel_t(uint64_t now_us) {
+    this->now = now_us;
+}
+
+sigil::timer_wheel_t::~timer_wheel_t() {
+    // Slab pool only frees memory, callbacks have to be destructed here
+    for (auto &level : levels) for (auto head : level.slots) {
+        while (head) {
+            entry_t *next = head->next;
+            entries.destroy(head);
+            head = next;
+        }
+    }
+}
+
+sigil::timer_handle_t sigil::timer_wheel_t::schedule(uint64_t expiry_us, uint64_t period_us,
+                                                     std::function<void()> callback) {
+    timer_handle_t handle;
+    entry_t *entry = entries.create(&handle);
+    if (!entry) return timer_handle_t();
+
+    entry->expiry = expiry_us;
+    entry->period = period_us;
+    entry->callback = std::move(callback);
+    link(entry);
+    num_timers++;
+    return handle;
+}
+
+bool sigil::timer_wheel_t::cancel(sigil::timer_handle_t handle) {
+    entry_t *entry = entries.get(handle);
+    if (!entry) return false;
+
+    unlink(entry);
+    entries.destroy(entry);
+    num_timers--;
+    return true;
+}
+
+// Lowest level whose range covers the delay, slot is picked by expiry digit of that level
+void sigil::timer_wheel_t::link(entry_t *entry) {
+    uint64_t delta = entry->expiry > now ? entry->expiry - now : 0;
+    uint64_t place = delta < TIMER_WHEEL_RANGE ? now + delta : now + TIMER_WHEEL_RANGE - 1;
+    delta = place - now;
+
+    uint32_t level = 0;
+    while (level < num_levels - 1 && (delta >> (level_bits * (level + 1))) != 0) level++;
+    uint32_t slot = (place >> (level_bits * level)) & (level_slots - 1);
+
+    level_t &l = levels[level];
+    entry->level = level;
+    entry->slot = slot;
+    entry->prev = nullptr;
+    entry->next = l.slots[slot];
+    if (entry->next) entry->next->prev = entry;
+    l.slots[slot] = entry;
+    l.occupied[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+void sigil::timer_wheel_t::unlink(entry_t *entry) {
+    level_t &l = levels[entry->level];
+
+    if (entry->prev) entry->prev->next = entry->next;
+    else l.slots[entry->slot] = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+
+    if (!l.slots[entry->slot]) l.occupied[entry->slot / 64] &= ~((uint64_t)1 << (entry->slot % 64));
+    entry->prev = entry->next = nullptr;
+}
+
+// Current slot of a level moves down, every entry lands on a lower level
+void sigil::timer_wheel_t::cascade(uint32_t level) {
+    uint32_t slot = (now >> (level_bits * level)) & (level_slots - 1);
+    level_t &l = levels[level];
+
+    entry_t *entry = l.slots[slot];
+    l.slots[slot] = nullptr;
+    l.occupied[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+
+    while (entry) {
+        entry_t *next = entry->next;
+        link(entry);
+        entry = next;
+    }
+}
+
+void sigil::timer_wheel_t::expire_current(std::vector<std::function<void()>> &due, size_t &num_due) {
+    uint32_t slot = now & (level_slots - 1);
+    level_t &l = levels[0];
+
+    entry_t *entry = l.slots[slot];
+    l.slots[slot] = nullptr;
+    l.occupied[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+
+    while (entry) {
+        entry_t *next = entry->next;
+
+        if (entry->expiry > now) {
+            link(entry);
+        } else if (entry->period) {
+            // Keeps its phase, periods missed while falling behind are dropped
+            due.push_back(entry->callback);
+            entry->expiry += ((now - entry->expiry) / entry->period + 1) * entry->period;
+            link(entry);
+            num_due++;
+        } else {
+            due.push_back(std::move(entry->callback));
+            entries.destroy(entry);
+            num_timers--;
+            num_due++;
+        }
+
+        entry = next;
+    }
+}
+
+int32_t sigil::timer_wheel_t::next_occupied(uint32_t level, uint32_t from) const {
+    if (from >= level_slots) return -1;
+
+    const uint64_t *occupied = levels[level].occupied;
+    uint32_t word = from / 64;
+    uint64_t bits = occupied[word] & (~(uint64_t)0 << (from % 64));
+
+    while (true) {
+        if (bits) return word * 64 + __builtin_ctzll(bits);
+        if (++word >= level_slots / 64) return -1;
+        bits = occupied[word];
+    }
+}
+
+bool sigil::timer_wheel_t::is_level_empty(uint32_t level) const {
+    for (auto bits : levels[level].occupied) if (bits) return false;
+    return true;
+}
+
+/*
+    Nearest tick after now where something happens. Either next occupied
+    slot of the lowest non-empty level, or wrap of that level if it only
+    holds entries for its next rotation. Empty stretches are skipped whole.
+*/
+uint64_t sigil::timer_wheel_t::next_wakeup_us() const {
+    if (!num_timers) return UINT64_MAX;
+    if (next_occupied(0, now & (level_slots - 1)) == (int32_t)(now & (level_slots - 1))) return now;
+
+    for (uint32_t level = 0; level < num_levels; level++) {
+        uint32_t shift = level_bits * level;
+        uint32_t index = (now >> shift) & (level_slots - 1);
+        uint64_t rotation = (now >> (shift + level_bits)) << (shift + level_bits);
+
+        int32_t slot = next_occupied(level, index + 1);
+        if (slot >= 0) return rotation | ((uint64_t)slot << shift);
+        if (!is_level_empty(level)) return rotation + ((uint64_t)1 << (shift + level_bits));
+    }
+
+    return UINT64_MAX;
+}
+
+size_t sigil::timer_wheel_t::advance(uint64_t now_us, std::vector<std::function<void()>> &due) {
+    size_t num_due = 0;
+    expire_current(due, num_due);
+
+    while (now < now_us) {
+        uint64_t next = next_wakeup_us();
+        if (next > now_us) {
+            now = now_us;
+            break;
+        }
+        now = next;
+
+        // Higher levels first, so their entries can still drop into lower slots due now
+        for (uint32_t level = num_levels - 1; level > 0; level--) {
+            uint64_t mask = ((uint64_t)1 << (level_bits * level)) - 1;
+            if ((now & mask) == 0) cascade(level);
+        }
+        expire_current(due, num_due);
+    }
+
+    return num_due;
+}
+
+uint64_t sigil::timer_wheel_t::now_us() const {
+    return now;
+}
+
+size_t sigil::timer_wheel_t::size() const {
+    return num_timers;
+}
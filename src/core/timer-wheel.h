@@ -0,0 +1,72 @@
+#pragma once
+/*
+    Hierarchical timing wheel.
+    Four levels of 256 slots, one tick is 1us, so level 0 covers 256us,
+    level 1 65ms, level 2 16.7s and level 3 71 minutes. Timers go to the
+    lowest level that covers their delay, insertion and cancellation are O(1).
+    Whenever a level wraps around, next slot of the level above is cascaded
+    down, so a timer is touched at most once per level.
+
+    Wheel itself does not keep time and is not thread safe, owner drives
+    it with advance() and collects callbacks that became due.
+*/
+#include <functional>
+#include <cstdint>
+#include <vector>
+#include "slab.h"
+
+namespace sigil {
+    typedef handle64_t timer_handle_t;
+
+    class timer_wheel_t {
+        public:
+        static constexpr uint32_t num_levels = 4;
+        static constexpr uint32_t level_bits = 8;
+        static constexpr uint32_t level_slots = 1 << level_bits;
+
+        explicit timer_wheel_t(uint64_t now_us = 0);
+        ~timer_wheel_t();
+        timer_wheel_t(const timer_wheel_t&) = delete;
+        timer_wheel_t& operator=(const timer_wheel_t&) = delete;
+
+        // Period of 0 makes a one-shot timer, returns null handle if pool is exhausted
+        timer_handle_t schedule(uint64_t expiry_us, uint64_t period_us, std::function<void()> callback);
+        // Returns false for fired one-shot or already cancelled timers
+        bool cancel(timer_handle_t handle);
+
+        // Moves wheel to now_us, callbacks that became due are appended to due
+        size_t advance(uint64_t now_us, std::vector<std::function<void()>> &due);
+        // Time of the next expiry or cascade, UINT64_MAX if wheel is empty
+        uint64_t next_wakeup_us() const;
+        uint64_t now_us() const;
+        size_t size() const;
+
+        private:
+        struct entry_t {
+            uint64_t expiry = 0;
+            uint64_t period = 0;
+            std::function<void()> callback;
+            entry_t *prev = nullptr;
+            entry_t *next = nullptr;
+            uint32_t level = 0;
+            uint32_t slot = 0;
+        };
+
+        struct level_t {
+            entry_t *slots[level_slots] = {};
+            uint64_t occupied[level_slots / 64] = {};
+        };
+
+        void link(entry_t *entry);
+        void unlink(entry_t *entry);
+        void cascade(uint32_t level);
+        void expire_current(std::vector<std::function<void()>> &due, size_t &num_due);
+        int32_t next_occupied(uint32_t level, uint32_t from) const;
+        bool is_level_empty(uint32_t level) const;
+
+        level_t levels[num_levels];
+        slab_pool_t<entry_t, timer_handle_t> entries;
+        uint64_t now = 0;
+        size_t num_timers = 0;
+    };
+}
@@ -0,0 +1,153 @@
+#include "trace.h"
+#include <pthread.h>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct trace_event_t {
+    uint64_t begin_ns;
+    uint64_t duration_ns;
+    char name[TRACE_NAME_SIZE];
+};
+
+// Owner thread moves head, export moves tail
+struct trace_buffer_t {
+    alignas(64) std::atomic<uint64_t> head = {0};
+    alignas(64) std::atomic<uint64_t> tail = {0};
+    std::atomic<uint64_t> dropped = {0};
+    uint32_t tid = 0;
+    std::string thread_name;
+    trace_event_t events[TRACE_BUFFER_EVENTS];
+};
+
+static_assert((TRACE_BUFFER_EVENTS & (TRACE_BUFFER_EVENTS - 1)) == 0, "trace buffer size must be a power of two");
+
+std::atomic<bool> sigil::trace::enabled = {false};
+
+// Buffers outlive their threads, so zones of finished threads still get exported
+static std::vector<std::unique_ptr<trace_buffer_t>> trace_buffers;
+static std::mutex trace_mutex;
+static std::atomic<uint64_t> trace_epoch_ns = {0};
+static thread_local trace_buffer_t *local_buffer = nullptr;
+static thread_local std::string local_thread_name;
+
+static trace_buffer_t* get_local_buffer() {
+    if (local_buffer) return local_buffer;
+
+    std::unique_ptr<trace_buffer_t> buffer(new trace_buffer_t);
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    buffer->tid = (uint32_t)trace_buffers.size() + 1;
+    buffer->thread_name = local_thread_name.empty() ? "thread-" + std::to_string(buffer->tid) : local_thread_name;
+    local_buffer = buffer.get();
+    trace_buffers.push_back(std::move(buffer));
+    return local_buffer;
+}
+
+void sigil::trace::enable(bool enable) {
+    if (enable && trace_epoch_ns.load() == 0) trace_epoch_ns.store(sigil::tsc::now_ns());
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+void sigil::trace::set_thread_name(const char *name) {
+    if (!name) return;
+    local_thread_name = name;
+
+#   ifdef __linux__
+    // Kernel keeps 15 characters, it shows in /proc and in debuggers
+    char os_name[16];
+    snprintf(os_name, sizeof(os_name), "%s", name);
+    pthread_setname_np(pthread_self(), os_name);
+#   endif /* __linux__ */
+
+    if (!local_buffer) return;
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    local_buffer->thread_name = name;
+}
+
+void sigil::trace::record(const char *name, uint64_t begin_ns, uint64_t duration_ns) {
+    trace_buffer_t *buffer = get_local_buffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+
+    if (head - buffer->tail.load(std::memory_order_acquire) >= TRACE_BUFFER_EVENTS) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    trace_event_t &event = buffer->events[head & (TRACE_BUFFER_EVENTS - 1)];
+    event.begin_ns = begin_ns;
+    event.duration_ns = duration_ns;
+    size_t length = name ? strnlen(name, TRACE_NAME_SIZE - 1) : 0;
+    if (length) memcpy(event.name, name, length);
+    event.name[length] = '\0';
+
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+static void append_escaped(std::string &out, const char *text) {
+    for (; *text; text++) {
+        char c = *text;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) out += ' ';
+        else out += c;
+    }
+}
+
+sigil::status_t sigil::trace::export_json(const char *path) {
+    if (!path) return VM_ARG_NULL;
+
+    FILE *file = fopen(path, "w");
+    if (!file) return VM_FAILED;
+
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    char text[128];
+    bool first = true;
+    uint64_t epoch_ns = trace_epoch_ns.load();
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (auto &buffer : trace_buffers) {
+        out += first ? "" : ",\n";
+        first = false;
+        snprintf(text, sizeof(text), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", buffer->tid);
+        out += text;
+        append_escaped(out, buffer->thread_name.c_str());
+        out += "\"}}";
+
+        uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            const trace_event_t &event = buffer->events[tail & (TRACE_BUFFER_EVENTS - 1)];
+            int64_t begin_ns = (int64_t)(event.begin_ns - epoch_ns);
+
+            out += ",\n{\"name\":\"";
+            append_escaped(out, event.name);
+            snprintf(text, sizeof(text), "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                buffer->tid, begin_ns / 1000.0, event.duration_ns / 1000.0);
+            out += text;
+        }
+        buffer->tail.store(head, std::memory_order_release);
+
+        // Written as it goes, trace of a long session can be large
+        if (out.size() >= (1 << 20)) {
+            fwrite(out.data(), 1, out.size(), file);
+            out.clear();
+        }
+    }
+    out += "\n]}\n";
+
+    bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    ok = fclose(file) == 0 && ok;
+    return ok ? VM_OK : VM_FAILED;
+}
+
+uint64_t sigil::trace::num_dropped() {
+    uint64_t dropped = 0;
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (auto &buffer : trace_buffers) dropped += buffer->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
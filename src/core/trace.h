@@ -0,0 +1,79 @@
+#pragma once
+/*
+    Scoped trace zones, exported as Chrome trace JSON (chrome://tracing, Perfetto).
+
+        void load_assets() {
+            SIGIL_TRACE_ZONE("load-assets");
+            ...
+        }
+
+    Zone is timed with tsc_timer_t from its construction to the end of its
+    scope. Every thread records into its own ring buffer, which only that
+    thread writes and export drains, neither side takes a lock. A full
+    buffer drops new zones until next export, see num_dropped().
+    While tracing is disabled a zone costs one relaxed load, and building
+    with SIGIL_DISABLE_TRACE removes zones altogether.
+*/
+#include <cstdint>
+#include <atomic>
+#include "tsc-clock.h"
+#include "utils.h"
+
+#define TRACE_BUFFER_EVENTS 8192
+#define TRACE_NAME_SIZE 48
+
+namespace sigil::trace {
+    extern std::atomic<bool> enabled;
+
+    // Zones started from now on are recorded, disabling keeps what was recorded
+    void enable(bool enable);
+    inline bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // Shown as name of calling thread in exported trace, and by the OS
+    void set_thread_name(const char *name);
+
+    // Name is copied, begin_ns on tsc::now_ns() timeline
+    void record(const char *name, uint64_t begin_ns, uint64_t duration_ns);
+
+    /**
+    * Write zones recorded since last export to path, and drop them
+    * Returns VM_OK on success, VM_ARG_NULL, or VM_FAILED if file cannot be written
+    */
+    status_t export_json(const char *path);
+
+    // Zones lost to full buffers so far
+    uint64_t num_dropped();
+
+    class zone_t {
+        public:
+        explicit zone_t(const char *name) : name(name) {
+            if (is_enabled()) {
+                active = true;
+                timer.start();
+            }
+        }
+
+        ~zone_t() {
+            if (!active) return;
+            timer.stop();
+            record(name, timer.started_ns(), timer.ns());
+        }
+
+        zone_t(const zone_t&) = delete;
+        zone_t& operator=(const zone_t&) = delete;
+
+        private:
+        const char *name;
+        bool active = false;
+        tsc_timer_t timer;
+    };
+}
+
+#define SIGIL_TRACE_CONCAT_(a, b) a##b
+#define SIGIL_TRACE_CONCAT(a, b) SIGIL_TRACE_CONCAT_(a, b)
+
+#ifdef SIGIL_DISABLE_TRACE
+#define SIGIL_TRACE_ZONE(name) do {} while (0)
+#else
+#define SIGIL_TRACE_ZONE(name) sigil::trace::zone_t SIGIL_TRACE_CONCAT(sigil_trace_zone_, __LINE__)(name)
+#endif
@@ -0,0 +1,102 @@
+#include "tsc-clock.h"
+#include <mutex>
+#include <time.h>
+#if defined(SIGIL_HAS_TSC)
+#include <cpuid.h>
+#endif
+
+#define TSC_CALIBRATION_NS 10000000
+#define TSC_SHIFT 32
+
+std::atomic<uint32_t> sigil::tsc::source = {sigil::tsc::SOURCE_UNCALIBRATED};
+
+// ns = ticks * mult >> TSC_SHIFT, mult is 1 << TSC_SHIFT for fallback clock
+static std::atomic<uint64_t> tsc_mult = {1ull << TSC_SHIFT};
+static std::atomic<uint64_t> tsc_frequency = {1000000000};
+static std::mutex calibrate_mutex;
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#if defined(SIGIL_HAS_TSC)
+static bool has_invariant_tsc() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return edx & (1u << 8);
+}
+
+// Pair of readings taken as close together as possible, best of a few tries
+static void sample(uint64_t &tsc, uint64_t &ns) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 8; i++) {
+        uint64_t before = __rdtsc();
+        uint64_t now = monotonic_ns();
+        uint64_t after = __rdtsc();
+
+        if (after - before < best) {
+            best = after - before;
+            tsc = before + (after - before) / 2;
+            ns = now;
+        }
+    }
+}
+#endif
+
+sigil::status_t sigil::tsc::calibrate(bool allow_tsc) {
+    std::lock_guard<std::mutex> lock(calibrate_mutex);
+
+#if defined(SIGIL_HAS_TSC)
+    if (allow_tsc && has_invariant_tsc()) {
+        uint64_t tsc_begin, ns_begin, tsc_end, ns_end;
+        sample(tsc_begin, ns_begin);
+
+        // Busy wait, sleeping could move thread to a core halfway through
+        while (monotonic_ns() - ns_begin < TSC_CALIBRATION_NS);
+        sample(tsc_end, ns_end);
+
+        uint64_t tsc_delta = tsc_end - tsc_begin;
+        uint64_t ns_delta = ns_end - ns_begin;
+        uint64_t hz = (uint64_t)((unsigned __int128)tsc_delta * 1000000000ull / ns_delta);
+
+        // Anything outside of 100MHz-20GHz means counter is not usable
+        if (hz >= 100000000ull && hz <= 20000000000ull) {
+            tsc_mult.store((uint64_t)(((unsigned __int128)ns_delta << TSC_SHIFT) / tsc_delta));
+            tsc_frequency.store(hz);
+            source.store(SOURCE_TSC);
+            return VM_OK;
+        }
+    }
+#endif
+
+    tsc_mult.store(1ull << TSC_SHIFT);
+    tsc_frequency.store(1000000000);
+    source.store(SOURCE_MONOTONIC);
+    return VM_NOT_SUPPORTED;
+}
+
+uint64_t sigil::tsc::read_slow() {
+    if (source.load(std::memory_order_acquire) == SOURCE_UNCALIBRATED) {
+        static std::once_flag calibrated;
+        std::call_once(calibrated, []() {
+            if (source.load() == SOURCE_UNCALIBRATED) calibrate();
+        });
+    }
+#if defined(SIGIL_HAS_TSC)
+    if (source.load(std::memory_order_relaxed) == SOURCE_TSC) return __rdtsc();
+#endif
+    return monotonic_ns();
+}
+
+uint64_t sigil::tsc::frequency() {
+    if (source.load(std::memory_order_acquire) == SOURCE_UNCALIBRATED) read_slow();
+    return tsc_frequency.load(std::memory_order_relaxed);
+}
+
+uint64_t sigil::tsc::to_ns(uint64_t ticks) {
+    if (source.load(std::memory_order_acquire) == SOURCE_UNCALIBRATED) read_slow();
+    return (uint64_t)(((unsigned __int128)ticks * tsc_mult.load(std::memory_order_relaxed)) >> TSC_SHIFT);
+}
@@ -0,0 +1,69 @@
+#pragma once
+/*
+    Low overhead clock for hot path timing.
+    On x86 with an invariant TSC (constant rate, keeps ticking in sleep
+    states) time stamp counter is read directly, a few ns per read, and
+    converted to ns with a multiply and shift calibrated against
+    CLOCK_MONOTONIC. Without one, ticks are CLOCK_MONOTONIC nanoseconds.
+    Clock calibrates itself on first use, which takes about 10ms.
+*/
+#include <cstdint>
+#include <atomic>
+#include "utils.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SIGIL_HAS_TSC
+#endif
+
+namespace sigil::tsc {
+    enum source_t : uint32_t {
+        SOURCE_UNCALIBRATED,
+        SOURCE_TSC,
+        SOURCE_MONOTONIC,
+    };
+
+    extern std::atomic<uint32_t> source;
+
+    /**
+    * Measure TSC rate, allow_tsc false forces CLOCK_MONOTONIC
+    * Ticks taken before do not mix with ticks taken after, so recalibrate
+    * only while no timers are running
+    * Returns VM_OK if TSC is used, or VM_NOT_SUPPORTED for fallback clock
+    */
+    status_t calibrate(bool allow_tsc = true);
+
+    // Calibrates on first call
+    uint64_t read_slow();
+
+    inline uint64_t ticks() {
+#ifdef SIGIL_HAS_TSC
+        if (source.load(std::memory_order_relaxed) == SOURCE_TSC) return __rdtsc();
+#endif
+        return read_slow();
+    }
+
+    // Ticks per second, as measured by calibrate()
+    uint64_t frequency();
+    uint64_t to_ns(uint64_t ticks);
+    inline uint64_t now_ns() { return to_ns(ticks()); }
+}
+
+namespace sigil {
+    // Like exec_timer, but reads tsc::ticks(), conversion only happens when asked for
+    class tsc_timer_t {
+        public:
+        void start() { start_ticks = tsc::ticks(); }
+        void stop() { stop_ticks = tsc::ticks(); }
+
+        uint64_t ticks() const { return stop_ticks - start_ticks; }
+        uint64_t ns() const { return tsc::to_ns(stop_ticks - start_ticks); }
+        uint64_t us() const { return ns() / 1000; }
+        uint64_t ms() const { return ns() / 1000000; }
+        // Start time on tsc::now_ns() timeline
+        uint64_t started_ns() const { return tsc::to_ns(start_ticks); }
+
+        private:
+        uint64_t start_ticks = 0;
+        uint64_t stop_ticks = 0;
+    };
+}
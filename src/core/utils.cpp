@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "frame-arena.h"
 #include <cstdarg>
 #include <cstdio>
 #include <filesystem>
@@ -14,14 +15,19 @@ int sigil::insert_into_string(std::string &target, const char *format, ...) {
     int written = vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
 
-    // Check if buffer was large enough, otherwise handle dynamic allocation
+    // Check if buffer was large enough, otherwise reformat on the frame arena
     if (written >= static_cast<int>(sizeof(buffer))) {
-        // Resize and reformat with a larger buffer if needed
-        std::unique_ptr<char[]> dynamicBuffer(new char[written + 1]);
-        va_start(args, format);
-        vsnprintf(dynamicBuffer.get(), written + 1, format, args);
-        va_end(args);
-        target += dynamicBuffer.get();
+        // Given back right away, so threads that never reset their arena do not grow it
+        sigil::arena_t &arena = sigil::frame_arena();
+        sigil::arena_t::marker_t mark = arena.mark();
+        char *wide = arena.allocate_array<char>(written + 1);
+        if (wide) {
+            va_start(args, format);
+            vsnprintf(wide, written + 1, format, args);
+            va_end(args);
+            target.append(wide, written);
+        }
+        arena.rewind(mark);
     } else {
         // If within buffer limit, directly append
         target += buffer;
@@ -11,6 +11,7 @@
 #include <memory>
 #include <random>
 #include <string>
+#include <string_view>
 #include <cmath>
 #include <vector>
 
@@ -88,20 +89,6 @@ namespace sigil {
         std::chrono::time_point<std::chrono::high_resolution_clock> ts_render_end; // Timestamp of last render end
     };
 
-    struct name_t {
-        std::string value;
-    };
-
-    struct memstat_t {
-        std::string command;
-        uint64_t vsize;
-        uint64_t rss;
-        uint32_t pid;
-        char state;
-    };
-
-    void get_memstats(memstat_t &result);
-    void print_memstats(const memstat_t &result);
     void print_mem_report();
 
     // Byte viewer, chuck = 16 bytes
@@ -176,7 +163,7 @@ namespace sigil {
 #       ifdef __linux__
         timespec ts;
         ts.tv_sec = (ms / 1000);
-        ts.tv_nsec = (ms % 1000) * 10e6;
+        ts.tv_nsec = (ms % 1000) * 1000000;
 
         int res = 0;
         do {
@@ -188,6 +175,16 @@ namespace sigil {
 #       endif
     }
 
+    // FNV-1a, never returns 0 so it can be used as an empty marker
+    inline uint64_t hash_str(std::string_view str) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (char c : str) {
+            hash ^= (uint8_t)c;
+            hash *= 0x100000001b3ULL;
+        }
+        return hash ? hash : 1;
+    }
+
     inline void boolflip(bool &val) {
         val ^= 1;
     }
@@ -300,13 +297,16 @@ inline const char* sigil::status_to_cstr(sigil::status_t status) {
         case VM_BUSY: return "VM_BUSY";
         case VM_LOCKED: return "VM_LOCKED";
         case VM_FAILED: return "VM_FAILED";
+        case VM_SKIPPED: return "VM_SKIPPED";
         case VM_ARG_NULL: return "VM_ARG_NULL";
         case VM_NOT_FOUND: return "VM_NOT_FOUND";
+        case VM_ARG_INVALID: return "VM_ARG_INVALID";
         case VM_FAILED_ALLOC: return "VM_FAILED_ALLOC";
         case VM_INVALID_ROOT: return "VM_INVALID_ROOT";
         case VM_NOT_SUPPORTED: return "VM_NOT_SUPPORTED";
         case VM_ALREADY_EXISTS: return "VM_ALREADY_EXISTS";
         case VM_SYSTEM_SHUTDOWN: return "VM_SYSTEM_SHUTDOWN";
+        case VM_NOT_IMPLEMENTED: return "VM_NOT_IMPLEMENTED";
         default: return "VM_UNKNOWN";
     }
 }
\ No newline at end of file
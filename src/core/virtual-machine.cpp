@@ -1,92 +1,922 @@
 #include "virtual-machine.h"
 #include "system.h"
 #include "utils.h"
+#include "trace.h"
+#include "proc-stats.h"
+#include "log.h"
+#include "mem-track.h"
+#include <condition_variable>
 #include <cstdint>
+#include <unistd.h>
 #include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+using sigil::virtual_machine::vm_phase_t;
 
-static std::vector<sigil::vmnode_t*> vmnode_lut;
 static sigil::vmnode_t *platform = nullptr;
 static sigil::vmnode_t *runtime = nullptr;
 static sigil::vmnode_t *vmroot = nullptr;
 static bool debug_mode = false;
 static uint32_t uptime_seconds;
 static std::string hostname;
-static uint32_t commands_run = 0;
+static std::atomic<uint32_t> commands_run = {0};
 static uint32_t num_workers = 0;
 static uint32_t hw_cores = 0;
 static uint32_t num_nodes = 0;
 
 // Vector of all threads, must be joined and cleaned
 static std::vector<std::thread*> vm_guest_threads;
+static std::mutex vm_threads_mutex;
 
 // Global state of VM, by default no vm active, so vm not found
 static sigil::status_t vm_state = sigil::VM_NOT_FOUND;
 
-//
+// Lifecycle state machine, phase and flags change under lifecycle_mutex only
+static std::mutex lifecycle_mutex;
+static std::condition_variable lifecycle_cv;
+static std::atomic<vm_phase_t> vm_phase = {sigil::virtual_machine::VM_PHASE_OFFLINE};
 static bool has_shutdown_handler = false;
 static bool shutdown_requested = false;
-static bool vm_initialized = false;
 
+// Handed to every spawned task, replaced on each initialize
+static sigil::cancel_token_t vm_cancel_token;
 
-sigil::status_t sigil::virtual_machine::spawn_thread(void (*task)(void)) {
+// Worker pool for short jobs, lives from initialize to deinitialize
+// Callers pin it through executor_rcu, so deinitialize frees it only after they are gone
+static std::atomic<sigil::executor_t*> vm_executor = {nullptr};
+static sigil::rcu_domain_t executor_rcu;
+
+struct vm_executor_ref_t {
+    uint32_t slot;
+    sigil::executor_t *executor;
+
+    vm_executor_ref_t() : slot(executor_rcu.read_lock()),
+                          executor(vm_executor.load(std::memory_order_acquire)) {}
+    ~vm_executor_ref_t() { executor_rcu.read_unlock(slot); }
+    vm_executor_ref_t(const vm_executor_ref_t&) = delete;
+    vm_executor_ref_t& operator=(const vm_executor_ref_t&) = delete;
+};
+
+// Debug mode latencies, initialize to ready and shutdown request to exit
+static sigil::exec_timer startup_timer;
+static sigil::exec_timer shutdown_timer;
+
+// Timer wheel, driven by its own thread, callbacks are handed to worker pool
+static sigil::timer_wheel_t *vm_timers = nullptr;
+static std::thread vm_timers_thread;
+static std::mutex timers_mutex;
+static std::condition_variable timers_cv;
+static bool timers_stopping = false;
+static std::chrono::steady_clock::time_point timers_epoch;
+
+// Registered commands, trie targets point into vm_commands, which dispatch to mailbox of owner node
+#define VM_COMMAND_QUEUE_SIZE 1024
+// Longest sleep of a command waiting for room in owner queue before it checks VM phase
+#define VM_COMMAND_WAIT_MS 10
+#define VM_STREAM_BATCH_SIZE 4096
+#define VM_STREAM_OUTPUT_SIZE (1 << 16)
+static sigil::parser::syntax_node vm_translator;
+static std::vector<std::unique_ptr<sigil::vmcommand_descriptor_t>> vm_commands;
+static std::mutex commands_mutex;
+
+// Travels through owner mailbox as a vmcall_t, deleted once it ran
+struct vmcommand_job_t {
+    sigil::parser::command_t command;
+    sigil::vmcommand_handler_ft handler;
+    std::promise<sigil::status_t> result;
+    uint64_t queued_ticks;
+};
+
+// Kept across VM restarts, like commands_run
+static sigil::windowed_histogram_t command_latency;
+
+// Registered modules, initialized in dependency order by initialize_modules()
+struct vmmodule_t {
+    sigil::vmmodule_descriptor_t info;
+    sigil::status_t status = sigil::VM_IDLE;
+    std::vector<vmmodule_t*> dependents;
+    std::atomic<uint32_t> deps_left = {0};
+    std::atomic<bool> deps_failed = {false};
+    // Debug timeline, relative to start of initialize_modules()
+    uint64_t start_us = 0;
+    uint64_t end_us = 0;
+};
+
+static std::vector<std::unique_ptr<vmmodule_t>> vm_modules;
+// Initialized modules in the order they got ready, deinitialized in reverse
+static std::vector<vmmodule_t*> vm_modules_ready;
+static std::mutex modules_mutex;
+
+// Caller holds lifecycle_mutex
+static void set_phase(vm_phase_t phase) {
+    vm_phase.store(phase, std::memory_order_release);
+    lifecycle_cv.notify_all();
+}
+
+sigil::status_t sigil::virtual_machine::spawn_thread(void (*task)(sigil::cancel_token_t token)) {
     if (!task) return VM_ARG_NULL;
 
-    std::thread *temp_thread_ptr = new std::thread(task);
+    // Checked under threads mutex, so deinitialize cannot miss the new thread
+    std::lock_guard<std::mutex> lock(vm_threads_mutex);
+    vm_phase_t phase = vm_phase.load(std::memory_order_acquire);
+    if (phase == VM_PHASE_OFFLINE) return VM_NOT_FOUND;
+    if (phase == VM_PHASE_STOPPING) return VM_SYSTEM_SHUTDOWN;
+
+    std::thread *temp_thread_ptr = new std::thread(task, vm_cancel_token);
     if (!temp_thread_ptr) return VM_FAILED_ALLOC;
     vm_guest_threads.push_back(temp_thread_ptr);
     return VM_OK;
 }
 
+sigil::status_t sigil::virtual_machine::submit(std::function<void()> job) {
+    if (!job) return VM_ARG_NULL;
+
+    vm_executor_ref_t ref;
+    if (!ref.executor || !ref.executor->submit(std::move(job))) return VM_NOT_FOUND;
+    return VM_OK;
+}
+
+// Runs on worker pool, drain_scheduled keeps it the only consumer of the mailbox
+static void drain_mailbox(sigil::vmnode_t *node) {
+    SIGIL_MEM_TAG(sigil::MEM_TAG_VMNODE);
+    sigil::vmmailbox_t *mailbox = node->mailbox.load(std::memory_order_acquire);
+    sigil::vmmessage_t batch[VM_MAILBOX_BATCH];
+    sigil::vmmetrics_t *metrics = sigil::metrics::of(node);
+    uint64_t started = sigil::tsc::ticks();
+    int64_t heap_before = sigil::memtrack::thread_balance();
+    uint64_t num_tasks = 0;
+
+    while (true) {
+        size_t count;
+        while ((count = mailbox->queue.pop_batch(batch, VM_MAILBOX_BATCH)) > 0) {
+            mailbox->notify_room();
+            // Calls split batch, so handler sees messages in order with them
+            size_t first = 0;
+            for (size_t i = 0; i < count; i++) {
+                sigil::vmcall_t call;
+                if (batch[i].kind != VM_MESSAGE_CALL || !batch[i].get(call)) continue;
+
+                if (i > first && mailbox->handler) mailbox->handler(node, batch + first, i - first);
+                call.fn(call.ctx, node);
+                num_tasks += 1 + (i > first);
+                first = i + 1;
+            }
+            if (count > first && mailbox->handler) mailbox->handler(node, batch + first, count - first);
+            num_tasks += count > first;
+        }
+
+        // Message posted after last pop, but before flag was cleared, is ours to handle
+        mailbox->drain_scheduled.store(false);
+        if (mailbox->queue.empty() || mailbox->drain_scheduled.exchange(true)) break;
+    }
+
+    metrics->cpu_ns.add(sigil::tsc::to_ns(sigil::tsc::ticks() - started));
+    metrics->tasks.add(num_tasks);
+    // Whatever handlers allocated and kept, freeing memory of others counts against it
+    metrics->memory.add(sigil::memtrack::thread_balance() - heap_before);
+}
+
+sigil::status_t sigil::virtual_machine::post_message(sigil::vmnode_handle_t target,
+                                                     const sigil::vmmessage_t &message) {
+    vmnode_read_guard_t guard;
+
+    vmnode_t *node = vmnode_t::from_handle(target);
+    if (!node) return VM_NOT_FOUND;
+
+    vmmailbox_t *mailbox = node->mailbox.load(std::memory_order_acquire);
+    if (!mailbox) return VM_NOT_SUPPORTED;
+    if (!mailbox->on_pool) return mailbox->queue.push(message) ? VM_OK : VM_BUSY;
+
+    // Checked before queueing, message nobody can drain is refused instead of left behind
+    // Reference keeps node alive until drain job is done, even if it gets removed
+    vm_executor_ref_t ref;
+    if (!ref.executor || ref.executor->is_closed() || !node->try_acquire()) return VM_NOT_FOUND;
+
+    if (!mailbox->queue.push(message)) {
+        node->release();
+        return VM_BUSY;
+    }
+    if (mailbox->drain_scheduled.exchange(true)) {
+        node->release();
+        return VM_OK;
+    }
+
+    // Lost race with shutdown, message stays queued and node teardown handles it
+    if (!ref.executor->submit([node]() {
+        drain_mailbox(node);
+        node->release();
+    })) {
+        node->release();
+    }
+    return VM_OK;
+}
+
+// Same pattern written with different spacing compares equal
+static std::string join_words(const std::vector<std::string> &words) {
+    std::string joined;
+    for (auto &word : words) {
+        if (!joined.empty()) joined += ' ';
+        joined += word;
+    }
+    return joined;
+}
+
+sigil::status_t sigil::virtual_machine::register_command(sigil::vmcommand_descriptor_t command_info) {
+    if (!command_info.handler) return VM_ARG_NULL;
+
+    parser::command_t pattern;
+    if (parser::parse_command(command_info.pattern.view(), pattern) != VM_OK) return VM_ARG_INVALID;
+    command_info.pattern = join_words(pattern.body);
+
+    {
+        vmnode_read_guard_t guard;
+        vmnode_t *owner = vmnode_t::from_handle(command_info.owner);
+        if (!owner) return VM_NOT_FOUND;
+
+        // Commands share mailbox with messages, which owner does not have to handle
+        status_t status = owner->open_mailbox(VM_COMMAND_QUEUE_SIZE, nullptr, true);
+        if (status == VM_ALREADY_EXISTS && !owner->mailbox.load()->on_pool) return VM_NOT_SUPPORTED;
+    }
+
+    std::lock_guard<std::mutex> lock(commands_mutex);
+    auto entry = std::make_unique<vmcommand_descriptor_t>(std::move(command_info));
+    status_t status = parser::register_command(vm_translator, std::move(pattern), entry.get());
+    if (status == VM_OK) vm_commands.push_back(std::move(entry));
+    return status;
+}
+
+sigil::status_t sigil::virtual_machine::unregister_command(const char *pattern) {
+    if (!pattern) return VM_ARG_NULL;
+
+    parser::command_t command;
+    if (parser::parse_command(pattern, command) != VM_OK) return VM_ARG_INVALID;
+
+    // Pattern never interned was never registered
+    sigil::name_t normalized;
+    if (!sigil::name_t::find(join_words(command.body), normalized)) return VM_NOT_FOUND;
+
+    std::lock_guard<std::mutex> lock(commands_mutex);
+    for (auto it = vm_commands.begin(); it != vm_commands.end(); it++) {
+        if ((*it)->pattern != normalized) continue;
+        parser::unregister_command(vm_translator, command);
+        vm_commands.erase(it);
+        return VM_OK;
+    }
+    return VM_NOT_FOUND;
+}
+
+// Commands are taken while starting up too, modules may run them
+static bool accepts_commands() {
+    vm_phase_t phase = vm_phase.load(std::memory_order_acquire);
+    return phase == sigil::virtual_machine::VM_PHASE_STARTING || phase == sigil::virtual_machine::VM_PHASE_READY;
+}
+
+static void run_command_job(void *ctx, sigil::vmnode_t *node) {
+    vmcommand_job_t *job = (vmcommand_job_t*)ctx;
+
+    // Discarded when owner got destroyed, either on its own or with whole VM
+    sigil::status_t status = accepts_commands() ? sigil::VM_NOT_FOUND : sigil::VM_SYSTEM_SHUTDOWN;
+    if (node) status = job->handler(node, job->command);
+
+    uint64_t now = sigil::tsc::ticks();
+    command_latency.record(sigil::tsc::to_ns(now - job->queued_ticks), sigil::tsc::to_ns(now));
+    job->result.set_value(status);
+    commands_run.fetch_add(1, std::memory_order_relaxed);
+    delete job;
+}
+
+static std::future<sigil::status_t> command_result(sigil::status_t status) {
+    std::promise<sigil::status_t> result;
+    result.set_value(status);
+    return result.get_future();
+}
+
+// Caller holds commands_mutex
+static sigil::status_t validate_command(sigil::parser::command_t &command,
+                                        sigil::vmcommand_descriptor_t **command_info) {
+    void *target = nullptr;
+    sigil::status_t status = sigil::parser::translate(vm_translator, command, &target);
+    *command_info = (sigil::vmcommand_descriptor_t*)target;
+    return status;
+}
+
+// Sleeps until drain job of owner makes room, gives up once VM stops
+static sigil::status_t post_when_room(sigil::vmnode_handle_t owner, const sigil::vmmessage_t &message) {
+    sigil::vmnode_t *node;
+    {
+        sigil::vmnode_read_guard_t guard;
+        node = sigil::vmnode_t::from_handle(owner);
+        if (!node || !node->try_acquire()) return sigil::VM_NOT_FOUND;
+    }
+    sigil::vmmailbox_t *mailbox = node->mailbox.load(std::memory_order_acquire);
+
+    // Counted before posting again, so a drain between the two cannot miss us
+    mailbox->num_waiting.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    sigil::status_t status;
+    {
+        std::unique_lock<std::mutex> lock(mailbox->room_mutex);
+        while ((status = sigil::virtual_machine::post_message(owner, message)) == sigil::VM_BUSY &&
+               vm_phase.load(std::memory_order_acquire) != sigil::virtual_machine::VM_PHASE_STOPPING) {
+            mailbox->room_cv.wait_for(lock, std::chrono::milliseconds(VM_COMMAND_WAIT_MS));
+        }
+    }
+    mailbox->num_waiting.fetch_sub(1);
+    node->release();
+    return status;
+}
+
+// Full owner queue is waited out, unless caller is a pool job that could be the one to drain it
+static std::future<sigil::status_t> dispatch_command(vmcommand_job_t *job, sigil::vmnode_handle_t owner) {
+    std::future<sigil::status_t> result = job->result.get_future();
+    sigil::vmmessage_t message = sigil::vmmessage_t::make(VM_MESSAGE_CALL, sigil::vmcall_t{run_command_job, job});
+
+    // Pinned for whole dispatch, waiting for room gives up once shutdown starts
+    vm_executor_ref_t ref;
+    sigil::status_t status = sigil::VM_SYSTEM_SHUTDOWN;
+    if (ref.executor && accepts_commands()) {
+        status = sigil::virtual_machine::post_message(owner, message);
+        if (status == sigil::VM_BUSY && !ref.executor->is_worker()) status = post_when_room(owner, message);
+    }
+    if (status == sigil::VM_OK) return result;
+
+    job->result.set_value(status);
+    delete job;
+    return result;
+}
+
+std::vector<std::future<sigil::status_t>> sigil::virtual_machine::run_commands(std::vector<sigil::parser::command_t> commands) {
+    std::vector<std::future<status_t>> results(commands.size());
+    std::vector<vmcommand_job_t*> jobs(commands.size(), nullptr);
+    std::vector<vmnode_handle_t> owners(commands.size());
+
+    if (!accepts_commands()) {
+        for (auto &result : results) result = command_result(VM_SYSTEM_SHUTDOWN);
+        return results;
+    }
+
+    // Whole batch is validated under one lock, queueing happens without it
+    uint64_t queued_ticks = tsc::ticks();
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        for (size_t i = 0; i < commands.size(); i++) {
+            vmcommand_descriptor_t *command_info;
+            status_t status = validate_command(commands[i], &command_info);
+            if (status != VM_OK) {
+                results[i] = command_result(status);
+                continue;
+            }
+
+            jobs[i] = new vmcommand_job_t;
+            jobs[i]->command = std::move(commands[i]);
+            jobs[i]->handler = command_info->handler;
+            jobs[i]->queued_ticks = queued_ticks;
+            owners[i] = command_info->owner;
+        }
+    }
+
+    for (size_t i = 0; i < commands.size(); i++) {
+        if (jobs[i]) results[i] = dispatch_command(jobs[i], owners[i]);
+    }
+    return results;
+}
+
+const sigil::windowed_histogram_t& sigil::virtual_machine::get_command_latency() {
+    return command_latency;
+}
+
+std::future<sigil::status_t> sigil::virtual_machine::run_command(sigil::parser::command_t command) {
+    std::vector<parser::command_t> batch;
+    batch.push_back(std::move(command));
+    return std::move(run_commands(std::move(batch))[0]);
+}
+
+std::future<sigil::status_t> sigil::virtual_machine::run_command(std::string_view line) {
+    parser::command_t command;
+    status_t status = parser::parse_command(line, command);
+    if (status != VM_OK) return command_result(status == VM_SKIPPED ? VM_ARG_INVALID : status);
+    return run_command(std::move(command));
+}
+
+struct stream_entry_t {
+    uint64_t line;
+    std::future<sigil::status_t> result;
+};
+
+static bool write_output(int fd, std::string &output) {
+    size_t written = 0;
+    while (written < output.size()) {
+        ssize_t count = write(fd, output.data() + written, output.size() - written);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        written += count;
+    }
+    output.clear();
+    return true;
+}
+
+static void collect_results(std::vector<stream_entry_t> &entries, std::string &output) {
+    char text[64];
+    for (auto &entry : entries) {
+        int length = snprintf(text, sizeof(text), "%lu %s\n", entry.line, sigil::status_to_cstr(entry.result.get()));
+        output.append(text, length);
+    }
+    entries.clear();
+}
+
+sigil::status_t sigil::virtual_machine::run_command_stream(int input_fd, int output_fd, uint64_t *num_commands,
+                                                          const sigil::cancel_token_t *cancel) {
+    // Asked on every refill and while waiting for input, so shutdown never waits on an open pipe
+    parser::line_reader_t reader(input_fd, 1 << 16, [cancel]() {
+        vm_phase_t phase = vm_phase.load(std::memory_order_acquire);
+        return (phase != VM_PHASE_STARTING && phase != VM_PHASE_READY) || (cancel && cancel->is_cancelled());
+    });
+    std::vector<parser::command_t> batch;
+    // One entry per line with a command, batch[i] belongs to entries[slots[i]]
+    std::vector<stream_entry_t> entries;
+    std::vector<size_t> slots;
+    // Previous batch, still running while next one is read
+    std::vector<stream_entry_t> running;
+    std::string output;
+    uint64_t line_number = 0;
+    uint64_t count = 0;
+    status_t status = VM_OK;
+
+    batch.reserve(VM_STREAM_BATCH_SIZE);
+    output.reserve(VM_STREAM_OUTPUT_SIZE * 2);
+
+    auto queue_batch = [&]() {
+        count += batch.size();
+        std::vector<std::future<status_t>> results = run_commands(std::move(batch));
+        for (size_t i = 0; i < results.size(); i++) entries[slots[i]].result = std::move(results[i]);
+        batch.clear();
+        slots.clear();
+
+        collect_results(running, output);
+        running.swap(entries);
+    };
+
+    while (true) {
+        std::string_view line;
+        status_t read_status = reader.next(line, false);
+
+        // Input has nothing ready, everything read so far runs and its results go out before blocking
+        if (read_status == VM_BUSY) {
+            if (!running.empty() || !entries.empty()) {
+                queue_batch();
+                collect_results(running, output);
+            }
+            if (!write_output(output_fd, output)) {
+                status = VM_FAILED;
+                break;
+            }
+            read_status = reader.next(line, true);
+        }
+
+        if (read_status == VM_SKIPPED) break;
+        if (read_status != VM_OK) {
+            status = read_status;
+            break;
+        }
+        line_number++;
+
+        parser::command_t command;
+        status_t parse_status = parser::parse_command(line, command);
+        if (parse_status == VM_SKIPPED) continue;
+
+        if (parse_status == VM_OK) {
+            slots.push_back(entries.size());
+            batch.push_back(std::move(command));
+        }
+        entries.push_back({line_number, parse_status == VM_OK ? std::future<status_t>() : command_result(parse_status)});
+        if (entries.size() < VM_STREAM_BATCH_SIZE) continue;
+
+        queue_batch();
+        if (output.size() >= VM_STREAM_OUTPUT_SIZE && !write_output(output_fd, output)) {
+            status = VM_FAILED;
+            break;
+        }
+    }
+
+    queue_batch();
+    collect_results(running, output);
+    if (!write_output(output_fd, output) && status == VM_OK) status = VM_FAILED;
+
+    if (num_commands) *num_commands = count;
+    return status;
+}
+
+static uint64_t timers_now_us() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - timers_epoch).count();
+}
+
+static void run_timers() {
+    sigil::trace::set_thread_name("vm-timers");
+    std::vector<std::function<void()>> due;
+    std::unique_lock<std::mutex> lock(timers_mutex);
+
+    while (!timers_stopping) {
+        vm_timers->advance(timers_now_us(), due);
+
+        if (!due.empty()) {
+            lock.unlock();
+            vm_executor_ref_t ref;
+            for (auto &callback : due) if (ref.executor) ref.executor->submit(std::move(callback));
+            due.clear();
+            lock.lock();
+            continue;
+        }
+
+        // Woken up early whenever a timer is scheduled
+        uint64_t wakeup = vm_timers->next_wakeup_us();
+        if (wakeup == UINT64_MAX) timers_cv.wait(lock);
+        else timers_cv.wait_until(lock, timers_epoch + std::chrono::microseconds(wakeup));
+    }
+}
+
+sigil::status_t sigil::virtual_machine::schedule_timer(uint64_t delay_us, uint64_t period_us,
+                                                       std::function<void()> callback,
+                                                       sigil::timer_handle_t *handle) {
+    if (!callback) return VM_ARG_NULL;
+
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    if (!vm_timers || timers_stopping) return VM_NOT_FOUND;
+
+    sigil::timer_handle_t new_timer = vm_timers->schedule(timers_now_us() + delay_us, period_us, std::move(callback));
+    if (new_timer.is_null()) return VM_FAILED_ALLOC;
+
+    if (handle) *handle = new_timer;
+    timers_cv.notify_one();
+    return VM_OK;
+}
+
+sigil::status_t sigil::virtual_machine::cancel_timer(sigil::timer_handle_t handle) {
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    if (!vm_timers) return VM_NOT_FOUND;
+
+    return vm_timers->cancel(handle) ? VM_OK : VM_NOT_FOUND;
+}
+
+sigil::executor_t* sigil::virtual_machine::get_executor() {
+    return vm_executor.load(std::memory_order_acquire);
+}
+
 bool sigil::virtual_machine::get_debug_mode() {
     return debug_mode;
 }
 
 
 bool sigil::virtual_machine::is_active() {
-    if (!vmroot) return false;
-    if (!vm_initialized) return false;
-    if (!has_shutdown_handler) return false;
-    return true;
+    return vm_phase.load(std::memory_order_acquire) == VM_PHASE_READY;
 }
 
 sigil::status_t sigil::virtual_machine::flush() {
     if (!vmroot) return VM_INVALID_ROOT;
 
-    printf("virtual-machine: flushing not implemented yet\n");
+    SIGIL_LOG_WARN("virtual-machine: flushing not implemented yet");
     return VM_NOT_IMPLEMENTED;
 }
 
-sigil::status_t sigil::virtual_machine::add_platform_node(sigil::vmnode_descriptor_t node_info) {
-    if (!platform) return VM_INVALID_ROOT;
+static sigil::status_t add_node(sigil::vmnode_t *master, sigil::vmnode_descriptor_t &node_info,
+                                 sigil::vmnode_handle_t *handle) {
+    if (!master) return sigil::VM_INVALID_ROOT;
 
-    vmnode_t *new_node = platform->spawn_subnode(node_info.name.value.c_str());
+    sigil::vmnode_t *new_node = master->spawn_subnode(node_info.name.c_str());
+    if (!new_node) return sigil::VM_ALREADY_EXISTS;
 
+    new_node->start = node_info.start;
+    new_node->stop = node_info.stop;
+    if (handle) *handle = new_node->handle;
 
-    printf("virtual-machine: platform registered node %s\n", node_info.name.value.c_str());
-    return VM_OK;
+    SIGIL_LOG_INFO("virtual-machine: %s registered node %s",
+        master->name.c_str(), node_info.name.c_str());
+    return sigil::VM_OK;
+}
+
+sigil::status_t sigil::virtual_machine::add_platform_node(sigil::vmnode_descriptor_t node_info,
+                                                          sigil::vmnode_handle_t *handle) {
+    return add_node(platform, node_info, handle);
+}
+
+sigil::status_t sigil::virtual_machine::add_runtime_node(sigil::vmnode_descriptor_t node_info,
+                                                         sigil::vmnode_handle_t *handle) {
+    return add_node(runtime, node_info, handle);
+}
+
+sigil::status_t sigil::virtual_machine::remove_node(sigil::vmnode_handle_t handle) {
+    if (!vmroot) return VM_NOT_FOUND;
+
+    // Node stays allocated until deinit_self is done, even if removed concurrently
+    vmnode_read_guard_t guard;
+    vmnode_t *node = vmnode_t::from_handle(handle);
+    if (!node) return VM_NOT_FOUND;
+    if (node == vmroot || node == runtime || node == platform) return VM_LOCKED;
+
+    return node->deinit_self();
 }
 
-sigil::status_t sigil::virtual_machine::add_runtime_node(sigil::vmnode_descriptor_t node_info) {
-    if (!runtime) return VM_INVALID_ROOT;
+sigil::status_t sigil::virtual_machine::register_module(sigil::vmmodule_descriptor_t module_info) {
+    if (!module_info.initialize) return VM_ARG_NULL;
+    if (!is_active() && vm_phase.load() != VM_PHASE_STARTING) return VM_NOT_FOUND;
 
-    vmnode_t *new_node = runtime->spawn_subnode(node_info.name.value.c_str());
+    std::lock_guard<std::mutex> lock(modules_mutex);
+    for (auto &m : vm_modules) {
+        if (m->info.name == module_info.name) return VM_ALREADY_EXISTS;
+    }
 
-    printf("virtual-machine: runtime registered node %s\n", node_info.name.value.c_str());
+    vm_modules.emplace_back(new vmmodule_t());
+    vm_modules.back()->info = std::move(module_info);
     return VM_OK;
 }
 
+// State of one initialize_modules() call
+struct module_init_run_t {
+    sigil::executor_t *executor = nullptr;
+    std::chrono::steady_clock::time_point t0;
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t num_done = 0;
+    // Ready main_thread modules, run by initialize_modules() itself
+    std::vector<vmmodule_t*> main_ready;
+
+    uint64_t elapsed_us() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - t0).count();
+    }
+};
+
+static void launch_module(std::shared_ptr<module_init_run_t> run, vmmodule_t *m);
+
+// Ready module goes to the pool, or to the calling thread if it is bound to it
+static void dispatch_module(std::shared_ptr<module_init_run_t> run, vmmodule_t *m) {
+    if (!m->info.main_thread) {
+        run->executor->submit([run, m]() { launch_module(run, m); });
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(run->done_mutex);
+    run->main_ready.push_back(m);
+    run->done_cv.notify_all();
+}
+
+// Runs or skips a module, then releases its dependents
+static void launch_module(std::shared_ptr<module_init_run_t> run, vmmodule_t *m) {
+    if (m->deps_failed) {
+        m->status = sigil::VM_SKIPPED;
+        m->start_us = m->end_us = run->elapsed_us();
+    } else {
+        sigil::trace::zone_t zone(m->info.name.c_str());
+        m->start_us = run->elapsed_us();
+        m->status = m->info.initialize();
+        m->end_us = run->elapsed_us();
+    }
+
+    // Listed before dependents can start, so deinitialize runs in reverse dependency order
+    if (m->status == sigil::VM_OK) {
+        std::lock_guard<std::mutex> lock(run->done_mutex);
+        vm_modules_ready.push_back(m);
+    }
+
+    for (auto d : m->dependents) {
+        if (m->status != sigil::VM_OK) d->deps_failed = true;
+        if (d->deps_left.fetch_sub(1) == 1) dispatch_module(run, d);
+    }
+
+    std::lock_guard<std::mutex> lock(run->done_mutex);
+    run->num_done++;
+    run->done_cv.notify_all();
+}
+
+static vmmodule_t* find_module(sigil::name_t name) {
+    for (auto &m : vm_modules) if (m->info.name == name) return m.get();
+    return nullptr;
+}
+
+sigil::status_t sigil::virtual_machine::initialize_modules() {
+    SIGIL_TRACE_ZONE("vm-initialize-modules");
+    SIGIL_MEM_TAG(sigil::MEM_TAG_VM);
+    vm_executor_ref_t ref;
+    sigil::executor_t *executor = ref.executor;
+    if (!executor) return VM_NOT_FOUND;
+    // Waiting on pool from within the pool could take the last free worker
+    if (executor->is_worker()) return VM_LOCKED;
+
+    std::lock_guard<std::mutex> lock(modules_mutex);
+
+    // Wire up modules not initialized yet, ready dependencies are already satisfied
+    std::vector<vmmodule_t*> pending;
+    for (auto &m : vm_modules) if (m->status == VM_IDLE) {
+        m->dependents.clear();
+        m->deps_left = 0;
+        m->deps_failed = false;
+        pending.push_back(m.get());
+    }
+    if (pending.empty()) return VM_OK;
+
+    for (auto m : pending) for (auto &dep_name : m->info.depends_on) {
+        vmmodule_t *dep = find_module(dep_name);
+        if (!dep) {
+            SIGIL_LOG_ERROR("virtual-machine: module %s depends on unknown module %s",
+                m->info.name.c_str(), dep_name.c_str());
+            return VM_NOT_FOUND;
+        }
+
+        if (dep->status == VM_IDLE) {
+            dep->dependents.push_back(m);
+            m->deps_left++;
+        } else if (dep->status != VM_OK) {
+            m->deps_failed = true;
+        }
+    }
+
+    // Dry run of the schedule, whatever never gets ready sits on a cycle
+    {
+        std::vector<uint32_t> deps_left;
+        std::vector<vmmodule_t*> ready;
+        for (auto m : pending) {
+            deps_left.push_back(m->deps_left);
+            if (m->deps_left == 0) ready.push_back(m);
+        }
+
+        size_t num_ready = 0;
+        while (!ready.empty()) {
+            vmmodule_t *m = ready.back();
+            ready.pop_back();
+            num_ready++;
+
+            for (auto d : m->dependents) {
+                size_t i = std::find(pending.begin(), pending.end(), d) - pending.begin();
+                if (--deps_left[i] == 0) ready.push_back(d);
+            }
+        }
+
+        if (num_ready != pending.size()) {
+            SIGIL_LOG_ERROR("virtual-machine: dependency cycle between modules");
+            return VM_ARG_INVALID;
+        }
+    }
+
+    // Shared with pool jobs, the last one may still be unwinding when we return
+    auto run = std::make_shared<module_init_run_t>();
+    run->executor = executor;
+    run->t0 = std::chrono::steady_clock::now();
+
+    for (auto m : pending) {
+        if (m->deps_left == 0) dispatch_module(run, m);
+    }
+
+    {
+        std::unique_lock<std::mutex> done_lock(run->done_mutex);
+        while (run->num_done != pending.size()) {
+            run->done_cv.wait(done_lock, [&]() { return run->num_done == pending.size() || !run->main_ready.empty(); });
+
+            while (!run->main_ready.empty()) {
+                vmmodule_t *m = run->main_ready.back();
+                run->main_ready.pop_back();
+                done_lock.unlock();
+                launch_module(run, m);
+                done_lock.lock();
+            }
+        }
+    }
+
+    sigil::status_t status = VM_OK;
+    uint64_t serial_us = 0;
+    for (auto m : pending) {
+        if (m->status != VM_OK) status = VM_FAILED;
+        serial_us += m->end_us - m->start_us;
+    }
+
+    if (debug_mode) {
+        std::sort(pending.begin(), pending.end(),
+            [](const vmmodule_t *a, const vmmodule_t *b) { return a->start_us < b->start_us; });
+
+        for (auto m : pending) {
+            SIGIL_LOG_DEBUG("virtual-machine: module %-12s %8luus -> %8luus %s", m->info.name.c_str(),
+                m->start_us, m->end_us, sigil::status_to_cstr(m->status));
+        }
+        SIGIL_LOG_DEBUG("virtual-machine: modules ready in %luus (%luus if serial)", run->elapsed_us(), serial_us);
+    }
+
+    return status;
+}
+
+sigil::status_t sigil::virtual_machine::get_module_status(const char *name) {
+    if (!name) return VM_ARG_NULL;
+
+    // Name never interned belongs to no module, and caller input is not added to the table
+    sigil::name_t module_name;
+    if (!sigil::name_t::find(name, module_name)) return VM_NOT_FOUND;
+
+    std::lock_guard<std::mutex> lock(modules_mutex);
+    vmmodule_t *m = find_module(module_name);
+    return m ? m->status : VM_NOT_FOUND;
+}
+
+// Reverse of the order modules got ready in, so dependents go first
+static void deinitialize_modules() {
+    std::lock_guard<std::mutex> lock(modules_mutex);
+
+    for (auto it = vm_modules_ready.rbegin(); it != vm_modules_ready.rend(); it++) {
+        vmmodule_t *m = *it;
+        if (!m->info.deinitialize) continue;
+
+        sigil::status_t status = m->info.deinitialize();
+        if (status != sigil::VM_OK) {
+            SIGIL_LOG_ERROR("virtual-machine: module %s failed to deinitialize (%s)",
+                m->info.name.c_str(), sigil::status_to_cstr(status));
+        }
+    }
+
+    vm_modules_ready.clear();
+    vm_modules.clear();
+}
+
+// Commands of VM itself, owned by vmroot
+static sigil::status_t command_treeinfo(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    return sigil::virtual_machine::vminfo();
+}
+
+// Prints latest background sample, takes one first if there is none yet
+static sigil::status_t command_memstats(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::procstat::snapshot_t usage;
+    if (!sigil::procstat::read(usage)) {
+        sigil::status_t status = sigil::procstat::sample();
+        if (status != sigil::VM_OK) return status;
+        sigil::procstat::read(usage);
+    }
+    sigil::procstat::print(usage);
+    sigil::memtrack::print();
+    return sigil::VM_OK;
+}
+
+// trace on|off, zones recorded meanwhile are kept until saved
+static sigil::status_t command_trace(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::trace::enable(command.args[0].number != 0);
+    return sigil::VM_OK;
+}
+
+static sigil::status_t command_trace_save(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::status_t status = sigil::trace::export_json(command.args[0].text.c_str());
+    if (status != sigil::VM_OK) SIGIL_LOG_ERROR("virtual-machine: failed to write trace %s", command.args[0].text.c_str());
+    return status;
+}
+
+static sigil::status_t command_latency_stats(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::histogram_t window;
+    command_latency.snapshot(window, 1000000000ull);
+    printf("virtual-machine: command latency last 1s   %s\n", window.summary().c_str());
+    command_latency.snapshot(window, command_latency.window_max_ns());
+    printf("virtual-machine: command latency last 10s  %s\n", window.summary().c_str());
+    printf("virtual-machine: command latency all time %s\n", command_latency.all_time().summary().c_str());
+    return sigil::VM_OK;
+}
+
+static sigil::status_t register_builtin_commands() {
+    static const struct {
+        const char *pattern;
+        sigil::vmcommand_handler_ft handler;
+    } builtins[] = {
+        {"treeinfo", command_treeinfo},
+        {"memstats", command_memstats},
+        {"latency", command_latency_stats},
+        {"trace <bool>", command_trace},
+        {"trace save <string>", command_trace_save},
+    };
+
+    for (auto &builtin : builtins) {
+        sigil::vmcommand_descriptor_t command_info;
+        command_info.pattern = builtin.pattern;
+        command_info.owner = vmroot->handle;
+        command_info.handler = builtin.handler;
+
+        sigil::status_t status = sigil::virtual_machine::register_command(command_info);
+        if (status != sigil::VM_OK) return status;
+    }
+    return sigil::VM_OK;
+}
+
 sigil::status_t sigil::virtual_machine::initialize(int argc, const char *argv[]) {
     if (vmroot) return VM_ALREADY_EXISTS;
 
     if (argc > 0 && argv == nullptr) return sigil::VM_ARG_NULL;
 
+    SIGIL_TRACE_ZONE("vm-initialize");
+    SIGIL_MEM_TAG(sigil::MEM_TAG_VM);
     sigil::exec_timer tmr;
     
     tmr.start();
-    vmroot = new sigil::vmnode_t(VM_NODE_VMROOT);
+    startup_timer.start();
+    vmroot = sigil::vmnode_t::create(VM_NODE_VMROOT);
     if (!vmroot) return VM_INVALID_ROOT;
 
     runtime = vmroot->spawn_subnode(VM_NODE_RUNTIME);
@@ -95,96 +925,215 @@ sigil::status_t sigil::virtual_machine::initialize(int argc, const char *argv[])
     platform = vmroot->spawn_subnode(VM_NODE_PLATFORM);
     if (!platform) return VM_FAILED_ALLOC;
 
-    vm_initialized = true;
+    // One worker per core, hardware_concurrency() may report 0 if unknown
+    hw_cores = MAX(std::thread::hardware_concurrency(), 1u);
+    num_workers = hw_cores;
+    vm_executor.store(new sigil::executor_t(num_workers), std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(timers_mutex);
+        timers_epoch = std::chrono::steady_clock::now();
+        timers_stopping = false;
+        vm_timers = new sigil::timer_wheel_t(0);
+    }
+    vm_timers_thread = std::thread(run_timers);
+    schedule_timer(0, PROCSTAT_INTERVAL_US, []() { sigil::procstat::sample(); });
+
+    if (register_builtin_commands() != VM_OK) SIGIL_LOG_ERROR("virtual-machine: failed to register builtin commands");
+
+    {
+        std::lock_guard<std::mutex> lock(lifecycle_mutex);
+        has_shutdown_handler = false;
+        shutdown_requested = false;
+        vm_cancel_token = sigil::cancel_token_t();
+        set_phase(VM_PHASE_STARTING);
+    }
 
     vm_state = VM_OK;
 
     tmr.stop();
     if (debug_mode) {
-        printf("virtual-machine: initialized in %luus\n", tmr.us());
+        SIGIL_LOG_DEBUG("virtual-machine: initialized in %luus", tmr.us());
+        SIGIL_LOG_DEBUG("virtual-machine: %u workers on %u cores", num_workers, hw_cores);
     }
     return vm_state;
 }
 
 sigil::status_t sigil::virtual_machine::deinitialize() {
-    if (!vmroot) return VM_NOT_FOUND;
+    bool was_requested;
+    {
+        // Only one caller gets to stop the VM
+        std::lock_guard<std::mutex> lock(lifecycle_mutex);
+        vm_phase_t phase = vm_phase.load(std::memory_order_acquire);
+        if (!vmroot || phase == VM_PHASE_OFFLINE) return VM_NOT_FOUND;
+        if (phase == VM_PHASE_STOPPING) return VM_BUSY;
+
+        was_requested = shutdown_requested;
+        set_phase(VM_PHASE_STOPPING);
+    }
 
     vm_state = sigil::VM_SYSTEM_SHUTDOWN | vm_state;
-    vm_initialized = false;
-    
-    for (auto &t : vm_guest_threads) {
+    vm_cancel_token.cancel();
+
+    std::vector<std::thread*> threads;
+    {
+        std::lock_guard<std::mutex> lock(vm_threads_mutex);
+        threads.swap(vm_guest_threads);
+    }
+
+    for (auto &t : threads) {
         if (t->joinable()) {
-            if (debug_mode) printf("virtual-machine: Joined a thread %p\n", t);
+            if (debug_mode) SIGIL_LOG_DEBUG("virtual-machine: Joined a thread %p", t);
             t->join();
         }
+        delete t;
+    }
+
+    // No new timer callbacks from here on
+    {
+        std::lock_guard<std::mutex> lock(timers_mutex);
+        timers_stopping = true;
+        timers_cv.notify_one();
+    }
+    if (vm_timers_thread.joinable()) vm_timers_thread.join();
+    {
+        std::lock_guard<std::mutex> lock(timers_mutex);
+        delete vm_timers;
+        vm_timers = nullptr;
+    }
+
+    // Pool jobs may still use modules, so they finish first
+    sigil::executor_t *executor = vm_executor.load(std::memory_order_acquire);
+    executor->wait_idle();
+    deinitialize_modules();
+
+    // Unpublished before it is freed, callers that still hold it finish first
+    vm_executor.store(nullptr, std::memory_order_release);
+    executor->shutdown();
+    executor->wait_idle();
+    executor_rcu.retire([executor]() { delete executor; });
+    while (executor_rcu.num_retired() > 0) {
+        std::this_thread::yield();
+        executor_rcu.reclaim();
+    }
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        vm_translator = sigil::parser::syntax_node();
+        vm_commands.clear();
     }
     
-    //vmroot->deinit_subnodes();
-    free(vmroot);
+    vmroot->deinit_self();
     vmroot = nullptr;
+    runtime = nullptr;
+    platform = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(lifecycle_mutex);
+        set_phase(VM_PHASE_OFFLINE);
+    }
+
+    if (debug_mode && was_requested) {
+        shutdown_timer.stop();
+        SIGIL_LOG_DEBUG("virtual-machine: shut down %luus after request", shutdown_timer.us());
+    }
+    sigil::log::flush();
     return VM_OK;
 }
 
 sigil::status_t sigil::virtual_machine::set_debug_mode(bool mode) {
     debug_mode = mode;
+    sigil::log::set_level(mode ? sigil::log::LEVEL_DEBUG : sigil::log::LEVEL_INFO);
     return VM_OK;
 }
 
 sigil::status_t sigil::virtual_machine::wait_for_shutdown() {
-    if (!vmroot || !vm_initialized) {
-        printf("virtual-machine: Error; waiting for shutdown while VM is not running\n");
+    std::unique_lock<std::mutex> lock(lifecycle_mutex);
+
+    if (!vmroot || vm_phase.load() != VM_PHASE_STARTING) {
+        if (has_shutdown_handler) {
+            SIGIL_LOG_WARN("virtual-machine: warning, multiple waits for shutdown, might end in deadlock");
+            return sigil::VM_LOCKED;
+        }
+        SIGIL_LOG_ERROR("virtual-machine: Error; waiting for shutdown while VM is not running");
         return VM_NOT_FOUND;
     }
 
-    if (has_shutdown_handler) {
-        printf("virtual-machine: warning, multiple waits for shutdown, might end in deadlock\n");
-        return sigil::VM_LOCKED;
-    }
-    
-    printf("virtual-machine: shutdown handler started\n");
     has_shutdown_handler = true;
-    
-    sigil::status_t status;
+    set_phase(VM_PHASE_READY);
+    startup_timer.stop();
 
-    while (is_active()) {
-        sigil::sleep_ms(50);
+    SIGIL_LOG_INFO("virtual-machine: shutdown handler started");
+    if (debug_mode) {
+        SIGIL_LOG_DEBUG("virtual-machine: ready %luus after startup", startup_timer.us());
+    }
 
-        if (shutdown_requested) {
-            status = sigil::virtual_machine::deinitialize();
-            if (status != VM_OK) {
-                printf("virtual-machine: Error occured when processing shutdown request\n");
-            }
-        }
+    // Either a request comes in, or someone calls deinitialize directly
+    lifecycle_cv.wait(lock, []() {
+        return shutdown_requested || vm_phase.load() != VM_PHASE_READY;
+    });
+
+    if (!shutdown_requested) {
+        lifecycle_cv.wait(lock, []() { return vm_phase.load() == VM_PHASE_OFFLINE; });
+        return VM_OK;
+    }
+
+    lock.unlock();
+    sigil::status_t status = sigil::virtual_machine::deinitialize();
+    if (status != VM_OK) {
+        SIGIL_LOG_ERROR("virtual-machine: Error occured when processing shutdown request");
     }
 
     return VM_OK;
 }
 
 sigil::status_t sigil::virtual_machine::wait_for_vm() {
-    if (!vm_initialized) return VM_NOT_FOUND;
-
-    while (!is_active()) {
-        sleep_ms(10);
-    }
+    std::unique_lock<std::mutex> lock(lifecycle_mutex);
+    if (vm_phase.load() == VM_PHASE_OFFLINE) return VM_NOT_FOUND;
 
-    return VM_OK;
+    lifecycle_cv.wait(lock, []() { return vm_phase.load() != VM_PHASE_STARTING; });
+    return vm_phase.load() == VM_PHASE_READY ? VM_OK : VM_SYSTEM_SHUTDOWN;
 }
 
 sigil::status_t sigil::virtual_machine::request_shutdown() {
-    if (!is_active()) {
-        printf("virtual-machine: Request shutdown, but the VM is not running\n");
-        return VM_FAILED;
+    {
+        std::lock_guard<std::mutex> lock(lifecycle_mutex);
+        if (vm_phase.load() != VM_PHASE_READY) {
+            SIGIL_LOG_WARN("virtual-machine: Request shutdown, but the VM is not running");
+            return VM_FAILED;
+        }
+
+        if (!shutdown_requested) shutdown_timer.start();
+        shutdown_requested = true;
+        lifecycle_cv.notify_all();
     }
 
-    shutdown_requested = true;
-    printf("virtual-machine: shutdown requested\n");
+    SIGIL_LOG_INFO("virtual-machine: shutdown requested");
     return VM_OK;
 }
 
+sigil::vmnode_handle_t sigil::virtual_machine::find_node(const char *name) {
+    if (!vmroot || !name) return vmnode_handle_t();
+
+    vmnode_t *node = vmroot->peek_subnode(name, VM_NODE_LOOKUP_MAX_DEPTH);
+    return node ? node->handle : vmnode_handle_t();
+}
+
+sigil::vmnode_ref_t sigil::virtual_machine::get_node(sigil::vmnode_handle_t handle) {
+    return vmnode_ref_t(handle);
+}
+
+sigil::vmtree_reader_t sigil::virtual_machine::read_tree() {
+    return vmtree_reader_t(vmroot);
+}
+
 sigil::status_t sigil::virtual_machine::get_state() {
     return vm_state;
 }
 
+sigil::virtual_machine::vm_phase_t sigil::virtual_machine::get_phase() {
+    return vm_phase.load(std::memory_order_acquire);
+}
+
 sigil::status_t sigil::virtual_machine::vminfo() {
     if (!vmroot) return VM_NOT_FOUND;
 
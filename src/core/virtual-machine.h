@@ -2,21 +2,205 @@
 #include "system.h"
 #include "utils.h"
 #include "parser.h"
+#include "cancel.h"
+#include "executor.h"
+#include "timer-wheel.h"
+#include "histogram.h"
+#include <functional>
+#include <future>
 
 namespace sigil::virtual_machine {
+    /*
+        Lifecycle of a VM, every transition wakes up threads waiting on it
+        OFFLINE -> STARTING     initialize()
+        STARTING -> READY       wait_for_shutdown() takes over
+        READY -> STOPPING       request_shutdown() or deinitialize()
+        STOPPING -> OFFLINE     tasks cancelled and joined, tree removed
+    */
+    enum vm_phase_t {
+        VM_PHASE_OFFLINE,
+        VM_PHASE_STARTING,
+        VM_PHASE_READY,
+        VM_PHASE_STOPPING,
+    };
+
     status_t initialize(int arg, const char *argv[]);
     status_t deinitialize();
-    status_t run_command(sigil::parser::command_t &command);
     bool is_active();
     status_t flush();
     status_t reset();
 
-    status_t add_platform_node(sigil::vmnode_descriptor_t node_info);
-    status_t add_runtime_node(sigil::vmnode_descriptor_t node_info);
-    status_t spawn_thread(void (*task)(void));
-    status_t run_command(parser::command_t cmd);
+    /**
+    * Register a node under platform or runtime branch of the tree
+    * If handle is not null, it receives a handle to the new node
+    * Returns VM_OK on success, VM_ALREADY_EXISTS if name is taken
+    */
+    status_t add_platform_node(sigil::vmnode_descriptor_t node_info, vmnode_handle_t *handle = nullptr);
+    status_t add_runtime_node(sigil::vmnode_descriptor_t node_info, vmnode_handle_t *handle = nullptr);
+
+    /**
+    * Remove a node together with its subnodes
+    * Returns VM_NOT_FOUND for stale handles
+    * or VM_LOCKED for vmroot, runtime and platform
+    */
+    status_t remove_node(vmnode_handle_t handle);
+
+    /**
+    * Run task on its own thread, joined on deinitialize
+    * Token is cancelled once VM starts stopping, task should return then
+    * Returns VM_NOT_FOUND if VM is not running
+    * or VM_SYSTEM_SHUTDOWN if it is already stopping
+    */
+    status_t spawn_thread(void (*task)(sigil::cancel_token_t token));
+
+    /**
+    * Queue a short job on VM worker pool, for long running tasks use spawn_thread
+    * Returns VM_OK on success
+    * or VM_NOT_FOUND if VM is not running
+    */
+    status_t submit(std::function<void()> job);
+
+    /**
+    * Worker pool of a running VM, sized from detected core count
+    * Returns nullptr if VM is not running, pointer is only valid
+    * until deinitialize, prefer submit/async from other threads
+    */
+    executor_t* get_executor();
+
+    /**
+    * Like submit, but result is delivered through returned future
+    * Future is not valid() if VM is not running
+    */
+    template <typename fn_t>
+    std::future<std::invoke_result_t<fn_t>> async(fn_t &&fn) {
+        using result_t = std::invoke_result_t<fn_t>;
+        auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<fn_t>(fn));
+        std::future<result_t> result = task->get_future();
+        if (submit([task]() { (*task)(); }) != VM_OK) return std::future<result_t>();
+        return result;
+    }
+
+    /**
+    * Register a command, run by its owner node on worker pool. Owner gets
+    * a mailbox if it has none, commands are queued in it with its messages
+    * Returns VM_OK on success, VM_ALREADY_EXISTS if pattern is taken,
+    * VM_ARG_INVALID for malformed pattern, VM_NOT_FOUND for stale owner,
+    * or VM_NOT_SUPPORTED if owner only polls its mailbox
+    */
+    status_t register_command(sigil::vmcommand_descriptor_t command_info);
+    // Pattern as it was registered, returns VM_NOT_FOUND if there is none
+    status_t unregister_command(const char *pattern);
+
+    /**
+    * Validate command and queue it to its owner node, returns right away
+    * Future gets status of command handler, or why it could not run:
+    * VM_ARG_INVALID for empty command or arguments not fitting its pattern,
+    * VM_NOT_FOUND for unknown command or removed owner,
+    * VM_SYSTEM_SHUTDOWN if VM stopped before command ran,
+    * or VM_BUSY if owner queue is full and caller is a pool job
+    */
+    std::future<status_t> run_command(parser::command_t command);
+    std::future<status_t> run_command(std::string_view line);
+
+    /**
+    * Like run_command, for many commands validated under one lock.
+    * Commands of one owner run in batch order, commands of different
+    * owners run concurrently. Futures are in batch order
+    */
+    std::vector<std::future<status_t>> run_commands(std::vector<parser::command_t> commands);
+
+    // Time from queueing a command to its handler returning, for every command run
+    const windowed_histogram_t& get_command_latency();
+
+    /**
+    * Run newline separated commands read from input_fd until end of input.
+    * Lines are read in large chunks and queued in batches, next batch is
+    * read while previous one runs. For every command a line with its input
+    * line number and status, e.g. "12 VM_OK", is written to output_fd,
+    * in input order. Output is written once it piles up, and whenever
+    * input has nothing ready, then commands read so far are run to the end
+    * first, so interactive pipes see their results before next read blocks.
+    * Reading stops once VM stops or cancel, if set, is cancelled.
+    * num_commands receives number of commands read, if set
+    * Returns VM_OK at end of input, VM_FAILED if input or output fails,
+    * or VM_SYSTEM_SHUTDOWN if VM stopped first
+    */
+    status_t run_command_stream(int input_fd, int output_fd, uint64_t *num_commands = nullptr,
+                                const cancel_token_t *cancel = nullptr);
+
+    /**
+    * Queue a message in mailbox of a node, see vmnode_t::open_mailbox()
+    * If node has a handler, it is scheduled on worker pool
+    * Returns VM_OK on success, VM_NOT_FOUND for stale handle, removed node
+    * with a handler or worker pool not running, VM_NOT_SUPPORTED if node
+    * has no mailbox, or VM_BUSY if mailbox is full
+    */
+    status_t post_message(vmnode_handle_t target, const vmmessage_t &message);
+
+    template <typename T>
+    status_t post(vmnode_handle_t target, uint32_t kind, const T &payload,
+                  vmnode_handle_t sender = vmnode_handle_t()) {
+        return post_message(target, vmmessage_t::make(kind, payload, sender));
+    }
+
+    /**
+    * Run callback on worker pool after delay_us, then every period_us unless it is 0
+    * Repeating callback may overlap with itself if it runs longer than its period
+    * If handle is not null, it receives a handle for cancel_timer()
+    * Returns VM_OK on success, VM_NOT_FOUND if VM is not running
+    */
+    status_t schedule_timer(uint64_t delay_us, uint64_t period_us, std::function<void()> callback,
+                            timer_handle_t *handle = nullptr);
+
+    /**
+    * Returns VM_OK on success
+    * or VM_NOT_FOUND if timer already fired, or was cancelled
+    */
+    status_t cancel_timer(timer_handle_t handle);
 
     status_t vminfo();
+
+    /**
+    * Register a module to be started by initialize_modules()
+    * Returns VM_OK on success, VM_ALREADY_EXISTS if name is taken
+    * VM_ARG_NULL without initialize function, or VM_NOT_FOUND if VM is not running
+    */
+    status_t register_module(sigil::vmmodule_descriptor_t module_info);
+
+    /**
+    * Initialize every registered module not initialized yet, independent
+    * modules run concurrently on worker pool, main_thread ones on calling
+    * thread. Blocks until all are done, must not be called from a pool job
+    * or from module initialize function
+    * Returns VM_OK on success, VM_NOT_FOUND for unknown dependency,
+    * VM_ARG_INVALID for dependency cycle, or VM_FAILED if any module failed
+    */
+    status_t initialize_modules();
+
+    /**
+    * Outcome of module initialization, VM_IDLE if not initialized yet,
+    * VM_SKIPPED if a dependency failed, or VM_NOT_FOUND for unknown module
+    */
+    status_t get_module_status(const char *name);
+
+    /**
+    * Find a node by its name or full path, e.g. "visor" or "vmroot/runtime/visor"
+    * Returns null handle if no such node is registered
+    */
+    vmnode_handle_t find_node(const char *name);
+
+    /**
+    * Resolve a handle, node stays allocated while returned reference is held
+    * Reference holds nullptr for null or stale handles
+    */
+    vmnode_ref_t get_node(vmnode_handle_t handle);
+
+    /**
+    * Lock free view of the whole VM tree, safe to hold on any thread
+    * Writes show up in it within VM_TREE_PUBLISH_US, longer for large trees
+    * Snapshot is nullptr if VM is not running
+    */
+    vmtree_reader_t read_tree();
     
     /**
     * Request shutdown of a VM
@@ -26,20 +210,21 @@ namespace sigil::virtual_machine {
     status_t request_shutdown();
 
     /**
-    * Go into a loop on a current thread
-    * Wait until shutdown is requrested
+    * Marks VM as ready and blocks current thread
+    * until shutdown is requested, then deinitializes VM
     * Returns VM_OK on success
     */
     status_t wait_for_shutdown();
 
     /**
-    * Waits until VM and shutdown handler are started
-    * Returns VM_OK on success
-    * or VM_FAILED if timeout is reached
+    * Blocks until VM and shutdown handler are started
+    * Returns VM_OK on success, VM_NOT_FOUND if VM is not initialized
+    * or VM_SYSTEM_SHUTDOWN if VM stopped before becoming ready
     */
     status_t wait_for_vm();
 
     status_t get_state();
+    vm_phase_t get_phase();
     
     status_t set_debug_mode(bool debug);
     bool     get_debug_mode();
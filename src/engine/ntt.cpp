@@ -1,9 +1,12 @@
 #include <cerrno>
+#include <thread>
 #include "system.h"
 #include "ntt.h"
+#include "trace.h"
+#include "mem-track.h"
 
-static sigil::vmnode_t *ntt_store_node = nullptr;
-static sigil::vmnode_t *ntt_host_node = nullptr;
+static sigil::vmnode_handle_t ntt_store_node;
+static sigil::vmnode_handle_t ntt_host_node;
 std::vector<sigil::ntt::scene_t*> scenes;
 uint32_t num_engines;
 
@@ -14,12 +17,15 @@ sigil::status_t sigil::ntt::initialize() {
 }
 
 sigil::ntt::scene_t* sigil::ntt::spawn_scene() {
+    SIGIL_MEM_TAG(sigil::MEM_TAG_NTT);
     sigil::ntt::scene_t *new_scene = new sigil::ntt::scene_t;
     scenes.push_back(new_scene);
     return new_scene;
 }
 
 inline void sigil::ntt::engine_t::sync_engine() {
+    SIGIL_TRACE_ZONE("ntt-sync-engine");
+    SIGIL_MEM_TAG(sigil::MEM_TAG_NTT);
     std::chrono::time_point<std::chrono::high_resolution_clock> timestamp;
     long int target_frame_us = 0;
 
@@ -31,7 +37,7 @@ inline void sigil::ntt::engine_t::sync_engine() {
         this->delta_us = std::chrono::duration_cast<std::chrono::microseconds>
                                     (timestamp - this->ts_render_end).count();
         if (this->delta_us < target_frame_us) {
-            sigil::sleep_ms(target_frame_us - this->delta_us);
+            std::this_thread::sleep_for(std::chrono::microseconds((long int)(target_frame_us - this->delta_us)));
             timestamp = std::chrono::high_resolution_clock::now();
             this->delta_us = std::chrono::duration_cast<std::chrono::microseconds>
                                         (timestamp - this->ts_render_end).count();
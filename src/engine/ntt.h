@@ -29,7 +29,7 @@ namespace sigil::ntt {
 
     typedef struct scene_t : sigil::reference_t {
         std::vector<entity_t> entities;
-        std::string name;
+        sigil::name_t name;
         bool paused;
     } scene_t;
     
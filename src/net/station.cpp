@@ -4,7 +4,7 @@
 #include "system.h"
 #include "utils.h"
 
-static sigil::vmnode_t *station_node = nullptr;
+static sigil::vmnode_handle_t station_node;
 std::vector<sigil::station::wifi_entry_t> networks_found = {};
 // LUT to find networks by name, usable on esp
 std::map<std::string, int> networks_name_map = {};
@@ -32,9 +32,9 @@ sigil::status_t  sigil::station::initialize() {
 
 
     vmnode_descriptor_t station_init_data;
-    station_init_data.name.value = "station";
+    station_init_data.name = "station";
 
-    status = virtual_machine::add_platform_node(station_init_data);
+    status = virtual_machine::add_platform_node(station_init_data, &station_node);
     if (status != VM_OK) return status;
 
     // Initialize module private data now
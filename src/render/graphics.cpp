@@ -1,13 +1,15 @@
 #include <vulkan.h>
 #include "graphics.h"
 #include "utils.h"
+#include "frame-arena.h"
+#include "log.h"
 
 static bool glfw_initialized = false;
 
 
 static void glfw_error_callback(int error, const char* description)
 {
-    fprintf(stderr, "GLFW Error %d: %s\n", error, description);
+    SIGIL_LOG_ERROR("GLFW Error %d: %s", error, description);
 }
 
 
@@ -35,15 +37,23 @@ sigil::graphics::static_mesh_t::static_mesh_t() {
 }
 
 void sigil::graphics::static_mesh_t::randomize() {
-    verteces = {};
     int num_new_verts = random_i32_scoped(5, 124);
-    for (int i = 0; i < num_new_verts; i++) {
-        float vert_x = random_i32_scoped(0, 255) * 0.01f;
-        float vert_y = random_i32_scoped(0, 255) * 0.01f;
-        float vert_z = random_i32_scoped(0, 255) * 0.01f;
-        sigil::v3_t new_ver(vert_x, vert_y, vert_z);
-        verteces.push_back(new_ver);
+    // Generated on the frame arena, mesh only copies them into its own storage
+    sigil::arena_t &arena = sigil::frame_arena();
+    sigil::arena_t::marker_t mark = arena.mark();
+    {
+        sigil::arena_vector_t<sigil::v3_t> generated(arena);
+        generated.reserve(num_new_verts);
+        for (int i = 0; i < num_new_verts; i++) {
+            float vert_x = random_i32_scoped(0, 255) * 0.01f;
+            float vert_y = random_i32_scoped(0, 255) * 0.01f;
+            float vert_z = random_i32_scoped(0, 255) * 0.01f;
+            sigil::v3_t new_ver(vert_x, vert_y, vert_z);
+            generated.push_back(new_ver);
+        }
+        verteces.assign(generated.begin(), generated.end());
     }
+    arena.rewind(mark);
 }
 
 // Default constructor
@@ -99,7 +109,7 @@ sigil::status_t sigil::graphics::initialize_glfw() {
     glfwSetErrorCallback(glfw_error_callback);
 
     if (!glfwInit()) {
-        printf("iocommon: failed glfw init\n");
+        SIGIL_LOG_ERROR("iocommon: failed glfw init");
         glfw_initialized = false;
         return sigil::VM_FAILED;
     }
@@ -6,12 +6,16 @@
 #include "system.h"
 #include "utils.h"
 #include "visor.h"
+#include "trace.h"
+#include "log.h"
+#include "mem-track.h"
 
 std::vector<sigil::visor::render_channel_t> render_channels = {};
 std::vector<sigil::graphics::window_t*> windows = {};
-static sigil::vmnode_t *visor_node = nullptr;
+static sigil::vmnode_handle_t visor_node;
 
 sigil::status_t sigil::visor::prepare_for_new_frame(sigil::graphics::window_t *window) {
+    SIGIL_MEM_TAG(sigil::MEM_TAG_VISOR);
     // glfw events first
     glfwPollEvents();
 
@@ -25,6 +29,7 @@ sigil::status_t sigil::visor::prepare_for_new_frame(sigil::graphics::window_t *w
 }
 
 sigil::status_t sigil::visor::finalize_new_frame(sigil::graphics::window_t *window) {
+    SIGIL_MEM_TAG(sigil::MEM_TAG_VISOR);
     
     // Convert ImGui elements into framedata for visor, end preparation
     // ImGui::Render();
@@ -48,17 +53,19 @@ sigil::status_t sigil::visor::initialize() {
     sigil::status_t status = virtual_machine::get_state();
     if (status != VM_OK) return status;
 
+    SIGIL_TRACE_ZONE("visor-initialize");
+    SIGIL_MEM_TAG(sigil::MEM_TAG_VISOR);
     sigil::exec_timer tmr;
     tmr.start();
 
     sigil::vmnode_descriptor_t node_info;
-    node_info.name.value = "visor";
+    node_info.name = "visor";
     
-    sigil::virtual_machine::add_runtime_node(node_info);
+    sigil::virtual_machine::add_runtime_node(node_info, &visor_node);
     
     tmr.stop();
     if (virtual_machine::get_debug_mode()) {
-        printf("visor: initialized in %luns\n", tmr.ns());
+        SIGIL_LOG_DEBUG("visor: initialized in %luns", tmr.ns());
     }
 
     return sigil::VM_OK;
@@ -71,13 +78,13 @@ sigil::status_t sigil::visor::deinitialize() {
 
 
 sigil::graphics::window_t *sigil::visor::spawn_window(const char *window_name) {
-    if (!visor_node) return nullptr;
+    if (!virtual_machine::get_node(visor_node).node) return nullptr;
 
     // TODO: User returned status from soft init and log the outcome
     //soft_init_glfw();
 
     if (!glfwVulkanSupported()) {
-        printf("iocommon: glfw-vulkan not available\n");
+        SIGIL_LOG_ERROR("iocommon: glfw-vulkan not available");
         return nullptr;
     }
 
@@ -87,7 +94,7 @@ sigil::graphics::window_t *sigil::visor::spawn_window(const char *window_name) {
     new_window->glfw_window = glfwCreateWindow(1280, 720, window_name, nullptr, nullptr);
 
     if (new_window->glfw_window == nullptr) {
-        printf("iocommon: failed to create glfw_window\n");
+        SIGIL_LOG_ERROR("iocommon: failed to create glfw_window");
         return nullptr;
     }
 
@@ -9,6 +9,8 @@
 #include "utils.h"
 #include "virtual-machine.h"
 #include "vulkan.h"
+#include "trace.h"
+#include "log.h"
 #include "visor.h"
 
 // Vulkan data
@@ -29,7 +31,7 @@ std::vector<VkPhysicalDevice> phy_dev_all;
 std::vector<VkPhysicalDevice> phy_dev_registered;
 
 // SigilVM specific data
-static sigil::vmnode_t *vulkan_node = nullptr;
+static sigil::vmnode_handle_t vulkan_node;
 
 // Vulkan setup procedures
 static sigil::status_t probe_devices(); // GPUs
@@ -54,7 +56,7 @@ bool is_vk_ext_available(const std::vector<VkExtensionProperties> &properties, c
     for (const VkExtensionProperties& p : properties)
         if (strcmp(p.extensionName, extension) == 0) {
             if (sigil::virtual_machine::get_debug_mode())
-                printf("vulkan: extenstion %s available\n", extension);
+                SIGIL_LOG_DEBUG("vulkan: extenstion %s available", extension);
             return true;
         }
     return false;
@@ -62,14 +64,15 @@ bool is_vk_ext_available(const std::vector<VkExtensionProperties> &properties, c
 
 // VM Tree integration
 sigil::status_t sigil::vulkan::initialize() {
+    SIGIL_TRACE_ZONE("vulkan-initialize");
     sigil::exec_timer tmr;
     tmr.start();
     sigil::status_t status = virtual_machine::get_state();
     if (status != VM_OK) return status;
 
     sigil::vmnode_descriptor_t node_info;
-    node_info.name.value = "vulkan";
-    status = sigil::virtual_machine::add_platform_node(node_info);
+    node_info.name = "vulkan";
+    status = sigil::virtual_machine::add_platform_node(node_info, &vulkan_node);
 
     status = initialize_vulkan_instance();
     status = probe_devices();
@@ -80,7 +83,7 @@ sigil::status_t sigil::vulkan::initialize() {
     
     tmr.stop();
     if (virtual_machine::get_debug_mode()) {
-        printf("vulkan: initialized in %luns\n", tmr.ns());
+        SIGIL_LOG_DEBUG("vulkan: initialized in %luns", tmr.ns());
     }
 
     return status;
@@ -107,6 +110,7 @@ sigil::status_t initialize_vulkan_instance() {
     // assert(vulkan_data->vk_inst == nullptr);
     // assert(vulkan_data->vk_allocators == nullptr);
 
+    SIGIL_TRACE_ZONE("vulkan-create-instance");
     sigil::exec_timer tmr;
     tmr.start();
 
@@ -128,7 +132,7 @@ sigil::status_t initialize_vulkan_instance() {
     if (!compute_mode) {
         sigil::graphics::initialize_glfw();
         if (!glfwVulkanSupported()) {
-           printf("vulkan: Vulkan GLFW Not Supported\n");
+            SIGIL_LOG_ERROR("vulkan: Vulkan GLFW Not Supported");
             return sigil::VM_NOT_SUPPORTED;
         }
         
@@ -157,11 +161,12 @@ sigil::status_t initialize_vulkan_instance() {
     err = vkCreateInstance(&create_info, vk_allocators, &vk_inst);
     sigil::vulkan::check_result(err);
     tmr.stop();
-    printf("vulkan: instance created in %lums\n", tmr.ms());
+    SIGIL_LOG_INFO("vulkan: instance created in %lums", tmr.ms());
     return sigil::VM_OK;
 }
 
 sigil::status_t sigil::vulkan::probe_devices() {
+    SIGIL_TRACE_ZONE("vulkan-probe-devices");
     sigil::status_t status;
 
     // First get number of devices found
@@ -169,11 +174,10 @@ sigil::status_t sigil::vulkan::probe_devices() {
     sigil::vulkan::check_result(err);
 
     if (num_phy_devices == 0) {
-        // TODO: Swap for logger
-        printf("vulkan: no GPUs found...\n");
+        SIGIL_LOG_ERROR("vulkan: no GPUs found...");
         return sigil::VM_NOT_FOUND;
     } else {
-        printf("vulkan: found %u GPUs\n", num_phy_devices);
+        SIGIL_LOG_INFO("vulkan: found %u GPUs", num_phy_devices);
     }
 
     // Resize physical device list and populate it
@@ -187,19 +191,18 @@ sigil::status_t sigil::vulkan::probe_devices() {
         VkPhysicalDevice device = phy_dev_all.at(i);
         VkPhysicalDeviceProperties properties;
         vkGetPhysicalDeviceProperties(device, &properties);
-        printf("vulkan: checking %s...\n", properties.deviceName);
+        SIGIL_LOG_INFO("vulkan: checking %s...", properties.deviceName);
 
         if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
             phy_dev_registered.push_back(device);
-            printf("vulkan: %s registered\n", properties.deviceName);
+            SIGIL_LOG_INFO("vulkan: %s registered", properties.deviceName);
         }
     }
 
     if (phy_dev_registered.size() > 0) return sigil::VM_OK;
 
     phy_dev_registered.push_back(phy_dev_all.at(0));
-    // TODO: Change to log
-    printf("vulkan: no discrete GPU entry found, using default\n");
+    SIGIL_LOG_WARN("vulkan: no discrete GPU entry found, using default");
     return sigil::VM_OK;
 }
 
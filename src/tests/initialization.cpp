@@ -2,6 +2,8 @@
 #include "station.h"
 #include "virtual-machine.h"
 #include "utils.h"
+#include <atomic>
+#include <thread>
 
 class InitializationSuite : public ::testing::Test {
 protected:
@@ -19,12 +21,424 @@ TEST_F(InitializationSuite, vm_startup_test) {
     ASSERT_EQ(sigil::virtual_machine::get_state(), sigil::VM_OK);
 }
 
+TEST_F(InitializationSuite, vm_node_handles) {
+    sigil::vmnode_descriptor_t node_info;
+    sigil::vmnode_handle_t handle;
+    sigil::vmnode_handle_t subnode;
+    node_info.name = "handle-test";
 
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &handle), sigil::VM_OK);
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, nullptr), sigil::VM_ALREADY_EXISTS);
+    EXPECT_EQ(sigil::virtual_machine::find_node("vmroot/runtime/handle-test"), handle);
+
+    {
+        sigil::vmnode_ref_t node = sigil::virtual_machine::get_node(handle);
+        ASSERT_NE(node.node, nullptr);
+        subnode = node->spawn_subnode("handle-test-sub")->handle;
+
+        // Held reference keeps node allocated, but its handle no longer resolves
+        ASSERT_EQ(sigil::virtual_machine::remove_node(handle), sigil::VM_OK);
+        EXPECT_EQ(node->get_node_name(), "handle-test");
+    }
+    EXPECT_EQ(sigil::virtual_machine::get_node(handle).node, nullptr);
+    EXPECT_EQ(sigil::virtual_machine::get_node(subnode).node, nullptr);
+    EXPECT_TRUE(sigil::virtual_machine::find_node("handle-test").is_null());
+    EXPECT_EQ(sigil::virtual_machine::remove_node(handle), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::virtual_machine::remove_node(sigil::virtual_machine::find_node("runtime")), sigil::VM_LOCKED);
+
+    // Name is free again, slot is reused under a new generation
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &handle), sigil::VM_OK);
+    EXPECT_NE(sigil::virtual_machine::get_node(handle).node, nullptr);
+
+    // Concurrent removals of one node, exactly one of them wins
+    std::atomic<uint32_t> num_removed = {0};
+    std::vector<std::thread> removers;
+    for (int t = 0; t < 4; t++) removers.emplace_back([&]() {
+        if (sigil::virtual_machine::remove_node(handle) == sigil::VM_OK) num_removed++;
+    });
+    for (auto &t : removers) t.join();
+    EXPECT_EQ(num_removed.load(), 1u);
+}
+
+TEST_F(InitializationSuite, vm_worker_pool) {
+    std::atomic<uint32_t> num_done = {0};
+    ASSERT_NE(sigil::virtual_machine::get_executor(), nullptr);
+
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_EQ(sigil::virtual_machine::submit([&]() { num_done++; }), sigil::VM_OK);
+    }
+    std::future<uint32_t> cores = sigil::virtual_machine::async([]() {
+        return sigil::virtual_machine::get_executor()->num_workers();
+    });
+
+    EXPECT_GE(cores.get(), 1u);
+    sigil::virtual_machine::get_executor()->wait_idle();
+    EXPECT_EQ(num_done.load(), 1000u);
+}
+
+TEST_F(InitializationSuite, vm_timers) {
+    std::atomic<uint32_t> num_oneshot = {0};
+    std::atomic<uint32_t> num_repeating = {0};
+    std::atomic<uint32_t> num_cancelled = {0};
+    sigil::timer_handle_t repeating;
+    sigil::timer_handle_t cancelled;
+
+    ASSERT_EQ(sigil::virtual_machine::schedule_timer(1000, 0, [&]() { num_oneshot++; }), sigil::VM_OK);
+    ASSERT_EQ(sigil::virtual_machine::schedule_timer(2000, 2000, [&]() { num_repeating++; }, &repeating), sigil::VM_OK);
+    ASSERT_EQ(sigil::virtual_machine::schedule_timer(500000, 0, [&]() { num_cancelled++; }, &cancelled), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::cancel_timer(cancelled), sigil::VM_OK);
+
+    for (int i = 0; i < 500 && num_repeating.load() < 3; i++) sigil::sleep_ms(2);
+    EXPECT_EQ(sigil::virtual_machine::cancel_timer(repeating), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::cancel_timer(repeating), sigil::VM_NOT_FOUND);
+    sigil::virtual_machine::get_executor()->wait_idle();
+
+    EXPECT_EQ(num_oneshot.load(), 1u);
+    EXPECT_GE(num_repeating.load(), 3u);
+    EXPECT_EQ(num_cancelled.load(), 0u);
+}
+
+static std::atomic<uint64_t> mailbox_sum = {0};
+static std::atomic<uint32_t> mailbox_handlers_running = {0};
+static std::atomic<bool> mailbox_overlapped = {false};
+
+struct mailbox_test_payload_t {
+    uint32_t value;
+    char tag[8];
+};
+
+static void mailbox_test_handler(sigil::vmnode_t *node, const sigil::vmmessage_t *messages, size_t count) {
+    if (mailbox_handlers_running++ > 0) mailbox_overlapped = true;
+    for (size_t i = 0; i < count; i++) {
+        mailbox_test_payload_t payload;
+        if (messages[i].get(payload)) mailbox_sum += payload.value;
+    }
+    mailbox_handlers_running--;
+}
+
+TEST_F(InitializationSuite, vm_node_mailbox) {
+    sigil::vmnode_descriptor_t node_info;
+    sigil::vmnode_handle_t handler_node;
+    sigil::vmnode_handle_t polled_node;
+    sigil::vmnode_handle_t plain_node;
+
+    node_info.name = "mailbox-handler";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &handler_node), sigil::VM_OK);
+    node_info.name = "mailbox-polled";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &polled_node), sigil::VM_OK);
+    node_info.name = "mailbox-plain";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &plain_node), sigil::VM_OK);
+
+    sigil::vmnode_ref_t node = sigil::virtual_machine::get_node(handler_node);
+    ASSERT_EQ(node->open_mailbox(256, mailbox_test_handler), sigil::VM_OK);
+    EXPECT_EQ(node->open_mailbox(256, mailbox_test_handler), sigil::VM_ALREADY_EXISTS);
+    ASSERT_EQ(sigil::virtual_machine::get_node(polled_node)->open_mailbox(4, nullptr), sigil::VM_OK);
+
+    // Handler is never run concurrently, even with many producers
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 4; p++) producers.emplace_back([&]() {
+        mailbox_test_payload_t payload = {1, "test"};
+        for (int i = 0; i < 1000; i++) {
+            while (sigil::virtual_machine::post(handler_node, 1, payload) == sigil::VM_BUSY) std::this_thread::yield();
+        }
+    });
+    for (auto &t : producers) t.join();
+    for (int i = 0; i < 500 && mailbox_sum.load() < 4000; i++) sigil::sleep_ms(2);
+    EXPECT_EQ(mailbox_sum.load(), 4000u);
+    EXPECT_FALSE(mailbox_overlapped);
+
+    // Without handler, messages wait for receive(), full mailbox refuses more
+    for (uint32_t i = 0; i < 4; i++) EXPECT_EQ(sigil::virtual_machine::post(polled_node, 2, i, handler_node), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::post(polled_node, 2, 4u), sigil::VM_BUSY);
+    sigil::vmmessage_t received[8];
+    ASSERT_EQ(sigil::virtual_machine::get_node(polled_node)->receive(received, 8), 4u);
+    uint32_t value = 0;
+    EXPECT_TRUE(received[3].get(value));
+    EXPECT_EQ(value, 3u);
+    EXPECT_EQ(received[3].sender, handler_node);
+    EXPECT_EQ(received[3].kind, 2u);
+
+    EXPECT_EQ(sigil::virtual_machine::post(plain_node, 1, value), sigil::VM_NOT_SUPPORTED);
+    ASSERT_EQ(sigil::virtual_machine::remove_node(handler_node), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::post(handler_node, 1, value), sigil::VM_NOT_FOUND);
+}
+
+static sigil::status_t metrics_test_command(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    sigil::metric_t work;
+    sigil::metrics::register_metric(node, "work", sigil::METRIC_HISTOGRAM, &work);
+    work.record(command.args[0].number);
+    return sigil::VM_OK;
+}
+
+TEST_F(InitializationSuite, vm_node_metrics) {
+    sigil::vmnode_descriptor_t node_info;
+    sigil::vmnode_handle_t handle;
+    node_info.name = "metrics-owner";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &handle), sigil::VM_OK);
+
+    sigil::vmcommand_descriptor_t command_info;
+    command_info.pattern = "metrics-test <int>";
+    command_info.owner = handle;
+    command_info.handler = metrics_test_command;
+    ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+
+    std::vector<sigil::parser::command_t> batch;
+    for (int i = 1; i <= 100; i++) batch.push_back({{"metrics-test", std::to_string(i)}});
+    for (auto &result : sigil::virtual_machine::run_commands(batch)) ASSERT_EQ(result.get(), sigil::VM_OK);
+
+    // Every command is a task of its owner, drain adds up after last one has run
+    {
+        sigil::vmnode_ref_t node = sigil::virtual_machine::get_node(handle);
+        std::vector<sigil::metric_value_t> values;
+        for (int i = 0; i < 500; i++) {
+            ASSERT_EQ(sigil::metrics::read(node.node, values), sigil::VM_OK);
+            if (values[1].value == 100) break;
+            sigil::sleep_ms(1);
+        }
+        ASSERT_EQ(values.size(), 4u);
+        EXPECT_EQ(values[0].name, "cpu-ns");
+        EXPECT_GT(values[0].value, 0);
+        EXPECT_EQ(values[1].value, 100);
+        // Command mailbox counts towards node memory
+        EXPECT_EQ(values[2].name, "memory");
+        EXPECT_GT(values[2].value, (int64_t)sizeof(sigil::vmmessage_t) * 2);
+        EXPECT_EQ(values[3].name, "work");
+        EXPECT_EQ(values[3].value, 100);
+        EXPECT_NE(sigil::metrics::describe(node.node).find("100 tasks"), std::string::npos);
+
+        sigil::metrics::of(node.node)->memory.set(4096);
+        EXPECT_NE(sigil::metrics::describe(node.node).find("4.0KB"), std::string::npos);
+        EXPECT_EQ(sigil::virtual_machine::vminfo(), sigil::VM_OK);
+    }
+
+    // Slots of a removed node are handed out again
+    EXPECT_EQ(sigil::virtual_machine::unregister_command("metrics-test <int>"), sigil::VM_OK);
+    size_t free_before = sigil::metrics::num_free_slots();
+    ASSERT_EQ(sigil::virtual_machine::remove_node(handle), sigil::VM_OK);
+    sigil::vmnode_t::wait_for_reclaim();
+    EXPECT_EQ(sigil::metrics::num_free_slots(), free_before + 4);
+}
+
+static std::atomic<uint32_t> modules_started = {0};
+static std::atomic<bool> base_module_ready = {false};
+static std::atomic<bool> dependent_saw_base = {false};
+
+static sigil::status_t base_module_init() {
+    modules_started++;
+    sigil::sleep_ms(5);
+    base_module_ready = true;
+    return sigil::VM_OK;
+}
+
+static sigil::status_t dependent_module_init() {
+    modules_started++;
+    dependent_saw_base = base_module_ready.load();
+    return sigil::VM_OK;
+}
+
+static sigil::status_t failing_module_init() {
+    modules_started++;
+    return sigil::VM_FAILED;
+}
+
+static std::thread::id main_module_thread;
+
+static sigil::status_t main_module_init() {
+    main_module_thread = std::this_thread::get_id();
+    return sigil::VM_OK;
+}
+
+static sigil::status_t add_test_module(const char *name, std::vector<sigil::name_t> depends_on,
+                                       sigil::status_t (*initialize)(void), bool main_thread = false) {
+    sigil::vmmodule_descriptor_t module_info;
+    module_info.name = name;
+    module_info.depends_on = depends_on;
+    module_info.initialize = initialize;
+    module_info.main_thread = main_thread;
+    return sigil::virtual_machine::register_module(module_info);
+}
+
+TEST_F(InitializationSuite, vm_module_dependencies) {
+    ASSERT_EQ(add_test_module("mod-base", {}, base_module_init), sigil::VM_OK);
+    ASSERT_EQ(add_test_module("mod-dependent", {"mod-base"}, dependent_module_init), sigil::VM_OK);
+    ASSERT_EQ(add_test_module("mod-independent", {}, dependent_module_init), sigil::VM_OK);
+    ASSERT_EQ(add_test_module("mod-failing", {}, failing_module_init), sigil::VM_OK);
+    ASSERT_EQ(add_test_module("mod-skipped", {"mod-failing", "mod-base"}, dependent_module_init), sigil::VM_OK);
+    EXPECT_EQ(add_test_module("mod-base", {}, base_module_init), sigil::VM_ALREADY_EXISTS);
+    EXPECT_EQ(sigil::virtual_machine::get_module_status("mod-base"), sigil::VM_IDLE);
+
+    EXPECT_EQ(sigil::virtual_machine::initialize_modules(), sigil::VM_FAILED);
+    EXPECT_TRUE(dependent_saw_base);
+    EXPECT_EQ(modules_started.load(), 4u);
+    EXPECT_EQ(sigil::virtual_machine::get_module_status("mod-dependent"), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::get_module_status("mod-failing"), sigil::VM_FAILED);
+    EXPECT_EQ(sigil::virtual_machine::get_module_status("mod-skipped"), sigil::VM_SKIPPED);
+
+    // Ready modules are not initialized twice, late modules may depend on them
+    ASSERT_EQ(add_test_module("mod-late", {"mod-dependent"}, dependent_module_init), sigil::VM_OK);
+    // Released by a pool job, still run on thread calling initialize_modules()
+    ASSERT_EQ(add_test_module("mod-main", {"mod-late"}, main_module_init, true), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::initialize_modules(), sigil::VM_OK);
+    EXPECT_EQ(modules_started.load(), 5u);
+    EXPECT_EQ(main_module_thread, std::this_thread::get_id());
+
+    ASSERT_EQ(add_test_module("mod-cycle-a", {"mod-cycle-b"}, dependent_module_init), sigil::VM_OK);
+    ASSERT_EQ(add_test_module("mod-cycle-b", {"mod-cycle-a"}, dependent_module_init), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::initialize_modules(), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::virtual_machine::get_module_status("mod-cycle-a"), sigil::VM_IDLE);
+
+    // Asking for an unknown module does not grow the name table
+    size_t interned = sigil::name_t::num_interned();
+    EXPECT_EQ(sigil::virtual_machine::get_module_status("mod-never-added"), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::name_t::num_interned(), interned);
+}
+
+TEST_F(InitializationSuite, vm_tree_snapshot_readers) {
+    std::atomic<bool> writing = {true};
+    std::atomic<uint32_t> num_reads = {0};
+    std::vector<std::thread> readers;
+
+    // Readers check that every snapshot they see is a well formed tree
+    for (int r = 0; r < 4; r++) readers.emplace_back([&]() {
+        while (writing.load()) {
+            sigil::vmtree_reader_t reader = sigil::virtual_machine::read_tree();
+            ASSERT_NE(reader.snapshot, nullptr);
+
+            auto &entries = reader.snapshot->entries;
+            ASSERT_EQ(entries[0].subtree_size, entries.size());
+            for (size_t i = 1; i < entries.size(); i++) {
+                ASSERT_LT(entries[i].master, i);
+                ASSERT_EQ(entries[i].depth, entries[entries[i].master].depth + 1);
+            }
+            num_reads++;
+        }
+    });
+
+    sigil::vmnode_ref_t runtime = sigil::virtual_machine::get_node(sigil::virtual_machine::find_node("runtime"));
+    ASSERT_NE(runtime.node, nullptr);
+    sigil::vmnode_t *branch = runtime->spawn_subnode("snapshot-test");
+
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_NE(branch->spawn_subnode(("snapshot-node-" + std::to_string(i)).c_str()), nullptr);
+    }
+
+    // On few cores writer may finish before any reader got scheduled
+    while (num_reads.load() == 0) std::this_thread::yield();
+    writing = false;
+    for (auto &t : readers) t.join();
+    EXPECT_GT(num_reads.load(), 0u);
+
+    // Last writes of the burst wait for publisher, which catches up on its own
+    sigil::vmnode_index_t *index = branch->get_index();
+    bool caught_up = false;
+    for (int tries = 0; tries < 1000 && !caught_up; tries++) {
+        sigil::vmtree_reader_t latest = sigil::virtual_machine::read_tree();
+        caught_up = latest.snapshot->version == index->version.load();
+        if (!caught_up) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(caught_up);
+
+    sigil::vmtree_reader_t reader = sigil::virtual_machine::read_tree();
+    int64_t i = reader.snapshot->find(branch);
+    ASSERT_GE(i, 0);
+    EXPECT_EQ(reader.snapshot->entries[i].subtree_size, 2001u);
+    EXPECT_EQ(reader.snapshot->entries[i].path, "vmroot/runtime/snapshot-test");
+    EXPECT_EQ(branch->get_node_name_tree().size(), std::string("snapshot-test").size() +
+        2000 * std::string(": snapshot-node-").size() + 10 + 90 * 2 + 900 * 3 + 1000 * 4);
+}
+
+TEST_F(InitializationSuite, vm_index_created_once) {
+    // First lookups of a fresh tree race to build its index, all get the same one
+    sigil::vmnode_t root("index-race");
+    std::atomic<bool> start = {false};
+    sigil::vmnode_index_t *seen[4] = {};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) threads.emplace_back([&, t]() {
+        while (!start.load()) std::this_thread::yield();
+        seen[t] = root.get_index();
+    });
+    start = true;
+    for (auto &t : threads) t.join();
+
+    ASSERT_NE(seen[0], nullptr);
+    for (int t = 1; t < 4; t++) EXPECT_EQ(seen[t], seen[0]);
+    EXPECT_EQ(root.get_index(), seen[0]);
+}
+
+TEST_F(InitializationSuite, vm_node_deferred_reclaim) {
+    sigil::vmnode_descriptor_t node_info;
+    sigil::vmnode_handle_t handle;
+    node_info.name = "reclaim-test";
+
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &handle), sigil::VM_OK);
+    sigil::vmnode_handle_t leaf_handle;
+    sigil::vmnode_t *ref;
+    {
+        sigil::vmnode_ref_t node = sigil::virtual_machine::get_node(handle);
+        ASSERT_NE(node.node, nullptr);
+
+        sigil::vmnode_t *leaf = node->spawn_subnode("reclaim-mid")->spawn_subnode("reclaim-leaf");
+        ASSERT_NE(leaf, nullptr);
+        leaf_handle = leaf->handle;
+        ref = node->get_subnode("reclaim-leaf", VM_NODE_LOOKUP_MAX_DEPTH);
+        ASSERT_EQ(ref, leaf);
+    }
+    sigil::vmnode_t::wait_for_reclaim();
+    size_t pooled = sigil::vmnode_t::num_pooled();
+
+    // Held reference keeps leaf and its masters alive, but unreachable
+    ASSERT_EQ(sigil::virtual_machine::remove_node(handle), sigil::VM_OK);
+    sigil::vmnode_t::wait_for_reclaim();
+    EXPECT_EQ(sigil::virtual_machine::get_node(leaf_handle).node, nullptr);
+    EXPECT_TRUE(sigil::virtual_machine::find_node("reclaim-leaf").is_null());
+    EXPECT_EQ(sigil::vmnode_t::num_pooled(), pooled);
+    EXPECT_EQ(ref->get_node_name(), "reclaim-leaf");
+
+    ref->release();
+    sigil::vmnode_t::wait_for_reclaim();
+    EXPECT_EQ(sigil::vmnode_t::num_pooled(), pooled - 3);
+}
 
 TEST_F(InitializationSuite, vm_shutdown_test) {
     ASSERT_EQ(sigil::virtual_machine::deinitialize(), sigil::VM_OK);
 }
 
+static std::atomic<bool> lifecycle_task_cancelled = {false};
+
+static void lifecycle_task(sigil::cancel_token_t token) {
+    token.wait_for(10000);
+    lifecycle_task_cancelled = token.is_cancelled();
+}
+
+TEST_F(InitializationSuite, vm_lifecycle_test) {
+    EXPECT_EQ(sigil::virtual_machine::wait_for_vm(), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::virtual_machine::spawn_thread(lifecycle_task), sigil::VM_NOT_FOUND);
+
+    ASSERT_EQ(sigil::virtual_machine::initialize(0, nullptr), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::get_phase(), sigil::virtual_machine::VM_PHASE_STARTING);
+    ASSERT_EQ(sigil::virtual_machine::spawn_thread(lifecycle_task), sigil::VM_OK);
+
+    std::thread handler([]() { sigil::virtual_machine::wait_for_shutdown(); });
+    ASSERT_EQ(sigil::virtual_machine::wait_for_vm(), sigil::VM_OK);
+    EXPECT_TRUE(sigil::virtual_machine::is_active());
+    EXPECT_EQ(sigil::virtual_machine::wait_for_shutdown(), sigil::VM_LOCKED);
+
+    // Task sleeps for 10s, cancellation has to cut that short
+    sigil::exec_timer tmr;
+    tmr.start();
+    ASSERT_EQ(sigil::virtual_machine::request_shutdown(), sigil::VM_OK);
+    handler.join();
+    tmr.stop();
+
+    EXPECT_TRUE(lifecycle_task_cancelled);
+    EXPECT_LT(tmr.ms(), 1000u);
+    EXPECT_EQ(sigil::virtual_machine::get_phase(), sigil::virtual_machine::VM_PHASE_OFFLINE);
+    EXPECT_EQ(sigil::virtual_machine::deinitialize(), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::virtual_machine::submit([]() {}), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::virtual_machine::schedule_timer(0, 0, []() {}), sigil::VM_NOT_FOUND);
+    EXPECT_FALSE(sigil::virtual_machine::async([]() { return 0; }).valid());
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
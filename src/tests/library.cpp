@@ -1,5 +1,28 @@
 #include <gtest/gtest.h>
 #include "utils.h"
+#include "slab.h"
+#include "rcu.h"
+#include "cancel.h"
+#include "executor.h"
+#include "timer-wheel.h"
+#include "mailbox.h"
+#include "trace.h"
+#include "tsc-clock.h"
+#include "histogram.h"
+#include "system.h"
+#include "proc-stats.h"
+#include "log.h"
+#include "line-buffer.h"
+#include "mem-track.h"
+#include "frame-arena.h"
+#include "name-table.h"
+#include <sstream>
+#include <unordered_map>
+#include <unistd.h>
+#include <cstdio>
+#include <chrono>
+#include <atomic>
+#include <thread>
 
 class LibrarySuite : public ::testing::Test {
 protected:
@@ -24,9 +47,776 @@ TEST_F(LibrarySuite, GeneratesValidNumbersInRange) {
     }
 }
 
+TEST_F(LibrarySuite, GenerationalHandlesPackFields) {
+    auto h32 = sigil::handle32_t::make(0xABCDE, 0x123);
+    EXPECT_EQ(h32.index(), 0xABCDEu);
+    EXPECT_EQ(h32.generation(), 0x123u);
+    EXPECT_EQ(sizeof(h32), sizeof(uint32_t));
+
+    auto h64 = sigil::handle64_t::make(0xDEADBEEF, 0xCAFE);
+    EXPECT_EQ(h64.index(), 0xDEADBEEFu);
+    EXPECT_EQ(h64.generation(), 0xCAFEu);
+    EXPECT_TRUE(sigil::handle64_t().is_null());
+}
+
+TEST_F(LibrarySuite, SlabPoolDetectsStaleHandles) {
+    sigil::slab_pool_t<std::string, sigil::handle32_t, 16, 64> pool;
+    std::vector<sigil::handle32_t> handles(100);
+    std::vector<std::string*> objects(100);
+
+    for (int i = 0; i < 100; i++) {
+        objects[i] = pool.create(&handles[i], "object-" + std::to_string(i));
+        ASSERT_NE(objects[i], nullptr);
+        EXPECT_EQ(pool.get(handles[i]), objects[i]);
+    }
+    EXPECT_EQ(pool.live(), 100u);
+    EXPECT_EQ(pool.capacity(), 112u);
+
+    // Freed slots are reused, old handles must not resolve to new objects
+    pool.destroy(objects[7]);
+    EXPECT_EQ(pool.get(handles[7]), nullptr);
+
+    sigil::handle32_t reused;
+    std::string *object = pool.create(&reused, "reused");
+    EXPECT_EQ(object, objects[7]);
+    EXPECT_EQ(reused.index(), handles[7].index());
+    EXPECT_NE(reused, handles[7]);
+    EXPECT_EQ(pool.get(handles[7]), nullptr);
+    EXPECT_EQ(*pool.get(reused), "reused");
+    EXPECT_EQ(pool.handle_of(object), reused);
+
+    for (int i = 0; i < 100; i++) pool.destroy(pool.get(i == 7 ? reused : handles[i]));
+    EXPECT_EQ(pool.live(), 0u);
+
+    // Pool is bounded by its slab count
+    sigil::slab_pool_t<uint64_t, sigil::handle32_t, 4, 2> tiny;
+    for (int i = 0; i < 8; i++) EXPECT_NE(tiny.create(nullptr, i), nullptr);
+    EXPECT_EQ(tiny.create(nullptr, 8), nullptr);
+}
+TEST_F(LibrarySuite, RcuDefersReclaimWhileRead) {
+    sigil::rcu_domain_t domain;
+    bool reclaimed = false;
+
+    uint32_t slot = domain.read_lock();
+    domain.retire([&reclaimed]() { reclaimed = true; });
+    EXPECT_FALSE(reclaimed);
+    EXPECT_EQ(domain.num_retired(), 1u);
+
+    // Reader that started after retirement does not hold it back
+    uint32_t late_slot = domain.read_lock();
+    domain.read_unlock(slot);
+    EXPECT_EQ(domain.reclaim(), 1u);
+    EXPECT_TRUE(reclaimed);
+    domain.read_unlock(late_slot);
+}
+
+TEST_F(LibrarySuite, CancelTokenWakesWaiters) {
+    sigil::cancel_token_t token;
+    sigil::cancel_token_t copy = token;
+    EXPECT_FALSE(token.wait_for(1));
+
+    sigil::exec_timer tmr;
+    tmr.start();
+    std::thread waiter([copy]() { copy.wait_for(10000); });
+    sigil::sleep_ms(5);
+    token.cancel();
+    waiter.join();
+    tmr.stop();
+
+    EXPECT_TRUE(copy.is_cancelled());
+    EXPECT_LT(tmr.ms(), 1000u);
+    EXPECT_FALSE(sigil::cancel_token_t().is_cancelled());
+}
+
+TEST_F(LibrarySuite, ExecutorRunsAndStealsJobs) {
+    sigil::executor_t executor(4);
+    std::atomic<uint32_t> num_done = {0};
+
+    // Nested submits all land on one deque, idle workers have to steal them
+    executor.submit([&]() {
+        for (int i = 0; i < 10000; i++) executor.submit([&]() { num_done++; });
+    });
+    executor.wait_idle();
+    EXPECT_EQ(num_done.load(), 10000u);
+
+    std::future<int> answer = executor.async([]() { return 42; });
+    std::future<bool> on_worker = executor.async([&]() { return executor.is_worker(); });
+    EXPECT_EQ(answer.get(), 42);
+    EXPECT_TRUE(on_worker.get());
+    EXPECT_FALSE(executor.is_worker());
+
+    // Work queued before shutdown still runs, anything after is refused
+    executor.submit([&]() { num_done++; });
+    executor.shutdown();
+    EXPECT_FALSE(executor.submit([&]() { num_done++; }));
+    EXPECT_FALSE(executor.async([]() { return 1; }).valid());
+    executor.wait_idle();
+    EXPECT_EQ(num_done.load(), 10001u);
+}
+
+TEST_F(LibrarySuite, TimerWheelFiresInOrder) {
+    sigil::timer_wheel_t wheel(1000);
+    std::vector<std::function<void()>> due;
+    std::vector<uint64_t> expiry;
+    std::vector<uint64_t> fired_at;
+    uint64_t now = 1000;
+
+    // Delays spread over every level, including past the wheel range
+    for (uint32_t i = 0; i < 2000; i++) {
+        uint64_t delay = sigil::random_u32_scoped(0, 1) ?
+            sigil::random_u32_scoped(0, 100000) : (uint64_t)sigil::random_u32_scoped(0, UINT32_MAX) * 2;
+        expiry.push_back(now + delay);
+        fired_at.push_back(0);
+        ASSERT_FALSE(wheel.schedule(now + delay, 0, [&, i]() { fired_at[i] = now; }).is_null());
+    }
+
+    uint32_t num_ticks = 0;
+    sigil::timer_handle_t ticker = wheel.schedule(now + 500, 500, [&]() { num_ticks++; });
+    sigil::timer_handle_t cancelled = wheel.schedule(now + 50, 0, []() { FAIL(); });
+    EXPECT_TRUE(wheel.cancel(cancelled));
+    EXPECT_FALSE(wheel.cancel(cancelled));
+
+    while (wheel.size() > 1) {
+        now += sigil::random_u32_scoped(1, 3000) * (now > 2000000 ? 1000 : 1);
+        wheel.advance(now, due);
+        for (auto &callback : due) callback();
+        due.clear();
+
+        // Never jumps over a pending expiry
+        ASSERT_GT(wheel.next_wakeup_us(), wheel.now_us());
+    }
+
+    for (uint32_t i = 0; i < expiry.size(); i++) {
+        ASSERT_GE(fired_at[i], expiry[i]);
+        // Fired on first advance past expiry
+        ASSERT_LT(fired_at[i], expiry[i] + (expiry[i] > 2000000 ? 3000000 : 3000));
+    }
+    EXPECT_GT(num_ticks, 0u);
+    EXPECT_TRUE(wheel.cancel(ticker));
+    EXPECT_EQ(wheel.next_wakeup_us(), UINT64_MAX);
+}
+
+TEST_F(LibrarySuite, MailboxKeepsProducerOrder) {
+    sigil::mailbox_t<uint64_t> mailbox(1000);
+    std::vector<std::thread> producers;
+    const uint64_t per_producer = 20000;
+    EXPECT_EQ(mailbox.capacity(), 1024u);
+
+    // Producer id in upper bits, sequence number in lower bits
+    for (uint64_t p = 0; p < 4; p++) producers.emplace_back([&, p]() {
+        for (uint64_t i = 0; i < per_producer; i++) {
+            while (!mailbox.push((p << 32) | i)) std::this_thread::yield();
+        }
+    });
+
+    uint64_t next[4] = {0};
+    uint64_t batch[64];
+    uint64_t num_received = 0;
+    while (num_received < 4 * per_producer) {
+        size_t count = mailbox.pop_batch(batch, 64);
+        for (size_t i = 0; i < count; i++) {
+            uint64_t p = batch[i] >> 32;
+            ASSERT_EQ(batch[i] & 0xFFFFFFFF, next[p]++);
+        }
+        num_received += count;
+    }
+
+    for (auto &t : producers) t.join();
+    EXPECT_TRUE(mailbox.empty());
+    for (uint32_t i = 0; i < 1024; i++) EXPECT_TRUE(mailbox.push(i));
+    EXPECT_FALSE(mailbox.push(0));
+}
+
+// Reads back begin and duration of a zone from exported trace
+static bool find_trace_zone(const std::string &json, const char *name, double &ts, double &dur) {
+    std::string key = std::string("{\"name\":\"") + name + "\",\"ph\":\"X\"";
+    size_t at = json.find(key);
+    if (at == std::string::npos) return false;
+    return sscanf(json.c_str() + json.find("\"ts\":", at), "\"ts\":%lf,\"dur\":%lf", &ts, &dur) == 2;
+}
+
+static std::string read_file(const char *path) {
+    std::string content;
+    FILE *file = fopen(path, "r");
+    if (!file) return content;
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) content.append(buffer, count);
+    fclose(file);
+    return content;
+}
+
+static size_t count_of(const std::string &text, const std::string &what) {
+    size_t count = 0;
+    for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) count++;
+    return count;
+}
+
+TEST_F(LibrarySuite, TraceZonesExportChromeJson) {
+    const char *path = "/tmp/sigil-trace-test.json";
+
+    // Nothing is recorded while disabled
+    { SIGIL_TRACE_ZONE("disabled-zone"); }
+
+    sigil::trace::enable(true);
+    sigil::trace::set_thread_name("test \"main\"");
+    {
+        SIGIL_TRACE_ZONE("outer");
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        {
+            SIGIL_TRACE_ZONE("inner");
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) threads.emplace_back([]() {
+        for (int i = 0; i < 100; i++) SIGIL_TRACE_ZONE("worker-zone");
+    });
+    for (auto &t : threads) t.join();
+
+    ASSERT_EQ(sigil::trace::export_json(path), sigil::VM_OK);
+    std::string json = read_file(path);
+
+    EXPECT_EQ(json.find("disabled-zone"), std::string::npos);
+    EXPECT_EQ(count_of(json, "\"worker-zone\""), 400u);
+    EXPECT_NE(json.find("test \\\"main\\\""), std::string::npos);
+
+    double outer_ts, outer_dur, inner_ts, inner_dur;
+    ASSERT_TRUE(find_trace_zone(json, "outer", outer_ts, outer_dur));
+    ASSERT_TRUE(find_trace_zone(json, "inner", inner_ts, inner_dur));
+    EXPECT_GE(outer_dur, 3000.0);
+    EXPECT_GE(inner_dur, 1000.0);
+    EXPECT_GE(inner_ts, outer_ts);
+    EXPECT_LE(inner_ts + inner_dur, outer_ts + outer_dur);
+
+    // Export drains buffers, next one only has what came after
+    { SIGIL_TRACE_ZONE("after-export"); }
+    ASSERT_EQ(sigil::trace::export_json(path), sigil::VM_OK);
+    json = read_file(path);
+    EXPECT_EQ(json.find("\"outer\""), std::string::npos);
+    EXPECT_EQ(count_of(json, "\"ph\":\"X\""), 1u);
+
+    // Full buffer drops new zones instead of overwriting unread ones
+    uint64_t dropped = sigil::trace::num_dropped();
+    for (int i = 0; i < TRACE_BUFFER_EVENTS + 10; i++) sigil::trace::record("flood", 0, 0);
+    EXPECT_EQ(sigil::trace::num_dropped() - dropped, 10u);
+
+    sigil::trace::enable(false);
+    ASSERT_EQ(sigil::trace::export_json(path), sigil::VM_OK);
+    EXPECT_EQ(count_of(read_file(path), "\"flood\""), (size_t)TRACE_BUFFER_EVENTS);
+    EXPECT_EQ(sigil::trace::export_json("/nonexistent/trace.json"), sigil::VM_FAILED);
+    remove(path);
+}
+
+TEST_F(LibrarySuite, TscClockMatchesMonotonic) {
+    for (bool allow_tsc : {false, true}) {
+        sigil::status_t status = sigil::tsc::calibrate(allow_tsc);
+        if (!allow_tsc) EXPECT_EQ(status, sigil::VM_NOT_SUPPORTED);
+        EXPECT_GE(sigil::tsc::frequency(), 100000000u);
+
+        sigil::tsc_timer_t timer;
+        sigil::exec_timer reference;
+        timer.start();
+        reference.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        reference.stop();
+        timer.stop();
+
+        // Both measure same interval, give or take scheduling
+        int64_t difference = (int64_t)timer.ns() - (int64_t)reference.ns();
+        EXPECT_LT(std::abs(difference), 200000) << "tsc " << allow_tsc;
+        EXPECT_GE(timer.ms(), 20u);
+
+        uint64_t previous = sigil::tsc::ticks();
+        for (int i = 0; i < 1000; i++) {
+            uint64_t now = sigil::tsc::ticks();
+            ASSERT_GE(now, previous);
+            previous = now;
+        }
+    }
+}
+
+TEST_F(LibrarySuite, HistogramPercentilesWithinBucket) {
+    // Every bucket starts right after previous one ends, and is narrower than 1/64 of its values
+    uint64_t previous_max = 0;
+    for (uint32_t bucket = 1; bucket < sigil::histogram_t::num_buckets - 1; bucket++) {
+        uint64_t bucket_max = sigil::histogram_t::bucket_max(bucket);
+        ASSERT_EQ(sigil::histogram_t::bucket_of(previous_max + 1), bucket);
+        ASSERT_EQ(sigil::histogram_t::bucket_of(bucket_max), bucket);
+        ASSERT_LE(bucket_max - previous_max - 1, MAX(previous_max / 64, (uint64_t)1));
+        previous_max = bucket_max;
+    }
+    EXPECT_EQ(sigil::histogram_t::bucket_of(UINT64_MAX), sigil::histogram_t::num_buckets - 1);
+
+    sigil::histogram_t values;
+    EXPECT_EQ(values.percentile(50.0), 0u);
+    EXPECT_EQ(values.min(), 0u);
+    for (uint64_t i = 1; i <= 100000; i++) values.record(i * 1000);
+
+    EXPECT_EQ(values.count(), 100000u);
+    EXPECT_EQ(values.min(), 1000u);
+    EXPECT_EQ(values.max(), 100000000u);
+    EXPECT_EQ(values.mean(), 50000500u);
+    for (double percent : {50.0, 90.0, 99.0, 99.9}) {
+        double expected = percent * 1000000.0;
+        double reported = (double)values.percentile(percent);
+        EXPECT_GE(reported, expected) << percent;
+        EXPECT_LE(reported, expected * (1.0 + 1.0 / 64)) << percent;
+    }
+    EXPECT_EQ(values.percentile(100.0), 100000000u);
+
+    // Threads record concurrently, nothing gets lost
+    sigil::histogram_t shared;
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; t++) {
+        threads.emplace_back([&shared, t]() {
+            for (uint64_t i = 0; i < 100000; i++) shared.record(t * 100000 + i);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    EXPECT_EQ(shared.count(), 400000u);
+    EXPECT_EQ(shared.max(), 399999u);
+    EXPECT_EQ(shared.min(), 0u);
+
+    values.add(shared);
+    EXPECT_EQ(values.count(), 500000u);
+    EXPECT_EQ(values.min(), 0u);
+}
+
+TEST_F(LibrarySuite, WindowedHistogramForgetsOldSlots) {
+    const uint64_t second = 1000000000ull;
+    sigil::windowed_histogram_t latency(second, 10);
+    sigil::histogram_t window;
+
+    // One value per second, value is second it was recorded in
+    for (uint64_t t = 100; t < 120; t++) latency.record(t * 1000, t * second + 5);
+
+    latency.snapshot(window, second, 119 * second);
+    EXPECT_EQ(window.count(), 1u);
+    EXPECT_EQ(window.max(), 119000u);
+
+    latency.snapshot(window, latency.window_max_ns(), 119 * second);
+    EXPECT_EQ(window.count(), 10u);
+    EXPECT_EQ(window.min(), 110000u);
+
+    // Nothing recorded since, slots age out of window without being touched
+    latency.snapshot(window, latency.window_max_ns(), 125 * second);
+    EXPECT_EQ(window.count(), 4u);
+    latency.snapshot(window, latency.window_max_ns(), 200 * second);
+    EXPECT_EQ(window.count(), 0u);
+    EXPECT_EQ(latency.all_time().count(), 20u);
+
+    // Slot reused after a full round starts over
+    latency.record(7, 129 * second);
+    latency.snapshot(window, second, 129 * second);
+    EXPECT_EQ(window.count(), 1u);
+    EXPECT_EQ(window.max(), 7u);
+}
+
+TEST_F(LibrarySuite, MetricsSumShardsOfAllThreads) {
+    sigil::vmnode_t *node = sigil::vmnode_t::create("metrics-test");
+    sigil::metric_t counter, gauge, other;
+    ASSERT_EQ(sigil::metrics::register_metric(node, "events", sigil::METRIC_COUNTER, &counter), sigil::VM_OK);
+    ASSERT_EQ(sigil::metrics::register_metric(node, "depth", sigil::METRIC_GAUGE, &gauge), sigil::VM_OK);
+    EXPECT_EQ(sigil::metrics::register_metric(node, "events", sigil::METRIC_COUNTER, &other), sigil::VM_ALREADY_EXISTS);
+    EXPECT_EQ(other.slot, counter.slot);
+    EXPECT_EQ(sigil::metrics::register_metric(node, "events", sigil::METRIC_GAUGE, &other), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::metrics::register_metric(node, nullptr, sigil::METRIC_GAUGE, &other), sigil::VM_ARG_NULL);
+
+    // Threads exit before reading, their counts are kept
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 100000; i++) counter.add();
+            gauge.add(5);
+            gauge.add(-2);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    counter.add(10);
+    sigil::metric_t().add();
+
+    std::vector<sigil::metric_value_t> values;
+    ASSERT_EQ(sigil::metrics::read(node, values), sigil::VM_OK);
+    ASSERT_EQ(values.size(), 5u);
+    EXPECT_EQ(values[3].name, "events");
+    EXPECT_EQ(values[3].value, 800010);
+    EXPECT_EQ(values[4].value, 24);
+    gauge.set(-7);
+    ASSERT_EQ(sigil::metrics::read(node, values), sigil::VM_OK);
+    EXPECT_EQ(values[4].value, -7);
+
+    // Reused slot starts from zero
+    size_t free_slots = sigil::metrics::num_free_slots();
+    sigil::vmnode_t::destroy(node);
+    EXPECT_EQ(sigil::metrics::num_free_slots(), free_slots + 5);
+    EXPECT_EQ(sigil::metrics::read(node, values), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::metrics::describe(node), "");
+
+    node = sigil::vmnode_t::create("metrics-test");
+    ASSERT_EQ(sigil::metrics::register_metric(node, "events", sigil::METRIC_COUNTER, &counter), sigil::VM_OK);
+    ASSERT_EQ(sigil::metrics::read(node, values), sigil::VM_OK);
+    EXPECT_EQ(values[3].value, 0);
+    sigil::vmnode_t::destroy(node);
+}
+
+TEST_F(LibrarySuite, ProcStatsSampleOwnProcess) {
+    std::atomic<bool> stop = {false};
+    std::atomic<bool> named = {false};
+    std::thread busy([&]() {
+        sigil::trace::set_thread_name("procstat-busy");
+        named = true;
+        volatile uint64_t spins = 0;
+        while (!stop.load()) spins++;
+    });
+    while (!named.load()) std::this_thread::yield();
+
+    ASSERT_EQ(sigil::procstat::sample(), sigil::VM_OK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(sigil::procstat::sample(), sigil::VM_OK);
+
+    sigil::procstat::snapshot_t snapshot;
+    ASSERT_TRUE(sigil::procstat::read(snapshot));
+    stop = true;
+    busy.join();
+
+    EXPECT_GE(snapshot.sequence, 2u);
+    EXPECT_EQ(snapshot.pid, (uint32_t)getpid());
+    EXPECT_GT(snapshot.rss, 0u);
+    EXPECT_GE(snapshot.peak_rss, snapshot.rss);
+    EXPECT_GE(snapshot.vsize, snapshot.rss);
+    EXPECT_GT(snapshot.minor_faults, 0u);
+    EXPECT_GE(snapshot.num_threads, 2u);
+    EXPECT_GT(snapshot.cpu_percent, 10.0f);
+
+    // Spinning thread uses most of a core
+    const sigil::procstat::task_t *found = nullptr;
+    for (uint32_t i = 0; i < snapshot.num_tasks; i++) {
+        if (strcmp(snapshot.tasks[i].name, "procstat-busy") == 0) found = &snapshot.tasks[i];
+    }
+    ASSERT_NE(found, nullptr);
+    EXPECT_GT(found->cpu_percent, 10.0f);
+    EXPECT_GT(found->cpu_ns, 0u);
+}
 
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
 
+TEST_F(LibrarySuite, LoggerWritesThreadsInTimeOrder) {
+    const char *path = "/tmp/sigil-log-test.log";
+    remove(path);
+    sigil::log::enable_console(false);
+    ASSERT_EQ(sigil::log::open_file(path), sigil::VM_OK);
+
+    SIGIL_LOG_DEBUG("log-test: filtered out");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) threads.emplace_back([t]() {
+        for (int i = 0; i < 100; i++) SIGIL_LOG_WARN("log-test: thread %d message %d", t, i);
+    });
+    for (auto &t : threads) t.join();
+    sigil::log::flush();
+
+    std::istringstream lines(read_file(path));
+    std::string line, previous_clock;
+    int next[4] = {0, 0, 0, 0};
+    size_t num_lines = 0;
+    while (std::getline(lines, line)) {
+        int t, i;
+        size_t at = line.find("log-test: thread ");
+        ASSERT_NE(at, std::string::npos) << line;
+        ASSERT_EQ(sscanf(line.c_str() + at, "log-test: thread %d message %d", &t, &i), 2);
+        EXPECT_EQ(i, next[t]++);
+        EXPECT_NE(line.find("] WARN "), std::string::npos);
+
+        // "[YYYY-mm-dd HH:MM:SS.mmm]" sorts as text
+        std::string clock = line.substr(0, line.find(']'));
+        EXPECT_GE(clock, previous_clock);
+        previous_clock = clock;
+        num_lines++;
+    }
+    EXPECT_EQ(num_lines, 400u);
+
+    // A burst larger than ring drops messages, none goes missing uncounted
+    uint64_t dropped = sigil::log::num_dropped();
+    const int num_flood = LOG_RING_RECORDS * 8;
+    for (int i = 0; i < num_flood; i++) SIGIL_LOG_INFO("log-test: flood %d", i);
+    sigil::log::flush();
+    size_t num_written = count_of(read_file(path), "log-test: flood ");
+    EXPECT_EQ(num_written + (sigil::log::num_dropped() - dropped), (size_t)num_flood);
+
+    EXPECT_EQ(sigil::log::open_file("/nonexistent/sigil.log"), sigil::VM_FAILED);
+    EXPECT_EQ(sigil::log::open_file(nullptr), sigil::VM_OK);
+    sigil::log::enable_console(true);
+    remove(path);
+}
+
+template<typename... Args> static std::string format_deferred(const char *format, const Args&... args) {
+    char payload[LOG_PAYLOAD_SIZE];
+    sigil::log::arg_buffer_t buffer = {payload, payload + sizeof(payload)};
+    (sigil::log::encode_arg(buffer, args), ...);
+    std::string out;
+    sigil::log::format_args(format, payload, buffer.at - payload, out);
+    return out;
+}
+
+TEST_F(LibrarySuite, DeferredLogFormatsLikePrintf) {
+    char expected[256];
+    snprintf(expected, sizeof(expected), "%d %u %x %lu %5.2f %-8s| %c %% %+.3e %hhu",
+        -42, 42u, 255u, (uint64_t)1 << 40, 3.14159, "abc", 'z', 1e10, (unsigned char)7);
+    EXPECT_EQ(format_deferred("%d %u %x %lu %5.2f %-8s| %c %% %+.3e %hhu",
+        -42, 42u, 255u, (uint64_t)1 << 40, 3.14159, "abc", 'z', 1e10, (unsigned char)7), expected);
+
+    snprintf(expected, sizeof(expected), "[%*d] [%-*s] %p", 6, 42, 4, "ab", (void*)0x1234);
+    EXPECT_EQ(format_deferred("[%*d] [%-*s] %p", 6, 42, 4, "ab", (void*)0x1234), expected);
+
+    char name[16] = "node-a";
+    std::string owner = "owner";
+    EXPECT_EQ(format_deferred("%s/%s/%s", name, owner.c_str(), (const char*)nullptr), "node-a/owner/(null)");
+
+    // Missing or mismatched arguments never read past payload
+    EXPECT_EQ(format_deferred("%d %s", 1), "1 <?>");
+    EXPECT_EQ(format_deferred("%s %f", 5, "x"), "<?> <?>");
+
+    // Long string is cut to what fits in a record
+    std::string long_text(LOG_RECORD_SIZE * 2, 'a');
+    std::string out = format_deferred("%s!", long_text.c_str());
+    EXPECT_LT(out.size(), (size_t)LOG_PAYLOAD_SIZE);
+    EXPECT_EQ(out.find_first_not_of('a'), out.size() - 1);
+}
+
+TEST_F(LibrarySuite, BinaryLogDumpsAsText) {
+    const char *path = "/tmp/sigil-log-test.bin";
+    sigil::log::enable_console(false);
+    ASSERT_EQ(sigil::log::open_binary_file(path), sigil::VM_OK);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++) threads.emplace_back([t]() {
+        for (int i = 0; i < 50; i++) SIGIL_LOG_WARN("log-test: binary %d of %s, %.1f", i, t ? "odd" : "even", i / 2.0);
+    });
+    for (auto &t : threads) t.join();
+    sigil::log::write(sigil::log::LEVEL_ERROR, "log-test: formatted %d", 7);
+    sigil::log::flush();
+    ASSERT_EQ(sigil::log::open_file(nullptr), sigil::VM_OK);
+    sigil::log::enable_console(true);
+
+    char *text = nullptr;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    ASSERT_EQ(sigil::log::dump_binary_file(path, out), sigil::VM_OK);
+    fclose(out);
+    std::string dump(text, size);
+    free(text);
+
+    EXPECT_EQ(count_of(dump, "] WARN "), 100u);
+    EXPECT_NE(dump.find("log-test: binary 49 of odd, 24.5\n"), std::string::npos);
+    EXPECT_NE(dump.find("log-test: binary 0 of even, 0.0\n"), std::string::npos);
+    EXPECT_NE(dump.find("] ERROR"), std::string::npos);
+    EXPECT_NE(dump.find("log-test: formatted 7\n"), std::string::npos);
+
+    EXPECT_EQ(sigil::log::dump_binary_file("/nonexistent/sigil.bin", stdout), sigil::VM_NOT_FOUND);
+    FILE *text_log = fopen(path, "w");
+    fputs("[2026-01-01 00:00:00.000] INFO    1 not binary\n", text_log);
+    fclose(text_log);
+    EXPECT_EQ(sigil::log::dump_binary_file(path, stdout), sigil::VM_FAILED);
+    remove(path);
+}
+
+TEST_F(LibrarySuite, LineBufferEvictsOldestToArchive) {
+    const char *path = "/tmp/sigil-lines-test.txt";
+    remove(path);
+    sigil::line_buffer_t lines(LINE_BUFFER_MAX_LINE, 8, 64);
+    ASSERT_EQ(lines.set_archive(path), sigil::VM_OK);
+
+    // Text is split at newlines, trailing text is a line of its own
+    EXPECT_TRUE(lines.push("one\ntwo\n\nthree"));
+    EXPECT_EQ(lines.collect(), 4u);
+    EXPECT_EQ(lines.line(2), "");
+    EXPECT_EQ(lines.line(3), "three");
+
+    // Line index is full past 8 lines
+    for (int i = 0; i < 10; i++) lines.printf("line %d", i);
+    EXPECT_EQ(lines.collect(), 10u);
+    EXPECT_EQ(lines.num_lines(), 8u);
+    EXPECT_EQ(lines.num_evicted(), 6u);
+    EXPECT_EQ(lines.line(0), "line 2");
+    EXPECT_EQ(lines.line(7), "line 9");
+
+    // Text ring is full past 3 long lines, a line never wraps around its end
+    std::string long_line(LINE_BUFFER_MAX_LINE / 3, 'x');
+    for (int i = 0; i < 4; i++) lines.push(long_line + std::to_string(i));
+    lines.collect();
+    EXPECT_LE(lines.num_lines(), 3u);
+    EXPECT_EQ(lines.line(lines.num_lines() - 1), long_line + "3");
+    for (uint32_t i = 0; i < lines.num_lines(); i++) EXPECT_EQ(lines.line(i).substr(0, 8), "xxxxxxxx");
+
+    // Full mailbox drops pushes instead of blocking
+    for (int i = 0; i < 100; i++) lines.printf("flood %d", i);
+    EXPECT_EQ(lines.num_dropped(), 36u);
+    lines.collect();
+
+    uint64_t evicted = lines.num_evicted();
+    lines.clear();
+    EXPECT_EQ(lines.num_lines(), 0u);
+    ASSERT_EQ(lines.set_archive(nullptr), sigil::VM_OK);
+
+    std::string archived = read_file(path);
+    EXPECT_EQ(count_of(archived, "\n"), evicted + 8);
+    EXPECT_EQ(archived.rfind("one\ntwo\n\nthree\nline 0\nline 1\n", 0), 0u);
+    EXPECT_NE(archived.find("flood 63\n"), std::string::npos);
+    EXPECT_EQ(archived.find("flood 64"), std::string::npos);
+    remove(path);
+}
+
+TEST_F(LibrarySuite, MemTrackAttributesToTags) {
+    sigil::mem_tag_stats_t before[sigil::MEM_TAG_COUNT], after[sigil::MEM_TAG_COUNT];
+    sigil::memtrack::read(before);
+
+    // Explicit tag counts with or without hooks
+    int64_t balance = sigil::memtrack::thread_balance();
+    void *block = sigil::memtrack::allocate(1000, sigil::MEM_TAG_VM);
+    EXPECT_EQ(sigil::memtrack::thread_balance() - balance, 1000);
+    sigil::memtrack::release(block);
+    EXPECT_EQ(sigil::memtrack::thread_balance(), balance);
+
+    void *blocks[4];
+    for (auto &block : blocks) block = sigil::memtrack::allocate(1000, sigil::MEM_TAG_NTT);
+    for (int i = 0; i < 2; i++) sigil::memtrack::release(blocks[i]);
+    sigil::memtrack::read(after);
+    EXPECT_EQ(after[sigil::MEM_TAG_NTT].live_bytes - before[sigil::MEM_TAG_NTT].live_bytes, 2000);
+    EXPECT_EQ(after[sigil::MEM_TAG_NTT].allocations - before[sigil::MEM_TAG_NTT].allocations, 4u);
+    EXPECT_EQ(after[sigil::MEM_TAG_NTT].frees - before[sigil::MEM_TAG_NTT].frees, 2u);
+    EXPECT_GE(after[sigil::MEM_TAG_NTT].peak_bytes, before[sigil::MEM_TAG_NTT].live_bytes + 4000);
+    for (int i = 2; i < 4; i++) sigil::memtrack::release(blocks[i]);
+
+    {
+        sigil::memtrack::scope_t scope(sigil::MEM_TAG_VISOR);
+        EXPECT_EQ(sigil::memtrack::current_tag(), sigil::MEM_TAG_VISOR);
+    }
+    EXPECT_EQ(sigil::memtrack::current_tag(), sigil::MEM_TAG_UNTAGGED);
+
+    if (!sigil::memtrack::hooks_enabled()) return;
+
+    // Freed from tag that allocated it, wherever delete runs
+    sigil::memtrack::read(before);
+    std::vector<char> *data;
+    struct alignas(128) aligned_t { char bytes[256]; } *aligned;
+    {
+        SIGIL_MEM_TAG(sigil::MEM_TAG_SCRIPT);
+        data = new std::vector<char>(1 << 20);
+        aligned = new aligned_t;
+    }
+    EXPECT_EQ((uintptr_t)aligned % 128, 0u);
+    sigil::memtrack::read(after);
+    EXPECT_GE(after[sigil::MEM_TAG_SCRIPT].live_bytes - before[sigil::MEM_TAG_SCRIPT].live_bytes, (1 << 20) + 256);
+
+    std::thread([&]() { delete data; delete aligned; }).join();
+    sigil::memtrack::read(after);
+    EXPECT_EQ(after[sigil::MEM_TAG_SCRIPT].live_bytes, before[sigil::MEM_TAG_SCRIPT].live_bytes);
+}
+
+TEST_F(LibrarySuite, ArenaResetsAndMergesChunks) {
+    sigil::mem_tag_stats_t before[sigil::MEM_TAG_COUNT], after[sigil::MEM_TAG_COUNT];
+    sigil::memtrack::read(before);
+    {
+        sigil::arena_t arena(4096, sigil::MEM_TAG_GUI);
+        EXPECT_EQ(arena.used(), 0u);
+
+        char *first = (char*)arena.allocate(10, 1);
+        uint64_t *aligned = (uint64_t*)arena.allocate(8, 64);
+        ASSERT_NE(first, nullptr);
+        EXPECT_EQ((uintptr_t)aligned % 64, 0u);
+        EXPECT_GT((char*)aligned, first);
+        EXPECT_EQ(arena.num_overflows(), 0u);
+
+        // Frame outgrows first chunk
+        for (int i = 0; i < 16; i++) ASSERT_NE(arena.allocate(1000), nullptr);
+        EXPECT_GT(arena.num_overflows(), 0u);
+        EXPECT_GE(arena.used(), 16000u);
+        sigil::memtrack::read(after);
+        EXPECT_GE(after[sigil::MEM_TAG_GUI].live_bytes - before[sigil::MEM_TAG_GUI].live_bytes, 16000);
+
+        // Same frame again fits into one merged chunk
+        arena.reset();
+        uint64_t overflows = arena.num_overflows();
+        EXPECT_EQ(arena.used(), 0u);
+        EXPECT_GE(arena.high_water(), 16000u);
+        ASSERT_NE(arena.allocate(10, 1), nullptr);
+        EXPECT_EQ(arena.used(), 10u);
+        for (int i = 0; i < 16; i++) ASSERT_NE(arena.allocate(1000), nullptr);
+        EXPECT_EQ(arena.num_overflows(), overflows);
+        arena.reset();
+
+        sigil::arena_vector_t<int> numbers(arena);
+        for (int i = 0; i < 1000; i++) numbers.push_back(i);
+        EXPECT_EQ(numbers[999], 999);
+        sigil::arena_string_t text("arena strings outgrow small string storage", arena);
+        text += " easily";
+        EXPECT_EQ(std::string_view(text).substr(text.size() - 6), "easily");
+        EXPECT_EQ(arena.printf("%s %d", "frame", 42), "frame 42");
+
+        // Rewind gives back what a scope took, overflow chunks included
+        size_t used = arena.used();
+        sigil::arena_t::marker_t mark = arena.mark();
+        for (int i = 0; i < 64; i++) ASSERT_NE(arena.allocate(1000), nullptr);
+        arena.rewind(mark);
+        EXPECT_EQ(arena.used(), used);
+        EXPECT_EQ(arena.printf("%s", "again"), "again");
+    }
+
+    // Long text is formatted on the arena of the thread, which ends where it started
+    std::string text;
+    size_t used = sigil::frame_arena().used();
+    EXPECT_EQ(sigil::insert_into_string(text, "%s%2000d", "long", 7), 2004);
+    EXPECT_EQ(text.size(), 2004u);
+    EXPECT_EQ(text.back(), '7');
+    EXPECT_EQ(sigil::frame_arena().used(), used);
+    sigil::memtrack::read(after);
+    EXPECT_EQ(after[sigil::MEM_TAG_GUI].live_bytes, before[sigil::MEM_TAG_GUI].live_bytes);
+}
+
+TEST_F(LibrarySuite, NameTableInternsOnce) {
+    sigil::name_t empty;
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ(empty.id(), 0u);
+    EXPECT_EQ(empty, sigil::name_t(""));
+    EXPECT_STREQ(empty.c_str(), "");
+
+    // Never interned text is not found, and finding does not add it
+    sigil::name_t found;
+    size_t before = sigil::name_t::num_interned();
+    EXPECT_FALSE(sigil::name_t::find("name-table-test", found));
+    EXPECT_EQ(sigil::name_t::num_interned(), before);
+
+    std::string text = "name-table-test";
+    sigil::name_t name = text;
+    EXPECT_EQ(sigil::name_t::num_interned(), before + 1);
+    EXPECT_TRUE(sigil::name_t::find(text, found));
+    EXPECT_EQ(found, name);
+    EXPECT_EQ(found.c_str(), name.c_str());
+    EXPECT_EQ(name.view(), "name-table-test");
+    EXPECT_EQ(name.hash(), sigil::hash_str(text));
+    EXPECT_NE(name, sigil::name_t("name-table-test2"));
+    EXPECT_NE(name.id(), sigil::name_t("name-table-test2").id());
+
+    // Threads interning same texts at once all get same names
+    const int num_threads = 4, num_names = 1000;
+    std::vector<std::vector<sigil::name_t>> interned(num_threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&interned, t]() {
+            for (int i = 0; i < num_names; i++) interned[t].push_back("name-table-thread-" + std::to_string(i));
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    for (int i = 0; i < num_names; i++) {
+        for (int t = 1; t < num_threads; t++) EXPECT_EQ(interned[t][i], interned[0][i]);
+    }
+    std::unordered_map<sigil::name_t, int> counts;
+    for (auto &names : interned) for (auto &n : names) counts[n]++;
+    EXPECT_EQ(counts.size(), (size_t)num_names);
+    EXPECT_EQ(counts[sigil::name_t("name-table-thread-7")], num_threads);
+}
@@ -1,6 +1,15 @@
 #include <gtest/gtest.h>
 #include "virtual-machine.h"
 #include "system.h"
+#include "script.h"
+#include "mapped-file.h"
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+
+#ifndef SIGIL_TEST_SCRIPTS_DIR
+#define SIGIL_TEST_SCRIPTS_DIR "src/tests/scripts"
+#endif
 
 class ParserSuite : public ::testing::Test {
     protected:
@@ -20,6 +29,503 @@ class ParserSuite : public ::testing::Test {
     Running simple scripts
 */
 
+TEST_F(ParserSuite, parse_basic_commands) {
+    sigil::parser::command_t command;
+
+    ASSERT_EQ(sigil::parser::parse_command("  echo   one\ttwo ", command), sigil::VM_OK);
+    EXPECT_EQ(command.body, (std::vector<std::string>{"echo", "one", "two"}));
+
+    ASSERT_EQ(sigil::parser::parse_command("say \"hello world\" \"a \\\"b\\\"\"", command), sigil::VM_OK);
+    EXPECT_EQ(command.body, (std::vector<std::string>{"say", "hello world", "a \"b\""}));
+
+    EXPECT_EQ(sigil::parser::parse_command("   ", command), sigil::VM_SKIPPED);
+    EXPECT_EQ(sigil::parser::parse_command("# comment", command), sigil::VM_SKIPPED);
+    EXPECT_EQ(sigil::parser::parse_command("say \"open", command), sigil::VM_ARG_INVALID);
+
+    std::vector<sigil::parser::command_t> commands;
+    ASSERT_EQ(sigil::parser::parse_script("a 1; b \"x;y\"\n# c; d\n\n e", commands), sigil::VM_OK);
+    ASSERT_EQ(commands.size(), 3u);
+    EXPECT_EQ(commands[1].body, (std::vector<std::string>{"b", "x;y"}));
+    EXPECT_EQ(commands[2].body, (std::vector<std::string>{"e"}));
+}
+
+// Records order in which commands of one owner ran, and peak concurrency across owners
+static std::atomic<uint32_t> commands_running = {0};
+static std::atomic<uint32_t> commands_peak = {0};
+static std::vector<int> order_a, order_b;
+
+static sigil::status_t record_command(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    uint32_t running = commands_running.fetch_add(1) + 1;
+    uint32_t peak = commands_peak.load();
+    while (running > peak && !commands_peak.compare_exchange_weak(peak, running));
+
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    (node->name == "owner-a" ? order_a : order_b).push_back(std::stoi(command.body[1]));
+
+    commands_running.fetch_sub(1);
+    return sigil::VM_OK;
+}
+
+static sigil::status_t failing_command(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    return sigil::VM_FAILED;
+}
+
+TEST_F(ParserSuite, run_command_batches) {
+    sigil::vmnode_handle_t owner_a, owner_b;
+    sigil::vmnode_descriptor_t node_info = {};
+    node_info.name = "owner-a";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &owner_a), sigil::VM_OK);
+    node_info.name = "owner-b";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &owner_b), sigil::VM_OK);
+
+    sigil::vmcommand_descriptor_t command_info;
+    command_info.pattern = "rec-a <int>";
+    command_info.owner = owner_a;
+    command_info.handler = record_command;
+    ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_ALREADY_EXISTS);
+
+    command_info.pattern = "rec-b <int>";
+    command_info.owner = owner_b;
+    ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+
+    command_info.pattern = "fail ...";
+    command_info.handler = failing_command;
+    ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+
+    // Validation errors come back without running anything
+    EXPECT_EQ(sigil::virtual_machine::run_command("nope").get(), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::virtual_machine::run_command("rec-a").get(), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::virtual_machine::run_command("   ").get(), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::virtual_machine::run_command("fail now").get(), sigil::VM_FAILED);
+
+    std::vector<sigil::parser::command_t> batch;
+    for (int i = 0; i < 200; i++) {
+        batch.push_back({{i % 2 ? "rec-b" : "rec-a", std::to_string(i)}});
+    }
+
+    auto results = sigil::virtual_machine::run_commands(std::move(batch));
+    ASSERT_EQ(results.size(), 200u);
+    for (auto &result : results) EXPECT_EQ(result.get(), sigil::VM_OK);
+
+    // Each owner keeps batch order, owners themselves may overlap
+    ASSERT_EQ(order_a.size(), 100u);
+    ASSERT_EQ(order_b.size(), 100u);
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(order_a[i], i * 2);
+        EXPECT_EQ(order_b[i], i * 2 + 1);
+    }
+    EXPECT_LE(commands_peak.load(), 2u);
+    if (std::thread::hardware_concurrency() > 1) EXPECT_EQ(commands_peak.load(), 2u);
+
+    // Removing owner fails its commands instead of leaving them hanging
+    ASSERT_EQ(sigil::virtual_machine::remove_node(owner_b), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::run_command("rec-b 1").get(), sigil::VM_NOT_FOUND);
+    EXPECT_EQ(sigil::virtual_machine::unregister_command("rec-b  <int>"), sigil::VM_OK);
+    EXPECT_EQ(sigil::virtual_machine::run_command("rec-b 1").get(), sigil::VM_NOT_FOUND);
+}
+
+// Holds owner queue full until test lets it go
+static std::atomic<bool> gate_open = {false};
+static std::atomic<uint32_t> gated_done = {0};
+
+static sigil::status_t gated_command(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    while (!gate_open.load()) std::this_thread::sleep_for(std::chrono::microseconds(100));
+    gated_done++;
+    return sigil::VM_OK;
+}
+
+TEST_F(ParserSuite, run_command_waits_for_full_queue) {
+    sigil::vmnode_handle_t owner;
+    sigil::vmnode_descriptor_t node_info = {};
+    node_info.name = "owner-gated";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &owner), sigil::VM_OK);
+
+    sigil::vmcommand_descriptor_t command_info;
+    command_info.pattern = "gated";
+    command_info.owner = owner;
+    command_info.handler = gated_command;
+    ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+
+    // More than owner queue holds, producer sleeps until drain makes room
+    std::vector<std::future<sigil::status_t>> results;
+    std::atomic<bool> queued = {false};
+    std::thread producer([&]() {
+        for (int i = 0; i < 1500; i++) results.push_back(sigil::virtual_machine::run_command("gated"));
+        queued = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(queued.load());
+
+    gate_open = true;
+    producer.join();
+    for (auto &result : results) EXPECT_EQ(result.get(), sigil::VM_OK);
+    EXPECT_EQ(gated_done.load(), 1500u);
+    EXPECT_EQ(sigil::virtual_machine::unregister_command("gated"), sigil::VM_OK);
+}
+
+// Targets are plain tags here, translator never dereferences them
+static int tag_start, tag_stop, tag_set_int, tag_set_float, tag_set_bool, tag_echo;
+
+static sigil::parser::command_t pattern_of(const char *text) {
+    sigil::parser::command_t pattern;
+    sigil::parser::parse_command(text, pattern);
+    return pattern;
+}
+
+static void* translate_line(const sigil::parser::syntax_node &root, const char *line,
+                            sigil::parser::command_t &command, sigil::status_t *status) {
+    void *target = nullptr;
+    command = pattern_of(line);
+    *status = sigil::parser::translate(root, command, &target);
+    return target;
+}
+
+TEST_F(ParserSuite, command_translator) {
+    sigil::parser::syntax_node root;
+    ASSERT_EQ(sigil::parser::register_command(root, pattern_of("net start"), &tag_start), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::register_command(root, pattern_of("net stop"), &tag_stop), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::register_command(root, pattern_of("set <string> <int>"), &tag_set_int), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::register_command(root, pattern_of("set <string> <float>"), &tag_set_float), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::register_command(root, pattern_of("set <string> <bool>"), &tag_set_bool), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::register_command(root, pattern_of("echo ..."), &tag_echo), sigil::VM_OK);
+
+    EXPECT_EQ(sigil::parser::register_command(root, pattern_of("net start"), &tag_stop), sigil::VM_ALREADY_EXISTS);
+    EXPECT_EQ(sigil::parser::register_command(root, pattern_of("bad <double>"), &tag_stop), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::parser::register_command(root, pattern_of("bad ... tail"), &tag_stop), sigil::VM_ARG_INVALID);
+
+    sigil::parser::command_t command;
+    sigil::status_t status;
+
+    EXPECT_EQ(translate_line(root, "net stop", command, &status), &tag_stop);
+    EXPECT_EQ(status, sigil::VM_OK);
+    EXPECT_TRUE(command.args.empty());
+
+    // Integer wins over float, float over bool, string takes anything
+    EXPECT_EQ(translate_line(root, "set speed 0x10", command, &status), &tag_set_int);
+    ASSERT_EQ(command.args.size(), 2u);
+    EXPECT_EQ(command.args[0].text, "speed");
+    EXPECT_EQ(command.args[1].number, 16);
+    EXPECT_EQ(translate_line(root, "set speed 2.5", command, &status), &tag_set_float);
+    EXPECT_DOUBLE_EQ(command.args[1].real, 2.5);
+    EXPECT_EQ(translate_line(root, "set vsync on", command, &status), &tag_set_bool);
+    EXPECT_EQ(command.args[1].number, 1);
+
+    EXPECT_EQ(translate_line(root, "echo \"a b\" c", command, &status), &tag_echo);
+    ASSERT_EQ(command.args.size(), 2u);
+    EXPECT_EQ(command.args[0].type, sigil::parser::ARG_REST);
+    EXPECT_EQ(command.args[0].text, "a b");
+    EXPECT_EQ(command.args[1].text, "c");
+
+    // Known command with wrong arguments is told apart from unknown one
+    translate_line(root, "set speed fast", command, &status);
+    EXPECT_EQ(status, sigil::VM_ARG_INVALID);
+    translate_line(root, "net", command, &status);
+    EXPECT_EQ(status, sigil::VM_ARG_INVALID);
+    translate_line(root, "launch", command, &status);
+    EXPECT_EQ(status, sigil::VM_NOT_FOUND);
+
+    // Conflicting tables are left untouched
+    sigil::parser::syntax_node extra;
+    ASSERT_EQ(sigil::parser::register_command(extra, pattern_of("net stop"), &tag_start), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::register_command(extra, pattern_of("net status"), &tag_start), sigil::VM_OK);
+    EXPECT_EQ(sigil::parser::join_translators(root, extra), sigil::VM_ALREADY_EXISTS);
+    translate_line(root, "net status", command, &status);
+    EXPECT_EQ(status, sigil::VM_ARG_INVALID);
+
+    ASSERT_EQ(sigil::parser::unregister_command(extra, pattern_of("net stop")), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::join_translators(root, extra), sigil::VM_OK);
+    EXPECT_EQ(translate_line(root, "net status", command, &status), &tag_start);
+
+    // Emptied branches are pruned, so whole command becomes unknown
+    ASSERT_EQ(sigil::parser::unregister_command(root, pattern_of("net start")), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::unregister_command(root, pattern_of("net stop")), sigil::VM_OK);
+    ASSERT_EQ(sigil::parser::unregister_command(root, pattern_of("net status")), sigil::VM_OK);
+    EXPECT_EQ(sigil::parser::unregister_command(root, pattern_of("net status")), sigil::VM_NOT_FOUND);
+    translate_line(root, "net start", command, &status);
+    EXPECT_EQ(status, sigil::VM_NOT_FOUND);
+}
+
+TEST_F(ParserSuite, line_reader) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    sigil::parser::line_reader_t reader(fds[0], 64);
+    std::string_view line;
+
+    // Nothing buffered yet, reader does not block unless asked to
+    EXPECT_EQ(reader.next(line, false), sigil::VM_BUSY);
+
+    std::string long_line(300, 'x');
+    std::string input = "first\n\nthird\r\n" + long_line + "\nlast";
+    ASSERT_EQ(write(fds[1], input.data(), input.size()), (ssize_t)input.size());
+    close(fds[1]);
+
+    ASSERT_EQ(reader.next(line), sigil::VM_OK);
+    EXPECT_EQ(line, "first");
+    ASSERT_EQ(reader.next(line, false), sigil::VM_OK);
+    EXPECT_EQ(line, "");
+    ASSERT_EQ(reader.next(line), sigil::VM_OK);
+    EXPECT_EQ(line, "third\r");
+    // Longer than buffer, which grows to fit it
+    ASSERT_EQ(reader.next(line), sigil::VM_OK);
+    EXPECT_EQ(line, long_line);
+    ASSERT_EQ(reader.next(line), sigil::VM_OK);
+    EXPECT_EQ(line, "last");
+    EXPECT_EQ(reader.next(line), sigil::VM_SKIPPED);
+    EXPECT_EQ(reader.next(line, false), sigil::VM_SKIPPED);
+    close(fds[0]);
+}
+
+TEST_F(ParserSuite, line_reader_ready_input_and_interrupt) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::atomic<bool> stop = {false};
+    sigil::parser::line_reader_t reader(fds[0], 64, [&stop]() { return stop.load(); });
+    std::string_view line;
+
+    // Input that is ready is read without waiting, busy only once read() would block
+    ASSERT_EQ(write(fds[1], "ready\npart", 10), 10);
+    ASSERT_EQ(reader.next(line, false), sigil::VM_OK);
+    EXPECT_EQ(line, "ready");
+    EXPECT_EQ(reader.next(line, false), sigil::VM_BUSY);
+
+    // Blocked reader gives up once interrupted, though pipe stays open
+    std::thread stopper([&stop]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        stop = true;
+    });
+    EXPECT_EQ(reader.next(line, true), sigil::VM_SYSTEM_SHUTDOWN);
+    stopper.join();
+    close(fds[1]);
+    close(fds[0]);
+}
+
+static sigil::status_t run_script(const char *source, sigil::script::environment_t &env,
+                                  sigil::script::program_t &program) {
+    std::string error;
+    sigil::status_t status = sigil::script::compile(source, program, &error);
+    if (status != sigil::VM_OK) {
+        env.error = error;
+        return status;
+    }
+    return sigil::script::execute(program, env);
+}
+
+TEST_F(ParserSuite, script_compile_errors) {
+    sigil::script::program_t program;
+    std::string error;
+
+    EXPECT_EQ(sigil::script::compile("let x = 1\nx = y + 1", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(error, "line 2: unknown variable 'y'");
+    EXPECT_EQ(sigil::script::compile("let x = 1\nwhile x < 3\n  x = x + 1\n", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(error, "line 2: block is missing its end");
+    EXPECT_EQ(sigil::script::compile("end", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::script::compile("break", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::script::compile("let x = (1 + 2", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::script::compile("let x = 1 2", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::script::compile("print \"open", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::script::compile("run echo $missing", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::script::compile("let if = 1", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(sigil::script::compile("if 1\nelse\nelif 1\nend", program, &error), sigil::VM_ARG_INVALID);
+    EXPECT_TRUE(program.code.empty());
+}
+
+TEST_F(ParserSuite, script_semantics) {
+    const char *source =
+        "# precedence, folding and wrapping\n"
+        "let a = 2 + 3 * 4 - -1\n"
+        "let b = (a > 10) + (a >= 15) * 2 + (not 0)\n"
+        "let big = 9223372036854775807\n"
+        "let wrapped = big + 1 < 0\n"
+        "let branches = 0\n"
+        "for i = 10 to 1 step -3\n"
+        "    if i == 10\n"
+        "        branches = branches + 1\n"
+        "    elif i == 7 or i == 4\n"
+        "        branches = branches + 10\n"
+        "    else\n"
+        "        branches = branches + 100\n"
+        "    end\n"
+        "end\n"
+        "let odd = 0\n"
+        "let k = 0\n"
+        "while 1\n"
+        "    k = k + 1\n"
+        "    if k > 9\n"
+        "        break\n"
+        "    end\n"
+        "    if k % 2 == 0\n"
+        "        continue\n"
+        "    end\n"
+        "    odd = odd + k\n"
+        "end\n"
+        "for j = 5 to 1\n"
+        "    odd = 0\n"
+        "end\n"
+        "print \"a:\", a, b * 10, \"done\"\n"
+        "run cmd x$a-$b \"two words\"\n";
+
+    sigil::script::program_t program;
+    sigil::script::environment_t env;
+    std::string output;
+    std::vector<sigil::parser::command_t> commands;
+    env.output = &output;
+    env.on_command = [&](sigil::parser::command_t command) {
+        commands.push_back(std::move(command));
+        return sigil::VM_OK;
+    };
+
+    ASSERT_EQ(run_script(source, env, program), sigil::VM_OK) << env.error;
+    EXPECT_EQ(env.get(program, "a"), 15);
+    EXPECT_EQ(env.get(program, "b"), 4);
+    EXPECT_EQ(env.get(program, "wrapped"), 1);
+    EXPECT_EQ(env.get(program, "branches"), 121);
+    EXPECT_EQ(env.get(program, "odd"), 25);
+    EXPECT_EQ(output, "a: 15 40 done\n");
+    ASSERT_EQ(commands.size(), 1u);
+    EXPECT_EQ(commands[0].body, (std::vector<std::string>{"cmd", "x15-4", "two words"}));
+
+    // Loop is an add and one fused branch, bound is loaded before the first statement
+    ASSERT_EQ(sigil::script::compile("let i = 0\nwhile i < 100\n  i = i + 1\nend", program), sigil::VM_OK);
+    std::string listing = sigil::script::disassemble(program);
+    EXPECT_EQ(program.code[3].op, sigil::script::OP_ADDI) << listing;
+    EXPECT_EQ(program.code[4].op, sigil::script::OP_BLT) << listing;
+    EXPECT_EQ(program.code[4].imm, 3) << listing;
+    EXPECT_EQ(program.code[5].op, sigil::script::OP_HALT) << listing;
+
+    ASSERT_EQ(run_script("let x = 1\nlet y = 0\nlet z = x / y", env, program), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(env.error, "line 3: division by zero");
+}
+
+static std::atomic<uint32_t> script_commands_done = {0};
+
+static sigil::status_t count_script_command(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    script_commands_done++;
+    return sigil::VM_OK;
+}
+
+// Every benchmark script computes result and declares value it expects
+TEST_F(ParserSuite, script_benchmarks) {
+    const char *scripts[] = {"loop-sum.svm", "primes.svm", "collatz.svm", "commands.svm"};
+
+    sigil::vmnode_handle_t owner;
+    sigil::vmnode_descriptor_t node_info = {};
+    node_info.name = "bench-scripts";
+    ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &owner), sigil::VM_OK);
+
+    sigil::vmcommand_descriptor_t command_info;
+    command_info.pattern = "bench-record <int>";
+    command_info.owner = owner;
+    command_info.handler = count_script_command;
+    ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+
+    for (const char *name : scripts) {
+        std::string path = std::string(SIGIL_TEST_SCRIPTS_DIR) + "/" + name;
+        sigil::script::program_t program;
+        std::string error;
+
+        sigil::exec_timer tmr;
+        tmr.start();
+        ASSERT_EQ(sigil::script::compile_file(path.c_str(), program, &error), sigil::VM_OK) << error;
+        tmr.stop();
+        uint64_t compile_us = tmr.us();
+
+        // Commands are only queued, results are collected once script is done
+        std::vector<std::future<sigil::status_t>> results;
+        sigil::script::environment_t env;
+        env.on_command = [&](sigil::parser::command_t command) {
+            results.push_back(sigil::virtual_machine::run_command(std::move(command)));
+            return sigil::VM_OK;
+        };
+
+        tmr.start();
+        ASSERT_EQ(sigil::script::execute(program, env), sigil::VM_OK) << env.error;
+        for (auto &result : results) EXPECT_EQ(result.get(), sigil::VM_OK);
+        tmr.stop();
+
+        EXPECT_EQ(env.get(program, "result"), env.get(program, "expected")) << name;
+        printf("parser: %-14s %4zu instructions, compiled in %luus, ran in %luus\n",
+            name, program.code.size(), compile_us, tmr.us());
+    }
+    EXPECT_EQ(script_commands_done.load(), 2000u);
+}
+
+static std::string write_temp_script(const std::string &source) {
+    char path[] = "/tmp/sigil-script-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return "";
+    size_t written = write(fd, source.data(), source.size());
+    close(fd);
+    return written == source.size() ? path : "";
+}
+
+TEST_F(ParserSuite, script_streaming) {
+    // Newline search has to agree with plain one at every alignment
+    std::string text(300, 'x');
+    for (size_t at : {0, 1, 15, 16, 17, 31, 64, 299}) {
+        text[at] = '\n';
+        for (size_t from = 0; from <= at; from++) {
+            EXPECT_EQ(sigil::find_newline(text.data() + from, text.data() + text.size()), text.data() + at);
+        }
+        text[at] = 'x';
+    }
+    EXPECT_EQ(sigil::find_newline(text.data(), text.data() + text.size()), text.data() + text.size());
+
+    // Top level statements split into many chunks, with loops and large constants across them
+    std::string source = "let total = 0\nlet big = 5000000000\n";
+    for (int i = 0; i < 200; i++) {
+        source += "total = total + " + std::to_string(i) + "\n";
+        if (i % 50 == 0) source += "for j = 1 to 10\n    total = total + j\nend\nprint \"at\", " + std::to_string(i) + "\n";
+    }
+    source += "total = total + big + 5000000000\n";
+
+    std::string path = write_temp_script(source);
+    ASSERT_FALSE(path.empty());
+
+    sigil::script::program_t whole;
+    sigil::script::environment_t whole_env;
+    std::string whole_output;
+    whole_env.output = &whole_output;
+    ASSERT_EQ(sigil::script::compile_file(path.c_str(), whole), sigil::VM_OK);
+    ASSERT_EQ(sigil::script::execute(whole, whole_env), sigil::VM_OK);
+
+    sigil::script::program_t streamed;
+    sigil::script::environment_t streamed_env;
+    std::string streamed_output, error;
+    streamed_env.output = &streamed_output;
+    ASSERT_EQ(sigil::script::execute_file(path.c_str(), streamed, streamed_env, &error, 128), sigil::VM_OK) << error;
+
+    int64_t expected = 199 * 200 / 2 + 4 * 55 + 10000000000;
+    EXPECT_EQ(whole_env.get(whole, "total"), expected);
+    EXPECT_EQ(streamed_env.get(streamed, "total"), expected);
+    EXPECT_EQ(streamed_output, whole_output);
+    unlink(path.c_str());
+
+    // Constant pool holds only what the current chunk loads, however many the file has
+    std::string constants_source = "let total = 0\n";
+    for (int i = 0; i < 100; i++) constants_source += "total = " + std::to_string(5000000000 + i) + "\n";
+    path = write_temp_script(constants_source);
+    ASSERT_FALSE(path.empty());
+    sigil::script::environment_t constants_env;
+    ASSERT_EQ(sigil::script::execute_file(path.c_str(), streamed, constants_env, &error, 128), sigil::VM_OK) << error;
+    EXPECT_EQ(constants_env.get(streamed, "total"), 5000000099);
+    EXPECT_LT(streamed.constants.size(), 10u);
+    unlink(path.c_str());
+
+    // Syntax error at the end stops whole compile, streamed run has started by then
+    path = write_temp_script(source + "total = = 1\n");
+    ASSERT_FALSE(path.empty());
+    EXPECT_EQ(sigil::script::compile_file(path.c_str(), whole, &error), sigil::VM_ARG_INVALID);
+
+    streamed_output.clear();
+    EXPECT_EQ(sigil::script::execute_file(path.c_str(), streamed, streamed_env, &error, 128), sigil::VM_ARG_INVALID);
+    EXPECT_EQ(error.rfind("line ", 0), 0u);
+    EXPECT_EQ(streamed_output, whole_output);
+    unlink(path.c_str());
+
+    EXPECT_EQ(sigil::script::execute_file("/nonexistent.svm", streamed, streamed_env, &error), sigil::VM_NOT_FOUND);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
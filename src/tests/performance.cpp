@@ -1,6 +1,20 @@
 #include <gtest/gtest.h>
 #include "system.h"
 #include "virtual-machine.h"
+#include <unistd.h>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include "timer-wheel.h"
+#include "script.h"
+#include "trace.h"
+#include "tsc-clock.h"
+#include "proc-stats.h"
+#include "log.h"
+#include "line-buffer.h"
+#include "mem-track.h"
+#include "frame-arena.h"
+#include <time.h>
 
 class PerformanceSuite : public ::testing::Test {
     protected:
@@ -20,6 +34,734 @@ class PerformanceSuite : public ::testing::Test {
     
 */
 
+// Average lookup time of n random nodes, by name and by full path
+static uint64_t vmnode_lookup_ns(sigil::vmnode_t *root, uint32_t num_nodes, bool by_path) {
+    constexpr uint32_t num_lookups = 100000;
+    std::vector<std::string> keys;
+
+    for (uint32_t i = 0; i < num_lookups; i++) {
+        uint32_t id = sigil::random_u32_scoped(0, num_nodes - 1);
+        std::string name = "node-" + std::to_string(id);
+        keys.push_back(by_path ? "bench/group-" + std::to_string(id % 16) + "/" + name : name);
+    }
+
+    sigil::exec_timer tmr;
+    tmr.start();
+    for (auto &key : keys) {
+        if (!root->peek_subnode(key.c_str(), VM_NODE_LOOKUP_MAX_DEPTH)) return UINT64_MAX;
+    }
+    tmr.stop();
+
+    return tmr.ns() / num_lookups;
+}
+
+TEST_F(PerformanceSuite, vmnode_lookup_flat) {
+    sigil::vmnode_t root("bench");
+    std::vector<sigil::vmnode_t*> groups;
+
+    for (int i = 0; i < 16; i++) {
+        groups.push_back(root.spawn_subnode(("group-" + std::to_string(i)).c_str()));
+    }
+
+    uint32_t num_nodes = 0;
+    auto grow_to = [&](uint32_t target) {
+        sigil::exec_timer tmr;
+        tmr.start();
+        for (; num_nodes < target; num_nodes++) {
+            std::string name = "node-" + std::to_string(num_nodes);
+            ASSERT_NE(groups[num_nodes % 16]->spawn_subnode(name.c_str()), nullptr);
+        }
+        tmr.stop();
+        printf("performance: grown to %u nodes in %lums\n", target, tmr.ms());
+    };
+
+    grow_to(1000);
+    uint64_t small_name = vmnode_lookup_ns(&root, num_nodes, false);
+    uint64_t small_path = vmnode_lookup_ns(&root, num_nodes, true);
+
+    grow_to(10000);
+    uint64_t medium_name = vmnode_lookup_ns(&root, num_nodes, false);
+    uint64_t medium_path = vmnode_lookup_ns(&root, num_nodes, true);
+
+    grow_to(100000);
+    uint64_t large_name = vmnode_lookup_ns(&root, num_nodes, false);
+    uint64_t large_path = vmnode_lookup_ns(&root, num_nodes, true);
+
+    printf("performance: lookup by name %luns/%luns/%luns (1k/10k/100k nodes)\n",
+        small_name, medium_name, large_name);
+    printf("performance: lookup by path %luns/%luns/%luns (1k/10k/100k nodes)\n",
+        small_path, medium_path, large_path);
+
+    // Every random key was found at every size, timings above are only reported
+    EXPECT_NE(small_name, UINT64_MAX);
+    EXPECT_NE(small_path, UINT64_MAX);
+    EXPECT_NE(medium_name, UINT64_MAX);
+    EXPECT_NE(medium_path, UINT64_MAX);
+    ASSERT_NE(large_name, UINT64_MAX);
+    ASSERT_NE(large_path, UINT64_MAX);
+    sigil::vmnode_t *last = root.peek_subnode("node-99999", VM_NODE_LOOKUP_MAX_DEPTH);
+    ASSERT_NE(last, nullptr);
+    EXPECT_EQ(root.peek_subnode("bench/group-15/node-99999", VM_NODE_LOOKUP_MAX_DEPTH), last);
+
+    // Duplicates are rejected, removed nodes are gone from the index
+    EXPECT_EQ(root.spawn_subnode("node-42"), nullptr);
+    groups[0]->deinit();
+    EXPECT_EQ(root.peek_subnode("node-16", VM_NODE_LOOKUP_MAX_DEPTH), nullptr);
+    EXPECT_NE(root.peek_subnode("bench/group-1/node-17", VM_NODE_LOOKUP_MAX_DEPTH), nullptr);
+    EXPECT_EQ(groups[1]->peek_subnode("node-18", VM_NODE_LOOKUP_MAX_DEPTH), nullptr);
+
+    root.deinit();
+}
+
+// Interned names skip hashing the key, and compare by address however long they are
+TEST_F(PerformanceSuite, vmnode_lookup_interned) {
+    const uint32_t num_nodes = 10000, num_lookups = 100000;
+    const std::string prefix = "a-rather-long-module-name-prefix-node-";
+    sigil::vmnode_t root("bench-names");
+
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        ASSERT_NE(root.spawn_subnode((prefix + std::to_string(i)).c_str()), nullptr);
+    }
+
+    std::vector<std::string> texts;
+    std::vector<sigil::name_t> names;
+    for (uint32_t i = 0; i < num_lookups; i++) {
+        texts.push_back(prefix + std::to_string(sigil::random_u32_scoped(0, num_nodes - 1)));
+        names.push_back(texts.back());
+    }
+
+    // Looking up by text finds already interned names, it never adds new ones
+    size_t interned = sigil::name_t::num_interned();
+    sigil::exec_timer tmr;
+    tmr.start();
+    for (auto &text : texts) ASSERT_NE(root.peek_subnode(text.c_str(), VM_NODE_LOOKUP_MAX_DEPTH), nullptr);
+    tmr.stop();
+    uint64_t text_ns = tmr.ns() / num_lookups;
+    EXPECT_EQ(sigil::name_t::num_interned(), interned);
+
+    tmr.start();
+    for (auto &name : names) ASSERT_NE(root.peek_subnode(name, VM_NODE_LOOKUP_MAX_DEPTH), nullptr);
+    tmr.stop();
+    uint64_t name_ns = tmr.ns() / num_lookups;
+    EXPECT_EQ(root.peek_subnode(names[0], VM_NODE_LOOKUP_MAX_DEPTH), root.peek_subnode(texts[0].c_str(), VM_NODE_LOOKUP_MAX_DEPTH));
+
+    // Equal strings that differ only at the end, the worst case of compare
+    uint32_t num_equal = 0;
+    tmr.start();
+    for (uint32_t i = 1; i < num_lookups; i++) num_equal += texts[i] == texts[i - 1];
+    tmr.stop();
+    uint64_t string_eq_ns = tmr.ns();
+
+    uint32_t num_equal_names = 0;
+    tmr.start();
+    for (uint32_t i = 1; i < num_lookups; i++) num_equal_names += names[i] == names[i - 1];
+    tmr.stop();
+    uint64_t name_eq_ns = tmr.ns();
+
+    printf("performance: lookup by text %luns, by name_t %luns; %lu vs %luns for %u compares, %zu names interned\n",
+        text_ns, name_ns, string_eq_ns, name_eq_ns, num_lookups - 1, sigil::name_t::num_interned());
+    EXPECT_EQ(num_equal, num_equal_names);
+    root.deinit();
+}
+
+TEST_F(PerformanceSuite, vmnode_deferred_reclaim) {
+    sigil::vmnode_t root("bench-reclaim");
+    sigil::vmnode_t::wait_for_reclaim();
+    size_t pooled = sigil::vmnode_t::num_pooled();
+
+    sigil::vmnode_t *subtree = root.spawn_subnode("subtree");
+    for (int i = 0; i < 100000; i++) {
+        std::string name = "node-" + std::to_string(i);
+        ASSERT_NE(subtree->spawn_subnode(name.c_str()), nullptr);
+    }
+
+    // Detaching only unindexes, freeing happens on reclaimer thread
+    sigil::exec_timer tmr;
+    tmr.start();
+    subtree->deinit_self();
+    tmr.stop();
+    uint64_t detach_us = tmr.us();
+
+    tmr.start();
+    sigil::vmnode_t::wait_for_reclaim();
+    tmr.stop();
+
+    printf("performance: detached 100k nodes in %luus, reclaimed in %luus\n", detach_us, tmr.us());
+    EXPECT_EQ(sigil::vmnode_t::num_pooled(), pooled);
+    EXPECT_EQ(root.peek_subnode("node-42", VM_NODE_LOOKUP_MAX_DEPTH), nullptr);
+}
+
+TEST_F(PerformanceSuite, executor_short_jobs) {
+    const uint32_t num_jobs = 10000;
+    std::atomic<uint32_t> num_done = {0};
+    sigil::exec_timer tmr;
+
+    // Baseline, what spawn_thread used to cost per job
+    tmr.start();
+    for (uint32_t i = 0; i < num_jobs / 10; i++) {
+        std::thread t([&]() { num_done++; });
+        t.join();
+    }
+    tmr.stop();
+    uint64_t thread_ns = tmr.ns() / (num_jobs / 10);
+
+    sigil::executor_t executor(MAX(std::thread::hardware_concurrency(), 1u));
+    std::atomic<uint32_t> on_workers = {0};
+    tmr.start();
+    for (uint32_t i = 0; i < num_jobs; i++) executor.submit([&]() { num_done++; on_workers += executor.is_worker(); });
+    executor.wait_idle();
+    tmr.stop();
+    uint64_t pool_ns = tmr.ns() / num_jobs;
+
+    printf("performance: thread per job %luns, pooled job %luns (%u workers)\n",
+        thread_ns, pool_ns, executor.num_workers());
+    EXPECT_EQ(num_done.load(), num_jobs + num_jobs / 10);
+    EXPECT_EQ(on_workers.load(), num_jobs);
+}
+
+static std::atomic<uint32_t> bench_commands_done = {0};
+
+static sigil::status_t bench_command(sigil::vmnode_t *node, const sigil::parser::command_t &command) {
+    bench_commands_done++;
+    return sigil::VM_OK;
+}
+
+TEST_F(PerformanceSuite, command_batch_throughput) {
+    const uint32_t num_owners = 8;
+    const uint32_t num_commands = 20000;
+
+    for (uint32_t i = 0; i < num_owners; i++) {
+        sigil::vmnode_handle_t owner;
+        sigil::vmnode_descriptor_t node_info = {};
+        node_info.name = "bench-owner-" + std::to_string(i);
+        ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &owner), sigil::VM_OK);
+
+        sigil::vmcommand_descriptor_t command_info;
+        command_info.pattern = "bench-" + std::to_string(i) + " <string>";
+        command_info.owner = owner;
+        command_info.handler = bench_command;
+        ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+    }
+
+    std::vector<sigil::parser::command_t> batch;
+    for (uint32_t i = 0; i < num_commands; i++) {
+        batch.push_back({{"bench-" + std::to_string(i % num_owners), "arg"}});
+    }
+
+    const sigil::histogram_t &latency = sigil::virtual_machine::get_command_latency().all_time();
+    uint64_t latency_count = latency.count();
+
+    sigil::exec_timer tmr;
+    tmr.start();
+    for (auto &command : batch) {
+        ASSERT_EQ(sigil::virtual_machine::run_command(command).get(), sigil::VM_OK);
+    }
+    tmr.stop();
+    uint64_t one_by_one_ns = tmr.ns() / num_commands;
+
+    tmr.start();
+    auto results = sigil::virtual_machine::run_commands(batch);
+    for (auto &result : results) ASSERT_EQ(result.get(), sigil::VM_OK);
+    tmr.stop();
+    uint64_t batched_ns = tmr.ns() / num_commands;
+
+    printf("performance: command blocking %luns, batched %luns\n", one_by_one_ns, batched_ns);
+    printf("performance: command latency %s\n", latency.summary().c_str());
+    EXPECT_EQ(bench_commands_done.load(), num_commands * 2);
+    EXPECT_EQ(latency.count() - latency_count, num_commands * 2);
+    EXPECT_EQ(results.size(), num_commands);
+}
+
+// Same commands as a newline separated stream, as sigil-tools --exec - gets them
+TEST_F(PerformanceSuite, command_stream_throughput) {
+    const uint32_t num_owners = 8;
+    const uint32_t num_commands = 50000;
+
+    for (uint32_t i = 0; i < num_owners; i++) {
+        sigil::vmnode_handle_t owner;
+        sigil::vmnode_descriptor_t node_info = {};
+        node_info.name = "stream-owner-" + std::to_string(i);
+        ASSERT_EQ(sigil::virtual_machine::add_runtime_node(node_info, &owner), sigil::VM_OK);
+
+        sigil::vmcommand_descriptor_t command_info;
+        command_info.pattern = "stream-" + std::to_string(i) + " <int>";
+        command_info.owner = owner;
+        command_info.handler = bench_command;
+        ASSERT_EQ(sigil::virtual_machine::register_command(command_info), sigil::VM_OK);
+    }
+
+    std::string input;
+    for (uint32_t i = 0; i < num_commands; i++) {
+        input += "stream-" + std::to_string(i % num_owners) + " " + std::to_string(i) + "\n";
+    }
+    input += "# comment\nmissing-command\n";
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    FILE *output = tmpfile();
+    ASSERT_NE(output, nullptr);
+
+    std::thread writer([&]() {
+        size_t written = 0;
+        while (written < input.size()) {
+            ssize_t count = write(fds[1], input.data() + written, input.size() - written);
+            if (count <= 0) break;
+            written += count;
+        }
+        close(fds[1]);
+    });
+
+    sigil::exec_timer tmr;
+    uint64_t num_read = 0;
+    bench_commands_done = 0;
+    tmr.start();
+    sigil::status_t status = sigil::virtual_machine::run_command_stream(fds[0], fileno(output), &num_read);
+    tmr.stop();
+    writer.join();
+    close(fds[0]);
+
+    ASSERT_EQ(status, sigil::VM_OK);
+    EXPECT_EQ(num_read, num_commands + 1);
+    EXPECT_EQ(bench_commands_done.load(), num_commands);
+
+    // One result per command, in input order, comment line is not one
+    rewind(output);
+    char text[128];
+    uint64_t num_results = 0;
+    uint64_t previous_line = 0;
+    while (fgets(text, sizeof(text), output)) {
+        uint64_t line = strtoull(text, nullptr, 10);
+        EXPECT_GT(line, previous_line);
+        previous_line = line;
+        num_results++;
+        if (line == num_commands + 2) EXPECT_STREQ(strchr(text, ' '), " VM_NOT_FOUND\n");
+        else if (line <= num_commands) EXPECT_STREQ(strchr(text, ' '), " VM_OK\n");
+    }
+    fclose(output);
+    EXPECT_EQ(num_results, num_commands + 1);
+    EXPECT_EQ(previous_line, num_commands + 2);
+
+    uint64_t per_second = (uint64_t)num_commands * 1000000 / MAX(tmr.us(), (uint64_t)1);
+    printf("performance: command stream %lu commands/s\n", per_second);
+}
+
+// Time until first command of a long script runs, compiled whole or mapped and streamed
+TEST_F(PerformanceSuite, script_streaming_start) {
+    const uint32_t num_lines = 400000;
+
+    std::string source = "let total = 0\nrun first\n";
+    for (uint32_t i = 0; i < num_lines; i++) source += "total = total + 7\n";
+
+    char path[] = "/tmp/sigil-bench-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, source.data(), source.size()), (ssize_t)source.size());
+    close(fd);
+
+    // Streamed run has compiled only its first chunk when first command runs
+    sigil::exec_timer tmr;
+    sigil::exec_timer first_command;
+    sigil::script::program_t program;
+    size_t compiled_at_first = 0;
+    sigil::script::environment_t env;
+    env.on_command = [&](sigil::parser::command_t command) {
+        first_command.stop();
+        compiled_at_first = program.code.size();
+        return sigil::VM_OK;
+    };
+
+    tmr.start();
+    first_command.start();
+    ASSERT_EQ(sigil::script::compile_file(path, program), sigil::VM_OK);
+    ASSERT_EQ(sigil::script::execute(program, env), sigil::VM_OK);
+    tmr.stop();
+    uint64_t whole_first_us = first_command.us();
+    uint64_t whole_us = tmr.us();
+    size_t whole_compiled = compiled_at_first;
+    EXPECT_EQ(env.get(program, "total"), (int64_t)num_lines * 7);
+
+    env = sigil::script::environment_t();
+    env.on_command = [&](sigil::parser::command_t command) {
+        first_command.stop();
+        compiled_at_first = program.code.size();
+        return sigil::VM_OK;
+    };
+    tmr.start();
+    first_command.start();
+    ASSERT_EQ(sigil::script::execute_file(path, program, env), sigil::VM_OK);
+    tmr.stop();
+    uint64_t streamed_first_us = first_command.us();
+    EXPECT_EQ(env.get(program, "total"), (int64_t)num_lines * 7);
+    unlink(path);
+
+    printf("performance: %zuKB script, first command after %luus whole/%luus streamed, done in %luus/%luus\n",
+        source.size() >> 10, whole_first_us, streamed_first_us, whole_us, tmr.us());
+    EXPECT_GE(whole_compiled, num_lines);
+    EXPECT_LT(compiled_at_first, whole_compiled / 2);
+}
+
+static void traced_work(uint32_t &counter) {
+    SIGIL_TRACE_ZONE("bench-zone");
+    counter++;
+}
+
+TEST_F(PerformanceSuite, trace_zone_overhead) {
+    const uint32_t num_zones = TRACE_BUFFER_EVENTS;
+    uint32_t counter = 0;
+
+    sigil::exec_timer tmr;
+    tmr.start();
+    for (uint32_t i = 0; i < num_zones * 16; i++) traced_work(counter);
+    tmr.stop();
+    uint64_t disabled_ns = tmr.ns() / (num_zones * 16);
+
+    // Fits one buffer, so nothing is dropped
+    sigil::trace::enable(true);
+    tmr.start();
+    for (uint32_t i = 0; i < num_zones; i++) traced_work(counter);
+    tmr.stop();
+    sigil::trace::enable(false);
+    uint64_t enabled_ns = tmr.ns() / num_zones;
+
+    // Only zones run while enabled were recorded
+    char path[] = "/tmp/sigil-trace-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    EXPECT_EQ(sigil::trace::export_json(path), sigil::VM_OK);
+    uint32_t num_recorded = 0;
+    FILE *file = fopen(path, "r");
+    ASSERT_NE(file, nullptr);
+    char line[256];
+    while (fgets(line, sizeof(line), file)) num_recorded += strstr(line, "\"bench-zone\"") != nullptr;
+    fclose(file);
+    unlink(path);
+
+    printf("performance: trace zone %luns disabled, %luns enabled\n", disabled_ns, enabled_ns);
+    EXPECT_EQ(counter, num_zones * 17);
+    EXPECT_EQ(num_recorded, num_zones);
+}
+
+// Cost of one start/stop pair, and drift against CLOCK_MONOTONIC over 50ms
+TEST_F(PerformanceSuite, tsc_timer_overhead) {
+    const uint32_t num_pairs = 1000000;
+    uint64_t sink = 0;
+    sigil::tsc::ticks();
+
+    sigil::exec_timer outer;
+    sigil::exec_timer exec_inner;
+    outer.start();
+    for (uint32_t i = 0; i < num_pairs; i++) {
+        exec_inner.start();
+        exec_inner.stop();
+        sink += exec_inner.ns();
+    }
+    outer.stop();
+    uint64_t exec_ns = outer.ns() / num_pairs;
+
+    sigil::tsc_timer_t tsc_inner;
+    outer.start();
+    for (uint32_t i = 0; i < num_pairs; i++) {
+        tsc_inner.start();
+        tsc_inner.stop();
+        sink += tsc_inner.ticks();
+    }
+    outer.stop();
+    uint64_t tsc_ns = outer.ns() / num_pairs;
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    uint64_t tsc_begin = sigil::tsc::now_ns();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    uint64_t tsc_end = sigil::tsc::now_ns();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int64_t monotonic_ns = (end.tv_sec - begin.tv_sec) * 1000000000ll + (end.tv_nsec - begin.tv_nsec);
+    int64_t error_ns = (int64_t)(tsc_end - tsc_begin) - monotonic_ns;
+
+    printf("performance: timer pair %luns exec_timer, %luns tsc_timer (%s, %luMHz), %ldns off over 50ms\n",
+        exec_ns, tsc_ns, sigil::tsc::source.load() == sigil::tsc::SOURCE_TSC ? "tsc" : "monotonic",
+        sigil::tsc::frequency() / 1000000, error_ns);
+    EXPECT_NE(sink, 0u);
+    // Wrong calibration is off by far more, preemption between the reads stays well within
+    EXPECT_LT(std::abs(error_ns), monotonic_ns / 10);
+}
+
+// Cost of recording one value, from one thread and from four at once
+TEST_F(PerformanceSuite, histogram_record) {
+    const uint32_t num_values = 1000000;
+    sigil::windowed_histogram_t latency;
+
+    sigil::exec_timer tmr;
+    tmr.start();
+    for (uint32_t i = 0; i < num_values; i++) latency.record(i & 0xfffff);
+    tmr.stop();
+    uint64_t single_ns = tmr.ns() / num_values;
+
+    std::vector<std::thread> threads;
+    tmr.start();
+    for (uint32_t t = 0; t < 4; t++) {
+        threads.emplace_back([&latency, t]() {
+            for (uint32_t i = 0; i < num_values; i++) latency.record((i * (t + 1)) & 0xfffff);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    tmr.stop();
+    uint64_t shared_ns = tmr.ns() / num_values;
+
+    printf("performance: histogram record %luns, %luns per round of 4 threads\n", single_ns, shared_ns);
+    // Concurrent recorders lose nothing, and no value lands above what was recorded
+    EXPECT_EQ(latency.all_time().count(), (uint64_t)num_values * 5);
+    EXPECT_LE(latency.all_time().max(), 0xfffffu);
+    EXPECT_LE(latency.all_time().percentile(50.0), latency.all_time().max());
+}
+
+// One background sample, and one read of published snapshot, as GUI does every frame
+TEST_F(PerformanceSuite, procstat_sample_and_read) {
+    const uint32_t num_samples = 200;
+    const uint32_t num_reads = 100000;
+    sigil::procstat::snapshot_t snapshot;
+
+    sigil::procstat::read(snapshot);
+    uint64_t sequence = snapshot.sequence;
+    sigil::exec_timer tmr;
+    tmr.start();
+    for (uint32_t i = 0; i < num_samples; i++) {
+        while (sigil::procstat::sample() == sigil::VM_BUSY) std::this_thread::yield();
+    }
+    tmr.stop();
+    uint64_t sample_us = tmr.us() / num_samples;
+
+    tmr.start();
+    for (uint32_t i = 0; i < num_reads; i++) ASSERT_TRUE(sigil::procstat::read(snapshot));
+    tmr.stop();
+    uint64_t read_ns = tmr.ns() / num_reads;
+
+    printf("performance: procstat sample %luus, read %luns, %u threads\n", sample_us, read_ns, snapshot.num_threads);
+    // Reads see every sample taken above, of this very process
+    EXPECT_GE(snapshot.sequence, sequence + num_samples);
+    EXPECT_EQ(snapshot.pid, (uint32_t)getpid());
+    EXPECT_GT(snapshot.rss, 0u);
+    EXPECT_GT(snapshot.num_threads, 0u);
+}
+
+// Deferred call site only copies arguments, formatted one runs vsnprintf too, printf also waits on the stream
+TEST_F(PerformanceSuite, log_write_vs_printf) {
+    // Bursts stop short of half a ring, which would wake flusher, and are flushed in between
+    const uint32_t burst = LOG_RING_RECORDS / 2 - 1;
+    const uint32_t num_messages = burst * 400;
+    FILE *null_file = fopen("/dev/null", "w");
+    ASSERT_NE(null_file, nullptr);
+    sigil::exec_timer tmr;
+
+    tmr.start();
+    for (uint32_t i = 0; i < num_messages; i++) {
+        fprintf(null_file, "performance: message %u of %u, %s\n", i, num_messages, "printf");
+        fflush(null_file);
+    }
+    tmr.stop();
+    uint64_t printf_ns = tmr.ns() / num_messages;
+    fclose(null_file);
+
+    // Flushed to a file outside of timed bursts, so every message can be counted there
+    char path[] = "/tmp/sigil-log-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_EQ(sigil::log::open_file(path), sigil::VM_OK);
+
+    uint64_t formatted_ns = 0, deferred_ns = 0;
+    sigil::log::enable_console(false);
+    uint64_t dropped = sigil::log::num_dropped();
+    for (uint32_t n = 0; n < num_messages; n += burst) {
+        tmr.start();
+        for (uint32_t i = n; i < n + burst; i++) {
+            sigil::log::write(sigil::log::LEVEL_INFO, "performance: message %u of %u, %s", i, num_messages, "formatted");
+        }
+        tmr.stop();
+        formatted_ns += tmr.ns();
+        sigil::log::flush();
+
+        tmr.start();
+        for (uint32_t i = n; i < n + burst; i++) SIGIL_LOG_INFO("performance: message %u of %u, %s", i, num_messages, "deferred");
+        tmr.stop();
+        deferred_ns += tmr.ns();
+        sigil::log::flush();
+    }
+    formatted_ns /= num_messages;
+    deferred_ns /= num_messages;
+    sigil::log::enable_console(true);
+    sigil::log::open_file(nullptr);
+
+    uint32_t num_formatted = 0, num_deferred = 0;
+    FILE *log_file = fopen(path, "r");
+    ASSERT_NE(log_file, nullptr);
+    char line[256];
+    while (fgets(line, sizeof(line), log_file)) {
+        num_formatted += strstr(line, ", formatted\n") != nullptr;
+        num_deferred += strstr(line, ", deferred\n") != nullptr;
+    }
+    fclose(log_file);
+    unlink(path);
+
+    printf("performance: log write deferred %luns, formatted %luns, printf %luns, %lu dropped\n",
+        deferred_ns, formatted_ns, printf_ns, sigil::log::num_dropped() - dropped);
+    EXPECT_EQ(sigil::log::num_dropped(), dropped);
+    EXPECT_EQ(num_formatted, num_messages);
+    EXPECT_EQ(num_deferred, num_messages);
+}
+
+// Output window touches only visible lines, cost of a frame stays flat as session grows
+TEST_F(PerformanceSuite, line_buffer_visible_lines) {
+    const uint32_t num_visible = 60;
+    const uint32_t num_frames = 1000;
+    sigil::line_buffer_t lines;
+    sigil::exec_timer tmr;
+
+    auto frame_ns = [&]() {
+        size_t bytes = 0, touched = 0;
+        tmr.start();
+        for (uint32_t f = 0; f < num_frames; f++) {
+            lines.collect();
+            uint32_t first = lines.num_lines() > num_visible ? lines.num_lines() - num_visible : 0;
+            for (uint32_t i = first; i < lines.num_lines(); i++) bytes += lines.line(i).size();
+            touched += lines.num_lines() - first;
+        }
+        tmr.stop();
+        EXPECT_GT(bytes, 0u);
+        EXPECT_EQ(touched, (size_t)num_visible * num_frames);
+        return tmr.ns() / num_frames;
+    };
+
+    for (uint32_t i = 0; i < 1000; i++) lines.printf("performance: output line %u", i);
+    uint64_t short_ns = frame_ns();
+
+    tmr.start();
+    for (uint32_t i = 0; i < 1000000; i++) {
+        lines.printf("performance: output line %u", i);
+        if (i % 1024 == 0) lines.collect();
+    }
+    lines.collect();
+    tmr.stop();
+    uint64_t push_ns = tmr.ns() / 1000000;
+    uint64_t long_ns = frame_ns();
+
+    printf("performance: line buffer push %luns, frame with 1k lines %luns, with %u kept of 1M %luns\n",
+        push_ns, short_ns, lines.num_lines(), long_ns);
+    // Whole session went through, only a bounded tail of it is kept
+    EXPECT_EQ(lines.num_dropped(), 0u);
+    EXPECT_EQ(lines.num_evicted() + lines.num_lines(), 1001000u);
+    EXPECT_LT(lines.num_lines(), 1000000u);
+    EXPECT_EQ(lines.line(lines.num_lines() - 1), "performance: output line 999999");
+}
+
+// Tagged allocation adds a header and three relaxed atomics to malloc
+TEST_F(PerformanceSuite, memtrack_allocate) {
+    const uint32_t num_blocks = 1000000;
+    sigil::exec_timer tmr;
+
+    tmr.start();
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        void *block = malloc(64);
+        asm volatile("" : : "r"(block) : "memory");
+        free(block);
+    }
+    tmr.stop();
+    uint64_t malloc_ns = tmr.ns() / num_blocks;
+
+    // GUI tag, nothing else allocates under it while tests run
+    sigil::mem_tag_stats_t before[sigil::MEM_TAG_COUNT], after[sigil::MEM_TAG_COUNT];
+    sigil::memtrack::read(before);
+    tmr.start();
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        void *block = sigil::memtrack::allocate(64, sigil::MEM_TAG_GUI);
+        asm volatile("" : : "r"(block) : "memory");
+        sigil::memtrack::release(block);
+    }
+    tmr.stop();
+    uint64_t tracked_ns = tmr.ns() / num_blocks;
+    sigil::memtrack::read(after);
+
+    printf("performance: malloc+free %luns, tagged %luns, hooks %s\n", malloc_ns, tracked_ns,
+        sigil::memtrack::hooks_enabled() ? "on" : "off");
+    EXPECT_EQ(after[sigil::MEM_TAG_GUI].allocations - before[sigil::MEM_TAG_GUI].allocations, num_blocks);
+    EXPECT_EQ(after[sigil::MEM_TAG_GUI].frees - before[sigil::MEM_TAG_GUI].frees, num_blocks);
+    EXPECT_EQ(after[sigil::MEM_TAG_GUI].live_bytes, before[sigil::MEM_TAG_GUI].live_bytes);
+    EXPECT_GE(after[sigil::MEM_TAG_GUI].peak_bytes, before[sigil::MEM_TAG_GUI].live_bytes + 64);
+}
+
+// Frame of small temporaries, each on heap or bumped off the frame arena
+TEST_F(PerformanceSuite, arena_vs_heap_frame) {
+    const uint32_t num_frames = 1000, per_frame = 1000;
+    sigil::arena_t arena(64 << 10, sigil::MEM_TAG_GUI);
+    std::vector<void*> blocks(per_frame);
+    sigil::exec_timer tmr;
+
+    tmr.start();
+    for (uint32_t f = 0; f < num_frames; f++) {
+        for (uint32_t i = 0; i < per_frame; i++) blocks[i] = malloc(16 + (i & 127));
+        asm volatile("" : : "r"(blocks.data()) : "memory");
+        for (uint32_t i = 0; i < per_frame; i++) free(blocks[i]);
+    }
+    tmr.stop();
+    uint64_t heap_ns = tmr.ns() / (num_frames * per_frame);
+
+    // First frame outgrows the initial chunk, after its reset every frame fits without heap
+    for (uint32_t i = 0; i < per_frame; i++) ASSERT_NE(arena.allocate(16 + (i & 127)), nullptr);
+    arena.reset();
+    uint64_t overflows = arena.num_overflows();
+    sigil::mem_tag_stats_t before[sigil::MEM_TAG_COUNT], after[sigil::MEM_TAG_COUNT];
+    sigil::memtrack::read(before);
+
+    tmr.start();
+    for (uint32_t f = 0; f < num_frames; f++) {
+        for (uint32_t i = 0; i < per_frame; i++) blocks[i] = arena.allocate(16 + (i & 127));
+        asm volatile("" : : "r"(blocks.data()) : "memory");
+        arena.reset();
+    }
+    tmr.stop();
+    uint64_t arena_ns = tmr.ns() / (num_frames * per_frame);
+    sigil::memtrack::read(after);
+
+    printf("performance: heap %luns, arena %luns per allocation, %lu overflows\n", heap_ns, arena_ns, arena.num_overflows());
+    EXPECT_EQ(arena.num_overflows(), overflows);
+    EXPECT_EQ(after[sigil::MEM_TAG_GUI].allocations, before[sigil::MEM_TAG_GUI].allocations);
+    EXPECT_EQ(arena.used(), 0u);
+    EXPECT_GE(arena.high_water(), per_frame * 16u);
+}
+
+TEST_F(PerformanceSuite, timer_wheel_insert) {
+    std::vector<std::function<void()>> due;
+    uint32_t num_fired = 0;
+    sigil::exec_timer tmr;
+
+    // Cost per insert has to stay flat while wheel fills up
+    auto insert_ns = [&](sigil::timer_wheel_t &wheel, uint32_t count) {
+        tmr.start();
+        for (uint32_t i = 0; i < count; i++) {
+            wheel.schedule(sigil::random_u32_scoped(1, 60000000), 0, [&]() { num_fired++; });
+        }
+        tmr.stop();
+        return tmr.ns() / count;
+    };
+
+    sigil::timer_wheel_t small_wheel;
+    sigil::timer_wheel_t large_wheel;
+    uint64_t small_ns = insert_ns(small_wheel, 1000);
+    uint64_t large_ns = insert_ns(large_wheel, 100000);
+
+    tmr.start();
+    for (uint64_t now = 0; now <= 60000000; now += 1000) large_wheel.advance(now, due);
+    tmr.stop();
+
+    printf("performance: timer insert %luns/%luns (1k/100k timers), 60s of 1ms ticks in %luus\n",
+        small_ns, large_ns, tmr.us());
+    // Every timer of large wheel came due once within 60s, wheel only hands callbacks out
+    EXPECT_EQ(due.size(), 100000u);
+    EXPECT_EQ(num_fired, 0u);
+    for (auto &callback : due) callback();
+    EXPECT_EQ(num_fired, 100000u);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();